@@ -46,6 +46,14 @@ ssize_t buffer_read_fd(buffer_t *buf, int fd);
  */
 ssize_t buffer_write_fd(buffer_t *buf, int fd);
 
+/* Same, writing at most max bytes (bandwidth shaping) */
+ssize_t buffer_write_fd_max(buffer_t *buf, int fd, size_t max);
+
+/* Append bytes to the buffer (after any data already in it).
+ * Copies as much as fits and returns the number of bytes copied.
+ */
+size_t buffer_append(buffer_t *buf, const void *data, size_t len);
+
 /* Check if buffer is full (no room for more reads).
  * If true, we have a problem: peer is sending faster than we can forward.
  * Options: close connection, apply backpressure, or increase buffer size.
@@ -80,4 +88,39 @@ size_t buffer_writable_bytes(const buffer_t *buf);
  */
 void buffer_compact(buffer_t *buf);
 
+/* ============================================================================
+ * BUFFER POOL
+ * ============================================================================
+ * Connections borrow their read/write buffers from a pool instead of
+ * embedding them. An idle keep-alive connection gives both back, which is
+ * what makes millions of mostly-idle connections affordable: memory scales
+ * with *active* connections, not open ones.
+ */
+
+/* Initialize an empty pool. Nothing is allocated until the first get. */
+void buffer_pool_init(buffer_pool_t *pool);
+
+/* Take a cleared buffer from the pool.
+ * Grows the pool by one huge-page backed chunk when the free list is empty.
+ * Returns NULL only if the chunk allocation fails.
+ */
+buffer_t *buffer_pool_get(buffer_pool_t *pool);
+
+/* Drop a reference. The buffer goes back to the pool with the last one.
+ * NULL is ignored.
+ */
+void buffer_pool_put(buffer_pool_t *pool, buffer_t *buf);
+
+/* Take another reference, for sharing a buffer's contents without a copy
+ * (traffic mirroring). A shared buffer is read-only: nobody appends to or
+ * compacts it until they are its only holder again.
+ */
+static inline buffer_t *buffer_ref(buffer_t *buf) {
+    buf->refs++;
+    return buf;
+}
+
+/* Release every chunk. All buffers must have been returned. */
+void buffer_pool_destroy(buffer_pool_t *pool);
+
 #endif /* BUFFER_H */
\ No newline at end of file
@@ -0,0 +1,108 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * TRAFFIC CAPTURE
+ * ============================================================================
+ * Records the requests clients send through the proxy, with their timing,
+ * so benchmarks can replay a real request mix (epoll-proxy-replay).
+ *
+ * File layout, all little-endian and 8-byte aligned so a reader can mmap
+ * the file and walk it in place:
+ *
+ *   capture_header_t
+ *   capture_record_t, request bytes, padding to 8
+ *   capture_record_t, request bytes, padding to 8
+ *   ...
+ *
+ * Sampling is per connection (1 in N accepted clients), so a sampled
+ * connection's keep-alive sequence is captured whole. Records of one
+ * connection share a conn_id, numbered from 1 in accept order.
+ *
+ * The writer reserves the whole size limit on disk up front (opening fails
+ * if it can't), maps it and appends with memcpy: no syscalls or allocation
+ * per request. The header is updated after each
+ * record, so a file left behind by a crash is still readable. Once the
+ * limit is reached further requests are counted as dropped.
+ */
+
+#define CAPTURE_MAGIC    0x50414345u  /* "ECAP" */
+#define CAPTURE_VERSION  1
+#define CAPTURE_ALIGN    8
+
+#define CAPTURE_DEFAULT_MAX_MB 64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_unix_ns;   /* Wall clock when the capture started */
+    uint64_t records;         /* Complete records that follow */
+    uint64_t end;             /* File offset just past the last record */
+    uint32_t sample_rate;     /* 1 in sample_rate connections */
+    uint32_t connections;     /* Highest conn_id used */
+    uint64_t reserved[3];
+} capture_header_t;
+
+typedef struct {
+    uint64_t time_us;         /* Since the start of the capture */
+    uint32_t conn_id;
+    uint32_t length;          /* Request bytes that follow */
+} capture_record_t;
+
+/* Writer state (the proxy) */
+typedef struct capture {
+    capture_header_t *header; /* Start of the mapping */
+    size_t limit;             /* Mapped (and maximum file) size */
+    uint64_t start_ns;        /* Monotonic clock at start */
+    uint32_t sample_rate;
+    uint64_t accepted;        /* Connections seen, for sampling */
+    uint64_t dropped;         /* Requests not recorded: file full */
+    int fd;
+} capture_t;
+
+/* ============================================================================
+ * WRITER
+ * ============================================================================
+ */
+
+/* Create (or truncate) path and map max_bytes of it.
+ * Returns NULL on failure (error already printed).
+ */
+capture_t *capture_open(const char *path, uint32_t sample_rate, size_t max_bytes);
+
+/* Trim the file to what was written, unmap and free */
+void capture_close(capture_t *cap);
+
+/* Sampling decision for a newly accepted connection.
+ * Returns its conn_id, or 0 if it isn't captured.
+ */
+uint32_t capture_connection(capture_t *cap);
+
+/* Append one request for a sampled connection */
+void capture_request(capture_t *cap, uint32_t conn_id, const void *data, size_t len);
+
+/* ============================================================================
+ * READER
+ * ============================================================================
+ */
+
+/* Map a capture file read-only and check its header.
+ * Returns NULL on failure (error already printed); *size gets the length.
+ */
+const capture_header_t *capture_map(const char *path, size_t *size);
+
+void capture_unmap(const capture_header_t *header, size_t size);
+
+/* First record, or the one after rec. NULL at the end. */
+const capture_record_t *capture_next(const capture_header_t *header,
+                                     const capture_record_t *rec);
+
+/* Request bytes of a record */
+static inline const char *capture_data(const capture_record_t *rec) {
+    return (const char *)(rec + 1);
+}
+
+#endif /* CAPTURE_H */
@@ -3,14 +3,20 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "histogram.h"
 
 /* ============================================================================
  * CONFIGURATION CONSTANTS
  * ============================================================================
  */
 
-/* Maximum number of simultaneous connections */
+/* Maximum number of simultaneous connections.
+ * Idle connections only cost a descriptor (buffers are pooled), so this can
+ * be raised at build time for C10M-style tests: make MAX_CONNECTIONS=1100000
+ */
+#ifndef MAX_CONNECTIONS
 #define MAX_CONNECTIONS 10000  /* Increased from 1024 for high concurrency */
+#endif
 
 /* Maximum events per epoll_wait() */
 #define MAX_EVENTS 256  /* Increased from 128 for better batching */
@@ -26,9 +32,54 @@
 
 /* HTTP-specific limits */
 #define MAX_REQUEST_SIZE (10 * 1024 * 1024)  /* 10MB max request */
-#define IDLE_TIMEOUT 60  /* Close idle connections after 60s */
 #define MAX_REQUESTS_PER_CONN 1000  /* Limit keep-alive reuse */
 
+/* Idle keep-alive connections give their buffers and parser state back to
+ * the pools after this long without a request, shrinking to a bare
+ * descriptor until the next EPOLLIN.
+ */
+#define IDLE_SHRINK_MS 1000
+
+/* Minimum data rate (-r): a client that is sending a request, or has a
+ * response waiting for it, must move at least min_rate bytes/s, judged
+ * over windows of this length. Anything slower is closed.
+ */
+#define MIN_RATE_WINDOW_MS 5000
+
+/* Expect: 100-continue: if the upstream hasn't answered this long after
+ * the headers went to it, the proxy sends the client its 100 Continue.
+ */
+#define CONTINUE_WAIT_MS 200
+
+/* Timer wheel: TIMER_TICK_MS resolution, TIMER_WHEEL_SLOTS slots.
+ * Timers further out than one revolution (~10s) just stay in their slot
+ * for extra rounds.
+ */
+#define TIMER_TICK_MS 10
+#define TIMER_WHEEL_SLOTS 1024
+
+/* TCP_INFO sampling: every TCPINFO_INTERVAL_MS, sample a rotating slice
+ * of the connection table, spending at most TCPINFO_BUDGET_PERMILLE of
+ * wall time on getsockopt() and scanning at most TCPINFO_SCAN_MAX slots.
+ */
+#define TCPINFO_INTERVAL_MS 100
+#define TCPINFO_BUDGET_PERMILLE 5
+#define TCPINFO_SCAN_MAX 4096
+
+/* Buffers are carved out of huge-page backed chunks of this size */
+#define BUFFER_POOL_CHUNK_SIZE (2 * 1024 * 1024)
+
+/* HTTP request parser state (~540KB each, ~20KB of it touched by a typical
+ * request) is pooled in 4K-page chunks of this size
+ */
+#define HTTP_REQUEST_POOL_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* Per-request arenas grow in blocks of this size, carved out of
+ * huge-page backed slabs. A single allocation can't exceed one block.
+ */
+#define ARENA_BLOCK_SIZE (16 * 1024)
+#define ARENA_SLAB_SIZE (2 * 1024 * 1024)
+
 /* ============================================================================
  * CONNECTION STATE MACHINE
  * ============================================================================
@@ -40,41 +91,215 @@ typedef enum {
     CONN_REQUEST_COMPLETE,  /* NEW: Have complete HTTP request */
     CONN_WRITING_RESPONSE,  /* NEW: Writing HTTP response */
     CONN_CLOSING,
-    CONN_CLOSED
+    CONN_CLOSED,
+    CONN_STATES
 } conn_state_t;
 
+/* What a connection is to the proxy. Handlers hang off (role, state,
+ * event) tables (proxy.c), so a new kind of connection adds a role and
+ * its rows rather than branches on the existing paths.
+ */
+typedef enum {
+    ROLE_TCP_CLIENT,        /* The two ends of a TCP mode pair */
+    ROLE_TCP_BACKEND,
+    ROLE_HTTP_CLIENT,
+    ROLE_HTTP_UPSTREAM,
+    CONN_ROLES
+} conn_role_t;
+
 /* ============================================================================
  * BUFFER STRUCTURE
  * ============================================================================
  */
-typedef struct {
+typedef struct buffer {
     char data[BUFFER_SIZE];
     size_t len;
     size_t pos;
+    uint32_t refs;             /* Holders; back to the pool when it drops to 0 */
+    struct buffer *next_free;  /* Free list link while parked in the pool */
 } buffer_t;
 
+/* ============================================================================
+ * BUFFER POOL
+ * ============================================================================
+ * Buffers are not embedded in connections: they are handed out from a pool
+ * when a connection needs them and returned when it goes idle or closes.
+ * The pool grows in BUFFER_POOL_CHUNK_SIZE chunks and never shrinks, so in
+ * steady state getting a buffer is a free-list pop.
+ */
+typedef struct {
+    buffer_t *free_list;
+    size_t free_count;
+    size_t total;          /* Buffers carved out so far */
+    void *chunks;          /* Singly linked list of chunks (for cleanup) */
+} buffer_pool_t;
+
+/* ============================================================================
+ * REQUEST ARENA
+ * ============================================================================
+ * Bump allocator for memory that lives exactly as long as one request
+ * (routing decisions, rewritten headers, cache keys, error bodies).
+ * Blocks come from a shared free list and go back to it in O(1) when the
+ * request ends; there is no per-allocation free.
+ */
+typedef struct arena_block {
+    struct arena_block *next;
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *free_list;
+    size_t free_count;
+    size_t total;          /* Blocks carved out so far */
+    void *slabs;           /* Singly linked list of slabs (for cleanup) */
+} arena_pool_t;
+
+typedef struct {
+    arena_pool_t *pool;    /* Where blocks come from and go back to */
+    arena_block_t *first;  /* Kept across resets; NULL until first use */
+    arena_block_t *extra;  /* Blocks added after first, newest first */
+    arena_block_t *extra_tail;
+    size_t extra_count;
+    char *ptr;             /* Next free byte in the current block */
+    char *end;             /* End of the current block */
+} arena_t;
+
 /* Forward declare http_request_t */
 struct http_request;
 
+/* ============================================================================
+ * HTTP REQUEST POOL
+ * ============================================================================
+ * Same scheme as the buffer pool, for the parser state of HTTP clients,
+ * except that chunks are never huge-page backed (see
+ * http_request_pool_grow()). A pooled request is reset field by field, never memset, so handing one
+ * out costs a free-list pop and a handful of stores.
+ */
+typedef struct {
+    struct http_request *free_list;
+    size_t free_count;
+    size_t total;          /* Requests carved out so far */
+    void *chunks;          /* Singly linked list of chunks (for cleanup) */
+    arena_pool_t *arenas;  /* Backs each request's arena */
+} http_request_pool_t;
+
+/* ============================================================================
+ * TIMER WHEEL
+ * ============================================================================
+ * Hashed timing wheel. Timer nodes are embedded in the objects they time
+ * (connections), so arming and cancelling is O(1) with no allocation.
+ */
+typedef struct timer_node {
+    struct timer_node *next;   /* NULL when not armed */
+    struct timer_node *prev;
+    uint64_t expires;          /* Absolute deadline, get_timestamp_ms() clock */
+} timer_node_t;
+
+typedef struct {
+    timer_node_t slots[TIMER_WHEEL_SLOTS];  /* Circular list heads */
+    uint64_t current_tick;                  /* Last tick processed */
+    size_t count;                           /* Armed timers */
+} timer_wheel_t;
+
+/* ============================================================================
+ * TCP_INFO SAMPLING
+ * ============================================================================
+ * Kernel-side view of our sockets, aggregated per side: the listener
+ * (client connections) and the upstream. Tells network latency apart from
+ * proxy latency.
+ */
+typedef struct {
+    uint64_t samples;
+    histogram_t rtt_us;          /* Smoothed RTT */
+    histogram_t rttvar_us;       /* RTT variance */
+    histogram_t delivery_rate;   /* Bytes/s, as estimated by the kernel */
+    histogram_t unacked;         /* Segments in flight */
+    histogram_t cwnd;            /* Congestion window, segments */
+    histogram_t retrans;         /* Total retransmits per connection (at close) */
+} tcpinfo_stats_t;
+
+typedef struct {
+    int enabled;
+    tcpinfo_stats_t listener;
+    tcpinfo_stats_t upstream;
+    timer_node_t timer;          /* Next sampling round */
+    int cursor;                  /* Next connection slot to look at */
+    int64_t budget_ns;           /* getsockopt() time left this round */
+    uint64_t cost_ns;            /* Running estimate of one sample's cost */
+    uint64_t skipped;            /* Close-time samples dropped for budget */
+} tcpinfo_sampler_t;
+
+/* ============================================================================
+ * SYSCALL ACCOUNTING
+ * ============================================================================
+ * Every syscall the proxy makes, by kind and by the side it was made for.
+ * "Wasted" calls are the ones that came back EAGAIN: the price of
+ * edge-triggered draining, and the first thing to look at when trying to
+ * get syscalls per request down.
+ */
+typedef enum {
+    SYSCALL_READ = 0,
+    SYSCALL_WRITE,
+    SYSCALL_EPOLL_WAIT,
+    SYSCALL_EPOLL_CTL,
+    SYSCALL_ACCEPT,
+    SYSCALL_SOCKET,
+    SYSCALL_CONNECT,
+    SYSCALL_FCNTL,
+    SYSCALL_SOCKOPT,     /* setsockopt() and getsockopt() */
+    SYSCALL_CLOSE,
+    SYSCALL_SENDFILE,
+    SYSCALL_FILE,        /* open/fstat/stat/close of static files */
+    SYSCALL_KINDS
+} syscall_kind_t;
+
+typedef enum {
+    SYSCALL_SIDE_LOOP = 0,   /* The event loop itself (epoll_wait) */
+    SYSCALL_SIDE_CLIENT,     /* Client connections, including accept */
+    SYSCALL_SIDE_UPSTREAM,   /* Backend connections */
+    SYSCALL_SIDE_MIRROR,     /* Shadow upstream connections (mirror.h) */
+    SYSCALL_SIDES
+} syscall_side_t;
+
+typedef struct {
+    uint64_t calls[SYSCALL_SIDES][SYSCALL_KINDS];
+    uint64_t wasted[SYSCALL_SIDES][SYSCALL_KINDS];  /* Returned EAGAIN */
+} syscall_stats_t;
+
 /* ============================================================================
  * CONNECTION STRUCTURE
  * ============================================================================
+ * 88 bytes on x86-64, and all an idle keep-alive client costs the proxy
+ * once it is shrunk: its buffers and parser state are back in the pools.
  */
 typedef struct connection {
     int fd;
-    struct connection *peer;
     conn_state_t state;
-    buffer_t read_buf;
-    buffer_t write_buf;
-    int is_client;
+    struct connection *peer;
+    buffer_t *read_buf;             /* NULL while shrunk (idle) */
+    buffer_t *write_buf;            /* NULL while shrunk (idle) */
     uint64_t last_active;
+    timer_node_t timer;             /* Idle shrink or min-rate deadline */
+    uint32_t window_bytes;          /* Client bytes moved this min-rate window */
     
     /* HTTP-specific fields */
+    uint32_t capture_id;            /* Traffic capture conn_id, 0 = not captured */
     struct http_request *http_req;  /* Parsed HTTP request (client connections only) */
-    int requests_handled;           /* Number of requests on this connection */
-    int keep_alive;                 /* Should we keep connection open? */
+    uint16_t requests_handled;      /* Number of requests on this connection */
+    
+    /* Small fields last, packed together */
+    uint8_t role;                   /* conn_role_t */
+    uint8_t keep_alive;             /* Should we keep connection open? */
+    uint8_t traffic_class;          /* Scheduler class (traffic_sched.h), 0 = default */
+    uint8_t shape_route;            /* Bandwidth-capped route + 1 (shaper.h), 0 = none */
+    uint8_t shape_paused;           /* Out of tokens: no EPOLLOUT until the timer */
 } connection_t;
 
+/* The README quotes this size; bench-idle measures it */
+#if UINTPTR_MAX == UINT64_MAX
+_Static_assert(sizeof(connection_t) == 88, "connection_t changed size: update README.md");
+#endif
+_Static_assert(MAX_REQUESTS_PER_CONN <= UINT16_MAX, "requests_handled is 16 bits");
+
 /* ============================================================================
  * PROXY MODE
  * ============================================================================
@@ -94,6 +319,7 @@ typedef struct {
     uint16_t listen_port;
     const char *backend_addr;
     uint16_t backend_port;
+    int backend_http10;     /* Backend's last response was HTTP/1.0 */
     
     /* Operating mode */
     proxy_mode_t mode;  /* NEW: TCP or HTTP mode */
@@ -107,6 +333,21 @@ typedef struct {
     int free_list[MAX_CONNECTIONS];
     int free_count;
     
+    /* Buffer pool shared by all connections */
+    buffer_pool_t buffers;
+    
+    /* Parser state pool shared by HTTP clients */
+    http_request_pool_t requests;
+    
+    /* Blocks for per-request arenas */
+    arena_pool_t arenas;
+    
+    /* Per-connection timers */
+    timer_wheel_t timers;
+    
+    /* TCP_INFO sampling */
+    tcpinfo_sampler_t tcpinfo;
+    
     /* Statistics */
     struct {
         uint64_t total_connections;
@@ -121,7 +362,57 @@ typedef struct {
         uint64_t requests_post;
         uint64_t requests_error;  /* Malformed requests */
         uint64_t keep_alive_reused;
+        uint64_t idle_shrinks;    /* Idle connections shrunk to a descriptor */
+        uint64_t idle_wakeups;    /* Shrunk connections woken by a request */
+        uint64_t slow_requests;   /* Closed: request arriving below -r */
+        uint64_t slow_drains;     /* Closed: response drained below -r */
+        uint64_t continues_sent;  /* 100 Continue sent by the proxy itself */
+        
+        /* Upstream stats (active = connects - closes) */
+        uint64_t upstream_connects;
+        uint64_t upstream_failures;
+        uint64_t upstream_closes;
+        
+        uint64_t loop_iterations;
     } stats;
+    
+    /* Syscalls made, see syscount.h */
+    syscall_stats_t syscalls;
+    
+    /* Live stats for epoll-proxy-top (NULL when not enabled) */
+    struct scoreboard *scoreboard;
+    const char *scoreboard_path;
+    uint64_t scoreboard_next_ms;
+    
+    /* Request capture for replay (NULL when not enabled) */
+    struct capture *capture;
+    
+    /* Routes served from local files (NULL when none are configured) */
+    struct static_files *static_files;
+    
+    /* Responses kept on disk (NULL when not enabled) */
+    struct disk_cache *disk_cache;
+    
+    /* Routes copied to a shadow upstream (NULL when none are configured) */
+    struct mirror *mirror;
+    
+    /* Weighted traffic classes (NULL when none are configured) */
+    struct sched *sched;
+    
+    /* Bandwidth caps (NULL when not enabled) */
+    struct shaper *shaper;
+    
+    /* Minimum client data rate in bytes/s (0 when not enforced) */
+    uint64_t min_rate;
+    
+    /* Response buffering for slow clients (NULL when not enabled) */
+    struct spooler *spooler;
+    
+    /* Request body buffering for slow uploads (NULL when not enabled) */
+    struct spooler *body_spooler;
+    
+    /* Routes answered by the proxy itself (NULL when none are configured) */
+    struct direct *direct;
 } proxy_config_t;
 
 /* ============================================================================
@@ -22,7 +22,7 @@
  * Sets up:
  *   - All connections in CONN_CLOSED state
  *   - Free list populated with all indices (0 to MAX_CONNECTIONS-1)
- *   - Buffers initialized
+ *   - Empty buffer pool and timer wheel
  */
 void connection_pool_init(proxy_config_t *config);
 
@@ -31,6 +31,7 @@ void connection_pool_init(proxy_config_t *config);
  * 
  * This pops from the free_list stack. O(1) operation.
  * The returned connection is in CONN_CLOSED state - caller must initialize it.
+ * It comes with a read and a write buffer borrowed from the buffer pool.
  * 
  * If this returns NULL, we've hit MAX_CONNECTIONS limit.
  * Options: close old connections, increase limit, or reject new clients.
@@ -51,18 +52,42 @@ void connection_free(proxy_config_t *config, connection_t *conn);
  * Parameters:
  *   conn: connection to initialize (from connection_alloc)
  *   fd: socket file descriptor
- *   is_client: 1 if client-facing, 0 if backend
+ *   role: what it is to the proxy (client or backend side, HTTP or TCP)
  *   state: initial state (usually CONN_CONNECTED or CONN_CONNECTING)
  * 
  * This:
- *   - Sets fd, is_client, state
+ *   - Sets fd, role, state
  *   - Clears buffers
  *   - Nulls peer pointer
  *   - Records timestamp
  */
-void connection_init(connection_t *conn, int fd, int is_client, 
+void connection_init(connection_t *conn, int fd, conn_role_t role, 
                     conn_state_t state);
 
+/* ============================================================================
+ * IDLE SHRINKING
+ * ============================================================================
+ * An idle keep-alive client holds two 16KB buffers and a large
+ * http_request_t while waiting for its next request - which may never come.
+ * Shrinking hands all of that back to the pools, leaving only the
+ * descriptor (fd, state, timer, stats). The next EPOLLIN wakes it up again.
+ */
+
+/* Release buffers and parser state of an idle connection.
+ * Returns 0 if shrunk, -1 if the connection still has data in flight
+ * (peer attached or bytes buffered) and must keep its state.
+ */
+int connection_shrink(proxy_config_t *config, connection_t *conn);
+
+/* Re-acquire buffers (and parser state for HTTP clients) for a shrunk
+ * connection. No-op if the connection isn't shrunk.
+ * Returns 0 on success, -1 if the pools are exhausted.
+ */
+int connection_wake(proxy_config_t *config, connection_t *conn);
+
+/* Is this connection currently shrunk to a bare descriptor? */
+int connection_is_shrunk(const connection_t *conn);
+
 /* Pair two connections (client <-> backend).
  * Each connection's peer pointer points to the other.
  * 
@@ -154,8 +179,17 @@ uint64_t get_timestamp_ms(void);
 /* ============================================================================
  * STATE MACHINE HELPERS
  * ============================================================================
- * These help reason about what operations are valid in each state.
+ * These help reason about what operations are valid in each state. What a
+ * state allows comes from a table (connection.c); buffers and the peer
+ * decide the rest.
+ */
+
+/* Is this the client side of its role (TCP or HTTP client)? Derived from
+ * role rather than stored, to keep connection_t small.
  */
+static inline int connection_is_client(const connection_t *conn) {
+    return conn->role == ROLE_TCP_CLIENT || conn->role == ROLE_HTTP_CLIENT;
+}
 
 /* Can we read from this connection in its current state?
  * Returns 1 if reading is appropriate, 0 otherwise.
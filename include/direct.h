@@ -0,0 +1,123 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include "config.h"
+#include "file_reply.h"
+#include <stddef.h>
+#include <stdint.h>
+
+struct http_request;
+
+/* ============================================================================
+ * DIRECT RESPONSES
+ * ============================================================================
+ * Routes the proxy answers itself, without an upstream connection:
+ *
+ *   /robots.txt=200:TEXT   fixed status and text/plain body
+ *   /old/=301:URL          redirect; a URL ending in '*' gets the rest of
+ *                          the request path in its place
+ *   /healthz=health        200 while the upstream looks healthy, 503 after
+ *                          DIRECT_HEALTH_FAILS failures in a row
+ *
+ * Every response is rendered at startup, once for each Connection header
+ * it may need to carry (see the variants below), so answering is picking
+ * the right bytes and one sendmsg() through the file reply path. A
+ * redirect sends three pieces: everything up to its target, the rest of
+ * the request path, and the end of the header.
+ *
+ * A route ending in '/' matches every path under it. Any other route
+ * matches that path only, with or without a query string.
+ *
+ * Upstream health is what the proxy observes: each connect that works
+ * resets the failure count, each upstream failure adds to it. Nothing
+ * probes an idle upstream.
+ */
+
+#define DIRECT_MAX_ROUTES    16
+#define DIRECT_TEXT_MAX      512     /* One pre-rendered piece */
+#define DIRECT_HEALTH_FAILS  3
+
+typedef enum {
+    DIRECT_FIXED,
+    DIRECT_REDIRECT,
+    DIRECT_HEALTH
+} direct_kind_t;
+
+/* The Connection header a response carries, as in static_files.c */
+enum {
+    DIRECT_KEEP_ALIVE,              /* HTTP/1.1 default: none */
+    DIRECT_KEEP_ALIVE_10,           /* HTTP/1.0: Connection: keep-alive */
+    DIRECT_CLOSE,                   /* Connection: close */
+    DIRECT_VARIANTS
+};
+
+typedef struct {
+    char text[DIRECT_TEXT_MAX];
+    size_t len;
+    size_t body_len;                /* Trailing body bytes, left out for HEAD */
+} direct_text_t;
+
+typedef struct {
+    const char *prefix;             /* URL path, e.g. "/healthz" */
+    size_t prefix_len;
+    int exact;                      /* Doesn't end in '/' */
+    direct_kind_t kind;
+
+    /* Fixed: the whole response. Health: [0] healthy, [1] down.
+     * Redirect: the header up to the target, then (append_path) the rest
+     * of the request path, then tail.
+     */
+    direct_text_t head[2][DIRECT_VARIANTS];
+    direct_text_t tail[DIRECT_VARIANTS];
+    int append_path;
+
+    uint64_t hits;
+} direct_route_t;
+
+typedef struct direct {
+    direct_route_t routes[DIRECT_MAX_ROUTES];
+    int route_count;
+
+    int upstream_fails;             /* In a row */
+
+    struct {
+        uint64_t responses;
+        uint64_t unhealthy;         /* Health checks answered 503 */
+        uint64_t went_down;         /* Healthy to failing */
+        uint64_t refused;           /* Paths unsafe to append to a Location */
+    } stats;
+} direct_t;
+
+/* ============================================================================
+ * FUNCTIONS
+ * ============================================================================
+ */
+
+/* Allocate an empty table. NULL on failure (printed). */
+direct_t *direct_create(void);
+
+void direct_destroy(direct_t *d);
+
+/* Add a route from "PATH=STATUS:BODY", "PATH=30x:URL" or "PATH=health"
+ * and render its responses. The string must outlive the table.
+ * Returns 0, or -1 with the reason printed.
+ */
+int direct_add_route(direct_t *d, char *spec);
+
+/* Route answering a request path, longest prefix first. NULL: go on. */
+direct_route_t *direct_route(direct_t *d, const char *path);
+
+/* Point reply at route's response to req (no body for HEAD). keep_alive
+ * picks the Connection header. Returns 0, or -1 when the rest of the path
+ * would go into a Location header and has a control byte or a space in it:
+ * the caller answers 400.
+ */
+int direct_respond(direct_t *d, direct_route_t *route, const struct http_request *req,
+                   file_reply_t *reply, int keep_alive);
+
+/* An upstream connect worked (ok) or an upstream failed. NULL is ignored. */
+void direct_upstream(direct_t *d, int ok);
+
+void direct_print(const direct_t *d);
+
+#endif /* DIRECT_H */
@@ -0,0 +1,282 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include "config.h"
+#include "file_reply.h"
+#include <pthread.h>
+#include <sys/types.h>
+
+/* ============================================================================
+ * DISK CACHE
+ * ============================================================================
+ * Complete upstream responses (status line, headers and body, exactly as
+ * received) kept in preallocated slab files and answered with sendfile()
+ * on later requests for the same host and path. A hit never opens an
+ * upstream connection and its bytes never pass through a buffer_t.
+ *
+ * Storage is one file per size class; a class is an array of equal slots,
+ * and each response takes the smallest slot it fits. The index (hash and
+ * per-class LRU) lives in memory.
+ *
+ * Filling a slot never blocks the event loop on the disk: while a cacheable
+ * response streams to the client, forward_data() copies it into a staging
+ * buffer. Once complete, the buffer goes to a writer thread that copies it
+ * into the slot through a shared mapping and signals back over an eventfd;
+ * the loop then marks the entry ready. A slot in use by a reply, or still
+ * being written, is never handed out again.
+ *
+ * Cached: 200 responses to GET with Content-Length framing and a reusable
+ * upstream connection, unless Cache-Control says no-store, no-cache or
+ * private, or the response sets a cookie or has a Vary header. Requests
+ * with Authorization or Range headers bypass the cache. Entries live for
+ * s-maxage / max-age seconds, or DISK_CACHE_DEFAULT_TTL_S without either.
+ *
+ * COMPRESSED VARIANTS
+ * A stored text response (text types, JSON, JavaScript, XML, SVG) with no
+ * Content-Encoding of its own can also be kept gzip- and brotli-encoded.
+ * A variant is an entry of its own, keyed by the identity key plus the
+ * encoding, holding a complete response with Content-Encoding, the new
+ * Content-Length and Vary: Accept-Encoding. It expires with the identity
+ * entry it was made from.
+ *
+ * Variants are made lazily: the first hit from a client that accepts an
+ * encoding the entry lacks queues it for the compressor thread and is
+ * answered with the identity response. The compressed response then goes
+ * to a slot through the writer like any fill, and later hits that accept
+ * it (brotli preferred) are sent from it. No request waits for compression.
+ *
+ * WARM RESTARTS
+ * The slab files outlive the process; what a restart loses is the index.
+ * Every DISK_CACHE_SNAPSHOT_S (when something changed) and at shutdown the
+ * loop copies the index into a snapshot image, and the writer thread syncs
+ * the slab files and then replaces DIR/index.dat with it. At startup the
+ * snapshot is mapped and its unexpired records go straight into the hash:
+ * only the index is read, slot contents are paged in by the first hits.
+ *
+ * A snapshot must never name a slot whose contents have changed since.
+ * The first time a slot it names is reused, the writer unlinks the file
+ * before it writes the new contents (jobs run in order), so after a crash
+ * the proxy starts cold rather than wrong.
+ */
+
+#define DISK_CACHE_CLASSES        6
+#define DISK_CACHE_MIN_SLOT       (16 * 1024)     /* Classes: 16K, 64K ... 16M */
+#define DISK_CACHE_KEY_MAX        512             /* Host + '\n' + path */
+#define DISK_CACHE_BUCKETS        16384           /* Power of two */
+#define DISK_CACHE_DEFAULT_MB     256
+#define DISK_CACHE_DEFAULT_TTL_S  60
+#define DISK_CACHE_SNAPSHOT_S     60
+#define DISK_CACHE_COMPRESS_MIN   1024    /* Smaller bodies aren't worth it */
+#define DISK_CACHE_GZIP_LEVEL     6
+#define DISK_CACHE_BROTLI_QUALITY 9       /* Paid once per variant */
+
+/* Responses staged for the writer at once; fills past this are skipped */
+#define DISK_CACHE_STAGING_MAX    (64 * 1024 * 1024)
+
+/* Content codings a variant can have, in order of preference */
+typedef enum {
+    DISK_ENCODING_BR = 0,
+    DISK_ENCODING_GZIP,
+    DISK_ENCODINGS
+} disk_encoding_t;
+
+/* Work for the worker threads, each queue done in order */
+typedef enum {
+    DISK_JOB_STORE,          /* Writer: copy an entry's staging buffer into its slot */
+    DISK_JOB_SNAPSHOT,       /* Writer: sync the slabs, then write index.dat */
+    DISK_JOB_UNLINK,         /* Writer: remove index.dat, it names a reused slot */
+    DISK_JOB_COMPRESS        /* Compressor: encode an entry into a variant */
+} disk_job_type_t;
+
+typedef struct disk_job {
+    disk_job_type_t type;
+    struct disk_job *next;
+} disk_job_t;
+
+/* A thread and its queue */
+typedef struct {
+    pthread_t thread;
+    pthread_cond_t wake;
+    disk_job_t *head;
+    disk_job_t *tail;
+    struct disk_cache *cache;
+    int started;
+} disk_worker_t;
+
+#define DISK_ENTRY_COMPRESSIBLE  0x1   /* Text type, no Content-Encoding */
+#define DISK_ENTRY_VARIANT       0x2   /* Made by the compressor */
+
+typedef enum {
+    DISK_ENTRY_FREE = 0,
+    DISK_ENTRY_FILLING,      /* Response still streaming into staging */
+    DISK_ENTRY_WRITING,      /* Owned by the writer thread */
+    DISK_ENTRY_READY         /* In the slot, servable */
+} disk_entry_state_t;
+
+typedef struct disk_entry {
+    char key[DISK_CACHE_KEY_MAX];
+    uint32_t hash;
+    int hashed;                     /* Reachable by lookup */
+    disk_entry_state_t state;
+    int refs;                       /* Replies sending from the slot */
+    int class_index;
+    uint32_t slot;
+    size_t len;                     /* Bytes of response in the slot */
+    size_t head_len;                /* ... of which the header block */
+    uint64_t expires_ms;
+    unsigned flags;                 /* DISK_ENTRY_* */
+    unsigned compressing;           /* Encodings queued, bit per encoding */
+    unsigned incompressible;        /* Encodings that didn't pay off */
+    uint32_t snapshot_gen;          /* Last snapshot that named this slot */
+
+    /* Staged response, between disk_cache_begin() and the writer */
+    char *staging;
+    disk_job_t job;
+
+    struct disk_entry *hash_next;
+    struct disk_entry *lru_prev;    /* Ready entries, most recent at the head */
+    struct disk_entry *lru_next;    /* Also links the class free list */
+} disk_entry_t;
+
+typedef struct {
+    size_t slot_size;
+    uint32_t slots;                 /* 0: class disabled (cache too small) */
+    int fd;
+    char *map;                      /* Worker threads only */
+    disk_entry_t *entries;          /* One per slot */
+    disk_entry_t *free_list;
+    disk_entry_t *lru_head;
+    disk_entry_t *lru_tail;
+} disk_class_t;
+
+/* A fill in progress (lives in the client's http_request_t) */
+typedef struct {
+    int wanted;                     /* Missed and eligible: try to fill */
+    struct disk_cache *cache;
+    disk_entry_t *entry;            /* NULL: not filling */
+    size_t len;                     /* Bytes staged so far */
+    size_t expected;                /* Header + Content-Length */
+} disk_fill_t;
+
+typedef struct disk_cache {
+    disk_class_t classes[DISK_CACHE_CLASSES];
+    size_t max_len;                 /* Largest response that fits a slot */
+    disk_entry_t *buckets[DISK_CACHE_BUCKETS];
+    size_t staging_bytes;           /* Staged and not yet written */
+
+    /* Worker threads: jobs in, finished ones back via the eventfd */
+    disk_worker_t writer;
+    disk_worker_t compressor;
+    pthread_mutex_t lock;           /* Both queues and the done list */
+    disk_job_t *done;
+    int stop;
+    int event_fd;
+
+    /* Snapshots */
+    const char *dir;
+    int dir_fd;                     /* For fsync() after rename/unlink */
+    uint32_t snapshot_gen;          /* Latest snapshot queued or loaded */
+    int snapshot_live;              /* index.dat names only unchanged slots */
+    uint64_t changes;               /* Index changes since the last snapshot */
+    uint64_t next_snapshot_ms;
+
+    struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t fills;             /* Responses staged */
+        uint64_t stored;            /* ... and written to a slot */
+        uint64_t aborted;           /* Fills cut short (client or upstream) */
+        uint64_t skipped;           /* Misses whose response wasn't cacheable */
+        uint64_t evictions;
+        uint64_t expired;
+        uint64_t bytes_written;     /* Into slots */
+        uint64_t hit_bytes;         /* Sent from slots */
+        uint64_t variant_hits;      /* Hits sent compressed */
+        uint64_t compressed;        /* Variants made */
+        uint64_t incompressible;    /* Compressions that saved too little */
+        uint64_t loaded;            /* Entries restored from index.dat */
+        uint64_t snapshots;         /* index.dat images queued */
+    } stats;
+} disk_cache_t;
+
+/* ============================================================================
+ * SNAPSHOT FORMAT (DIR/index.dat)
+ * ============================================================================
+ * A header, then count fixed-size records, all in host byte order: the file
+ * is mapped and read in place. Expiry is wall-clock time so it survives the
+ * restart; the geometry must match the running cache or the file is ignored.
+ */
+
+#define DISK_SNAPSHOT_MAGIC    0x45484341434b5344ULL  /* "DSKCACHE" */
+#define DISK_SNAPSHOT_VERSION  2
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;                 /* Records that follow */
+    uint64_t written_unix_ms;
+    struct {
+        uint64_t slot_size;
+        uint64_t slots;
+    } classes[DISK_CACHE_CLASSES];
+} disk_snapshot_header_t;
+
+typedef struct {
+    uint64_t expires_unix_ms;
+    uint64_t len;
+    uint64_t head_len;
+    uint32_t class_index;
+    uint32_t slot;
+    uint32_t flags;
+    uint32_t reserved;
+    char key[DISK_CACHE_KEY_MAX];   /* NUL-terminated */
+} disk_snapshot_record_t;
+
+/* ============================================================================
+ * FUNCTIONS
+ * ============================================================================
+ */
+
+/* Create (or reuse) the slab files in dir, size_mb split evenly across the
+ * classes, restore the index from dir/index.dat if it matches, register the
+ * eventfd with the proxy's epoll instance and start the worker threads.
+ * dir must outlive the cache. NULL on failure (printed).
+ */
+disk_cache_t *disk_cache_create(proxy_config_t *config, const char *dir, size_t size_mb);
+
+/* Snapshot the index, let the workers finish their queues, stop them and
+ * free everything. NULL is ignored. Fills still streaming must have been aborted.
+ */
+void disk_cache_destroy(disk_cache_t *dc);
+
+/* Look req up. On a hit, reply is set up to send the stored response (the
+ * best variant req's Accept-Encoding allows) and 1 is returned. Otherwise
+ * returns 0 and, if the request is eligible, marks req->fill so the
+ * response can be captured.
+ */
+int disk_cache_lookup(disk_cache_t *dc, struct http_request *req, file_reply_t *reply);
+
+/* The final response header block of a wanted fill has been parsed; data
+ * (len bytes) is the start of what the client will receive. Reserves a slot
+ * and starts staging if the response is cacheable.
+ */
+void disk_cache_begin(disk_cache_t *dc, struct http_request *req,
+                      const char *data, size_t len);
+
+/* Response bytes on their way to the client. Hands the response to the
+ * writer thread once it is complete.
+ */
+void disk_cache_tee(disk_fill_t *fill, const char *data, size_t len);
+
+/* Drop a fill that didn't complete. Safe on an idle fill. */
+void disk_cache_abort(disk_fill_t *fill);
+
+/* The eventfd fired: mark written entries ready, store new variants. */
+void disk_cache_poll(proxy_config_t *config);
+
+/* Periodic work from the event loop: queue a snapshot when one is due. */
+void disk_cache_tick(disk_cache_t *dc, uint64_t now);
+
+void disk_cache_print(const disk_cache_t *dc);
+
+#endif /* DISK_CACHE_H */
@@ -41,6 +41,40 @@ int epoll_init(void);
  */
 int epoll_add(int epoll_fd, int fd, uint32_t events, void *conn);
 
+/* ============================================================================
+ * REGISTRATION SOURCES
+ * ============================================================================
+ * What a registration's data pointer refers to. Connections are registered
+ * as themselves; the few other descriptors (listener, disk cache eventfd,
+ * shadow requests) carry their kind in the pointer's low bits, which are
+ * always zero in these structs. The event loop sends every connection
+ * event straight to dispatch after one test, instead of first asking each
+ * optional feature whether the event is its own.
+ */
+typedef enum {
+    EPOLL_SOURCE_CONN = 0,          /* connection_t */
+    EPOLL_SOURCE_LISTENER,          /* NULL */
+    EPOLL_SOURCE_DISK_CACHE,        /* disk_cache_t */
+    EPOLL_SOURCE_MIRROR,            /* mirror_slot_t */
+    EPOLL_SOURCES
+} epoll_source_t;
+
+#define EPOLL_SOURCE_MASK ((uintptr_t)7)
+
+/* Data pointer for registering ptr as a source other than a connection */
+static inline void *epoll_tag(void *ptr, epoll_source_t source) {
+    return (void *)((uintptr_t)ptr | (uintptr_t)source);
+}
+
+static inline epoll_source_t epoll_source(const void *data) {
+    return (epoll_source_t)((uintptr_t)data & EPOLL_SOURCE_MASK);
+}
+
+/* The pointer a tagged registration was made with */
+static inline void *epoll_untag(void *data) {
+    return (void *)((uintptr_t)data & ~EPOLL_SOURCE_MASK);
+}
+
 /* Modify events for an already-registered file descriptor.
  * 
  * Use this to switch between EPOLLIN and EPOLLOUT as needed:
@@ -0,0 +1,42 @@
+#ifndef FILE_REPLY_H
+#define FILE_REPLY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* ============================================================================
+ * FILE REPLIES
+ * ============================================================================
+ * A response whose body comes from a file: a header from memory (possibly
+ * empty), then a byte range of the file sent with sendfile(). Static routes
+ * and the disk cache both answer this way, so nothing passes through the
+ * connection's buffers. Direct responses are all header: no file, an empty
+ * range.
+ *
+ * The owner of the file keeps a count of replies sending from it and must
+ * not close or overwrite the file while it is non-zero.
+ */
+
+/* Most bytes one client gets per write event before others have a turn */
+#define FILE_REPLY_BURST  (1024 * 1024)
+
+typedef struct {
+    int active;
+    int fd;                   /* Body comes from here */
+    int *refs;                /* Owner's count of replies using fd, or NULL */
+    uint64_t *body_bytes;     /* Owner's counter of body bytes sent, or NULL */
+    struct iovec head[3];     /* Header pieces, written before the body */
+    int head_count;           /* Pieces of head not fully written */
+    int head_first;
+    off_t offset;             /* Next file byte to send */
+    off_t remaining;
+} file_reply_t;
+
+/* Account n header bytes written. Returns 1 once the header is out. */
+int file_reply_advance(file_reply_t *reply, size_t n);
+
+/* The reply is done or abandoned: drop its ref. Safe to call twice. */
+void file_reply_end(file_reply_t *reply);
+
+#endif /* FILE_REPLY_H */
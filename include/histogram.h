@@ -0,0 +1,52 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * LOG-LINEAR HISTOGRAM
+ * ============================================================================
+ * Fixed-size histogram for non-negative integer samples (microseconds,
+ * bytes, segments). Each power of two is split into HISTOGRAM_SUB_BUCKETS
+ * linear buckets, so any recorded value is off by at most 1/8 (12.5%)
+ * while the whole uint64_t range fits in a few KB.
+ *
+ * Recording is a bit scan and an increment - cheap enough for the data
+ * path - and the struct is plain data, so it can be embedded, copied into
+ * the scoreboard, or merged by adding bucket arrays.
+ */
+
+#define HISTOGRAM_SUB_BITS    3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS     ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/* Empty the histogram */
+void histogram_init(histogram_t *h);
+
+/* Record one sample */
+void histogram_record(histogram_t *h, uint64_t value);
+
+/* Record the same sample n times (coordinated-omission backfill) */
+void histogram_record_n(histogram_t *h, uint64_t value, uint64_t n);
+
+/* Add every sample of src into dst */
+void histogram_merge(histogram_t *dst, const histogram_t *src);
+
+/* Value at percentile p (0-100): upper bound of the bucket holding it.
+ * Returns 0 for an empty histogram.
+ */
+uint64_t histogram_percentile(const histogram_t *h, double p);
+
+/* Mean of the recorded samples (0 when empty) */
+double histogram_mean(const histogram_t *h);
+
+#endif /* HISTOGRAM_H */
@@ -3,6 +3,11 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "config.h"
+#include "http_response.h"
+#include "file_reply.h"
+#include "disk_cache.h"
+#include "spool.h"
 
 /* ============================================================================
  * HTTP METHOD TYPES
@@ -41,6 +46,10 @@ typedef enum {
 #define MAX_HEADERS             64
 #define MAX_HEADER_NAME_LEN     128
 #define MAX_HEADER_VALUE_LEN    8192
+#define MAX_BODY_LEN            (100 * 1024 * 1024)
+
+/* Go-ahead for a client that sent Expect: 100-continue */
+#define CONTINUE_RESPONSE       "HTTP/1.1 100 Continue\r\n\r\n"
 
 /* ============================================================================
  * HTTP HEADER STRUCTURE
@@ -72,6 +81,8 @@ typedef struct http_request {
     /* Body information */
     int64_t content_length;  /* -1 if not specified */
     int chunked;             /* 1 if Transfer-Encoding: chunked */
+    int expect_continue;     /* 1 if Expect: 100-continue */
+    uint64_t body_left;      /* Body bytes still to relay from the client */
     
     /* Connection management */
     int keep_alive;          /* 1 for keep-alive, 0 for close */
@@ -80,10 +91,32 @@ typedef struct http_request {
     int is_complete;         /* 1 when full request received */
     size_t headers_end_offset;  /* Offset where headers end (\r\n\r\n) */
     size_t total_length;     /* Total length including body */
+    uint64_t started_us;     /* Parsed at (sched_now_us()), with classes only */
     
     /* Raw data (not owned by this struct) */
     const char *raw_data;
     size_t raw_data_len;
+    
+    /* Framing of the upstream response to this request */
+    http_response_t response;
+    
+    /* Response sent from a file (static route or cache hit), no upstream */
+    file_reply_t file;
+    
+    /* Upstream response being captured for the disk cache */
+    disk_fill_t fill;
+    
+    /* Upstream response bytes the client hasn't taken yet (-o) */
+    spool_t spool;
+    
+    /* Request body past the buffer, collected before the upstream (-O) */
+    spool_t body;
+    
+    /* Scratch memory for this request; reset when the request ends */
+    arena_t arena;
+    
+    /* Free list link while parked in the pool */
+    struct http_request *next_free;
 } http_request_t;
 
 /* ============================================================================
@@ -94,9 +127,36 @@ typedef struct http_request {
 /**
  * Initialize an HTTP request structure
  * @param req Request structure to initialize
+ *
+ * Only the scalar fields and string terminators are reset; header slots
+ * past header_count are never read, so stale bytes there are harmless.
+ * This runs on every keep-alive request, so it must stay O(1). The arena
+ * is reset too, keeping its first block for the next request.
  */
 void http_request_init(http_request_t *req);
 
+/* ============================================================================
+ * REQUEST POOL
+ * ============================================================================
+ */
+
+/* Initialize an empty pool. Nothing is allocated until the first get.
+ * Request arenas draw their blocks from arenas.
+ */
+void http_request_pool_init(http_request_pool_t *pool, arena_pool_t *arenas);
+
+/* Take an initialized request from the pool.
+ * Grows the pool by one chunk (4K pages) when the free list is empty.
+ * Returns NULL if that allocation fails.
+ */
+http_request_t *http_request_pool_get(http_request_pool_t *pool);
+
+/* Return a request to the pool, releasing its arena. NULL is ignored. */
+void http_request_pool_put(http_request_pool_t *pool, http_request_t *req);
+
+/* Unmap every chunk. Requests handed out earlier become invalid. */
+void http_request_pool_destroy(http_request_pool_t *pool);
+
 /**
  * Parse HTTP request from buffer
  * @param req Request structure to fill
@@ -113,6 +173,16 @@ int http_request_parse(http_request_t *req, const char *data, size_t len);
  */
 int http_request_is_valid(const http_request_t *req);
 
+/**
+ * Bytes of a parsed request that are in its read buffer now: the headers
+ * when the body is spooled, else the whole request, or as much of it as
+ * has arrived (an Expect: 100-continue body comes later)
+ * @param req Parsed request
+ * @param buffered Bytes in the buffer it was parsed from
+ * @return Bytes to forward or capture, never more than buffered
+ */
+size_t http_request_buffered_length(const http_request_t *req, size_t buffered);
+
 /**
  * Get header value by name (case-insensitive)
  * @param req Request to search
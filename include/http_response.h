@@ -0,0 +1,88 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * HTTP RESPONSE FRAMING
+ * ============================================================================
+ * The proxy forwards response bytes untouched, but it has to know where a
+ * response ends: that is the moment the client can be put back into
+ * keep-alive and the upstream connection is done with.
+ *
+ * This is deliberately not a full response parser. It reads the status line
+ * and the three headers that decide framing (Content-Length,
+ * Transfer-Encoding, Connection) and then counts body bytes. The disk cache
+ * also gets the few facts it needs from Cache-Control, Set-Cookie and Vary.
+ */
+
+typedef enum {
+    HTTP_RESP_HEADERS = 0,   /* Waiting for the end of the header block */
+    HTTP_RESP_BODY_LENGTH,   /* Content-Length body */
+    HTTP_RESP_CHUNK_SIZE,    /* Chunked: reading a chunk-size line */
+    HTTP_RESP_CHUNK_DATA,    /* Chunked: inside chunk data */
+    HTTP_RESP_CHUNK_CRLF,    /* Chunked: CRLF after chunk data */
+    HTTP_RESP_TRAILERS,      /* Chunked: trailer section after last chunk */
+    HTTP_RESP_BODY_EOF,      /* Body ends when upstream closes */
+    HTTP_RESP_DONE,          /* Response complete */
+    HTTP_RESP_INVALID        /* Framing error: close both sides */
+} http_resp_state_t;
+
+typedef struct http_response {
+    http_resp_state_t state;
+    int status_code;
+    int keep_alive;          /* Upstream will keep the connection open */
+    int http10;              /* Status line said HTTP/1.0 */
+    int head_request;        /* Response to HEAD: never has a body */
+    int64_t remaining;       /* Bytes left in body / current chunk */
+    size_t header_length;    /* Bytes in the status line + headers */
+    size_t interim_length;   /* 1xx responses ahead of an incomplete final one */
+    uint32_t line_length;    /* Chunk parser: bytes in the current line */
+    int chunk_ext;           /* Chunk parser: inside a chunk extension */
+    
+    /* For the disk cache */
+    int64_t content_length;  /* -1 if not specified */
+    int64_t max_age;         /* Cache-Control max-age / s-maxage, -1 if absent */
+    int uncacheable;         /* no-store, private, no-cache, Set-Cookie, Vary */
+} http_response_t;
+
+/**
+ * Prepare for the response to a new request
+ * @param resp Response framing state
+ * @param head_request 1 if the request was HEAD (response has no body)
+ */
+void http_response_init(http_response_t *resp, int head_request);
+
+/**
+ * Parse the response header block
+ * @param resp Response framing state
+ * @param data Buffer starting at the status line
+ * @param len Bytes available
+ * @return 1 if headers complete (resp->header_length set), 0 if need more
+ *         data, -1 on malformed response
+ *
+ * 1xx interim responses (other than 101) are reported as complete with
+ * status_code < 200; the caller calls http_response_init() again and parses
+ * the final response that follows them.
+ */
+int http_response_parse_headers(http_response_t *resp, const char *data, size_t len);
+
+/**
+ * Account for body bytes
+ * @param resp Response framing state (headers already parsed)
+ * @param data Body bytes
+ * @param len Number of bytes
+ * @return Number of bytes that belong to this response. When this is less
+ *         than len, or resp->state is HTTP_RESP_DONE, the response is over.
+ */
+size_t http_response_consume(http_response_t *resp, const char *data, size_t len);
+
+/**
+ * Is the response complete?
+ * @param resp Response framing state
+ * @return 1 if complete, 0 otherwise
+ */
+int http_response_is_complete(const http_response_t *resp);
+
+#endif /* HTTP_RESPONSE_H */
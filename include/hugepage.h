@@ -0,0 +1,54 @@
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#include <stddef.h>
+
+/* ============================================================================
+ * HUGE PAGE BACKED ALLOCATIONS
+ * ============================================================================
+ * The big long-lived arenas (connection table, buffer slabs, cache storage)
+ * span hundreds of MB. Backed by 4K pages, dispatching events across
+ * thousands of connections touches a different page almost every time and
+ * the dTLB thrashes. Backing them with 2MB pages cuts the number of TLB
+ * entries needed by 512x.
+ *
+ * Allocation strategy, in order:
+ *   1. mmap(MAP_HUGETLB)          - explicit hugetlbfs pages (needs
+ *                                   vm.nr_hugepages reserved by the admin)
+ *   2. mmap + madvise(MADV_HUGEPAGE) - transparent huge pages
+ *   3. plain mmap                 - 4K pages, always works
+ *
+ * Every step falls back silently to the next one. Memory returned is always
+ * zeroed (fresh anonymous mappings), so callers can drop their calloc().
+ */
+
+typedef enum {
+    HUGEPAGE_BACKING_NONE = 0,  /* Plain 4K pages */
+    HUGEPAGE_BACKING_THP,       /* madvise(MADV_HUGEPAGE) */
+    HUGEPAGE_BACKING_HUGETLB    /* MAP_HUGETLB */
+} hugepage_backing_t;
+
+/* Size of a huge page on x86-64 / most aarch64 kernels */
+#define HUGEPAGE_SIZE (2UL * 1024 * 1024)
+
+/* Set the allocation policy. Call once at startup, before the first
+ * hugepage_alloc().
+ *
+ *   enabled:  0 = always use plain 4K pages (for before/after benchmarks)
+ *   prefault: 1 = touch every page at allocation time, so the first burst
+ *                 of connections doesn't pay page faults in the event loop
+ */
+void hugepage_configure(int enabled, int prefault);
+
+/* Allocate size bytes of zeroed memory, rounded up to a huge page multiple.
+ * Returns NULL on failure. backing (optional) reports what we actually got.
+ */
+void *hugepage_alloc(size_t size, hugepage_backing_t *backing);
+
+/* Release memory from hugepage_alloc(). size must match the allocation. */
+void hugepage_free(void *ptr, size_t size);
+
+/* Human-readable name of a backing type, for startup logging */
+const char *hugepage_backing_name(hugepage_backing_t backing);
+
+#endif /* HUGEPAGE_H */
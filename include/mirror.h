@@ -0,0 +1,117 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include "config.h"
+#include "http_response.h"
+#include <stdint.h>
+
+/* ============================================================================
+ * TRAFFIC MIRRORING
+ * ============================================================================
+ * Requests under a configured path prefix are also sent to a shadow
+ * upstream (a new backend version, say). The shadow's response is framed
+ * and thrown away; the client only ever sees the primary's.
+ *
+ * The mirror must never slow the primary path down:
+ *   - No copy: the request buffer is shared. The primary upstream takes
+ *     the client's read buffer as its write buffer and the mirror holds a
+ *     second reference to it (buffer_t.refs), sending from its own offset.
+ *     Neither side writes into a buffer while another holds a reference.
+ *   - No backpressure: shadow requests in flight are capped at the number
+ *     of slots. With every slot busy, or the shadow unreachable, the copy
+ *     is dropped and counted; the primary request goes ahead regardless.
+ *   - No waiting: a shadow that hasn't answered within MIRROR_TIMEOUT_MS
+ *     is cut off, so a stuck shadow can't hold the slots forever.
+ *
+ * Every method is mirrored, POST included: point the shadow at something
+ * that tolerates replayed side effects.
+ *
+ * Shadow sockets are not in the connection table. The loop tells them
+ * apart by address: the epoll data pointer and the timer node of a shadow
+ * request both point into the slot array.
+ */
+
+#define MIRROR_MAX_ROUTES     8
+#define MIRROR_DEFAULT_SLOTS  64      /* Shadow requests in flight */
+#define MIRROR_TIMEOUT_MS     5000
+
+typedef struct {
+    const char *prefix;       /* URL path prefix, e.g. "/api/" */
+    size_t prefix_len;
+    const char *addr;         /* Shadow upstream (IPv4 address) */
+    uint16_t port;
+
+    struct {
+        uint64_t mirrored;    /* Copies sent on their way */
+        uint64_t dropped;     /* All slots busy */
+        uint64_t failed;      /* Shadow unreachable, reset or malformed */
+        uint64_t timeouts;
+        uint64_t completed;   /* Full response read and discarded */
+        uint64_t status[6];   /* Completed, by status class (index 1..5) */
+    } stats;
+} mirror_route_t;
+
+typedef struct mirror_slot {
+    int fd;                         /* -1: slot free */
+    int connecting;
+    mirror_route_t *route;
+
+    buffer_t *request;              /* Shared, read-only; NULL once sent */
+    size_t request_len;
+    size_t sent;
+
+    buffer_t *response;             /* Shadow's response, framed and dropped */
+    http_response_t framing;
+
+    timer_node_t timer;             /* MIRROR_TIMEOUT_MS deadline */
+    struct mirror_slot *next_free;
+} mirror_slot_t;
+
+typedef struct mirror {
+    mirror_route_t routes[MIRROR_MAX_ROUTES];
+    int route_count;
+
+    mirror_slot_t *slots;           /* slot_count of them, huge-page backed */
+    uint32_t slot_count;
+    uint32_t in_flight;
+    mirror_slot_t *free_list;
+} mirror_t;
+
+/* ============================================================================
+ * FUNCTIONS
+ * ============================================================================
+ */
+
+/* Allocate slot_count idle slots and no routes. NULL on failure (printed). */
+mirror_t *mirror_create(uint32_t slot_count);
+
+/* Cut off shadow requests in flight and free everything. Must run before
+ * the buffer pool is destroyed. NULL is ignored.
+ */
+void mirror_destroy(proxy_config_t *config, mirror_t *m);
+
+/* Add a route from "PREFIX=ADDR:PORT". The string must outlive the mirror.
+ * Returns 0, or -1 with the reason printed.
+ */
+int mirror_add_route(mirror_t *m, char *spec);
+
+/* Route mirroring a request path, longest prefix first. NULL: don't. */
+mirror_route_t *mirror_route(mirror_t *m, const char *path);
+
+/* Send a copy of the request in buf[0, len) to route's shadow. Takes its
+ * own reference to buf on success; the caller keeps its reference either
+ * way. Never blocks and never fails the caller: a copy that can't go is
+ * counted as dropped or failed.
+ */
+void mirror_request(proxy_config_t *config, mirror_route_t *route,
+                    buffer_t *buf, size_t len, int head_request);
+
+/* Epoll event for a shadow request (registered as EPOLL_SOURCE_MIRROR) */
+void mirror_event(proxy_config_t *config, mirror_slot_t *slot, uint32_t events);
+
+/* Expired timer node. Returns 1 if it was a shadow request's deadline. */
+int mirror_timer(proxy_config_t *config, timer_node_t *node);
+
+void mirror_print(const mirror_t *m);
+
+#endif /* MIRROR_H */
@@ -0,0 +1,46 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+/* ============================================================================
+ * IN-PROCESS SAMPLING PROFILER
+ * ============================================================================
+ * Profiles a running proxy without restarting it under perf.
+ *
+ * An ITIMER_PROF timer delivers SIGPROF PROFILER_HZ times per second of CPU
+ * time. The handler walks the frame-pointer chain from the interrupted
+ * context and stores the raw return addresses in a fixed ring (no
+ * allocation, no locks, async-signal-safe). On request the event loop
+ * symbolizes the ring against the binary's own symbol table and writes
+ * folded stacks, one "root;caller;leaf count" line per unique stack - the
+ * input format of flamegraph.pl and speedscope.
+ *
+ * Stacks are only complete in a build with frame pointers
+ * (make profile-build). The production build omits them, and the walk then
+ * stops after a frame or two.
+ *
+ * The proxy is a single event loop, so there is one timer and one ring.
+ */
+
+#define PROFILER_HZ         99     /* Off-beat with 100 Hz periodic work */
+#define PROFILER_RING_SIZE  4096   /* Newest samples kept between dumps */
+#define PROFILER_MAX_DEPTH  32
+
+/* Install the handlers and start the timer. Dumps go to path.
+ * Returns 0 on success, -1 on error (already printed).
+ */
+int profiler_start(const char *path);
+
+/* Stop the timer. Samples still in the ring are discarded. */
+void profiler_stop(void);
+
+/* Ask for a dump from outside the loop (also what SIGUSR1 does) */
+void profiler_request_dump(void);
+
+/* Called by the event loop once per iteration: writes the dump if one was
+ * requested. Symbolizing allocates, so it never runs in the signal handler.
+ */
+void profiler_poll(void);
+
+#endif /* PROFILER_H */
@@ -28,6 +28,11 @@ int proxy_init(proxy_config_t *config,
 /* Run the proxy event loop */
 int proxy_run(proxy_config_t *config);
 
+/* Run one epoll event for a connection, as the loop does: the handler
+ * for its role, state and event, if any.
+ */
+void proxy_dispatch(proxy_config_t *config, connection_t *conn, uint32_t events);
+
 /* Cleanup and shutdown */
 void proxy_cleanup(proxy_config_t *config);
 
@@ -51,6 +56,9 @@ void handle_connect(proxy_config_t *config, connection_t *conn);
 /* Handle error/hangup */
 void handle_error(proxy_config_t *config, connection_t *conn);
 
+/* Handle connection timer expiry (idle shrink) */
+void handle_timeout(proxy_config_t *config, connection_t *conn);
+
 /* ============================================================================
  * HTTP-SPECIFIC HANDLERS
  * ============================================================================
@@ -59,7 +67,10 @@ void handle_error(proxy_config_t *config, connection_t *conn);
 /* Handle complete HTTP request (called when we have full request parsed) */
 void handle_http_request(proxy_config_t *config, connection_t *client);
 
-/* Send HTTP error response to client */
+/* Send HTTP error response to client.
+ * Fills the client's write buffer and moves it to CONN_WRITING_RESPONSE;
+ * the caller flushes it with handle_write().
+ */
 void send_http_error(connection_t *client, int status_code, const char *message);
 
 /* ============================================================================
@@ -0,0 +1,147 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * SHARED-MEMORY SCOREBOARD
+ * ============================================================================
+ * A file-backed shared mapping (normally under /dev/shm) that the proxy
+ * publishes its statistics into and that epoll-proxy-top reads live.
+ *
+ * The data path never touches it: handlers keep bumping the plain counters
+ * in proxy_config_t, and the event loop copies them over every
+ * SCOREBOARD_PUBLISH_MS. One memcpy-sized write per publish, no syscalls.
+ *
+ * Consistency uses a seqlock. The single writer makes seq odd, writes the
+ * payload, then makes it even again. Readers copy the payload and retry if
+ * seq was odd or changed while they were copying. Readers never block the
+ * writer.
+ *
+ * The layout is an ABI shared with external readers: bump
+ * SCOREBOARD_VERSION whenever it changes.
+ */
+
+#define SCOREBOARD_MAGIC         0x42535045u  /* "EPSB" */
+#define SCOREBOARD_VERSION       3
+#define SCOREBOARD_MAX_WORKERS   16
+#define SCOREBOARD_MAX_UPSTREAMS 16
+#define SCOREBOARD_NAME_LEN      64
+#define SCOREBOARD_PUBLISH_MS    100
+
+/* Monotonic counters (readers compute rates from deltas) */
+typedef struct {
+    uint64_t total_connections;
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+    uint64_t errors;
+    uint64_t requests_total;
+    uint64_t requests_get;
+    uint64_t requests_post;
+    uint64_t requests_error;
+    uint64_t keep_alive_reused;
+    uint64_t idle_shrinks;
+    uint64_t idle_wakeups;
+    uint64_t loop_iterations;
+    uint64_t syscalls;
+    uint64_t syscalls_eagain;
+} scoreboard_counters_t;
+
+/* TCP_INFO summary for one side (clients or an upstream), cumulative since
+ * start. Percentiles are computed by the proxy at publish time.
+ */
+typedef struct {
+    uint64_t samples;
+    uint64_t rtt_p50_us;
+    uint64_t rtt_p99_us;
+    uint64_t rttvar_p50_us;
+    uint64_t cwnd_p50;               /* Segments */
+    uint64_t unacked_p99;            /* Segments in flight */
+    uint64_t delivery_rate_p50;      /* Bytes per second */
+    uint64_t retrans_milli;          /* Mean retransmits per connection x1000 */
+} scoreboard_tcpinfo_t;
+
+/* One event loop */
+typedef struct {
+    uint32_t pid;
+    uint32_t mode;                 /* proxy_mode_t */
+    uint64_t started_ms;           /* get_timestamp_ms() clock (monotonic) */
+    uint64_t updated_ms;           /* Last publish; stale => worker stuck */
+    
+    /* Gauges */
+    uint64_t active_connections;
+    uint64_t buffers_total;
+    uint64_t buffers_in_use;
+    uint64_t parsers_total;
+    uint64_t parsers_in_use;
+    uint64_t arena_blocks_total;
+    uint64_t arena_blocks_in_use;
+    uint64_t timers_armed;
+    
+    scoreboard_counters_t counters;
+    scoreboard_tcpinfo_t clients;    /* Sampled on the listener side */
+} scoreboard_worker_t;
+
+/* One upstream (backend) */
+typedef struct {
+    char name[SCOREBOARD_NAME_LEN];  /* "addr:port" */
+    uint64_t connects;               /* Connections opened */
+    uint64_t failures;               /* Connect errors and broken exchanges */
+    uint64_t active;                 /* Connections open right now */
+    scoreboard_tcpinfo_t tcp;
+} scoreboard_upstream_t;
+
+typedef struct scoreboard {
+    /* Header: written once at creation, never changes */
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                   /* sizeof(scoreboard_t) */
+    uint32_t reserved;
+    
+    /* Seqlock: odd while the payload is being written */
+    uint64_t seq;
+    
+    /* Payload */
+    uint32_t worker_count;
+    uint32_t upstream_count;
+    scoreboard_worker_t workers[SCOREBOARD_MAX_WORKERS];
+    scoreboard_upstream_t upstreams[SCOREBOARD_MAX_UPSTREAMS];
+} scoreboard_t;
+
+/* ============================================================================
+ * WRITER (the proxy)
+ * ============================================================================
+ */
+
+/* Create (or truncate) the segment at path and map it read-write.
+ * Returns NULL on failure (error already printed).
+ */
+scoreboard_t *scoreboard_create(const char *path);
+
+/* Unmap and remove the segment */
+void scoreboard_destroy(scoreboard_t *sb, const char *path);
+
+/* Bracket every payload update */
+void scoreboard_write_begin(scoreboard_t *sb);
+void scoreboard_write_end(scoreboard_t *sb);
+
+/* ============================================================================
+ * READER (epoll-proxy-top)
+ * ============================================================================
+ */
+
+/* Map an existing segment read-only and check magic, version and size.
+ * Returns NULL on failure (error already printed).
+ */
+const scoreboard_t *scoreboard_open(const char *path);
+
+/* Unmap a segment opened with scoreboard_open() */
+void scoreboard_close(const scoreboard_t *sb);
+
+/* Copy a consistent snapshot of the payload into out.
+ * Returns 0 on success, -1 if the writer kept it busy for too long.
+ */
+int scoreboard_snapshot(const scoreboard_t *sb, scoreboard_t *out);
+
+#endif /* SCOREBOARD_H */
@@ -0,0 +1,127 @@
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * BANDWIDTH SHAPING
+ * ============================================================================
+ * Token buckets capping the bytes we send: one per connection (-w, every
+ * connection, both modes) and one per route (-W, shared by the clients of
+ * every request under the route's path prefix, HTTP only). A send may go
+ * out when both buckets it draws on have tokens, and takes at most that
+ * many bytes.
+ *
+ * A connection that runs out is paused: conn->shape_paused drops EPOLLOUT
+ * from its registration and a timer wheel node wakes it once the bucket
+ * has refilled to half its depth. No polling in between. Its write buffer
+ * stays full meanwhile, and the usual backpressure (connection_can_read()
+ * on the peer) stops the other side reading, so TCP flow control slows
+ * the sender down.
+ *
+ * Buckets hold credit in byte-microseconds, so refilling is exact integer
+ * arithmetic at any rate and any call frequency. A bucket holds
+ * SHAPER_BURST_MS worth of tokens (at least SHAPER_MIN_BURST): enough to
+ * ride out a late timer tick without losing refill.
+ *
+ * Per-connection state lives in a table indexed like config->connections,
+ * so connection_t only spends two bytes of what was padding on it.
+ */
+
+#define SHAPER_MAX_ROUTES  8
+#define SHAPER_BURST_MS    20           /* Two timer wheel ticks */
+#define SHAPER_MIN_BURST   (16 * 1024)
+
+typedef struct {
+    int64_t credit;                 /* Bytes * 1e6; may go negative */
+    uint64_t last_us;               /* Last refill; 0: not used yet (full) */
+} token_bucket_t;
+
+typedef struct {
+    const char *prefix;             /* URL path prefix, e.g. "/downloads/" */
+    size_t prefix_len;
+    uint64_t rate;                  /* Bytes per second */
+    int64_t burst;                  /* Bucket depth in bytes */
+    token_bucket_t bucket;
+
+    struct {
+        uint64_t bytes;
+        uint64_t requests;
+        uint64_t pauses;            /* Sends held back for tokens */
+    } stats;
+} shaper_route_t;
+
+typedef struct {
+    token_bucket_t bucket;
+    timer_node_t timer;             /* Wakeup while paused */
+} shaper_conn_t;
+
+typedef struct shaper {
+    uint64_t conn_rate;             /* Per connection; 0: uncapped */
+    int64_t conn_burst;
+
+    shaper_route_t routes[SHAPER_MAX_ROUTES];
+    int route_count;
+
+    shaper_conn_t *conns;           /* MAX_CONNECTIONS, huge-page backed */
+    uint64_t started_ms;
+
+    struct {
+        uint64_t bytes;             /* Sent by capped connections */
+        uint64_t pauses;
+        uint64_t wakeups;
+    } stats;
+} shaper_t;
+
+/* ============================================================================
+ * FUNCTIONS
+ * ============================================================================
+ */
+
+/* Parse a rate: bytes per second with an optional K, M or G suffix (1024
+ * based), e.g. "500K" or "1.5G". Returns 0, or -1 if it isn't one.
+ */
+int shaper_parse_rate(const char *s, uint64_t *rate);
+
+/* Allocate a shaper capping every connection at conn_rate bytes/s (0: no
+ * per-connection cap). NULL on failure (printed).
+ */
+shaper_t *shaper_create(uint64_t conn_rate);
+
+void shaper_destroy(shaper_t *s);
+
+/* Add a route from "PREFIX=RATE". The string must outlive the shaper.
+ * Returns 0, or -1 with the reason printed.
+ */
+int shaper_add_route(shaper_t *s, char *spec);
+
+/* Route for a request path, longest prefix first: index + 1, or 0 */
+uint8_t shaper_route(shaper_t *s, const char *path);
+
+/* How many of want bytes conn may send now (at least 1 when nonzero).
+ * 0 means the connection is now paused until its timer fires.
+ */
+size_t shaper_allow(proxy_config_t *config, connection_t *conn, size_t want);
+
+/* conn sent n bytes */
+void shaper_charge(proxy_config_t *config, connection_t *conn, size_t n);
+
+/* Expired timer node. Returns the connection it resumes (no longer
+ * paused; the caller retries its writes), or NULL if it isn't ours.
+ */
+connection_t *shaper_timer(proxy_config_t *config, timer_node_t *node);
+
+/* conn is closing: disarm its wakeup and fill its bucket for the next user */
+void shaper_forget(proxy_config_t *config, connection_t *conn);
+
+void shaper_print(const shaper_t *s);
+
+/* Is anything capping conn? One branch when shaping is off. */
+static inline int shaper_applies(const proxy_config_t *config, const connection_t *conn) {
+    return config->shaper != NULL &&
+           (config->shaper->conn_rate != 0 || conn->shape_route != 0);
+}
+
+#endif /* SHAPER_H */
@@ -0,0 +1,107 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* ============================================================================
+ * RESPONSE AND REQUEST BODY BUFFERING
+ * ============================================================================
+ * Without it, a slow client holds its upstream for the whole download:
+ * once the client's write buffer is full, connection_can_read() stops
+ * reading the upstream and the upstream waits on the client's bandwidth.
+ *
+ * With response buffering (-o), what doesn't fit into the client's write
+ * buffer goes into a spool: a ring of pool buffers up to the configured
+ * size, then an unlinked temp file. The upstream is read at its own pace
+ * and released as soon as the response is complete; the client drains
+ * the spool afterwards. Upstream concurrency then tracks backend work, not
+ * client bandwidth.
+ *
+ * Ordering: bytes only go into memory while the file has nothing pending,
+ * so everything in memory is older than anything in the file. The file
+ * is written and read from the loop. It is short-lived and normally never
+ * leaves the page cache.
+ *
+ * A spool that is full (memory and SPOOL_MAX_FILE of file) takes nothing
+ * more; the upstream's read buffer fills and ordinary backpressure applies.
+ *
+ * The same spools hold request bodies too big for the client's read
+ * buffer (-O): the body is collected in full before an upstream is
+ * leased, so a slow upload doesn't hold one either.
+ */
+
+#define SPOOL_MAX_CHUNKS    64                  /* Pool buffers per response */
+#define SPOOL_DEFAULT_KB    256                 /* In memory before the file */
+#define SPOOL_MAX_FILE      (1024ULL << 20)     /* Per response */
+
+typedef struct spooler {
+    buffer_pool_t *pool;
+    int chunk_limit;                /* Pool buffers per response */
+    const char *dir;                /* Where spill files go */
+
+    struct {
+        uint64_t buffered;          /* Spools that took any bytes */
+        uint64_t bytes;             /* Spooled in memory or file */
+        uint64_t spills;            /* Spools that went to a file */
+        uint64_t spill_bytes;
+        uint64_t released_early;    /* Upstreams freed before the client was done */
+        uint64_t failures;          /* Spill file errors */
+    } stats;
+} spooler_t;
+
+typedef struct {
+    spooler_t *owner;               /* NULL: this response isn't buffered */
+    int failed;                     /* Spill file error: the response is lost */
+    int counted;
+
+    /* Memory: a ring of pool buffers, oldest first */
+    buffer_t *chunks[SPOOL_MAX_CHUNKS];
+    int head;
+    int count;
+    size_t memory;                  /* Bytes pending in chunks */
+
+    /* File: everything past written, read to read_off so far */
+    int fd;                         /* -1 until the first spill */
+    uint64_t written;
+    uint64_t read_off;
+} spool_t;
+
+/* ============================================================================
+ * FUNCTIONS
+ * ============================================================================
+ */
+
+/* Buffer up to memory_kb per spool in pool buffers, then spill to
+ * unlinked files in dir. NULL on failure (printed).
+ */
+spooler_t *spooler_create(buffer_pool_t *pool, size_t memory_kb, const char *dir);
+
+void spooler_destroy(spooler_t *s);
+
+/* what: what the spools hold, e.g. "responses" */
+void spooler_print(const spooler_t *s, const char *what);
+
+/* Start buffering into sp */
+void spool_begin(spool_t *sp, spooler_t *owner);
+
+/* Release everything the spool holds; it is off again. Safe on a spool
+ * that was never begun.
+ */
+void spool_reset(spool_t *sp);
+
+/* Take up to len bytes, in order. Returns how many were taken:
+ * fewer than len once the spool is full or has failed.
+ */
+size_t spool_append(spool_t *sp, const char *data, size_t len);
+
+/* Move the oldest pending bytes into dst's free space. Returns how many. */
+size_t spool_pull(spool_t *sp, buffer_t *dst);
+
+/* Bytes taken but not yet pulled */
+static inline uint64_t spool_pending(const spool_t *sp) {
+    return sp->memory + (sp->written - sp->read_off);
+}
+
+#endif /* SPOOL_H */
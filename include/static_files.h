@@ -0,0 +1,124 @@
+#ifndef STATIC_FILES_H
+#define STATIC_FILES_H
+
+#include "config.h"
+#include "file_reply.h"
+#include <sys/types.h>
+#include <time.h>
+
+/* ============================================================================
+ * STATIC FILE ROUTES
+ * ============================================================================
+ * Requests under a configured path prefix are answered from a local
+ * directory instead of the backend. The body goes from the page cache to
+ * the socket with sendfile(): it never passes through a buffer_t and no
+ * upstream connection is opened.
+ *
+ * Open files are kept in a bounded cache keyed by file system path. An
+ * entry holds the descriptor, what fstat() said and the complete 200
+ * response header, so a hit costs a hash lookup and two syscalls (header,
+ * sendfile). Entries are trusted for STATIC_REVALIDATE_MS; after that the
+ * next hit stat()s the path and reopens the file if it changed.
+ *
+ * An entry stays open while a reply is still sending from it. If the file
+ * changes (or the entry is evicted) meanwhile, the entry only leaves the
+ * hash: the reply finishes from the old descriptor and the slot is reused
+ * later.
+ *
+ * Supported: GET and HEAD, single byte ranges (206/416), If-Range and
+ * If-None-Match against the ETag (304). Multiple ranges get the whole file.
+ */
+
+#define STATIC_MAX_ROUTES      8
+#define STATIC_CACHE_ENTRIES   1024    /* Open files kept */
+#define STATIC_CACHE_BUCKETS   2048    /* Power of two */
+#define STATIC_PATH_MAX        1024
+#define STATIC_HEADER_MAX      512
+#define STATIC_REVALIDATE_MS   1000
+
+typedef struct {
+    const char *prefix;       /* URL path prefix, e.g. "/assets/" */
+    size_t prefix_len;
+    const char *root;         /* Directory the rest of the path is under */
+} static_route_t;
+
+typedef struct static_entry {
+    char path[STATIC_PATH_MAX];     /* Key: file system path */
+    uint32_t hash;
+    int hashed;                     /* Reachable by lookup */
+    int fd;                         /* -1: slot unused */
+    int refs;                       /* Replies sending from fd */
+
+    /* What the file looked like when opened */
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    uint64_t validated_ms;
+
+    const char *content_type;
+    char etag[48];
+    char last_modified[32];
+    char header[STATIC_HEADER_MAX]; /* 200 header, without the blank line */
+    size_t header_len;
+
+    struct static_entry *hash_next;
+    struct static_entry *lru_prev;  /* Most recently used at the head */
+    struct static_entry *lru_next;
+} static_entry_t;
+
+typedef struct static_files {
+    static_route_t routes[STATIC_MAX_ROUTES];
+    int route_count;
+
+    static_entry_t *entries;        /* STATIC_CACHE_ENTRIES, huge-page backed */
+    static_entry_t *buckets[STATIC_CACHE_BUCKETS];
+    static_entry_t *lru_head;
+    static_entry_t *lru_tail;
+    static_entry_t *free_list;      /* Never used slots, via lru_next */
+
+    struct {
+        uint64_t hits;              /* Served from an open entry */
+        uint64_t opens;             /* Files opened (misses and changes) */
+        uint64_t revalidations;     /* stat() after the TTL */
+        uint64_t changed;           /* ... that found a different file */
+        uint64_t evictions;
+        uint64_t not_found;
+        uint64_t ranges;            /* 206 responses */
+        uint64_t not_modified;      /* 304 responses */
+        uint64_t bytes;             /* Body bytes via sendfile() */
+    } stats;
+} static_files_t;
+
+/* ============================================================================
+ * FUNCTIONS
+ * ============================================================================
+ */
+
+/* Allocate an empty cache with no routes. NULL on failure (printed). */
+static_files_t *static_files_create(void);
+
+/* Close every cached file and free the cache. NULL is ignored. */
+void static_files_destroy(static_files_t *sf);
+
+/* Add a route from "PREFIX=DIR". The strings must outlive the cache.
+ * Returns 0, or -1 with the reason printed.
+ */
+int static_files_add_route(static_files_t *sf, char *spec);
+
+/* Route serving a request path, longest prefix first. NULL: proxy it. */
+const static_route_t *static_files_route(const static_files_t *sf, const char *path);
+
+/* Prepare the response to req from route into reply (header, then the
+ * Connection line + CRLF, then the body from the entry's descriptor).
+ * Returns 0 when reply holds a response to send (200, 206, 304 or 416),
+ * or the status of an error to answer with instead (404, 405, 503).
+ * keep_alive picks the Connection line.
+ */
+int static_files_respond(proxy_config_t *config, const static_route_t *route,
+                         struct http_request *req, file_reply_t *reply,
+                         int keep_alive);
+
+void static_files_print(const static_files_t *sf);
+
+#endif /* STATIC_FILES_H */
@@ -0,0 +1,54 @@
+#ifndef SYSCOUNT_H
+#define SYSCOUNT_H
+
+#include "config.h"
+#include "connection.h"
+#include <errno.h>
+
+/* ============================================================================
+ * SYSCALL ACCOUNTING
+ * ============================================================================
+ * The syscall wrappers (buffer_read_fd(), epoll_mod(), ...) don't know which
+ * connection they work for, so calls are counted at the call sites, right
+ * next to the syscall, where the connection is at hand. One increment each:
+ * cheap enough to leave on in production builds.
+ *
+ * Helpers that make several syscalls internally are charged with the
+ * constants below. Keep them in step with src/core/epoll.c.
+ */
+
+/* set_nonblocking(): fcntl(F_GETFL) + fcntl(F_SETFL) */
+#define SYSCOUNT_SET_NONBLOCKING 2
+
+/* set_socket_options(): SO_REUSEADDR, SO_KEEPALIVE, TCP_NODELAY */
+#define SYSCOUNT_SOCKET_OPTIONS 3
+
+/* Count one call. ret is the syscall's return value; a -1 with EAGAIN is
+ * also counted as wasted. Call before anything can clobber errno.
+ */
+static inline void syscount(proxy_config_t *config, syscall_side_t side,
+                            syscall_kind_t kind, long ret) {
+    config->syscalls.calls[side][kind]++;
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        config->syscalls.wasted[side][kind]++;
+    }
+}
+
+/* Count n calls that can't have returned EAGAIN */
+static inline void syscount_n(proxy_config_t *config, syscall_side_t side,
+                              syscall_kind_t kind, uint64_t n) {
+    config->syscalls.calls[side][kind] += n;
+}
+
+static inline syscall_side_t syscount_side(const connection_t *conn) {
+    return connection_is_client(conn) ? SYSCALL_SIDE_CLIENT : SYSCALL_SIDE_UPSTREAM;
+}
+
+/* Total calls (and EAGAIN returns) over all kinds and sides */
+uint64_t syscount_total(const syscall_stats_t *stats);
+uint64_t syscount_wasted(const syscall_stats_t *stats);
+
+/* Print the table, per request (HTTP) or per connection (TCP) and per MB */
+void syscount_print(const proxy_config_t *config);
+
+#endif /* SYSCOUNT_H */
@@ -0,0 +1,38 @@
+#ifndef TCPINFO_H
+#define TCPINFO_H
+
+#include "config.h"
+
+/* ============================================================================
+ * TCP_INFO SAMPLING
+ * ============================================================================
+ * Is a slow request slow because of us or because of the network? The
+ * kernel knows: getsockopt(TCP_INFO) reports RTT, congestion window,
+ * bytes in flight and retransmits for each socket.
+ *
+ * Sampling every socket would cost a syscall per connection per round, so
+ * a timer walks a rotating slice of the connection table instead, and
+ * stops when it has spent its share of loop time. Connections are also
+ * sampled once more when they close (that's where the retransmit total is
+ * read), paid for out of the same budget.
+ *
+ * Samples go into histograms per side: the listener (clients) and the
+ * upstream.
+ */
+
+/* Reset all histograms. Sampling starts out enabled. */
+void tcpinfo_init(tcpinfo_sampler_t *sampler);
+
+/* Arm the sampling timer (no-op when disabled) */
+void tcpinfo_start(proxy_config_t *config, uint64_t now_ms);
+
+/* Timer callback: sample the next slice of connections and re-arm */
+void tcpinfo_sample_round(proxy_config_t *config, uint64_t now_ms);
+
+/* Last look at a connection about to be closed (budget permitting) */
+void tcpinfo_sample_close(proxy_config_t *config, const connection_t *conn);
+
+/* Print one side's histograms (for the shutdown statistics) */
+void tcpinfo_print(const char *label, const tcpinfo_stats_t *stats);
+
+#endif /* TCPINFO_H */
@@ -0,0 +1,47 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "config.h"
+
+/* ============================================================================
+ * TIMER WHEEL
+ * ============================================================================
+ * A hashed timing wheel: TIMER_WHEEL_SLOTS buckets of TIMER_TICK_MS each.
+ * A timer lands in bucket (deadline / tick) % slots. Every loop iteration
+ * we walk the buckets between the last processed tick and now, firing the
+ * nodes whose deadline has passed.
+ *
+ * Why a wheel and not a heap?
+ *   Arm, re-arm and cancel are all O(1) list operations, and with a
+ *   million idle connections each re-arming on every request that matters
+ *   far more than precise ordering. 10ms resolution is plenty for timeouts.
+ */
+
+/* Initialize an empty wheel. now_ms is the current get_timestamp_ms(). */
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now_ms);
+
+/* Arm (or re-arm) a timer to fire at expires_ms.
+ * A node that is already armed is moved, not duplicated.
+ */
+void timer_schedule(timer_wheel_t *wheel, timer_node_t *node, uint64_t expires_ms);
+
+/* Disarm a timer. Safe to call on a node that isn't armed. */
+void timer_cancel(timer_wheel_t *wheel, timer_node_t *node);
+
+/* Is this timer armed? */
+int timer_pending(const timer_node_t *node);
+
+/* Fire every timer whose deadline is <= now_ms.
+ * The node is disarmed before callback runs, so the callback may re-arm it.
+ * Returns the number of timers fired.
+ */
+size_t timer_wheel_expire(timer_wheel_t *wheel, uint64_t now_ms,
+                          void (*callback)(void *ctx, timer_node_t *node),
+                          void *ctx);
+
+/* How long epoll_wait() may sleep without missing a tick.
+ * Returns max_ms when no timers are armed.
+ */
+int timer_wheel_timeout(const timer_wheel_t *wheel, uint64_t now_ms, int max_ms);
+
+#endif /* TIMER_H */
@@ -0,0 +1,138 @@
+#ifndef TRAFFIC_SCHED_H
+#define TRAFFIC_SCHED_H
+
+#include "config.h"
+#include "histogram.h"
+#include <sys/epoll.h>
+#include <sys/types.h>
+
+/* ============================================================================
+ * TRAFFIC CLASSES
+ * ============================================================================
+ * Without classes the loop handles events in kernel order and each handler
+ * drains its socket to EAGAIN, so one bulk transfer that always has data
+ * can hold up a whole batch of small API calls behind it.
+ *
+ * With classes (-Q), requests are classified by path prefix and their
+ * connections (client and upstream) carry the class. Each epoll batch is
+ * sorted into per-class queues and served in this order:
+ *   1. Interactive classes, strictly first. Each connection gets one turn
+ *      of at most its class's quantum.
+ *   2. Everything else, by deficit round robin. Each round adds weight *
+ *      SCHED_QUANTUM bytes to a class's deficit, and its queued connections
+ *      take turns while the deficit lasts. A class that empties its queue
+ *      forfeits what's left, so idle classes don't save up.
+ *
+ * A turn is charged for every byte read, written or sent from a file. A
+ * read or write loop that has used up its turn's budget stops short of
+ * EAGAIN and re-arms its epoll registration (EPOLL_CTL_MOD reports a
+ * still-ready socket again), so it is back in the next batch, behind
+ * whatever arrived meanwhile. Each connection gets at most one turn per
+ * batch, so a batch always ends.
+ *
+ * TCP mode has a single listener and no paths: everything is in the
+ * default class.
+ */
+
+#define SCHED_MAX_CLASSES   8       /* Including the default class */
+#define SCHED_MAX_PREFIXES  8       /* Per class */
+#define SCHED_QUANTUM       (64 * 1024)
+
+typedef struct {
+    const char *name;
+    uint32_t weight;
+    int interactive;
+    const char *prefixes[SCHED_MAX_PREFIXES];
+    size_t prefix_lens[SCHED_MAX_PREFIXES];
+    int prefix_count;
+
+    /* This batch */
+    int64_t deficit;
+    int queue[MAX_EVENTS];          /* Event indices, in kernel order */
+    int head;
+    int count;
+
+    struct {
+        uint64_t bytes;             /* Read, written and sent in turns */
+        uint64_t turns;
+        uint64_t preempted;         /* Turns that ended on budget */
+        uint64_t requests;
+        histogram_t latency_us;     /* Request parsed -> response written */
+        histogram_t wait_us;        /* epoll_wait returned -> turn started */
+    } stats;
+} sched_class_t;
+
+typedef struct sched {
+    sched_class_t classes[SCHED_MAX_CLASSES];   /* 0 is the default class */
+    int class_count;
+    int64_t budget;                 /* Bytes the running turn may still move */
+    int preempted;                  /* The running turn stopped on budget */
+    uint64_t started_ms;
+} sched_t;
+
+/* Runs one event's worth of work for a connection */
+typedef void (*sched_dispatch_fn)(proxy_config_t *config, connection_t *conn,
+                                  uint32_t events);
+
+/* ============================================================================
+ * FUNCTIONS
+ * ============================================================================
+ */
+
+/* Allocate a scheduler with just the default class (weight 1). NULL on
+ * failure (printed).
+ */
+sched_t *sched_create(void);
+
+void sched_destroy(sched_t *s);
+
+/* Add a class from "NAME:WEIGHT[:interactive]=PREFIX[,PREFIX...]". The
+ * string must outlive the scheduler. Returns 0, or -1 with the reason printed.
+ */
+int sched_add_class(sched_t *s, char *spec);
+
+/* Class for a request path: longest matching prefix, else 0 */
+uint8_t sched_classify(const sched_t *s, const char *path);
+
+/* Queue events[index] for its connection's class */
+static inline void sched_enqueue(sched_t *s, const connection_t *conn, int index) {
+    sched_class_t *c = &s->classes[conn->traffic_class];
+    c->queue[c->head + c->count++] = index;
+}
+
+/* Serve everything queued from events, then empty the queues. batch_us is
+ * when epoll_wait returned (sched_now_us()).
+ */
+void sched_run(proxy_config_t *config, struct epoll_event *events, uint64_t batch_us,
+               sched_dispatch_fn dispatch);
+
+/* A request of class c finished; started_us is when it was parsed */
+void sched_request_done(sched_t *s, uint8_t c, uint64_t started_us);
+
+void sched_print(const sched_t *s);
+
+uint64_t sched_now_us(void);
+
+/* ============================================================================
+ * TURN BUDGET
+ * ============================================================================
+ * Called from the I/O loops. Without a scheduler both are one branch.
+ */
+
+static inline void sched_charge(proxy_config_t *config, ssize_t n) {
+    if (config->sched != NULL && n > 0) {
+        config->sched->budget -= n;
+    }
+}
+
+/* Should the running loop stop here (and leave the rest for a later turn)? */
+static inline int sched_over_budget(proxy_config_t *config) {
+    sched_t *s = config->sched;
+    if (s == NULL || s->budget > 0) {
+        return 0;
+    }
+    s->preempted = 1;
+    return 1;
+}
+
+#endif /* TRAFFIC_SCHED_H */
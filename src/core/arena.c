@@ -0,0 +1,218 @@
+#include "arena.h"
+#include "hugepage.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#define ARENA_ASAN_POISON(p, n)   ASAN_POISON_MEMORY_REGION((p), (n))
+#define ARENA_ASAN_UNPOISON(p, n) ASAN_UNPOISON_MEMORY_REGION((p), (n))
+#else
+#define ARENA_ASAN_POISON(p, n)   ((void)(p), (void)(n))
+#define ARENA_ASAN_UNPOISON(p, n) ((void)(p), (void)(n))
+#endif
+
+/* The block header is padded so data starts ARENA_ALIGN aligned */
+#define ARENA_BLOCK_HEADER ARENA_ALIGN
+#define ARENA_BLOCK_DATA (ARENA_BLOCK_SIZE - ARENA_BLOCK_HEADER)
+
+/* Slabs start with a link to the next slab, padded to a cache line */
+#define ARENA_SLAB_HEADER 64
+
+#define ARENA_POISON_BYTE 0xA5
+
+/* Poisoning walks the released bytes, so only debug builds pay for it */
+#if defined(DEBUG) || defined(__SANITIZE_ADDRESS__)
+#define ARENA_POISONING 1
+#endif
+
+static char *block_data(arena_block_t *block) {
+    return (char *)block + ARENA_BLOCK_HEADER;
+}
+
+#ifdef ARENA_POISONING
+/* Make released bytes unusable: pattern-fill in debug builds, and tell
+ * ASan nobody may touch them until they are handed out again.
+ */
+static void poison(char *ptr, size_t len) {
+#ifdef DEBUG
+    ARENA_ASAN_UNPOISON(ptr, len);
+    memset(ptr, ARENA_POISON_BYTE, len);
+#endif
+    ARENA_ASAN_POISON(ptr, len);
+}
+#endif
+
+/* ============================================================================
+ * BLOCK POOL
+ * ============================================================================
+ */
+
+void arena_pool_init(arena_pool_t *pool) {
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    pool->total = 0;
+    pool->slabs = NULL;
+}
+
+static int arena_pool_grow(arena_pool_t *pool) {
+    void **slab = hugepage_alloc(ARENA_SLAB_SIZE, NULL);
+    if (slab == NULL) {
+        perror("arena slab mmap");
+        return -1;
+    }
+    
+    *slab = pool->slabs;
+    pool->slabs = slab;
+    
+    /* The first block would overlap the slab header, so blocks start one
+     * header in; the last partial block is lost (a few KB per 2MB).
+     */
+    size_t count = (ARENA_SLAB_SIZE - ARENA_SLAB_HEADER) / ARENA_BLOCK_SIZE;
+    char *base = (char *)slab + ARENA_SLAB_HEADER;
+    for (size_t i = 0; i < count; i++) {
+        arena_block_t *block = (arena_block_t *)(base + i * ARENA_BLOCK_SIZE);
+        block->next = pool->free_list;
+        pool->free_list = block;
+        ARENA_ASAN_POISON(block_data(block), ARENA_BLOCK_DATA);
+    }
+    
+    pool->free_count += count;
+    pool->total += count;
+    return 0;
+}
+
+static arena_block_t *arena_pool_get(arena_pool_t *pool) {
+    if (pool->free_list == NULL && arena_pool_grow(pool) == -1) {
+        return NULL;
+    }
+    arena_block_t *block = pool->free_list;
+    pool->free_list = block->next;
+    pool->free_count--;
+    block->next = NULL;
+    return block;
+}
+
+void arena_pool_destroy(arena_pool_t *pool) {
+    void **slab = pool->slabs;
+    while (slab != NULL) {
+        void **next = *slab;
+        hugepage_free(slab, ARENA_SLAB_SIZE);
+        slab = next;
+    }
+    arena_pool_init(pool);
+}
+
+/* ============================================================================
+ * ARENA
+ * ============================================================================
+ */
+
+void arena_init(arena_t *arena, arena_pool_t *pool) {
+    arena->pool = pool;
+    arena->first = NULL;
+    arena->extra = NULL;
+    arena->extra_tail = NULL;
+    arena->extra_count = 0;
+    arena->ptr = NULL;
+    arena->end = NULL;
+}
+
+/* Slow path: current block is full (or there is none yet) */
+static void *arena_alloc_block(arena_t *arena, size_t size) {
+    if (size > ARENA_BLOCK_DATA) {
+        return NULL;
+    }
+    
+    arena_block_t *block = arena_pool_get(arena->pool);
+    if (block == NULL) {
+        return NULL;
+    }
+    
+    if (arena->first == NULL) {
+        arena->first = block;
+    } else {
+        block->next = arena->extra;
+        arena->extra = block;
+        if (arena->extra_tail == NULL) {
+            arena->extra_tail = block;
+        }
+        arena->extra_count++;
+    }
+    
+    char *ptr = block_data(block);
+    arena->ptr = ptr + size;
+    arena->end = ptr + ARENA_BLOCK_DATA;
+    return ptr;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    
+    char *ptr = arena->ptr;
+    if (ptr == NULL || (size_t)(arena->end - ptr) < size) {
+        ptr = arena_alloc_block(arena, size);
+        if (ptr == NULL) {
+            return NULL;
+        }
+    } else {
+        arena->ptr = ptr + size;
+    }
+    
+    ARENA_ASAN_UNPOISON(ptr, size);
+    return ptr;
+}
+
+char *arena_strndup(arena_t *arena, const char *s, size_t n) {
+    char *copy = arena_alloc(arena, n + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    return copy;
+}
+
+void arena_reset(arena_t *arena) {
+    if (arena->first == NULL) {
+        return;
+    }
+    
+#ifdef ARENA_POISONING
+    for (arena_block_t *b = arena->extra; b != NULL; b = b->next) {
+        poison(block_data(b), ARENA_BLOCK_DATA);
+    }
+    poison(block_data(arena->first), ARENA_BLOCK_DATA);
+#endif
+    
+    /* Splice the extra blocks back onto the free list in one go */
+    if (arena->extra != NULL) {
+        arena_pool_t *pool = arena->pool;
+        arena->extra_tail->next = pool->free_list;
+        pool->free_list = arena->extra;
+        pool->free_count += arena->extra_count;
+        arena->extra = NULL;
+        arena->extra_tail = NULL;
+        arena->extra_count = 0;
+    }
+    
+    arena->ptr = block_data(arena->first);
+    arena->end = arena->ptr + ARENA_BLOCK_DATA;
+}
+
+void arena_release(arena_t *arena) {
+    if (arena->first == NULL) {
+        return;
+    }
+    
+    arena_reset(arena);
+    
+    arena_pool_t *pool = arena->pool;
+    arena->first->next = pool->free_list;
+    pool->free_list = arena->first;
+    pool->free_count++;
+    
+    arena->first = NULL;
+    arena->ptr = NULL;
+    arena->end = NULL;
+}
@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+#include "capture.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static size_t align_up(size_t n) {
+    return (n + CAPTURE_ALIGN - 1) & ~(size_t)(CAPTURE_ALIGN - 1);
+}
+
+/* ============================================================================
+ * WRITER
+ * ============================================================================
+ */
+
+capture_t *capture_open(const char *path, uint32_t sample_rate, size_t max_bytes) {
+    if (max_bytes < sizeof(capture_header_t)) {
+        fprintf(stderr, "capture: size limit too small\n");
+        return NULL;
+    }
+
+    capture_t *cap = calloc(1, sizeof(capture_t));
+    if (cap == NULL) {
+        perror("capture");
+        return NULL;
+    }
+
+    cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (cap->fd == -1) {
+        perror("capture open");
+        free(cap);
+        return NULL;
+    }
+
+    /* Reserve the whole limit now: a store into a sparse MAP_SHARED page
+     * the disk can't back raises SIGBUS, and a full disk must not kill the
+     * proxy halfway through a capture.
+     */
+    int err = posix_fallocate(cap->fd, 0, (off_t)max_bytes);
+    if (err != 0) {
+        fprintf(stderr, "capture: cannot reserve %zu bytes: %s\n", max_bytes, strerror(err));
+        close(cap->fd);
+        unlink(path);
+        free(cap);
+        return NULL;
+    }
+
+    cap->header = mmap(NULL, max_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, 0);
+    if (cap->header == MAP_FAILED) {
+        perror("capture mmap");
+        close(cap->fd);
+        free(cap);
+        return NULL;
+    }
+
+    cap->limit = max_bytes;
+    cap->sample_rate = sample_rate > 0 ? sample_rate : 1;
+    cap->start_ns = clock_ns(CLOCK_MONOTONIC);
+
+    capture_header_t *h = cap->header;
+    h->version = CAPTURE_VERSION;
+    h->start_unix_ns = clock_ns(CLOCK_REALTIME);
+    h->end = sizeof(capture_header_t);
+    h->sample_rate = cap->sample_rate;
+    h->magic = CAPTURE_MAGIC;
+    return cap;
+}
+
+void capture_close(capture_t *cap) {
+    if (cap == NULL) {
+        return;
+    }
+
+    size_t end = (size_t)cap->header->end;
+    munmap(cap->header, cap->limit);
+    if (ftruncate(cap->fd, (off_t)end) == -1) {
+        perror("capture ftruncate");
+    }
+    close(cap->fd);
+    free(cap);
+}
+
+uint32_t capture_connection(capture_t *cap) {
+    if (cap->accepted++ % cap->sample_rate != 0) {
+        return 0;
+    }
+    return ++cap->header->connections;
+}
+
+void capture_request(capture_t *cap, uint32_t conn_id, const void *data, size_t len) {
+    capture_header_t *h = cap->header;
+    size_t need = sizeof(capture_record_t) + align_up(len);
+
+    if (len > UINT32_MAX || need > cap->limit - h->end) {
+        cap->dropped++;
+        return;
+    }
+
+    capture_record_t *rec = (capture_record_t *)((char *)h + h->end);
+    rec->time_us = (clock_ns(CLOCK_MONOTONIC) - cap->start_ns) / 1000;
+    rec->conn_id = conn_id;
+    rec->length = (uint32_t)len;
+    memcpy(rec + 1, data, len);
+
+    /* Record first, then the header that makes it visible */
+    h->end += need;
+    h->records++;
+}
+
+/* ============================================================================
+ * READER
+ * ============================================================================
+ */
+
+const capture_header_t *capture_map(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(capture_header_t)) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    capture_header_t *h = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+        perror("capture mmap");
+        return NULL;
+    }
+
+    if (h->magic != CAPTURE_MAGIC || h->version != CAPTURE_VERSION ||
+        h->end > (uint64_t)st.st_size) {
+        fprintf(stderr, "%s: not a capture file (or a different version)\n", path);
+        munmap(h, (size_t)st.st_size);
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+    return h;
+}
+
+void capture_unmap(const capture_header_t *header, size_t size) {
+    munmap((void *)(uintptr_t)header, size);
+}
+
+const capture_record_t *capture_next(const capture_header_t *header,
+                                     const capture_record_t *rec) {
+    const char *base = (const char *)header;
+    size_t off = rec == NULL
+        ? sizeof(capture_header_t)
+        : (size_t)((const char *)rec - base) + sizeof(capture_record_t) + align_up(rec->length);
+
+    if (off + sizeof(capture_record_t) > header->end) {
+        return NULL;
+    }
+    const capture_record_t *next = (const capture_record_t *)(base + off);
+    if (off + sizeof(capture_record_t) + next->length > header->end) {
+        return NULL;
+    }
+    return next;
+}
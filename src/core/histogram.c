@@ -0,0 +1,106 @@
+#include "histogram.h"
+#include <string.h>
+
+/* ============================================================================
+ * BUCKET MATH
+ * ============================================================================
+ * Values below HISTOGRAM_SUB_BUCKETS get a bucket each. Above that, the
+ * bucket is picked by the position of the top bit (which power of two)
+ * and the next HISTOGRAM_SUB_BITS bits (where inside it).
+ */
+
+static size_t bucket_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (size_t)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    size_t sub = (size_t)(value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (size_t)(shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/* Largest value that lands in bucket idx */
+static uint64_t bucket_upper(size_t idx) {
+    if (idx < HISTOGRAM_SUB_BUCKETS) {
+        return idx;
+    }
+    int shift = (int)(idx / HISTOGRAM_SUB_BUCKETS) - 1;
+    uint64_t sub = idx % HISTOGRAM_SUB_BUCKETS;
+    uint64_t lower = (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return lower + ((1ULL << shift) - 1);
+}
+
+/* ============================================================================
+ * HISTOGRAM
+ * ============================================================================
+ */
+
+void histogram_init(histogram_t *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void histogram_record_n(histogram_t *h, uint64_t value, uint64_t n) {
+    if (n == 0) {
+        return;
+    }
+    h->buckets[bucket_index(value)] += n;
+    h->count += n;
+    h->sum += value * n;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+void histogram_record(histogram_t *h, uint64_t value) {
+    histogram_record_n(h, value, 1);
+}
+
+void histogram_merge(histogram_t *dst, const histogram_t *src) {
+    if (src->count == 0) {
+        return;
+    }
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+uint64_t histogram_percentile(const histogram_t *h, double p) {
+    if (h->count == 0) {
+        return 0;
+    }
+    
+    /* Rank of the sample we want, 1-based */
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)h->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > h->count) {
+        rank = h->count;
+    }
+    
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+double histogram_mean(const histogram_t *h) {
+    return h->count ? (double)h->sum / (double)h->count : 0.0;
+}
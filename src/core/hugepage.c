@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "hugepage.h"
+#include <sys/mman.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* ============================================================================
+ * ALLOCATION POLICY
+ * ============================================================================
+ */
+
+static int hugepages_enabled = 1;
+static int hugepages_prefault = 0;
+
+void hugepage_configure(int enabled, int prefault) {
+    hugepages_enabled = enabled;
+    hugepages_prefault = prefault;
+}
+
+/* Round up to a whole number of huge pages.
+ * Both the hugetlb and THP paths work in 2MB units, and hugepage_free()
+ * relies on the same rounding to munmap the exact range.
+ */
+static size_t round_to_hugepage(size_t size) {
+    return (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+}
+
+/* Touch one byte per 4K page so the kernel populates the mapping now.
+ * For THP regions the first touch inside each 2MB extent is what
+ * allocates the huge page, so this also forces huge pages in early.
+ */
+static void prefault(void *ptr, size_t size) {
+    volatile char *p = ptr;
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0) {
+        page = 4096;
+    }
+    for (size_t off = 0; off < size; off += (size_t)page) {
+        p[off] = 0;
+    }
+}
+
+/* ============================================================================
+ * ALLOCATION
+ * ============================================================================
+ */
+
+void *hugepage_alloc(size_t size, hugepage_backing_t *backing) {
+    size_t len = round_to_hugepage(size);
+    void *ptr;
+
+    if (backing) {
+        *backing = HUGEPAGE_BACKING_NONE;
+    }
+
+    if (!hugepages_enabled) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (hugepages_prefault) {
+            flags |= MAP_POPULATE;
+        }
+        ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        return ptr == MAP_FAILED ? NULL : ptr;
+    }
+
+#ifdef MAP_HUGETLB
+    /* 1. Explicit hugetlbfs pages. Fails with ENOMEM unless the admin has
+     * reserved pages (vm.nr_hugepages), which is the common case - so we
+     * don't print anything on failure.
+     */
+    {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+        if (hugepages_prefault) {
+            flags |= MAP_POPULATE;
+        }
+        ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr != MAP_FAILED) {
+            if (backing) {
+                *backing = HUGEPAGE_BACKING_HUGETLB;
+            }
+            return ptr;
+        }
+    }
+#endif
+
+    /* 2. Transparent huge pages. THP only backs 2MB-aligned extents, and
+     * mmap() only guarantees 4K alignment, so over-allocate by one huge
+     * page and trim the unaligned head and tail.
+     */
+    char *raw = mmap(NULL, len + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    uintptr_t aligned = ((uintptr_t)raw + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+    size_t head = aligned - (uintptr_t)raw;
+    size_t tail = HUGEPAGE_SIZE - head;
+    if (head > 0) {
+        munmap(raw, head);
+    }
+    if (tail > 0) {
+        munmap((char *)aligned + len, tail);
+    }
+    ptr = (void *)aligned;
+
+#ifdef MADV_HUGEPAGE
+    /* 3. If the kernel was built without THP (or it's disabled outright)
+     * madvise fails and we simply keep the 4K mapping.
+     */
+    if (madvise(ptr, len, MADV_HUGEPAGE) == 0 && backing) {
+        *backing = HUGEPAGE_BACKING_THP;
+    }
+#endif
+
+    if (hugepages_prefault) {
+        prefault(ptr, len);
+    }
+
+    return ptr;
+}
+
+void hugepage_free(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    munmap(ptr, round_to_hugepage(size));
+}
+
+const char *hugepage_backing_name(hugepage_backing_t backing) {
+    switch (backing) {
+        case HUGEPAGE_BACKING_HUGETLB: return "hugetlb (2MB)";
+        case HUGEPAGE_BACKING_THP:     return "transparent huge pages";
+        default:                       return "4K pages";
+    }
+}
@@ -1,9 +1,21 @@
 #include "proxy.h"
 #include "config.h"
+#include "hugepage.h"
+#include "scoreboard.h"
+#include "profiler.h"
+#include "capture.h"
+#include "static_files.h"
+#include "disk_cache.h"
+#include "mirror.h"
+#include "traffic_sched.h"
+#include "shaper.h"
+#include "spool.h"
+#include "direct.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <unistd.h>
 
 /* ============================================================================
  * USAGE AND HELP
@@ -21,6 +33,50 @@ static void print_usage(const char *program_name) {
     printf("  -b, --backend ADDR   Backend address (default: 127.0.0.1)\n");
     printf("  -P, --backend-port PORT  Backend port (default: 8081)\n");
     printf("  -m, --mode MODE      Proxy mode: tcp or http (default: http)\n");
+    printf("  -H, --no-hugepages   Back the connection table with 4K pages only\n");
+    printf("  -F, --prefault       Pre-fault all arenas at startup\n");
+    printf("  -S, --scoreboard PATH  Publish live stats for epoll-proxy-top\n");
+    printf("                       (e.g. /dev/shm/epoll-proxy)\n");
+    printf("  -T, --no-tcp-info    Don't sample TCP_INFO (RTT, cwnd, retransmits)\n");
+    printf("  -R, --profile FILE   Sample stacks at %d Hz; write folded stacks to\n", PROFILER_HZ);
+    printf("                       FILE on SIGUSR1 and at exit\n");
+    printf("  -C, --capture FILE   Record client requests for epoll-proxy-replay (HTTP)\n");
+    printf("  -c, --capture-rate N Capture 1 in N connections (default: 1)\n");
+    printf("  -M, --capture-max MB Capture file size limit (default: %d)\n",
+           CAPTURE_DEFAULT_MAX_MB);
+    printf("  -s, --static PREFIX=DIR  Serve URL paths under PREFIX from files in DIR\n");
+    printf("                       with sendfile() (HTTP; repeat for up to %d routes)\n",
+           STATIC_MAX_ROUTES);
+    printf("  -d, --direct PATH=RESPONSE  Answer PATH from the proxy: STATUS:BODY,\n");
+    printf("                       30x:URL (a trailing * appends the rest of the path)\n");
+    printf("                       or health (HTTP; repeat for up to %d routes)\n",
+           DIRECT_MAX_ROUTES);
+    printf("  -D, --disk-cache DIR Cache upstream responses in slab files in DIR (HTTP)\n");
+    printf("  -Z, --disk-cache-size MB  Disk space for the cache (default: %d)\n",
+           DISK_CACHE_DEFAULT_MB);
+    printf("  -x, --mirror PREFIX=ADDR:PORT  Also send requests under PREFIX to a shadow\n");
+    printf("                       upstream, discarding its responses (HTTP; repeat\n");
+    printf("                       for up to %d routes)\n", MIRROR_MAX_ROUTES);
+    printf("  -X, --mirror-slots N Shadow requests in flight before copies are\n");
+    printf("                       dropped (default: %d)\n", MIRROR_DEFAULT_SLOTS);
+    printf("  -Q, --class NAME:WEIGHT[:interactive]=PREFIX,...  Share bandwidth\n");
+    printf("                       between request classes by weight; interactive\n");
+    printf("                       classes go first (HTTP; repeat for up to %d)\n",
+           SCHED_MAX_CLASSES - 1);
+    printf("  -w, --rate RATE      Cap what is sent to each connection, in bytes/s\n");
+    printf("                       with an optional K, M or G suffix\n");
+    printf("  -W, --route-rate PREFIX=RATE  Cap responses to requests under PREFIX,\n");
+    printf("                       all together (HTTP; repeat for up to %d routes)\n",
+           SHAPER_MAX_ROUTES);
+    printf("  -r, --min-rate RATE  Close clients sending a request or reading a\n");
+    printf("                       response slower than RATE bytes/s over %ds (HTTP)\n",
+           MIN_RATE_WINDOW_MS / 1000);
+    printf("  -o, --buffer-responses KB  Let upstreams finish ahead of slow clients:\n");
+    printf("                       keep up to KB per response in memory (e.g. %d),\n",
+           SPOOL_DEFAULT_KB);
+    printf("                       the rest in a temp file under $TMPDIR (HTTP)\n");
+    printf("  -O, --buffer-requests KB  Collect request bodies too big for a buffer\n");
+    printf("                       before contacting the backend, KB in memory (HTTP)\n");
     printf("  -h, --help           Show this help message\n");
     printf("\n");
     printf("Modes:\n");
@@ -34,6 +90,15 @@ static void print_usage(const char *program_name) {
     printf("  # TCP proxy (for non-HTTP protocols)\n");
     printf("  %s -m tcp -p 3306 -P 3307\n", program_name);
     printf("\n");
+    printf("  # Static assets from disk, everything else to the backend\n");
+    printf("  %s -s /assets/=/var/www/assets\n", program_name);
+    printf("\n");
+    printf("  # Cache backend responses on local disk\n");
+    printf("  %s -D /var/cache/epoll-proxy -Z 4096\n", program_name);
+    printf("\n");
+    printf("  # Try a new backend version on a copy of the API traffic\n");
+    printf("  %s -x /api/=10.0.0.7:8081\n", program_name);
+    printf("\n");
     printf("Performance:\n");
     printf("  - Supports up to %d concurrent connections\n", MAX_CONNECTIONS);
     printf("  - Edge-triggered epoll for maximum efficiency\n");
@@ -53,6 +118,31 @@ typedef struct {
     const char *backend_addr;
     uint16_t backend_port;
     const char *mode;
+    int hugepages;
+    int prefault;
+    const char *scoreboard;
+    int tcp_info;
+    const char *profile;
+    const char *capture;
+    uint32_t capture_rate;
+    size_t capture_max_mb;
+    char *static_routes[STATIC_MAX_ROUTES];
+    int static_count;
+    char *direct_routes[DIRECT_MAX_ROUTES];
+    int direct_count;
+    const char *disk_cache;
+    size_t disk_cache_mb;
+    char *mirror_routes[MIRROR_MAX_ROUTES];
+    int mirror_count;
+    uint32_t mirror_slots;
+    char *classes[SCHED_MAX_CLASSES];
+    int class_count;
+    uint64_t conn_rate;
+    char *rate_routes[SHAPER_MAX_ROUTES];
+    int rate_route_count;
+    uint64_t min_rate;
+    size_t buffer_kb;
+    size_t body_buffer_kb;
 } args_t;
 
 static int parse_args(int argc, char **argv, args_t *args) {
@@ -61,6 +151,26 @@ static int parse_args(int argc, char **argv, args_t *args) {
     args->backend_addr = "127.0.0.1";
     args->backend_port = 8081;
     args->mode = "http";  /* Default to HTTP mode */
+    args->hugepages = 1;
+    args->prefault = 0;
+    args->scoreboard = NULL;
+    args->tcp_info = 1;
+    args->profile = NULL;
+    args->capture = NULL;
+    args->capture_rate = 1;
+    args->capture_max_mb = CAPTURE_DEFAULT_MAX_MB;
+    args->static_count = 0;
+    args->direct_count = 0;
+    args->disk_cache = NULL;
+    args->disk_cache_mb = DISK_CACHE_DEFAULT_MB;
+    args->mirror_count = 0;
+    args->mirror_slots = MIRROR_DEFAULT_SLOTS;
+    args->class_count = 0;
+    args->conn_rate = 0;
+    args->rate_route_count = 0;
+    args->min_rate = 0;
+    args->buffer_kb = 0;
+    args->body_buffer_kb = 0;
     
     static struct option long_options[] = {
         {"listen",       required_argument, 0, 'l'},
@@ -68,6 +178,26 @@ static int parse_args(int argc, char **argv, args_t *args) {
         {"backend",      required_argument, 0, 'b'},
         {"backend-port", required_argument, 0, 'P'},
         {"mode",         required_argument, 0, 'm'},
+        {"no-hugepages", no_argument,       0, 'H'},
+        {"prefault",     no_argument,       0, 'F'},
+        {"scoreboard",   required_argument, 0, 'S'},
+        {"no-tcp-info",  no_argument,       0, 'T'},
+        {"profile",      required_argument, 0, 'R'},
+        {"capture",      required_argument, 0, 'C'},
+        {"capture-rate", required_argument, 0, 'c'},
+        {"capture-max",  required_argument, 0, 'M'},
+        {"static",       required_argument, 0, 's'},
+        {"direct",       required_argument, 0, 'd'},
+        {"disk-cache",   required_argument, 0, 'D'},
+        {"disk-cache-size", required_argument, 0, 'Z'},
+        {"mirror",       required_argument, 0, 'x'},
+        {"mirror-slots", required_argument, 0, 'X'},
+        {"class",        required_argument, 0, 'Q'},
+        {"rate",         required_argument, 0, 'w'},
+        {"route-rate",   required_argument, 0, 'W'},
+        {"min-rate",     required_argument, 0, 'r'},
+        {"buffer-responses", required_argument, 0, 'o'},
+        {"buffer-requests", required_argument, 0, 'O'},
         {"help",         no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
@@ -75,7 +205,7 @@ static int parse_args(int argc, char **argv, args_t *args) {
     int opt;
     int option_index = 0;
     
-    while ((opt = getopt_long(argc, argv, "l:p:b:P:m:h", 
+    while ((opt = getopt_long(argc, argv, "l:p:b:P:m:HFS:TR:C:c:M:s:d:D:Z:x:X:Q:w:W:r:o:O:h", 
                              long_options, &option_index)) != -1) {
         switch (opt) {
             case 'l':
@@ -120,6 +250,123 @@ static int parse_args(int argc, char **argv, args_t *args) {
                 args->mode = optarg;
                 break;
             
+            case 'H':
+                args->hugepages = 0;
+                break;
+            
+            case 'F':
+                args->prefault = 1;
+                break;
+            
+            case 'S':
+                args->scoreboard = optarg;
+                break;
+            
+            case 'T':
+                args->tcp_info = 0;
+                break;
+            
+            case 'R':
+                args->profile = optarg;
+                break;
+            
+            case 'C':
+                args->capture = optarg;
+                break;
+            
+            case 'c':
+            case 'M':
+            case 'Z':
+            case 'X':
+            case 'o':
+            case 'O': {
+                char *endptr;
+                long n = strtol(optarg, &endptr, 10);
+                
+                if (*endptr != '\0' || n <= 0 || n > UINT32_MAX) {
+                    fprintf(stderr, "Invalid %s: %s\n",
+                            opt == 'c' ? "capture rate" :
+                            opt == 'M' ? "capture size" :
+                            opt == 'Z' ? "disk cache size" :
+                            opt == 'X' ? "mirror slot count" :
+                            opt == 'o' ? "response buffer size" : "request buffer size", optarg);
+                    return -1;
+                }
+                
+                if (opt == 'c') {
+                    args->capture_rate = (uint32_t)n;
+                } else if (opt == 'M') {
+                    args->capture_max_mb = (size_t)n;
+                } else if (opt == 'Z') {
+                    args->disk_cache_mb = (size_t)n;
+                } else if (opt == 'X') {
+                    args->mirror_slots = (uint32_t)n;
+                } else if (opt == 'o') {
+                    args->buffer_kb = (size_t)n;
+                } else {
+                    args->body_buffer_kb = (size_t)n;
+                }
+                break;
+            }
+            
+            case 's':
+                if (args->static_count == STATIC_MAX_ROUTES) {
+                    fprintf(stderr, "Too many static routes (at most %d)\n",
+                            STATIC_MAX_ROUTES);
+                    return -1;
+                }
+                args->static_routes[args->static_count++] = optarg;
+                break;
+            
+            case 'd':
+                if (args->direct_count == DIRECT_MAX_ROUTES) {
+                    fprintf(stderr, "Too many direct routes (at most %d)\n",
+                            DIRECT_MAX_ROUTES);
+                    return -1;
+                }
+                args->direct_routes[args->direct_count++] = optarg;
+                break;
+            
+            case 'D':
+                args->disk_cache = optarg;
+                break;
+            
+            case 'x':
+                if (args->mirror_count == MIRROR_MAX_ROUTES) {
+                    fprintf(stderr, "Too many mirror routes (at most %d)\n",
+                            MIRROR_MAX_ROUTES);
+                    return -1;
+                }
+                args->mirror_routes[args->mirror_count++] = optarg;
+                break;
+            
+            case 'Q':
+                if (args->class_count == SCHED_MAX_CLASSES - 1) {
+                    fprintf(stderr, "Too many traffic classes (at most %d)\n",
+                            SCHED_MAX_CLASSES - 1);
+                    return -1;
+                }
+                args->classes[args->class_count++] = optarg;
+                break;
+            
+            case 'w':
+            case 'r':
+                if (shaper_parse_rate(optarg, opt == 'w' ? &args->conn_rate
+                                                         : &args->min_rate) == -1) {
+                    fprintf(stderr, "Invalid rate: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            
+            case 'W':
+                if (args->rate_route_count == SHAPER_MAX_ROUTES) {
+                    fprintf(stderr, "Too many shaped routes (at most %d)\n",
+                            SHAPER_MAX_ROUTES);
+                    return -1;
+                }
+                args->rate_routes[args->rate_route_count++] = optarg;
+                break;
+            
             case 'h':
                 print_usage(argv[0]);
                 exit(0);
@@ -172,14 +419,9 @@ static int validate_config(const args_t *args) {
 int main(int argc, char **argv) {
     args_t args;
     proxy_config_t *config;
+    hugepage_backing_t backing;
     int ret;
     
-    config = calloc(1, sizeof(proxy_config_t));
-    if (config == NULL) {
-        fprintf(stderr, "Failed to allocate memory for proxy config\n");
-        return EXIT_FAILURE;
-    }
-    
     printf("╔════════════════════════════════════════╗\n");
     printf("║   High-Performance Epoll Proxy        ║\n");
     printf("║   Edge-Triggered | Non-Blocking I/O   ║\n");
@@ -187,12 +429,21 @@ int main(int argc, char **argv) {
     printf("\n");
     
     if (parse_args(argc, argv, &args) == -1) {
-        free(config);
         return EXIT_FAILURE;
     }
     
     if (validate_config(&args) == -1) {
-        free(config);
+        return EXIT_FAILURE;
+    }
+    
+    /* The config embeds the connection table, which is by far the largest
+     * arena we have. Back it with huge pages to keep dTLB misses down when
+     * events hop between thousands of connections.
+     */
+    hugepage_configure(args.hugepages, args.prefault);
+    config = hugepage_alloc(sizeof(proxy_config_t), &backing);
+    if (config == NULL) {
+        fprintf(stderr, "Failed to allocate memory for proxy config\n");
         return EXIT_FAILURE;
     }
     
@@ -202,6 +453,9 @@ int main(int argc, char **argv) {
     printf("  Backend: %s:%d\n", args.backend_addr, args.backend_port);
     printf("  Max connections: %d\n", MAX_CONNECTIONS);
     printf("  Buffer size: %d bytes\n", BUFFER_SIZE);
+    printf("  Connection table: %zu MB, %s%s\n",
+           sizeof(proxy_config_t) >> 20, hugepage_backing_name(backing),
+           args.prefault ? ", pre-faulted" : "");
     printf("\n");
     
     /* Initialize based on mode */
@@ -217,14 +471,238 @@ int main(int argc, char **argv) {
     
     if (ret == -1) {
         fprintf(stderr, "Failed to initialize proxy\n");
-        free(config);
+        hugepage_free(config, sizeof(proxy_config_t));
         return EXIT_FAILURE;
     }
     
+    config->tcpinfo.enabled = args.tcp_info;
+    
+    /* Only HTTP mode knows where a request ends */
+    if (args.capture != NULL) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Capture needs HTTP mode, ignoring -C\n");
+        } else {
+            config->capture = capture_open(args.capture, args.capture_rate,
+                                           args.capture_max_mb << 20);
+            if (config->capture != NULL) {
+                printf("Capturing 1 in %u connections to %s (up to %zu MB)\n",
+                       args.capture_rate, args.capture, args.capture_max_mb);
+            }
+        }
+    }
+    
+    /* Direct routes: answered from memory, never proxied */
+    if (args.direct_count > 0) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Direct routes need HTTP mode, ignoring -d\n");
+        } else {
+            config->direct = direct_create();
+            if (config->direct == NULL) {
+                proxy_cleanup(config);
+                hugepage_free(config, sizeof(proxy_config_t));
+                return EXIT_FAILURE;
+            }
+            for (int i = 0; i < args.direct_count; i++) {
+                if (direct_add_route(config->direct, args.direct_routes[i]) == -1) {
+                    proxy_cleanup(config);
+                    hugepage_free(config, sizeof(proxy_config_t));
+                    return EXIT_FAILURE;
+                }
+                printf("Direct: %s\n", config->direct->routes[i].prefix);
+            }
+        }
+    }
+    
+    /* Static routes: answered from disk, never proxied */
+    if (args.static_count > 0) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Static routes need HTTP mode, ignoring -s\n");
+        } else {
+            config->static_files = static_files_create();
+            if (config->static_files == NULL) {
+                proxy_cleanup(config);
+                hugepage_free(config, sizeof(proxy_config_t));
+                return EXIT_FAILURE;
+            }
+            for (int i = 0; i < args.static_count; i++) {
+                if (static_files_add_route(config->static_files, args.static_routes[i]) == -1) {
+                    proxy_cleanup(config);
+                    hugepage_free(config, sizeof(proxy_config_t));
+                    return EXIT_FAILURE;
+                }
+                printf("Static: %s -> %s\n", config->static_files->routes[i].prefix,
+                       config->static_files->routes[i].root);
+            }
+        }
+    }
+    
+    /* Response cache on local disk */
+    if (args.disk_cache != NULL) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Disk cache needs HTTP mode, ignoring -D\n");
+        } else {
+            config->disk_cache = disk_cache_create(config, args.disk_cache, args.disk_cache_mb);
+            if (config->disk_cache == NULL) {
+                proxy_cleanup(config);
+                hugepage_free(config, sizeof(proxy_config_t));
+                return EXIT_FAILURE;
+            }
+            printf("Disk cache: %s (%zu MB, responses up to %zu KB)\n", args.disk_cache,
+                   args.disk_cache_mb, config->disk_cache->max_len / 1024);
+        }
+    }
+    
+    /* Shadow upstreams get a copy of some routes' requests */
+    if (args.mirror_count > 0) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Mirroring needs HTTP mode, ignoring -x\n");
+        } else {
+            config->mirror = mirror_create(args.mirror_slots);
+            if (config->mirror == NULL) {
+                proxy_cleanup(config);
+                hugepage_free(config, sizeof(proxy_config_t));
+                return EXIT_FAILURE;
+            }
+            for (int i = 0; i < args.mirror_count; i++) {
+                if (mirror_add_route(config->mirror, args.mirror_routes[i]) == -1) {
+                    proxy_cleanup(config);
+                    hugepage_free(config, sizeof(proxy_config_t));
+                    return EXIT_FAILURE;
+                }
+                printf("Mirror: %s -> %s:%u\n", config->mirror->routes[i].prefix,
+                       config->mirror->routes[i].addr, config->mirror->routes[i].port);
+            }
+            printf("Mirror: at most %u shadow requests in flight\n", args.mirror_slots);
+        }
+    }
+    
+    /* Weighted fair sharing between request classes */
+    if (args.class_count > 0) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Traffic classes need HTTP mode, ignoring -Q\n");
+        } else {
+            config->sched = sched_create();
+            if (config->sched == NULL) {
+                proxy_cleanup(config);
+                hugepage_free(config, sizeof(proxy_config_t));
+                return EXIT_FAILURE;
+            }
+            for (int i = 0; i < args.class_count; i++) {
+                if (sched_add_class(config->sched, args.classes[i]) == -1) {
+                    proxy_cleanup(config);
+                    hugepage_free(config, sizeof(proxy_config_t));
+                    return EXIT_FAILURE;
+                }
+                const sched_class_t *c = &config->sched->classes[i + 1];
+                printf("Class: %s, weight %u%s, %d prefixes\n", c->name, c->weight,
+                       c->interactive ? ", interactive" : "", c->prefix_count);
+            }
+        }
+    }
+    
+    /* Slow clients get closed rather than holding a slot forever */
+    if (args.min_rate > 0) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Minimum rate needs HTTP mode, ignoring -r\n");
+        } else {
+            config->min_rate = args.min_rate;
+            printf("Minimum rate: %lu bytes/s per client, over %ds\n",
+                   (unsigned long)args.min_rate, MIN_RATE_WINDOW_MS / 1000);
+        }
+    }
+    
+    /* Upstreams finish at backend speed, slow clients drain the spool */
+    const char *spool_dir = getenv("TMPDIR");
+    if (spool_dir == NULL || spool_dir[0] == '\0') {
+        spool_dir = "/tmp";
+    }
+    if (args.buffer_kb > 0) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Response buffering needs HTTP mode, ignoring -o\n");
+        } else {
+            config->spooler = spooler_create(&config->buffers, args.buffer_kb, spool_dir);
+            if (config->spooler == NULL) {
+                proxy_cleanup(config);
+                hugepage_free(config, sizeof(proxy_config_t));
+                return EXIT_FAILURE;
+            }
+            printf("Response buffering: %d KB per response in memory, then %s\n",
+                   config->spooler->chunk_limit * BUFFER_SIZE / 1024,
+                   config->spooler->dir);
+        }
+    }
+    
+    /* Slow uploads arrive in full before an upstream is leased */
+    if (args.body_buffer_kb > 0) {
+        if (config->mode != PROXY_MODE_HTTP) {
+            fprintf(stderr, "Request buffering needs HTTP mode, ignoring -O\n");
+        } else {
+            config->body_spooler = spooler_create(&config->buffers, args.body_buffer_kb,
+                                                  spool_dir);
+            if (config->body_spooler == NULL) {
+                proxy_cleanup(config);
+                hugepage_free(config, sizeof(proxy_config_t));
+                return EXIT_FAILURE;
+            }
+            printf("Request buffering: %d KB per body in memory, then %s\n",
+                   config->body_spooler->chunk_limit * BUFFER_SIZE / 1024,
+                   config->body_spooler->dir);
+        }
+    }
+    
+    /* Bandwidth caps per connection and per route */
+    if (args.rate_route_count > 0 && config->mode != PROXY_MODE_HTTP) {
+        fprintf(stderr, "Shaped routes need HTTP mode, ignoring -W\n");
+        args.rate_route_count = 0;
+    }
+    if (args.conn_rate > 0 || args.rate_route_count > 0) {
+        config->shaper = shaper_create(args.conn_rate);
+        if (config->shaper == NULL) {
+            proxy_cleanup(config);
+            hugepage_free(config, sizeof(proxy_config_t));
+            return EXIT_FAILURE;
+        }
+        if (args.conn_rate > 0) {
+            printf("Rate limit: %.2f MB/s per connection\n",
+                   (double)args.conn_rate / (1024 * 1024));
+        }
+        for (int i = 0; i < args.rate_route_count; i++) {
+            if (shaper_add_route(config->shaper, args.rate_routes[i]) == -1) {
+                proxy_cleanup(config);
+                hugepage_free(config, sizeof(proxy_config_t));
+                return EXIT_FAILURE;
+            }
+            printf("Rate limit: %.2f MB/s for %s\n",
+                   (double)config->shaper->routes[i].rate / (1024 * 1024),
+                   config->shaper->routes[i].prefix);
+        }
+    }
+    
+    /* Live stats are optional: without them the proxy runs as before */
+    if (args.scoreboard != NULL) {
+        config->scoreboard = scoreboard_create(args.scoreboard);
+        config->scoreboard_path = args.scoreboard;
+        if (config->scoreboard != NULL) {
+            printf("Scoreboard: %s (watch with epoll-proxy-top %s)\n",
+                   args.scoreboard, args.scoreboard);
+        }
+    }
+    
+    /* In-process profiler: flamegraph.pl FILE > profile.svg */
+    if (args.profile != NULL && profiler_start(args.profile) == 0) {
+        printf("Profiling: kill -USR1 %d writes %s\n", (int)getpid(), args.profile);
+    }
+    
     ret = proxy_run(config);
     
+    if (args.profile != NULL) {
+        profiler_request_dump();
+        profiler_poll();
+        profiler_stop();
+    }
+    
     proxy_cleanup(config);
-    free(config);
+    hugepage_free(config, sizeof(proxy_config_t));
     
     if (ret == -1) {
         fprintf(stderr, "Proxy terminated with error\n");
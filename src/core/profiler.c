@@ -0,0 +1,408 @@
+#define _GNU_SOURCE
+#include "profiler.h"
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+typedef struct {
+    uint32_t depth;
+    uintptr_t pcs[PROFILER_MAX_DEPTH];  /* pcs[0] is the interrupted leaf */
+} profiler_sample_t;
+
+/* Everything the signal handler touches is static: a handler can't be
+ * handed a pointer. It's only ever touched when profiling is enabled.
+ */
+static struct {
+    profiler_sample_t samples[PROFILER_RING_SIZE];
+    volatile uint64_t head;     /* Samples taken; written by the handler only */
+    uint64_t tail;              /* First sample not dumped yet */
+    uintptr_t stack_lo;         /* Bounds for the frame-pointer walk */
+    uintptr_t stack_hi;
+    const char *path;
+    volatile sig_atomic_t dump_requested;
+    int running;
+} prof;
+
+/* ============================================================================
+ * SAMPLING (signal context)
+ * ============================================================================
+ */
+
+static void on_sigprof(int signum, siginfo_t *info, void *context) {
+    (void)signum;
+    (void)info;
+    const ucontext_t *uc = context;
+    uintptr_t pc, fp;
+
+#if defined(__x86_64__)
+    pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+    fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    pc = (uintptr_t)uc->uc_mcontext.pc;
+    fp = (uintptr_t)uc->uc_mcontext.regs[29];
+#else
+    (void)uc;
+    return;  /* No unwinder for this architecture */
+#endif
+
+    profiler_sample_t *s = &prof.samples[prof.head % PROFILER_RING_SIZE];
+    uint32_t depth = 0;
+    s->pcs[depth++] = pc;
+
+    /* Each frame record is {saved fp, return address}. Anything that isn't
+     * a plausible, strictly-outward pointer into our stack ends the walk:
+     * code built without frame pointers (libc, or the production build)
+     * leaves arbitrary values in the frame register.
+     */
+    while (depth < PROFILER_MAX_DEPTH && (fp & (sizeof(uintptr_t) - 1)) == 0 &&
+           fp >= prof.stack_lo && fp + 2 * sizeof(uintptr_t) <= prof.stack_hi) {
+        const uintptr_t *frame = (const uintptr_t *)fp;
+        uintptr_t next = frame[0];
+        uintptr_t ret = frame[1];
+
+        if (ret == 0) {
+            break;
+        }
+        s->pcs[depth++] = ret - 1;  /* Inside the call, not after it */
+        if (next <= fp) {
+            break;
+        }
+        fp = next;
+    }
+
+    s->depth = depth;
+    prof.head++;
+}
+
+static void on_sigusr1(int signum) {
+    (void)signum;
+    prof.dump_requested = 1;
+}
+
+/* ============================================================================
+ * SYMBOLIZATION
+ * ============================================================================
+ * backtrace_symbols() and dladdr() only see exported symbols, and almost
+ * everything in the proxy is static. So read the full .symtab out of our
+ * own executable; dladdr() covers shared libraries.
+ */
+
+typedef struct {
+    uintptr_t addr;
+    uintptr_t size;
+    const char *name;
+} symbol_t;
+
+typedef struct {
+    void *map;
+    size_t map_len;
+    symbol_t *syms;
+    size_t count;
+} symtab_t;
+
+static int compare_symbols(const void *a, const void *b) {
+    const symbol_t *x = a, *y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int symtab_load(symtab_t *t) {
+    memset(t, 0, sizeof(*t));
+
+    int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return -1;
+    }
+    t->map_len = (size_t)st.st_size;
+    t->map = mmap(NULL, t->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (t->map == MAP_FAILED) {
+        t->map = NULL;
+        return -1;
+    }
+
+    const char *base = t->map;
+    const Elf64_Ehdr *eh = t->map;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf64_Shdr) > t->map_len) {
+        return -1;
+    }
+    const Elf64_Shdr *sh = (const Elf64_Shdr *)(base + eh->e_shoff);
+
+    /* Prefer the full symbol table; a stripped binary only has .dynsym */
+    const Elf64_Shdr *symsec = NULL;
+    for (int pass = 0; pass < 2 && symsec == NULL; pass++) {
+        for (int i = 0; i < eh->e_shnum; i++) {
+            if (sh[i].sh_type == (pass == 0 ? SHT_SYMTAB : SHT_DYNSYM)) {
+                symsec = &sh[i];
+                break;
+            }
+        }
+    }
+    if (symsec == NULL || symsec->sh_link >= eh->e_shnum) {
+        return -1;
+    }
+    const Elf64_Shdr *strsec = &sh[symsec->sh_link];
+    if (symsec->sh_offset + symsec->sh_size > t->map_len ||
+        strsec->sh_offset + strsec->sh_size > t->map_len) {
+        return -1;
+    }
+
+    /* A PIE is linked at 0 and loaded anywhere */
+    uintptr_t bias = 0;
+    Dl_info self;
+    if (eh->e_type == ET_DYN && dladdr((void *)symtab_load, &self) != 0) {
+        bias = (uintptr_t)self.dli_fbase;
+    }
+
+    const Elf64_Sym *sym = (const Elf64_Sym *)(base + symsec->sh_offset);
+    size_t nsyms = symsec->sh_size / sizeof(Elf64_Sym);
+    t->syms = malloc(nsyms * sizeof(symbol_t));
+    if (t->syms == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < nsyms; i++) {
+        if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || sym[i].st_value == 0 ||
+            sym[i].st_shndx == SHN_UNDEF || sym[i].st_name >= strsec->sh_size) {
+            continue;
+        }
+        t->syms[t->count].addr = bias + sym[i].st_value;
+        t->syms[t->count].size = sym[i].st_size;
+        t->syms[t->count].name = base + strsec->sh_offset + sym[i].st_name;
+        t->count++;
+    }
+    qsort(t->syms, t->count, sizeof(symbol_t), compare_symbols);
+    return 0;
+}
+
+static void symtab_free(symtab_t *t) {
+    free(t->syms);
+    if (t->map != NULL) {
+        munmap(t->map, t->map_len);
+    }
+}
+
+static void print_frame(FILE *out, const symtab_t *t, uintptr_t pc) {
+    /* Last symbol starting at or below pc */
+    size_t lo = 0, hi = t->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (t->syms[mid].addr <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0 && pc < t->syms[lo - 1].addr + t->syms[lo - 1].size) {
+        fputs(t->syms[lo - 1].name, out);
+        return;
+    }
+
+    Dl_info info;
+    if (dladdr((void *)pc, &info) != 0) {
+        if (info.dli_sname != NULL) {
+            fputs(info.dli_sname, out);
+            return;
+        }
+        if (info.dli_fname != NULL) {
+            const char *slash = strrchr(info.dli_fname, '/');
+            fprintf(out, "[%s]", slash ? slash + 1 : info.dli_fname);
+            return;
+        }
+    }
+    fprintf(out, "0x%lx", (unsigned long)pc);
+}
+
+/* ============================================================================
+ * DUMP
+ * ============================================================================
+ */
+
+static int compare_samples(const void *a, const void *b) {
+    const profiler_sample_t *x = a, *y = b;
+    if (x->depth != y->depth) {
+        return x->depth < y->depth ? -1 : 1;
+    }
+    return memcmp(x->pcs, y->pcs, x->depth * sizeof(uintptr_t));
+}
+
+static void dump(void) {
+    /* Copy the ring out with SIGPROF held off, so the handler can't
+     * overwrite a slot halfway through the copy.
+     */
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGPROF);
+    sigprocmask(SIG_BLOCK, &block, &old);
+
+    uint64_t head = prof.head;
+    uint64_t taken = head - prof.tail;
+    size_t n = taken < PROFILER_RING_SIZE ? (size_t)taken : PROFILER_RING_SIZE;
+    profiler_sample_t *copy = malloc((n ? n : 1) * sizeof(profiler_sample_t));
+    if (copy != NULL) {
+        for (size_t i = 0; i < n; i++) {
+            copy[i] = prof.samples[(head - n + i) % PROFILER_RING_SIZE];
+        }
+        prof.tail = head;
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    if (copy == NULL) {
+        fprintf(stderr, "Profile dump: out of memory\n");
+        return;
+    }
+    
+    /* Keep the previous dump rather than replace it with nothing */
+    if (n == 0) {
+        printf("Profile: no new samples since the last dump\n");
+        fflush(stdout);
+        free(copy);
+        return;
+    }
+
+    /* Identical stacks end up adjacent and are counted once */
+    qsort(copy, n, sizeof(profiler_sample_t), compare_samples);
+
+    symtab_t symtab;
+    if (symtab_load(&symtab) == -1) {
+        fprintf(stderr, "Profile dump: no symbol table, writing addresses\n");
+    }
+
+    /* Write next to the target and rename, so readers never see half */
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", prof.path);
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL) {
+        perror("profile dump");
+        symtab_free(&symtab);
+        free(copy);
+        return;
+    }
+
+    size_t stacks = 0;
+    for (size_t i = 0; i < n; ) {
+        size_t j = i + 1;
+        while (j < n && compare_samples(&copy[i], &copy[j]) == 0) {
+            j++;
+        }
+
+        /* Folded format is root first */
+        for (uint32_t d = copy[i].depth; d-- > 0; ) {
+            print_frame(out, &symtab, copy[i].pcs[d]);
+            if (d > 0) {
+                fputc(';', out);
+            }
+        }
+        fprintf(out, " %zu\n", j - i);
+        stacks++;
+        i = j;
+    }
+
+    if (fclose(out) != 0 || rename(tmp, prof.path) == -1) {
+        perror("profile dump");
+        unlink(tmp);
+    } else {
+        printf("Profile: %zu samples, %zu unique stacks, %lu overwritten -> %s\n",
+               n, stacks, (unsigned long)(taken - n), prof.path);
+        fflush(stdout);
+    }
+
+    symtab_free(&symtab);
+    free(copy);
+}
+
+/* ============================================================================
+ * CONTROL
+ * ============================================================================
+ */
+
+int profiler_start(const char *path) {
+    pthread_attr_t attr;
+    void *stack;
+    size_t stack_size;
+
+    /* The walk only follows frame pointers that land on our own stack */
+    if (pthread_getattr_np(pthread_self(), &attr) != 0 ||
+        pthread_attr_getstack(&attr, &stack, &stack_size) != 0) {
+        fprintf(stderr, "profiler: can't find the stack bounds\n");
+        return -1;
+    }
+    pthread_attr_destroy(&attr);
+    prof.stack_lo = (uintptr_t)stack;
+    prof.stack_hi = (uintptr_t)stack + stack_size;
+    prof.path = path;
+    prof.head = 0;
+    prof.tail = 0;
+    prof.dump_requested = 0;
+
+    /* SA_RESTART: a sample landing mid-read() must not turn into EINTR */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sa.sa_sigaction = on_sigprof;
+    if (sigaction(SIGPROF, &sa, NULL) == -1) {
+        perror("sigaction SIGPROF");
+        return -1;
+    }
+
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = on_sigusr1;
+    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
+        perror("sigaction SIGUSR1");
+        return -1;
+    }
+
+    struct itimerval it;
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = 1000000 / PROFILER_HZ;
+    it.it_value = it.it_interval;
+    if (setitimer(ITIMER_PROF, &it, NULL) == -1) {
+        perror("setitimer");
+        return -1;
+    }
+
+    prof.running = 1;
+    return 0;
+}
+
+void profiler_stop(void) {
+    if (!prof.running) {
+        return;
+    }
+
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_PROF, &it, NULL);
+
+    /* A SIGPROF may still be pending, and its default action is to kill */
+    signal(SIGPROF, SIG_IGN);
+    prof.running = 0;
+}
+
+void profiler_request_dump(void) {
+    prof.dump_requested = 1;
+}
+
+void profiler_poll(void) {
+    if (prof.dump_requested && prof.running) {
+        prof.dump_requested = 0;
+        dump();
+    }
+}
@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 200809L
+#include "scoreboard.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Readers give up after this many torn copies in a row */
+#define SCOREBOARD_READ_RETRIES 1000
+
+/* ============================================================================
+ * WRITER
+ * ============================================================================
+ */
+
+scoreboard_t *scoreboard_create(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("scoreboard open");
+        return NULL;
+    }
+    
+    if (ftruncate(fd, sizeof(scoreboard_t)) == -1) {
+        perror("scoreboard ftruncate");
+        close(fd);
+        return NULL;
+    }
+    
+    scoreboard_t *sb = mmap(NULL, sizeof(scoreboard_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+    close(fd);  /* The mapping keeps the file alive */
+    if (sb == MAP_FAILED) {
+        perror("scoreboard mmap");
+        return NULL;
+    }
+    
+    /* Fresh file pages are zero, so only the header needs filling in.
+     * magic goes last: a reader that sees it sees a complete header.
+     */
+    sb->version = SCOREBOARD_VERSION;
+    sb->size = sizeof(scoreboard_t);
+    __atomic_store_n(&sb->magic, SCOREBOARD_MAGIC, __ATOMIC_RELEASE);
+    return sb;
+}
+
+void scoreboard_destroy(scoreboard_t *sb, const char *path) {
+    if (sb == NULL) {
+        return;
+    }
+    munmap(sb, sizeof(scoreboard_t));
+    unlink(path);
+}
+
+void scoreboard_write_begin(scoreboard_t *sb) {
+    __atomic_store_n(&sb->seq, sb->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void scoreboard_write_end(scoreboard_t *sb) {
+    __atomic_store_n(&sb->seq, sb->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* ============================================================================
+ * READER
+ * ============================================================================
+ */
+
+const scoreboard_t *scoreboard_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(scoreboard_t)) {
+        fprintf(stderr, "%s: not a scoreboard (size mismatch)\n", path);
+        close(fd);
+        return NULL;
+    }
+    
+    scoreboard_t *sb = mmap(NULL, sizeof(scoreboard_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sb == MAP_FAILED) {
+        perror("scoreboard mmap");
+        return NULL;
+    }
+    
+    if (__atomic_load_n(&sb->magic, __ATOMIC_ACQUIRE) != SCOREBOARD_MAGIC ||
+        sb->version != SCOREBOARD_VERSION || sb->size != sizeof(scoreboard_t)) {
+        fprintf(stderr, "%s: scoreboard version %u, expected %d\n",
+                path, sb->version, SCOREBOARD_VERSION);
+        munmap(sb, sizeof(scoreboard_t));
+        return NULL;
+    }
+    return sb;
+}
+
+void scoreboard_close(const scoreboard_t *sb) {
+    if (sb != NULL) {
+        munmap((void *)(uintptr_t)sb, sizeof(scoreboard_t));
+    }
+}
+
+int scoreboard_snapshot(const scoreboard_t *sb, scoreboard_t *out) {
+    for (int i = 0; i < SCOREBOARD_READ_RETRIES; i++) {
+        uint64_t before = __atomic_load_n(&sb->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;  /* Write in progress */
+        }
+        
+        memcpy(out, sb, sizeof(*out));
+        
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sb->seq, __ATOMIC_RELAXED) == before) {
+            return 0;
+        }
+    }
+    return -1;
+}
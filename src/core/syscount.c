@@ -0,0 +1,76 @@
+#include "syscount.h"
+#include <stdio.h>
+
+static const char *kind_names[SYSCALL_KINDS] = {
+    [SYSCALL_READ]       = "read",
+    [SYSCALL_WRITE]      = "write",
+    [SYSCALL_EPOLL_WAIT] = "epoll_wait",
+    [SYSCALL_EPOLL_CTL]  = "epoll_ctl",
+    [SYSCALL_ACCEPT]     = "accept",
+    [SYSCALL_SOCKET]     = "socket",
+    [SYSCALL_CONNECT]    = "connect",
+    [SYSCALL_FCNTL]      = "fcntl",
+    [SYSCALL_SOCKOPT]    = "[gs]etsockopt",
+    [SYSCALL_CLOSE]      = "close",
+    [SYSCALL_SENDFILE]   = "sendfile",
+    [SYSCALL_FILE]       = "open/stat",
+};
+
+uint64_t syscount_total(const syscall_stats_t *stats) {
+    uint64_t total = 0;
+    for (int s = 0; s < SYSCALL_SIDES; s++) {
+        for (int k = 0; k < SYSCALL_KINDS; k++) {
+            total += stats->calls[s][k];
+        }
+    }
+    return total;
+}
+
+uint64_t syscount_wasted(const syscall_stats_t *stats) {
+    uint64_t total = 0;
+    for (int s = 0; s < SYSCALL_SIDES; s++) {
+        for (int k = 0; k < SYSCALL_KINDS; k++) {
+            total += stats->wasted[s][k];
+        }
+    }
+    return total;
+}
+
+void syscount_print(const proxy_config_t *config) {
+    const syscall_stats_t *st = &config->syscalls;
+    
+    /* HTTP has requests; a TCP "request" is a whole client connection */
+    int http = config->mode == PROXY_MODE_HTTP;
+    uint64_t units = http ? config->stats.requests_total : config->stats.total_connections;
+    double mb = (double)config->stats.bytes_received / (1024 * 1024);
+    
+    printf("%-14s %10s %10s %10s %10s %10s %8s %8s\n", "Syscall", "loop", "client",
+           "upstream", "mirror", "EAGAIN", http ? "/req" : "/conn", "/MB");
+    
+    for (int k = 0; k < SYSCALL_KINDS; k++) {
+        uint64_t total = 0, wasted = 0;
+        for (int s = 0; s < SYSCALL_SIDES; s++) {
+            total += st->calls[s][k];
+            wasted += st->wasted[s][k];
+        }
+        if (total == 0) {
+            continue;
+        }
+        printf("%-14s %10lu %10lu %10lu %10lu %10lu %8.2f %8.1f\n", kind_names[k],
+               (unsigned long)st->calls[SYSCALL_SIDE_LOOP][k],
+               (unsigned long)st->calls[SYSCALL_SIDE_CLIENT][k],
+               (unsigned long)st->calls[SYSCALL_SIDE_UPSTREAM][k],
+               (unsigned long)st->calls[SYSCALL_SIDE_MIRROR][k],
+               (unsigned long)wasted,
+               units ? (double)total / units : 0.0,
+               mb > 0 ? total / mb : 0.0);
+    }
+    
+    uint64_t total = syscount_total(st);
+    uint64_t wasted = syscount_wasted(st);
+    printf("Syscalls per %s: %.2f (%.2f EAGAIN), per MB: %.1f\n",
+           http ? "request" : "connection",
+           units ? (double)total / units : 0.0,
+           units ? (double)wasted / units : 0.0,
+           mb > 0 ? total / mb : 0.0);
+}
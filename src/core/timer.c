@@ -0,0 +1,137 @@
+#include "timer.h"
+#include <stddef.h>
+
+/* ============================================================================
+ * LIST HELPERS
+ * ============================================================================
+ * Each slot is a circular doubly linked list with the slot itself as the
+ * sentinel head, so insert and unlink never need to special-case empty lists.
+ */
+
+static void list_insert(timer_node_t *head, timer_node_t *node) {
+    node->next = head->next;
+    node->prev = head;
+    head->next->prev = node;
+    head->next = node;
+}
+
+static void list_unlink(timer_node_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+/* ============================================================================
+ * TIMER WHEEL
+ * ============================================================================
+ */
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now_ms) {
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        wheel->slots[i].next = &wheel->slots[i];
+        wheel->slots[i].prev = &wheel->slots[i];
+        wheel->slots[i].expires = 0;
+    }
+    wheel->current_tick = now_ms / TIMER_TICK_MS;
+    wheel->count = 0;
+}
+
+void timer_schedule(timer_wheel_t *wheel, timer_node_t *node, uint64_t expires_ms) {
+    if (node->next != NULL) {
+        list_unlink(node);
+        wheel->count--;
+    }
+
+    /* Round the deadline up to a tick boundary: by the time we sweep that
+     * tick, the deadline has passed. A deadline that is already in the past
+     * goes into the next slot we will visit, rather than one already swept.
+     */
+    uint64_t tick = (expires_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (tick <= wheel->current_tick) {
+        tick = wheel->current_tick + 1;
+    }
+
+    node->expires = expires_ms;
+    list_insert(&wheel->slots[tick % TIMER_WHEEL_SLOTS], node);
+    wheel->count++;
+}
+
+void timer_cancel(timer_wheel_t *wheel, timer_node_t *node) {
+    if (node->next == NULL) {
+        return;
+    }
+    list_unlink(node);
+    wheel->count--;
+}
+
+int timer_pending(const timer_node_t *node) {
+    return node->next != NULL;
+}
+
+size_t timer_wheel_expire(timer_wheel_t *wheel, uint64_t now_ms,
+                          void (*callback)(void *ctx, timer_node_t *node),
+                          void *ctx) {
+    uint64_t now_tick = now_ms / TIMER_TICK_MS;
+    size_t fired = 0;
+
+    if (now_tick <= wheel->current_tick) {
+        return 0;
+    }
+
+    /* After a long stall, one full revolution visits every slot */
+    uint64_t ticks = now_tick - wheel->current_tick;
+    if (ticks > TIMER_WHEEL_SLOTS) {
+        ticks = TIMER_WHEEL_SLOTS;
+    }
+
+    for (uint64_t t = now_tick - ticks + 1; t <= now_tick; t++) {
+        timer_node_t *head = &wheel->slots[t % TIMER_WHEEL_SLOTS];
+
+        /* This tick counts as swept from here on: a callback arming a
+         * timer that is already due puts it in the next slot, not back in
+         * this one (where it would wait a whole revolution).
+         */
+        wheel->current_tick = t;
+
+        /* Detach the slot first: callbacks may re-arm into this same slot,
+         * and timers for later revolutions have to go back in.
+         */
+        timer_node_t pending;
+        if (head->next == head) {
+            continue;
+        }
+        pending.next = head->next;
+        pending.prev = head->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        head->next = head;
+        head->prev = head;
+
+        while (pending.next != &pending) {
+            timer_node_t *node = pending.next;
+            list_unlink(node);
+
+            if (node->expires <= now_ms) {
+                wheel->count--;
+                fired++;
+                callback(ctx, node);
+            } else {
+                list_insert(head, node);
+            }
+        }
+    }
+
+    wheel->current_tick = now_tick;
+    return fired;
+}
+
+int timer_wheel_timeout(const timer_wheel_t *wheel, uint64_t now_ms, int max_ms) {
+    if (wheel->count == 0) {
+        return max_ms;
+    }
+
+    /* Sleep until the start of the next tick */
+    int ms = (int)(TIMER_TICK_MS - now_ms % TIMER_TICK_MS);
+    return ms < max_ms ? ms : max_ms;
+}
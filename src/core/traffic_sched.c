@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+#include "traffic_sched.h"
+#include "connection.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* ============================================================================
+ * SETUP
+ * ============================================================================
+ */
+
+static void class_init(sched_class_t *c, const char *name, uint32_t weight) {
+    c->name = name;
+    c->weight = weight;
+    histogram_init(&c->stats.latency_us);
+    histogram_init(&c->stats.wait_us);
+}
+
+sched_t *sched_create(void) {
+    sched_t *s = calloc(1, sizeof(sched_t));
+    if (s == NULL) {
+        perror("sched");
+        return NULL;
+    }
+    class_init(&s->classes[0], "default", 1);
+    s->class_count = 1;
+    s->budget = INT64_MAX;
+    s->started_ms = get_timestamp_ms();
+    return s;
+}
+
+void sched_destroy(sched_t *s) {
+    free(s);
+}
+
+int sched_add_class(sched_t *s, char *spec) {
+    char *eq = strchr(spec, '=');
+    char *colon = strchr(spec, ':');
+    if (eq == NULL || colon == NULL || colon > eq || colon == spec || eq[1] != '/') {
+        fprintf(stderr, "Invalid class '%s' (expected NAME:WEIGHT[:interactive]=/PREFIX,...)\n",
+                spec);
+        return -1;
+    }
+    if (s->class_count == SCHED_MAX_CLASSES) {
+        fprintf(stderr, "Too many traffic classes (at most %d)\n", SCHED_MAX_CLASSES - 1);
+        return -1;
+    }
+
+    *eq = '\0';
+    *colon = '\0';
+    char *end;
+    long weight = strtol(colon + 1, &end, 10);
+    int interactive = 0;
+    if (strcmp(end, ":interactive") == 0) {
+        interactive = 1;
+    } else if (*end != '\0') {
+        weight = 0;
+    }
+    if (weight <= 0 || weight > 1024) {
+        fprintf(stderr, "Class %s: weight must be 1..1024\n", spec);
+        return -1;
+    }
+
+    sched_class_t *c = &s->classes[s->class_count];
+    class_init(c, spec, (uint32_t)weight);
+    c->interactive = interactive;
+
+    for (char *prefix = strtok(eq + 1, ","); prefix != NULL; prefix = strtok(NULL, ",")) {
+        if (prefix[0] != '/' || c->prefix_count == SCHED_MAX_PREFIXES) {
+            fprintf(stderr, "Class %s: bad prefix %s (at most %d, each starting with /)\n",
+                    spec, prefix, SCHED_MAX_PREFIXES);
+            return -1;
+        }
+        c->prefixes[c->prefix_count] = prefix;
+        c->prefix_lens[c->prefix_count++] = strlen(prefix);
+    }
+    s->class_count++;
+    return 0;
+}
+
+uint8_t sched_classify(const sched_t *s, const char *path) {
+    uint8_t best = 0;
+    size_t best_len = 0;
+    for (int i = 1; i < s->class_count; i++) {
+        const sched_class_t *c = &s->classes[i];
+        for (int j = 0; j < c->prefix_count; j++) {
+            if (c->prefix_lens[j] > best_len &&
+                strncmp(path, c->prefixes[j], c->prefix_lens[j]) == 0) {
+                best = (uint8_t)i;
+                best_len = c->prefix_lens[j];
+            }
+        }
+    }
+    return best;
+}
+
+uint64_t sched_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* ============================================================================
+ * SERVING A BATCH
+ * ============================================================================
+ */
+
+/* One connection's turn with at most budget bytes. Returns bytes used. */
+static int64_t turn(proxy_config_t *config, sched_class_t *c, struct epoll_event *ev,
+                    int64_t budget, uint64_t batch_us, sched_dispatch_fn dispatch) {
+    sched_t *s = config->sched;
+
+    histogram_record(&c->stats.wait_us, sched_now_us() - batch_us);
+    s->budget = budget;
+    s->preempted = 0;
+    dispatch(config, (connection_t *)ev->data.ptr, ev->events);
+
+    int64_t used = budget - s->budget;
+    s->budget = INT64_MAX;  /* Work outside turns isn't metered */
+    c->stats.bytes += (uint64_t)used;
+    c->stats.turns++;
+    c->stats.preempted += (uint64_t)s->preempted;
+    return used;
+}
+
+void sched_run(proxy_config_t *config, struct epoll_event *events, uint64_t batch_us,
+               sched_dispatch_fn dispatch) {
+    sched_t *s = config->sched;
+
+    /* Interactive classes: first, one quantum per connection */
+    for (int i = 0; i < s->class_count; i++) {
+        sched_class_t *c = &s->classes[i];
+        if (!c->interactive) {
+            continue;
+        }
+        while (c->count > 0) {
+            c->count--;
+            turn(config, c, &events[c->queue[c->head++]],
+                 (int64_t)c->weight * SCHED_QUANTUM, batch_us, dispatch);
+        }
+    }
+
+    /* The rest: deficit round robin until every queue is empty */
+    int backlogged = 1;
+    while (backlogged) {
+        backlogged = 0;
+        for (int i = 0; i < s->class_count; i++) {
+            sched_class_t *c = &s->classes[i];
+            if (c->interactive || c->count == 0) {
+                continue;
+            }
+            c->deficit += (int64_t)c->weight * SCHED_QUANTUM;
+            while (c->deficit > 0 && c->count > 0) {
+                c->count--;
+                c->deficit -= turn(config, c, &events[c->queue[c->head++]],
+                                   c->deficit, batch_us, dispatch);
+            }
+            if (c->count > 0) {
+                backlogged = 1;
+            } else if (c->deficit > 0) {
+                c->deficit = 0;  /* No saving up while idle */
+            }
+        }
+    }
+
+    for (int i = 0; i < s->class_count; i++) {
+        s->classes[i].head = 0;
+    }
+}
+
+void sched_request_done(sched_t *s, uint8_t c, uint64_t started_us) {
+    s->classes[c].stats.requests++;
+    histogram_record(&s->classes[c].stats.latency_us, sched_now_us() - started_us);
+}
+
+void sched_print(const sched_t *s) {
+    double secs = (double)(get_timestamp_ms() - s->started_ms) / 1000.0;
+
+    printf("%-12s %6s %10s %10s %8s %9s %9s %10s %9s\n", "Class", "weight", "requests",
+           "MB", "MB/s", "p50 ms", "p99 ms", "wait p99", "preempted");
+    for (int i = 0; i < s->class_count; i++) {
+        const sched_class_t *c = &s->classes[i];
+        double mb = (double)c->stats.bytes / (1024 * 1024);
+        printf("%-12s %5u%s %10lu %10.1f %8.1f %9.2f %9.2f %8luus %9lu\n",
+               c->name, c->weight, c->interactive ? "i" : " ",
+               (unsigned long)c->stats.requests, mb, secs > 0 ? mb / secs : 0.0,
+               (double)histogram_percentile(&c->stats.latency_us, 50) / 1000.0,
+               (double)histogram_percentile(&c->stats.latency_us, 99) / 1000.0,
+               (unsigned long)histogram_percentile(&c->stats.wait_us, 99),
+               (unsigned long)c->stats.preempted);
+    }
+    printf("(i: interactive, served before the others; wait: epoll_wait to turn)\n");
+}
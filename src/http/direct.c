@@ -0,0 +1,264 @@
+#include "direct.h"
+#include "http_request.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ============================================================================
+ * RENDERING
+ * ============================================================================
+ */
+
+static const char *reason_phrase(long status) {
+    switch (status) {
+        case 200: return "OK";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 410: return "Gone";
+        case 429: return "Too Many Requests";
+        case 503: return "Service Unavailable";
+        default:  return NULL;
+    }
+}
+
+static int is_redirect(long status) {
+    return status == 301 || status == 302 || status == 303 ||
+           status == 307 || status == 308;
+}
+
+static const char *connection_line(int variant) {
+    switch (variant) {
+        case DIRECT_KEEP_ALIVE_10: return "Connection: keep-alive\r\n";
+        case DIRECT_CLOSE:         return "Connection: close\r\n";
+        default:                   return "";
+    }
+}
+
+/* A complete response with a text/plain body (plus a newline) */
+static int render_fixed(direct_text_t *t, long status, const char *body, int variant) {
+    size_t body_len = strlen(body) + 1;
+    int len = snprintf(t->text, sizeof(t->text),
+                       "HTTP/1.1 %ld %s\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %zu\r\n"
+                       "%s"
+                       "\r\n"
+                       "%s\n",
+                       status, reason_phrase(status), body_len,
+                       connection_line(variant), body);
+    if (len < 0 || len >= DIRECT_TEXT_MAX) {
+        return -1;
+    }
+    t->len = (size_t)len;
+    t->body_len = body_len;
+    return 0;
+}
+
+/* Header of a redirect around its Location, which the request completes */
+static int render_redirect(direct_route_t *route, long status, const char *target) {
+    size_t target_len = strlen(target);
+    route->append_path = target_len > 0 && target[target_len - 1] == '*';
+    if (route->append_path) {
+        target_len--;
+    }
+    for (size_t i = 0; i < target_len; i++) {
+        if ((unsigned char)target[i] <= ' ') {
+            return -1;  /* Would break the header */
+        }
+    }
+
+    for (int v = 0; v < DIRECT_VARIANTS; v++) {
+        direct_text_t *head = &route->head[0][v];
+        direct_text_t *tail = &route->tail[v];
+        int len = snprintf(head->text, sizeof(head->text), "HTTP/1.1 %ld %s\r\nLocation: %.*s",
+                           status, reason_phrase(status), (int)target_len, target);
+        if (len < 0 || len >= DIRECT_TEXT_MAX) {
+            return -1;
+        }
+        head->len = (size_t)len;
+        head->body_len = 0;
+
+        len = snprintf(tail->text, sizeof(tail->text), "\r\nContent-Length: 0\r\n%s\r\n",
+                       connection_line(v));
+        tail->len = (size_t)len;
+        tail->body_len = 0;
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * SETUP
+ * ============================================================================
+ */
+
+direct_t *direct_create(void) {
+    direct_t *d = calloc(1, sizeof(direct_t));
+    if (d == NULL) {
+        perror("direct responses");
+    }
+    return d;
+}
+
+void direct_destroy(direct_t *d) {
+    free(d);
+}
+
+int direct_add_route(direct_t *d, char *spec) {
+    char *eq = strchr(spec, '=');
+    if (eq == NULL || spec[0] != '/' || eq[1] == '\0') {
+        fprintf(stderr, "Invalid direct route '%s' (expected /PATH=STATUS:BODY, "
+                "/PATH=30x:URL or /PATH=health)\n", spec);
+        return -1;
+    }
+    if (d->route_count == DIRECT_MAX_ROUTES) {
+        fprintf(stderr, "Too many direct routes (at most %d)\n", DIRECT_MAX_ROUTES);
+        return -1;
+    }
+
+    *eq = '\0';
+    const char *what = eq + 1;
+    direct_route_t *route = &d->routes[d->route_count];
+    route->prefix = spec;
+    route->prefix_len = strlen(spec);
+    route->exact = spec[route->prefix_len - 1] != '/';
+
+    int ok = 0;
+    if (strcmp(what, "health") == 0) {
+        route->kind = DIRECT_HEALTH;
+        for (int v = 0; v < DIRECT_VARIANTS; v++) {
+            ok |= render_fixed(&route->head[0][v], 200, "ok", v);
+            ok |= render_fixed(&route->head[1][v], 503, "upstream unavailable", v);
+        }
+    } else {
+        char *end;
+        long status = strtol(what, &end, 10);
+        if (*end != ':' || reason_phrase(status) == NULL) {
+            fprintf(stderr, "Direct route %s: '%s' doesn't start with a supported "
+                    "status and ':'\n", spec, what);
+            return -1;
+        }
+        if (is_redirect(status)) {
+            route->kind = DIRECT_REDIRECT;
+            ok = render_redirect(route, status, end + 1);
+        } else {
+            route->kind = DIRECT_FIXED;
+            for (int v = 0; v < DIRECT_VARIANTS; v++) {
+                ok |= render_fixed(&route->head[0][v], status, end + 1, v);
+            }
+        }
+    }
+    if (ok != 0) {
+        fprintf(stderr, "Direct route %s: response too long or malformed\n", spec);
+        return -1;
+    }
+
+    d->route_count++;
+    return 0;
+}
+
+/* ============================================================================
+ * RESPONSES
+ * ============================================================================
+ */
+
+direct_route_t *direct_route(direct_t *d, const char *path) {
+    direct_route_t *best = NULL;
+    for (int i = 0; i < d->route_count; i++) {
+        direct_route_t *route = &d->routes[i];
+        if (strncmp(path, route->prefix, route->prefix_len) != 0) {
+            continue;
+        }
+        char next = path[route->prefix_len];
+        if (route->exact && next != '\0' && next != '?') {
+            continue;
+        }
+        if (best == NULL || route->prefix_len > best->prefix_len) {
+            best = route;
+        }
+    }
+    return best;
+}
+
+/* The request path goes into the Location header as sent: anything that
+ * could end the header line or split the URL can't be appended.
+ */
+static int safe_in_location(const char *rest) {
+    for (const unsigned char *p = (const unsigned char *)rest; *p != '\0'; p++) {
+        if (*p <= 0x20 || *p == 0x7f) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int direct_respond(direct_t *d, direct_route_t *route, const http_request_t *req,
+                   file_reply_t *reply, int keep_alive) {
+    const char *rest = req->path + route->prefix_len;
+    if (route->kind == DIRECT_REDIRECT && route->append_path && !safe_in_location(rest)) {
+        d->stats.refused++;
+        return -1;
+    }
+
+    int variant = !keep_alive ? DIRECT_CLOSE
+                : req->version == HTTP_VERSION_10 ? DIRECT_KEEP_ALIVE_10 : DIRECT_KEEP_ALIVE;
+
+    const direct_text_t *head = &route->head[0][variant];
+    if (route->kind == DIRECT_HEALTH && d->upstream_fails >= DIRECT_HEALTH_FAILS) {
+        head = &route->head[1][variant];
+        d->stats.unhealthy++;
+    }
+
+    reply->active = 1;
+    reply->fd = -1;
+    reply->refs = NULL;
+    reply->body_bytes = NULL;
+    reply->offset = 0;
+    reply->remaining = 0;
+    reply->head[0].iov_base = (void *)(uintptr_t)head->text;
+    reply->head[0].iov_len = head->len - (req->method == HTTP_METHOD_HEAD ? head->body_len : 0);
+    reply->head_first = 0;
+    reply->head_count = 1;
+
+    if (route->kind == DIRECT_REDIRECT) {
+        reply->head[1].iov_base = (void *)(uintptr_t)rest;
+        reply->head[1].iov_len = route->append_path ? strlen(rest) : 0;
+        reply->head[2].iov_base = (void *)(uintptr_t)route->tail[variant].text;
+        reply->head[2].iov_len = route->tail[variant].len;
+        reply->head_count = 3;
+    }
+
+    route->hits++;
+    d->stats.responses++;
+    return 0;
+}
+
+void direct_upstream(direct_t *d, int ok) {
+    if (d == NULL) {
+        return;
+    }
+    if (ok) {
+        d->upstream_fails = 0;
+    } else if (d->upstream_fails < DIRECT_HEALTH_FAILS &&
+               ++d->upstream_fails == DIRECT_HEALTH_FAILS) {
+        d->stats.went_down++;
+    }
+}
+
+void direct_print(const direct_t *d) {
+    printf("Direct responses:   %lu (%lu health checks failed, upstream down %lu times, "
+           "%lu redirects refused)\n",
+           (unsigned long)d->stats.responses, (unsigned long)d->stats.unhealthy,
+           (unsigned long)d->stats.went_down, (unsigned long)d->stats.refused);
+    for (int i = 0; i < d->route_count; i++) {
+        const direct_route_t *r = &d->routes[i];
+        printf("%s: %s, %lu hits\n", r->prefix,
+               r->kind == DIRECT_HEALTH ? "health" :
+               r->kind == DIRECT_REDIRECT ? "redirect" : "fixed",
+               (unsigned long)r->hits);
+    }
+}
@@ -0,0 +1,1171 @@
+#define _GNU_SOURCE
+#include "disk_cache.h"
+#include "http_request.h"
+#include "connection.h"
+#include "epoll.h"
+#include "hugepage.h"
+#include "syscount.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#define ZLIB_CONST  /* next_in takes a const pointer */
+#include <zlib.h>
+#include <brotli/encode.h>
+
+/* A snapshot image on its way to the writer */
+typedef struct {
+    disk_job_t job;
+    size_t count;
+    disk_snapshot_header_t header;
+    disk_snapshot_record_t records[];
+} snapshot_job_t;
+
+/* An entry to encode, and the response that came of it */
+typedef struct {
+    disk_job_t job;
+    disk_entry_t *source;       /* Holds a ref until the job comes back */
+    disk_encoding_t encoding;
+    char *output;               /* Complete response; NULL if not worth it */
+    size_t output_len;
+    size_t head_len;
+} compress_job_t;
+
+static const char *const encoding_names[DISK_ENCODINGS] = { "br", "gzip" };
+
+static void load_snapshot(disk_cache_t *dc);
+static void queue_snapshot(disk_cache_t *dc);
+
+static disk_entry_t *job_entry(disk_job_t *job) {
+    return (disk_entry_t *)((char *)job - offsetof(disk_entry_t, job));
+}
+
+static uint64_t unix_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* ============================================================================
+ * WORKER THREADS
+ * ============================================================================
+ * The only code that touches the slab mappings. A page fault here may wait
+ * for the disk and compression takes real CPU; the event loop does neither.
+ * The writer stores slots and snapshots, the compressor makes variants.
+ */
+
+static char *slot_address(disk_cache_t *dc, const disk_entry_t *e) {
+    disk_class_t *cls = &dc->classes[e->class_index];
+    return cls->map + (size_t)e->slot * cls->slot_size;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Slot contents first, then the index that names them: a crash at any
+ * point leaves either the old snapshot or the new one, both true.
+ */
+static void write_snapshot(disk_cache_t *dc, snapshot_job_t *snap) {
+    char tmp[1024], path[1024];
+    snprintf(tmp, sizeof(tmp), "%s/index.tmp", dc->dir);
+    snprintf(path, sizeof(path), "%s/index.dat", dc->dir);
+
+    for (int i = 0; i < DISK_CACHE_CLASSES; i++) {
+        if (dc->classes[i].fd != -1 && fdatasync(dc->classes[i].fd) == -1) {
+            perror("disk cache fdatasync");
+            return;
+        }
+    }
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror(tmp);
+        return;
+    }
+    if (write_all(fd, &snap->header, sizeof(snap->header)) == -1 ||
+        write_all(fd, snap->records, snap->count * sizeof(disk_snapshot_record_t)) == -1 ||
+        fdatasync(fd) == -1) {
+        perror(tmp);
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    close(fd);
+
+    if (rename(tmp, path) == -1) {
+        perror(path);
+        return;
+    }
+    fsync(dc->dir_fd);
+}
+
+static void unlink_snapshot(disk_cache_t *dc) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/index.dat", dc->dir);
+    if (unlink(path) == -1 && errno != ENOENT) {
+        perror(path);
+    }
+    fsync(dc->dir_fd);
+}
+
+/* Encode body into out (room bytes). Returns the encoded length, 0 on failure. */
+static size_t encode(disk_encoding_t encoding, const char *body, size_t len,
+                     char *out, size_t room) {
+    if (encoding == DISK_ENCODING_BR) {
+        size_t out_len = room;
+        if (!BrotliEncoderCompress(DISK_CACHE_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW,
+                                   BROTLI_MODE_TEXT, len, (const uint8_t *)body,
+                                   &out_len, (uint8_t *)out)) {
+            return 0;
+        }
+        return out_len;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, DISK_CACHE_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 0;
+    }
+    zs.next_in = (const Bytef *)body;
+    zs.avail_in = (uInt)len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = (uInt)room;
+    int ret = deflate(&zs, Z_FINISH);
+    size_t out_len = zs.total_out;
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END ? out_len : 0;
+}
+
+static size_t encode_bound(disk_encoding_t encoding, size_t len) {
+    if (encoding == DISK_ENCODING_BR) {
+        return BrotliEncoderMaxCompressedSize(len);
+    }
+    return compressBound((uLong)len) + 18;  /* gzip header and trailer */
+}
+
+/* The stored response with its body encoded: same status and headers, but
+ * a new Content-Length, plus Content-Encoding and Vary. Leaves
+ * cj->output NULL when the body doesn't shrink by at least a tenth.
+ */
+static void compress_entry(disk_cache_t *dc, compress_job_t *cj) {
+    const disk_entry_t *e = cj->source;
+    const char *head = slot_address(dc, e);
+    const char *body = head + e->head_len;
+    size_t body_len = e->len - e->head_len;
+
+    size_t head_room = e->head_len + 128;
+    size_t bound = encode_bound(cj->encoding, body_len);
+    if (bound == 0) {
+        return;
+    }
+    char *out = malloc(head_room + bound);
+    if (out == NULL) {
+        return;
+    }
+
+    size_t encoded = encode(cj->encoding, body, body_len, out + head_room, bound);
+    if (encoded == 0 || encoded > body_len - body_len / 10) {
+        free(out);
+        return;
+    }
+
+    /* Every header line but Content-Length, then ours */
+    size_t n = 0;
+    const char *line = head;
+    const char *end = head + e->head_len - 2;  /* Before the blank line */
+    while (line < end) {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        eol = eol ? eol + 1 : end;
+        if (strncasecmp(line, "Content-Length:", 15) != 0) {
+            memcpy(out + n, line, (size_t)(eol - line));
+            n += (size_t)(eol - line);
+        }
+        line = eol;
+    }
+    n += (size_t)snprintf(out + n, head_room - n,
+                          "Content-Encoding: %s\r\nContent-Length: %zu\r\n"
+                          "Vary: Accept-Encoding\r\n\r\n",
+                          encoding_names[cj->encoding], encoded);
+    memmove(out + n, out + head_room, encoded);
+
+    cj->output = out;
+    cj->head_len = n;
+    cj->output_len = n + encoded;
+}
+
+static void *worker_main(void *arg) {
+    disk_worker_t *w = arg;
+    disk_cache_t *dc = w->cache;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&dc->lock);
+    for (;;) {
+        while (w->head == NULL && !dc->stop) {
+            pthread_cond_wait(&w->wake, &dc->lock);
+        }
+        disk_job_t *job = w->head;
+        if (job == NULL) {
+            break;  /* Stopping, queue drained */
+        }
+        w->head = job->next;
+        if (w->head == NULL) {
+            w->tail = NULL;
+        }
+        int stopping = dc->stop;
+        pthread_mutex_unlock(&dc->lock);
+
+        disk_job_type_t type = job->type;
+        if (type == DISK_JOB_STORE) {
+            disk_entry_t *e = job_entry(job);
+            memcpy(slot_address(dc, e), e->staging, e->len);
+        } else if (type == DISK_JOB_COMPRESS) {
+            if (!stopping) {
+                compress_entry(dc, (compress_job_t *)job);
+            }
+        } else if (type == DISK_JOB_SNAPSHOT) {
+            write_snapshot(dc, (snapshot_job_t *)job);
+            free(job);
+        } else {
+            unlink_snapshot(dc);
+            free(job);
+        }
+
+        pthread_mutex_lock(&dc->lock);
+        if (type == DISK_JOB_STORE || type == DISK_JOB_COMPRESS) {
+            job->next = dc->done;
+            dc->done = job;
+            if (write(dc->event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+                perror("disk cache eventfd");
+            }
+        }
+    }
+    pthread_mutex_unlock(&dc->lock);
+    return NULL;
+}
+
+/* Each worker runs its jobs in the order queued */
+static void queue_job(disk_cache_t *dc, disk_worker_t *w, disk_job_t *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&dc->lock);
+    if (w->tail != NULL) {
+        w->tail->next = job;
+    } else {
+        w->head = job;
+    }
+    w->tail = job;
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&dc->lock);
+}
+
+static int start_worker(disk_cache_t *dc, disk_worker_t *w, const char *name) {
+    w->cache = dc;
+    pthread_cond_init(&w->wake, NULL);
+
+    /* Signals (shutdown, the profiler's SIGPROF) belong to the loop thread */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&w->thread, NULL, worker_main, w);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        fprintf(stderr, "disk cache: can't start the %s: %s\n", name, strerror(err));
+        pthread_cond_destroy(&w->wake);
+        return -1;
+    }
+    w->started = 1;
+    return 0;
+}
+
+static void stop_worker(disk_worker_t *w) {
+    if (w->started) {
+        pthread_join(w->thread, NULL);
+        pthread_cond_destroy(&w->wake);
+        w->started = 0;
+    }
+}
+
+/* ============================================================================
+ * SETUP
+ * ============================================================================
+ */
+
+static size_t entries_size(const disk_class_t *cls) {
+    return (size_t)cls->slots * sizeof(disk_entry_t);
+}
+
+/* Sets *fresh if the file had to grow: its slots can't match a snapshot */
+static int open_class(disk_class_t *cls, int index, const char *dir, size_t share,
+                      int *fresh) {
+    cls->fd = -1;
+    cls->slot_size = (size_t)DISK_CACHE_MIN_SLOT << (2 * index);
+    cls->slots = (uint32_t)(share / cls->slot_size);
+    if (cls->slots == 0) {
+        return 0;
+    }
+    size_t bytes = (size_t)cls->slots * cls->slot_size;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/slab-%zuk.dat", dir, cls->slot_size / 1024);
+    cls->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (cls->fd == -1) {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(cls->fd, &st) == -1 || (size_t)st.st_size < bytes) {
+        *fresh = 1;
+    }
+
+    /* Allocate the blocks now: a store into a hole that finds the disk full
+     * would be a SIGBUS in the writer thread.
+     */
+    int err = posix_fallocate(cls->fd, 0, (off_t)bytes);
+    if (err != 0) {
+        fprintf(stderr, "%s: can't preallocate %zu MB: %s\n", path, bytes >> 20, strerror(err));
+        return -1;
+    }
+
+    cls->map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, cls->fd, 0);
+    if (cls->map == MAP_FAILED) {
+        cls->map = NULL;
+        perror("disk cache mmap");
+        return -1;
+    }
+
+    cls->entries = hugepage_alloc(entries_size(cls), NULL);
+    if (cls->entries == NULL) {
+        fprintf(stderr, "disk cache: can't allocate the index\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < cls->slots; i++) {
+        cls->entries[i].class_index = index;
+        cls->entries[i].slot = i;
+    }
+    return 0;
+}
+
+disk_cache_t *disk_cache_create(proxy_config_t *config, const char *dir, size_t size_mb) {
+    disk_cache_t *dc = calloc(1, sizeof(disk_cache_t));
+    if (dc == NULL) {
+        perror("disk cache");
+        return NULL;
+    }
+    dc->event_fd = -1;
+    dc->dir = dir;
+    dc->dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dc->dir_fd == -1) {
+        perror(dir);
+        free(dc);
+        return NULL;
+    }
+
+    int fresh = 0;
+    size_t share = (size_mb << 20) / DISK_CACHE_CLASSES;
+    for (int i = 0; i < DISK_CACHE_CLASSES; i++) {
+        if (open_class(&dc->classes[i], i, dir, share, &fresh) == -1) {
+            disk_cache_destroy(dc);
+            return NULL;
+        }
+        if (dc->classes[i].slots > 0) {
+            dc->max_len = dc->classes[i].slot_size;
+        }
+    }
+    if (dc->max_len == 0) {
+        fprintf(stderr, "disk cache: %zu MB is too small for a single slot\n", size_mb);
+        disk_cache_destroy(dc);
+        return NULL;
+    }
+
+    if (!fresh) {
+        load_snapshot(dc);
+    }
+    for (int i = 0; i < DISK_CACHE_CLASSES; i++) {
+        disk_class_t *cls = &dc->classes[i];
+        for (uint32_t slot = cls->slots; slot-- > 0;) {
+            if (cls->entries[slot].state == DISK_ENTRY_FREE) {
+                cls->entries[slot].lru_next = cls->free_list;
+                cls->free_list = &cls->entries[slot];
+            }
+        }
+    }
+    dc->next_snapshot_ms = get_timestamp_ms() + DISK_CACHE_SNAPSHOT_S * 1000;
+
+    dc->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (dc->event_fd == -1 || epoll_add(config->epoll_fd, dc->event_fd, EPOLLIN,
+                                       epoll_tag(dc, EPOLL_SOURCE_DISK_CACHE)) == -1) {
+        perror("disk cache eventfd");
+        disk_cache_destroy(dc);
+        return NULL;
+    }
+
+    pthread_mutex_init(&dc->lock, NULL);
+    if (start_worker(dc, &dc->writer, "writer") == -1 ||
+        start_worker(dc, &dc->compressor, "compressor") == -1) {
+        disk_cache_destroy(dc);
+        return NULL;
+    }
+    return dc;
+}
+
+void disk_cache_destroy(disk_cache_t *dc) {
+    if (dc == NULL) {
+        return;
+    }
+
+    if (dc->writer.started) {
+        if (dc->changes > 0 || !dc->snapshot_live) {
+            queue_snapshot(dc);
+        }
+        pthread_mutex_lock(&dc->lock);
+        dc->stop = 1;
+        pthread_cond_signal(&dc->writer.wake);
+        pthread_cond_signal(&dc->compressor.wake);
+        pthread_mutex_unlock(&dc->lock);
+        stop_worker(&dc->compressor);
+        stop_worker(&dc->writer);
+        pthread_mutex_destroy(&dc->lock);
+
+        disk_job_t *job = dc->done;
+        while (job != NULL) {
+            disk_job_t *next = job->next;
+            if (job->type == DISK_JOB_STORE) {
+                free(job_entry(job)->staging);
+            } else {
+                free(((compress_job_t *)job)->output);
+                free(job);
+            }
+            job = next;
+        }
+    }
+
+    if (dc->event_fd != -1) {
+        close(dc->event_fd);  /* Also leaves the epoll set */
+    }
+    for (int i = 0; i < DISK_CACHE_CLASSES; i++) {
+        disk_class_t *cls = &dc->classes[i];
+        if (cls->map != NULL) {
+            munmap(cls->map, (size_t)cls->slots * cls->slot_size);
+        }
+        if (cls->entries != NULL) {
+            hugepage_free(cls->entries, entries_size(cls));
+        }
+        if (cls->fd != -1) {
+            close(cls->fd);
+        }
+    }
+    close(dc->dir_fd);
+    free(dc);
+}
+
+/* ============================================================================
+ * INDEX
+ * ============================================================================
+ */
+
+static uint32_t hash_key(const char *key) {
+    uint32_t h = 2166136261u;  /* FNV-1a */
+    for (; *key; key++) {
+        h = (h ^ (uint8_t)*key) * 16777619u;
+    }
+    return h;
+}
+
+/* host + '\n' + path. Returns -1 if it doesn't fit an entry. */
+static int build_key(const http_request_t *req, char *out) {
+    int n = snprintf(out, DISK_CACHE_KEY_MAX, "%s\n%s", req->host, req->path);
+    return n < 0 || n >= DISK_CACHE_KEY_MAX ? -1 : 0;
+}
+
+static void lru_unlink(disk_class_t *cls, disk_entry_t *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next; else cls->lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev; else cls->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_head(disk_class_t *cls, disk_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cls->lru_head;
+    if (cls->lru_head) cls->lru_head->lru_prev = e; else cls->lru_tail = e;
+    cls->lru_head = e;
+}
+
+static void lru_push_tail(disk_class_t *cls, disk_entry_t *e) {
+    e->lru_next = NULL;
+    e->lru_prev = cls->lru_tail;
+    if (cls->lru_tail) cls->lru_tail->lru_next = e; else cls->lru_head = e;
+    cls->lru_tail = e;
+}
+
+static disk_entry_t **bucket(disk_cache_t *dc, uint32_t hash) {
+    return &dc->buckets[hash & (DISK_CACHE_BUCKETS - 1)];
+}
+
+static void unhash(disk_cache_t *dc, disk_entry_t *e) {
+    disk_entry_t **pp = bucket(dc, e->hash);
+    while (*pp != e) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = e->hash_next;
+    e->hash_next = NULL;
+    e->hashed = 0;
+}
+
+/* A ready entry nobody may find again. A reply still sending from its slot
+ * keeps it; at the LRU tail it's the first to be reused afterwards.
+ */
+static void retire(disk_cache_t *dc, disk_entry_t *e) {
+    disk_class_t *cls = &dc->classes[e->class_index];
+    unhash(dc, e);
+    dc->changes++;
+    lru_unlink(cls, e);
+    lru_push_tail(cls, e);
+}
+
+static disk_entry_t *find(disk_cache_t *dc, const char *key, uint32_t hash) {
+    for (disk_entry_t *e = *bucket(dc, hash); e != NULL; e = e->hash_next) {
+        if (e->hash == hash && strcmp(e->key, key) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void free_slot(disk_cache_t *dc, disk_entry_t *e) {
+    disk_class_t *cls = &dc->classes[e->class_index];
+    e->state = DISK_ENTRY_FREE;
+    e->lru_prev = NULL;
+    e->lru_next = cls->free_list;
+    cls->free_list = e;
+}
+
+/* A free slot in the class, or the least recently used ready one that no
+ * reply is sending from. If index.dat names the slot, it goes before the
+ * slot is overwritten.
+ */
+static disk_entry_t *take_slot(disk_cache_t *dc, disk_class_t *cls) {
+    disk_entry_t *e = cls->free_list;
+    if (e != NULL) {
+        cls->free_list = e->lru_next;
+        e->lru_next = NULL;
+    } else {
+        for (e = cls->lru_tail; e != NULL && e->refs > 0; e = e->lru_prev) {
+        }
+        if (e == NULL) {
+            return NULL;
+        }
+        if (e->hashed) {
+            unhash(dc, e);
+            dc->stats.evictions++;
+            dc->changes++;
+        }
+        lru_unlink(cls, e);
+    }
+
+    if (dc->snapshot_live && e->snapshot_gen == dc->snapshot_gen) {
+        disk_job_t *job = malloc(sizeof(disk_job_t));
+        if (job == NULL) {
+            free_slot(dc, e);  /* Not reusable until the file is gone */
+            return NULL;
+        }
+        job->type = DISK_JOB_UNLINK;
+        queue_job(dc, &dc->writer, job);
+        dc->snapshot_live = 0;
+    }
+    return e;
+}
+
+/* A slot for total bytes under key, hashed and FILLING. NULL when every
+ * slot of the class is busy.
+ */
+static disk_entry_t *reserve(disk_cache_t *dc, const char *key, uint32_t hash,
+                             size_t total) {
+    int index = 0;
+    while (dc->classes[index].slot_size < total || dc->classes[index].slots == 0) {
+        index++;
+    }
+    disk_entry_t *e = take_slot(dc, &dc->classes[index]);
+    if (e == NULL) {
+        return NULL;
+    }
+
+    memcpy(e->key, key, strlen(key) + 1);
+    e->hash = hash;
+    e->hashed = 1;
+    e->hash_next = *bucket(dc, hash);
+    *bucket(dc, hash) = e;
+    e->state = DISK_ENTRY_FILLING;
+    e->refs = 0;
+    e->len = total;
+    e->head_len = 0;
+    e->flags = 0;
+    e->compressing = 0;
+    e->incompressible = 0;
+    return e;
+}
+
+/* The variant key: identity key, '\n', coding name. -1 if it won't fit. */
+static int variant_key(const char *key, disk_encoding_t encoding, char *out) {
+    int n = snprintf(out, DISK_CACHE_KEY_MAX, "%s\n%s", key, encoding_names[encoding]);
+    return n < DISK_CACHE_KEY_MAX ? 0 : -1;
+}
+
+/* ============================================================================
+ * LOOKUP
+ * ============================================================================
+ */
+
+/* Codings an Accept-Encoding value allows, bit per disk_encoding_t.
+ * "*" allows both; a q of zero excludes.
+ */
+static unsigned accepted_encodings(const char *value) {
+    unsigned mask = 0;
+
+    while (value != NULL && *value != '\0') {
+        while (*value == ' ' || *value == '\t' || *value == ',') {
+            value++;
+        }
+        const char *name = value;
+        while (*value != '\0' && *value != ',' && *value != ';' &&
+               *value != ' ' && *value != '\t') {
+            value++;
+        }
+        size_t name_len = (size_t)(value - name);
+
+        /* Parameters: only q matters */
+        int refused = 0;
+        while (*value != '\0' && *value != ',') {
+            if (*value == '=' && (value[-1] == 'q' || value[-1] == 'Q')) {
+                refused = strtod(value + 1, NULL) <= 0.0;
+            }
+            value++;
+        }
+        if (refused || name_len == 0) {
+            continue;
+        }
+
+        if (name_len == 2 && strncasecmp(name, "br", 2) == 0) {
+            mask |= 1u << DISK_ENCODING_BR;
+        } else if (name_len == 4 && strncasecmp(name, "gzip", 4) == 0) {
+            mask |= 1u << DISK_ENCODING_GZIP;
+        } else if (name_len == 1 && *name == '*') {
+            mask |= (1u << DISK_ENCODINGS) - 1;
+        }
+    }
+    return mask;
+}
+
+/* The entry under key if it can be served now. An expired one is retired;
+ * *busy says the key exists but is still being filled or written.
+ */
+static disk_entry_t *find_ready(disk_cache_t *dc, const char *key, int *busy) {
+    disk_entry_t *e = find(dc, key, hash_key(key));
+
+    *busy = 0;
+    if (e == NULL) {
+        return NULL;
+    }
+    if (e->state != DISK_ENTRY_READY) {
+        *busy = 1;
+        return NULL;
+    }
+    if (get_timestamp_ms() >= e->expires_ms) {
+        retire(dc, e);
+        dc->stats.expired++;
+        return NULL;
+    }
+    return e;
+}
+
+/* Hand the identity entry e to the compressor for the most preferred
+ * coding the client accepts and the entry has no variant for yet.
+ */
+static void maybe_compress(disk_cache_t *dc, disk_entry_t *e, unsigned accepted) {
+    if (!(e->flags & DISK_ENTRY_COMPRESSIBLE)) {
+        return;
+    }
+    accepted &= ~(e->compressing | e->incompressible);
+
+    for (int i = 0; i < DISK_ENCODINGS; i++) {
+        char key[DISK_CACHE_KEY_MAX];
+        int busy;
+        if (!(accepted & (1u << i)) || variant_key(e->key, (disk_encoding_t)i, key) == -1 ||
+            find_ready(dc, key, &busy) != NULL || busy) {
+            continue;
+        }
+
+        compress_job_t *cj = calloc(1, sizeof(compress_job_t));
+        if (cj == NULL) {
+            return;
+        }
+        cj->job.type = DISK_JOB_COMPRESS;
+        cj->source = e;
+        cj->encoding = (disk_encoding_t)i;
+        e->refs++;  /* The slot stays put until the job comes back */
+        e->compressing |= 1u << i;
+        queue_job(dc, &dc->compressor, &cj->job);
+        return;
+    }
+}
+
+int disk_cache_lookup(disk_cache_t *dc, http_request_t *req, file_reply_t *reply) {
+    char key[DISK_CACHE_KEY_MAX];
+    int busy;
+
+    if (req->method != HTTP_METHOD_GET ||
+        http_request_get_header(req, "Authorization") != NULL ||
+        http_request_get_header(req, "Range") != NULL ||
+        build_key(req, key) == -1) {
+        return 0;
+    }
+
+    unsigned accepted = accepted_encodings(http_request_get_header(req, "Accept-Encoding"));
+    disk_entry_t *e = NULL;
+
+    for (int i = 0; i < DISK_ENCODINGS && e == NULL; i++) {
+        char vkey[DISK_CACHE_KEY_MAX];
+        if ((accepted & (1u << i)) && variant_key(key, (disk_encoding_t)i, vkey) == 0) {
+            e = find_ready(dc, vkey, &busy);
+        }
+    }
+    if (e != NULL) {
+        dc->stats.variant_hits++;
+    } else {
+        e = find_ready(dc, key, &busy);
+        if (e == NULL) {
+            dc->stats.misses++;
+            req->fill.wanted = !busy;  /* Busy: someone else is filling it */
+            return 0;
+        }
+        if (accepted != 0) {
+            maybe_compress(dc, e, accepted);
+        }
+    }
+
+    disk_class_t *cls = &dc->classes[e->class_index];
+    lru_unlink(cls, e);
+    lru_push_head(cls, e);
+    dc->stats.hits++;
+
+    reply->active = 1;
+    reply->fd = cls->fd;
+    reply->refs = &e->refs;
+    reply->body_bytes = &dc->stats.hit_bytes;
+    reply->head_count = 0;
+    reply->head_first = 0;
+    reply->offset = (off_t)e->slot * (off_t)cls->slot_size;
+    reply->remaining = (off_t)e->len;
+    e->refs++;
+    return 1;
+}
+
+/* ============================================================================
+ * FILLING
+ * ============================================================================
+ */
+
+/* Worth compressing, going by the header block: a text type and no
+ * Content-Encoding already.
+ */
+static int compressible(const char *head, size_t len) {
+    static const char *const types[] = {
+        "text/", "application/json", "application/javascript",
+        "application/xml", "image/svg+xml", "+json", "+xml"
+    };
+    int text = 0;
+    const char *line = head;
+    const char *end = head + len;
+
+    while (line < end) {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        eol = eol ? eol + 1 : end;
+        size_t line_len = (size_t)(eol - line);
+
+        if (line_len > 17 && strncasecmp(line, "Content-Encoding:", 17) == 0) {
+            return 0;
+        }
+        if (line_len > 13 && strncasecmp(line, "Content-Type:", 13) == 0) {
+            for (size_t i = 0; i < sizeof(types) / sizeof(types[0]) && !text; i++) {
+                size_t n = strlen(types[i]);
+                for (const char *p = line + 13; p + n <= eol && !text; p++) {
+                    text = strncasecmp(p, types[i], n) == 0;
+                }
+            }
+        }
+        line = eol;
+    }
+    return text;
+}
+
+void disk_cache_begin(disk_cache_t *dc, http_request_t *req, const char *data, size_t len) {
+    const http_response_t *resp = &req->response;
+    disk_fill_t *fill = &req->fill;
+
+    fill->wanted = 0;
+
+    /* The block must start with the final status line: no 1xx before it */
+    if (resp->status_code != 200 || resp->content_length < 0 || !resp->keep_alive ||
+        resp->uncacheable || resp->max_age == 0 ||
+        len < 12 || memcmp(data + 8, " 200", 4) != 0) {
+        dc->stats.skipped++;
+        return;
+    }
+
+    size_t total = resp->header_length + (size_t)resp->content_length;
+    if (total > dc->max_len || dc->staging_bytes + total > DISK_CACHE_STAGING_MAX) {
+        dc->stats.skipped++;
+        return;
+    }
+
+    char key[DISK_CACHE_KEY_MAX];
+    if (build_key(req, key) == -1) {
+        return;  /* Lookup checked it already */
+    }
+    uint32_t hash = hash_key(key);
+    if (find(dc, key, hash) != NULL) {
+        dc->stats.skipped++;  /* Filled by another client meanwhile */
+        return;
+    }
+
+    char *staging = malloc(total);
+    if (staging == NULL) {
+        dc->stats.skipped++;
+        return;
+    }
+    disk_entry_t *e = reserve(dc, key, hash, total);
+    if (e == NULL) {
+        free(staging);
+        dc->stats.skipped++;  /* Every slot in the class is busy */
+        return;
+    }
+    e->staging = staging;
+    e->head_len = resp->header_length;
+    if (compressible(data, resp->header_length) &&
+        (size_t)resp->content_length >= DISK_CACHE_COMPRESS_MIN) {
+        e->flags |= DISK_ENTRY_COMPRESSIBLE;
+    }
+
+    int64_t ttl = resp->max_age > 0 ? resp->max_age : DISK_CACHE_DEFAULT_TTL_S;
+    e->expires_ms = get_timestamp_ms() + (uint64_t)ttl * 1000;
+
+    fill->cache = dc;
+    fill->entry = e;
+    fill->len = 0;
+    fill->expected = total;
+    dc->staging_bytes += total;
+    dc->stats.fills++;
+}
+
+void disk_cache_tee(disk_fill_t *fill, const char *data, size_t len) {
+    disk_entry_t *e = fill->entry;
+    size_t room = fill->expected - fill->len;
+
+    memcpy(e->staging + fill->len, data, len < room ? len : room);
+    fill->len += len < room ? len : room;
+    if (fill->len < fill->expected) {
+        return;
+    }
+
+    disk_cache_t *dc = fill->cache;
+    fill->entry = NULL;
+    e->state = DISK_ENTRY_WRITING;
+    e->job.type = DISK_JOB_STORE;
+    queue_job(dc, &dc->writer, &e->job);
+}
+
+void disk_cache_abort(disk_fill_t *fill) {
+    disk_entry_t *e = fill->entry;
+
+    fill->wanted = 0;
+    if (e == NULL) {
+        return;
+    }
+
+    disk_cache_t *dc = fill->cache;
+    unhash(dc, e);
+    free(e->staging);
+    e->staging = NULL;
+    dc->staging_bytes -= fill->expected;
+    free_slot(dc, e);
+    dc->stats.aborted++;
+    fill->entry = NULL;
+}
+
+/* A compression came back: stage the variant for the writer like a fill,
+ * unless the source has gone meanwhile or it didn't pay off.
+ */
+static void store_variant(disk_cache_t *dc, compress_job_t *cj) {
+    disk_entry_t *src = cj->source;
+    unsigned bit = 1u << cj->encoding;
+    char key[DISK_CACHE_KEY_MAX];
+
+    src->refs--;
+    src->compressing &= ~bit;
+
+    if (cj->output == NULL) {
+        src->incompressible |= bit;
+        dc->stats.incompressible++;
+    } else if (src->hashed && src->state == DISK_ENTRY_READY &&
+               variant_key(src->key, cj->encoding, key) == 0 &&
+               dc->staging_bytes + cj->output_len <= DISK_CACHE_STAGING_MAX) {
+        uint32_t hash = hash_key(key);
+        disk_entry_t *e = find(dc, key, hash) == NULL
+                              ? reserve(dc, key, hash, cj->output_len) : NULL;
+        if (e != NULL) {
+            e->staging = cj->output;
+            e->head_len = cj->head_len;
+            e->flags = DISK_ENTRY_VARIANT;
+            e->expires_ms = src->expires_ms;
+            e->state = DISK_ENTRY_WRITING;
+            e->job.type = DISK_JOB_STORE;
+            dc->staging_bytes += e->len;
+            dc->stats.compressed++;
+            queue_job(dc, &dc->writer, &e->job);
+            cj->output = NULL;
+        }
+    }
+    free(cj->output);
+    free(cj);
+}
+
+void disk_cache_poll(proxy_config_t *config) {
+    disk_cache_t *dc = config->disk_cache;
+    uint64_t count;
+
+    ssize_t n = read(dc->event_fd, &count, sizeof(count));
+    syscount(config, SYSCALL_SIDE_LOOP, SYSCALL_READ, n);
+
+    pthread_mutex_lock(&dc->lock);
+    disk_job_t *job = dc->done;
+    dc->done = NULL;
+    pthread_mutex_unlock(&dc->lock);
+
+    while (job != NULL) {
+        disk_job_t *next = job->next;
+        if (job->type == DISK_JOB_COMPRESS) {
+            store_variant(dc, (compress_job_t *)job);
+            job = next;
+            continue;
+        }
+
+        disk_entry_t *e = job_entry(job);
+        job = next;
+        free(e->staging);
+        e->staging = NULL;
+        dc->staging_bytes -= e->len;
+        dc->stats.stored++;
+        dc->stats.bytes_written += e->len;
+        dc->changes++;
+
+        e->state = DISK_ENTRY_READY;
+        lru_push_head(&dc->classes[e->class_index], e);
+    }
+}
+
+/* ============================================================================
+ * SNAPSHOTS
+ * ============================================================================
+ */
+
+/* Copy every servable entry into an image for the writer, most recently
+ * used first within each class so a restore keeps the LRU order.
+ */
+static void queue_snapshot(disk_cache_t *dc) {
+    uint64_t now = get_timestamp_ms();
+    size_t count = 0;
+
+    for (int i = 0; i < DISK_CACHE_CLASSES; i++) {
+        for (disk_entry_t *e = dc->classes[i].lru_head; e != NULL; e = e->lru_next) {
+            count += e->hashed && e->expires_ms > now;
+        }
+    }
+
+    snapshot_job_t *snap = malloc(sizeof(snapshot_job_t) +
+                                  count * sizeof(disk_snapshot_record_t));
+    if (snap == NULL) {
+        fprintf(stderr, "disk cache: no memory for a snapshot\n");
+        return;
+    }
+
+    uint64_t wall = unix_ms();
+    dc->snapshot_gen++;
+    snap->job.type = DISK_JOB_SNAPSHOT;
+    snap->count = 0;
+    memset(&snap->header, 0, sizeof(snap->header));
+    snap->header.magic = DISK_SNAPSHOT_MAGIC;
+    snap->header.version = DISK_SNAPSHOT_VERSION;
+    snap->header.written_unix_ms = wall;
+
+    for (int i = 0; i < DISK_CACHE_CLASSES; i++) {
+        disk_class_t *cls = &dc->classes[i];
+        snap->header.classes[i].slot_size = cls->slot_size;
+        snap->header.classes[i].slots = cls->slots;
+
+        for (disk_entry_t *e = cls->lru_head; e != NULL; e = e->lru_next) {
+            if (!e->hashed || e->expires_ms <= now) {
+                continue;
+            }
+            disk_snapshot_record_t *rec = &snap->records[snap->count++];
+            rec->expires_unix_ms = wall + (e->expires_ms - now);
+            rec->len = e->len;
+            rec->head_len = e->head_len;
+            rec->flags = e->flags;
+            rec->reserved = 0;
+            rec->class_index = (uint32_t)i;
+            rec->slot = e->slot;
+            size_t key_len = strlen(e->key);
+            memcpy(rec->key, e->key, key_len);
+            memset(rec->key + key_len, 0, sizeof(rec->key) - key_len);
+            e->snapshot_gen = dc->snapshot_gen;
+        }
+    }
+    snap->header.count = (uint32_t)snap->count;
+
+    queue_job(dc, &dc->writer, &snap->job);
+    dc->snapshot_live = 1;
+    dc->changes = 0;
+    dc->stats.snapshots++;
+}
+
+void disk_cache_tick(disk_cache_t *dc, uint64_t now) {
+    if (now < dc->next_snapshot_ms) {
+        return;
+    }
+    dc->next_snapshot_ms = now + DISK_CACHE_SNAPSHOT_S * 1000;
+    if (dc->changes > 0) {
+        queue_snapshot(dc);
+    }
+}
+
+/* Does the file describe these slab files? */
+static int snapshot_matches(const disk_cache_t *dc, const disk_snapshot_header_t *h,
+                            size_t size) {
+    if (size < sizeof(*h) || h->magic != DISK_SNAPSHOT_MAGIC ||
+        h->version != DISK_SNAPSHOT_VERSION ||
+        size != sizeof(*h) + (size_t)h->count * sizeof(disk_snapshot_record_t)) {
+        return 0;
+    }
+    for (int i = 0; i < DISK_CACHE_CLASSES; i++) {
+        if (h->classes[i].slot_size != dc->classes[i].slot_size ||
+            h->classes[i].slots != dc->classes[i].slots) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Runs before the free lists are built: a restored slot just becomes
+ * READY. Contents aren't touched; the first hits page them in.
+ */
+static void load_snapshot(disk_cache_t *dc) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/index.dat", dc->dir);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror(path);
+        }
+        return;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s: unreadable, starting cold\n", path);
+        return;
+    }
+
+    const disk_snapshot_header_t *h = map;
+    if (!snapshot_matches(dc, h, (size_t)st.st_size)) {
+        fprintf(stderr, "%s: doesn't match this cache (-Z changed?), starting cold\n", path);
+        munmap(map, (size_t)st.st_size);
+        unlink(path);
+        return;
+    }
+
+    const disk_snapshot_record_t *rec = (const disk_snapshot_record_t *)(h + 1);
+    uint64_t now = get_timestamp_ms();
+    uint64_t wall = unix_ms();
+
+    dc->snapshot_gen = 1;
+    for (uint32_t i = 0; i < h->count; i++, rec++) {
+        if (rec->class_index >= DISK_CACHE_CLASSES || rec->expires_unix_ms <= wall ||
+            memchr(rec->key, '\0', sizeof(rec->key)) == NULL) {
+            continue;
+        }
+        disk_class_t *cls = &dc->classes[rec->class_index];
+        if (rec->slot >= cls->slots || rec->len == 0 || rec->len > cls->slot_size ||
+            rec->head_len >= rec->len) {
+            continue;
+        }
+        disk_entry_t *e = &cls->entries[rec->slot];
+        uint32_t hash = hash_key(rec->key);
+        if (e->state != DISK_ENTRY_FREE || find(dc, rec->key, hash) != NULL) {
+            continue;
+        }
+
+        memcpy(e->key, rec->key, sizeof(e->key));
+        e->hash = hash;
+        e->hashed = 1;
+        e->hash_next = *bucket(dc, hash);
+        *bucket(dc, hash) = e;
+        e->state = DISK_ENTRY_READY;
+        e->len = rec->len;
+        e->head_len = rec->head_len;
+        e->flags = rec->flags & (DISK_ENTRY_COMPRESSIBLE | DISK_ENTRY_VARIANT);
+        e->expires_ms = now + (rec->expires_unix_ms - wall);
+        e->snapshot_gen = dc->snapshot_gen;
+        lru_push_tail(cls, e);
+        dc->stats.loaded++;
+    }
+
+    /* The file names exactly what was restored, until a slot is reused */
+    dc->snapshot_live = 1;
+    munmap(map, (size_t)st.st_size);
+}
+
+void disk_cache_print(const disk_cache_t *dc) {
+    uint64_t lookups = dc->stats.hits + dc->stats.misses;
+    printf("Cache hits:         %lu of %lu (%.1f%%), %lu bytes sent from slots\n",
+           (unsigned long)dc->stats.hits, (unsigned long)lookups,
+           lookups ? 100.0 * (double)dc->stats.hits / (double)lookups : 0.0,
+           (unsigned long)dc->stats.hit_bytes);
+    printf("Cache fills:        %lu staged, %lu stored, %lu aborted, %lu skipped\n",
+           (unsigned long)dc->stats.fills, (unsigned long)dc->stats.stored,
+           (unsigned long)dc->stats.aborted, (unsigned long)dc->stats.skipped);
+    printf("Cache evictions:    %lu (%lu expired), %lu bytes written\n",
+           (unsigned long)dc->stats.evictions, (unsigned long)dc->stats.expired,
+           (unsigned long)dc->stats.bytes_written);
+    printf("Cache variants:     %lu compressed, %lu incompressible, %lu hits sent compressed\n",
+           (unsigned long)dc->stats.compressed, (unsigned long)dc->stats.incompressible,
+           (unsigned long)dc->stats.variant_hits);
+    printf("Cache snapshots:    %lu entries restored at startup, %lu periodic snapshots\n",
+           (unsigned long)dc->stats.loaded, (unsigned long)dc->stats.snapshots);
+}
@@ -0,0 +1,25 @@
+#include "file_reply.h"
+#include <stddef.h>
+
+int file_reply_advance(file_reply_t *reply, size_t n) {
+    while (reply->head_count > 0) {
+        struct iovec *iov = &reply->head[reply->head_first];
+        if (n < iov->iov_len) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+            return 0;
+        }
+        n -= iov->iov_len;
+        reply->head_first++;
+        reply->head_count--;
+    }
+    return 1;
+}
+
+void file_reply_end(file_reply_t *reply) {
+    if (reply->refs != NULL) {
+        (*reply->refs)--;
+        reply->refs = NULL;
+    }
+    reply->active = 0;
+}
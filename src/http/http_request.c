@@ -1,8 +1,11 @@
+#define _GNU_SOURCE
 #include "http_request.h"
+#include "arena.h"
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 /* ============================================================================
  * HELPER FUNCTIONS
@@ -131,6 +134,13 @@ static int parse_request_line(http_request_t *req, const char *line, size_t len)
     const char *p = line;
     const char *end = line + len;
     
+    /* The line ends at the first CRLF; a lone CR or LF before it is not a
+     * line end a later hop agrees on, and never part of a target.
+     */
+    if (memchr(line, '\r', len) != NULL || memchr(line, '\n', len) != NULL) {
+        return -1;
+    }
+    
     /* Parse method */
     const char *method_start = p;
     while (p < end && *p != ' ') p++;
@@ -236,6 +246,10 @@ static int parse_header(http_request_t *req, const char *line, size_t len) {
         if (strncasecmp_custom(header->value, "chunked", 7) == 0) {
             req->chunked = 1;
         }
+    } else if (strncasecmp_custom(header->name, "Expect", 6) == 0) {
+        if (strncasecmp_custom(header->value, "100-continue", 12) == 0) {
+            req->expect_continue = 1;
+        }
     }
     
     return 0;
@@ -247,10 +261,32 @@ static int parse_header(http_request_t *req, const char *line, size_t len) {
  */
 
 void http_request_init(http_request_t *req) {
-    memset(req, 0, sizeof(http_request_t));
-    req->content_length = -1;  /* -1 means "not specified" */
+    /* No memset: the struct is over half a megabyte, almost all of it
+     * header storage that the parser overwrites before reading.
+     */
+    req->method = HTTP_METHOD_UNKNOWN;
+    req->method_str[0] = '\0';
+    req->path[0] = '\0';
     req->version = HTTP_VERSION_11;  /* Default to HTTP/1.1 */
+    req->host[0] = '\0';
+    req->header_count = 0;
+    req->content_length = -1;  /* -1 means "not specified" */
+    req->chunked = 0;
+    req->expect_continue = 0;
+    req->body_left = 0;
     req->keep_alive = 1;  /* HTTP/1.1 defaults to keep-alive */
+    req->is_complete = 0;
+    req->headers_end_offset = 0;
+    req->total_length = 0;
+    req->started_us = 0;
+    req->raw_data = NULL;
+    req->raw_data_len = 0;
+    req->file.active = 0;
+    req->file.refs = NULL;
+    disk_cache_abort(&req->fill);  /* Response never completed */
+    spool_reset(&req->spool);
+    spool_reset(&req->body);
+    arena_reset(&req->arena);
 }
 
 int http_request_parse(http_request_t *req, const char *data, size_t len) {
@@ -272,6 +308,15 @@ int http_request_parse(http_request_t *req, const char *data, size_t len) {
     
     req->headers_end_offset = (header_end - data) + 4;  /* +4 for \r\n\r\n */
     
+    /* Headers are re-parsed on every call until the body is complete, so
+     * start from a clean header table each time.
+     */
+    req->header_count = 0;
+    req->host[0] = '\0';
+    req->content_length = -1;
+    req->chunked = 0;
+    req->expect_continue = 0;
+    
     /* Parse request line */
     const char *line_start = data;
     const char *crlf = find_crlf(data, len);
@@ -284,8 +329,11 @@ int http_request_parse(http_request_t *req, const char *data, size_t len) {
     /* Parse headers */
     line_start = crlf + 2;  /* Skip \r\n */
     
+    /* header_end points at the final "\r\n\r\n"; its first CRLF ends the
+     * last header line, so search up to and including it.
+     */
     while (line_start < header_end) {
-        crlf = find_crlf(line_start, header_end - line_start);
+        crlf = find_crlf(line_start, header_end + 2 - line_start);
         if (!crlf) break;
         
         size_t line_len = crlf - line_start;
@@ -341,6 +389,100 @@ int http_request_parse(http_request_t *req, const char *data, size_t len) {
     return req->is_complete ? 1 : 0;
 }
 
+/* ============================================================================
+ * REQUEST POOL
+ * ============================================================================
+ */
+
+/* Each chunk starts with this header; requests follow it back to back */
+typedef struct http_request_chunk {
+    struct http_request_chunk *next;
+} http_request_chunk_t;
+
+#define HTTP_REQUEST_CHUNK_HEADER 64
+
+void http_request_pool_init(http_request_pool_t *pool, arena_pool_t *arenas) {
+    pool->arenas = arenas;
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    pool->total = 0;
+    pool->chunks = NULL;
+}
+
+/* Unlike the other pools, chunks are plain 4K pages, never huge ones: a
+ * request is ~540KB of mostly unused header slots, and only the pages the
+ * parser writes get faulted in (its first few, plus the one holding the
+ * arena and free-list link at its end). A huge page would fault in all of
+ * it, every slot, on first touch.
+ */
+static int http_request_pool_grow(http_request_pool_t *pool) {
+    http_request_chunk_t *chunk = mmap(NULL, HTTP_REQUEST_POOL_CHUNK_SIZE,
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+        perror("request pool mmap");
+        return -1;
+    }
+#ifdef MADV_NOHUGEPAGE
+    /* THP set to "always" would back it with huge pages regardless */
+    madvise(chunk, HTTP_REQUEST_POOL_CHUNK_SIZE, MADV_NOHUGEPAGE);
+#endif
+    
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    
+    size_t count = (HTTP_REQUEST_POOL_CHUNK_SIZE - HTTP_REQUEST_CHUNK_HEADER) /
+                   sizeof(http_request_t);
+    http_request_t *reqs = (http_request_t *)((char *)chunk + HTTP_REQUEST_CHUNK_HEADER);
+    for (size_t i = 0; i < count; i++) {
+        arena_init(&reqs[i].arena, pool->arenas);
+        reqs[i].next_free = pool->free_list;
+        pool->free_list = &reqs[i];
+    }
+    
+    pool->free_count += count;
+    pool->total += count;
+    return 0;
+}
+
+http_request_t *http_request_pool_get(http_request_pool_t *pool) {
+    if (pool->free_list == NULL && http_request_pool_grow(pool) == -1) {
+        return NULL;
+    }
+    
+    http_request_t *req = pool->free_list;
+    pool->free_list = req->next_free;
+    pool->free_count--;
+    
+    req->next_free = NULL;
+    http_request_init(req);
+    return req;
+}
+
+void http_request_pool_put(http_request_pool_t *pool, http_request_t *req) {
+    if (req == NULL) {
+        return;
+    }
+    file_reply_end(&req->file);  /* Client left mid-file */
+    disk_cache_abort(&req->fill);
+    spool_reset(&req->spool);
+    spool_reset(&req->body);
+    arena_release(&req->arena);
+    req->next_free = pool->free_list;
+    pool->free_list = req;
+    pool->free_count++;
+}
+
+void http_request_pool_destroy(http_request_pool_t *pool) {
+    http_request_chunk_t *chunk = pool->chunks;
+    while (chunk != NULL) {
+        http_request_chunk_t *next = chunk->next;
+        munmap(chunk, HTTP_REQUEST_POOL_CHUNK_SIZE);
+        chunk = next;
+    }
+    http_request_pool_init(pool, pool->arenas);
+}
+
 /* ============================================================================
  * QUERY FUNCTIONS
  * ============================================================================
@@ -371,14 +513,20 @@ int http_request_is_valid(const http_request_t *req) {
         return 0;
     }
     
-    /* Content-Length must be reasonable (< 100MB) */
-    if (req->content_length > 100 * 1024 * 1024) {
+    /* Content-Length must be reasonable */
+    if (req->content_length > MAX_BODY_LEN) {
         return 0;
     }
     
     return 1;
 }
 
+size_t http_request_buffered_length(const http_request_t *req, size_t buffered) {
+    size_t len = req->body.owner != NULL ? req->headers_end_offset
+                                         : req->total_length;
+    return len < buffered ? len : buffered;
+}
+
 /* ============================================================================
  * ERROR RESPONSES
  * ============================================================================
@@ -389,6 +537,7 @@ const char* http_get_status_line(int status_code) {
         case 200: return "HTTP/1.1 200 OK\r\n";
         case 400: return "HTTP/1.1 400 Bad Request\r\n";
         case 404: return "HTTP/1.1 404 Not Found\r\n";
+        case 405: return "HTTP/1.1 405 Method Not Allowed\r\n";
         case 413: return "HTTP/1.1 413 Request Entity Too Large\r\n";
         case 500: return "HTTP/1.1 500 Internal Server Error\r\n";
         case 502: return "HTTP/1.1 502 Bad Gateway\r\n";
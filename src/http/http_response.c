@@ -0,0 +1,259 @@
+#define _POSIX_C_SOURCE 200809L
+#include "http_response.h"
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+/* ============================================================================
+ * HELPERS
+ * ============================================================================
+ */
+
+/* Find double CRLF (end of headers) */
+static const char* find_header_end(const char *data, size_t len) {
+    if (len < 4) return NULL;
+    
+    for (size_t i = 0; i < len - 3; i++) {
+        if (data[i] == '\r' && data[i + 1] == '\n' &&
+            data[i + 2] == '\r' && data[i + 3] == '\n') {
+            return data + i;
+        }
+    }
+    return NULL;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Does header line [line, end) have this name? Returns pointer to the
+ * value (leading whitespace skipped) or NULL.
+ */
+static const char* header_value(const char *line, const char *end,
+                                const char *name, size_t name_len) {
+    if ((size_t)(end - line) <= name_len || line[name_len] != ':' ||
+        strncasecmp(line, name, name_len) != 0) {
+        return NULL;
+    }
+    
+    const char *value = line + name_len + 1;
+    while (value < end && (*value == ' ' || *value == '\t')) {
+        value++;
+    }
+    return value;
+}
+
+/* ============================================================================
+ * HEADER PARSING
+ * ============================================================================
+ */
+
+void http_response_init(http_response_t *resp, int head_request) {
+    resp->state = HTTP_RESP_HEADERS;
+    resp->status_code = 0;
+    resp->keep_alive = 1;
+    resp->http10 = 0;
+    resp->head_request = head_request;
+    resp->remaining = 0;
+    resp->header_length = 0;
+    resp->interim_length = 0;
+    resp->line_length = 0;
+    resp->chunk_ext = 0;
+    resp->content_length = -1;
+    resp->max_age = -1;
+    resp->uncacheable = 0;
+}
+
+/* Cache-Control: pick out what a shared cache must obey */
+static void parse_cache_control(http_response_t *resp, const char *value, const char *end) {
+    while (value < end) {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ',')) {
+            value++;
+        }
+        const char *token = value;
+        while (value < end && *value != ',') {
+            value++;
+        }
+        size_t len = (size_t)(value - token);
+        
+        if ((len >= 8 && strncasecmp(token, "no-store", 8) == 0) ||
+            (len >= 8 && strncasecmp(token, "no-cache", 8) == 0) ||
+            (len >= 7 && strncasecmp(token, "private", 7) == 0)) {
+            resp->uncacheable = 1;
+        } else if (len > 9 && strncasecmp(token, "s-maxage=", 9) == 0) {
+            resp->max_age = atoll(token + 9);  /* Overrides max-age */
+        } else if (len > 8 && strncasecmp(token, "max-age=", 8) == 0 &&
+                   resp->max_age < 0) {
+            resp->max_age = atoll(token + 8);
+        }
+    }
+}
+
+int http_response_parse_headers(http_response_t *resp, const char *data, size_t len) {
+    const char *header_end = find_header_end(data, len);
+    if (!header_end) {
+        return 0;
+    }
+    resp->header_length = (header_end - data) + 4;
+    
+    /* Status line: "HTTP/1.1 200 OK" */
+    if (len < 12 || strncmp(data, "HTTP/1.", 7) != 0 || data[8] != ' ') {
+        resp->state = HTTP_RESP_INVALID;
+        return -1;
+    }
+    resp->keep_alive = (data[7] == '1');  /* HTTP/1.0 defaults to close */
+    resp->http10 = (data[7] == '0');
+    resp->status_code = atoi(data + 9);
+    if (resp->status_code < 100 || resp->status_code > 999) {
+        resp->state = HTTP_RESP_INVALID;
+        return -1;
+    }
+    
+    /* Scan headers for the ones that decide framing */
+    int64_t content_length = -1;
+    int chunked = 0;
+    const char *line = memchr(data, '\n', header_end - data);
+    line = line ? line + 1 : header_end;
+    
+    while (line < header_end) {
+        const char *eol = memchr(line, '\r', header_end + 2 - line);
+        if (!eol) break;
+        
+        const char *value;
+        if ((value = header_value(line, eol, "Content-Length", 14)) != NULL) {
+            content_length = atoll(value);
+        } else if ((value = header_value(line, eol, "Transfer-Encoding", 17)) != NULL) {
+            chunked = (strncasecmp(value, "chunked", 7) == 0);
+        } else if ((value = header_value(line, eol, "Connection", 10)) != NULL) {
+            if (strncasecmp(value, "close", 5) == 0) {
+                resp->keep_alive = 0;
+            } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+                resp->keep_alive = 1;
+            }
+        } else if ((value = header_value(line, eol, "Cache-Control", 13)) != NULL) {
+            parse_cache_control(resp, value, eol);
+        } else if (header_value(line, eol, "Set-Cookie", 10) != NULL ||
+                   header_value(line, eol, "Vary", 4) != NULL) {
+            resp->uncacheable = 1;
+        }
+        
+        line = eol + 2;
+    }
+    
+    resp->content_length = chunked ? -1 : content_length;
+    
+    /* Pick the framing (RFC 9112 section 6.3) */
+    if (resp->status_code == 101) {
+        /* Switching Protocols: whatever follows is a tunnel until close */
+        resp->state = HTTP_RESP_BODY_EOF;
+        resp->keep_alive = 0;
+    } else if (resp->head_request || resp->status_code < 200 ||
+               resp->status_code == 204 || resp->status_code == 304) {
+        resp->state = HTTP_RESP_DONE;
+    } else if (chunked) {
+        resp->state = HTTP_RESP_CHUNK_SIZE;
+        resp->remaining = 0;
+        resp->line_length = 0;
+        resp->chunk_ext = 0;
+    } else if (content_length >= 0) {
+        resp->remaining = content_length;
+        resp->state = content_length > 0 ? HTTP_RESP_BODY_LENGTH : HTTP_RESP_DONE;
+    } else {
+        /* Close-delimited: the upstream can't be reused */
+        resp->state = HTTP_RESP_BODY_EOF;
+        resp->keep_alive = 0;
+    }
+    
+    return 1;
+}
+
+/* ============================================================================
+ * BODY FRAMING
+ * ============================================================================
+ */
+
+size_t http_response_consume(http_response_t *resp, const char *data, size_t len) {
+    size_t i = 0;
+    
+    while (i < len) {
+        switch (resp->state) {
+            case HTTP_RESP_BODY_EOF:
+                return len;
+                
+            case HTTP_RESP_BODY_LENGTH:
+            case HTTP_RESP_CHUNK_DATA: {
+                size_t take = len - i;
+                if ((int64_t)take > resp->remaining) {
+                    take = (size_t)resp->remaining;
+                }
+                i += take;
+                resp->remaining -= take;
+                if (resp->remaining == 0) {
+                    resp->state = (resp->state == HTTP_RESP_BODY_LENGTH)
+                                  ? HTTP_RESP_DONE : HTTP_RESP_CHUNK_CRLF;
+                }
+                break;
+            }
+            
+            case HTTP_RESP_CHUNK_SIZE: {
+                char c = data[i++];
+                if (c == '\n') {
+                    if (resp->line_length == 0) {
+                        resp->state = HTTP_RESP_INVALID;
+                        return i;
+                    }
+                    resp->line_length = 0;
+                    resp->chunk_ext = 0;
+                    resp->state = resp->remaining ? HTTP_RESP_CHUNK_DATA
+                                                  : HTTP_RESP_TRAILERS;
+                } else if (c == '\r' || resp->chunk_ext) {
+                    /* Skip CR and chunk extensions */
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    resp->chunk_ext = 1;
+                } else {
+                    int v = hex_value(c);
+                    if (v < 0 || resp->remaining > (INT64_MAX >> 4)) {
+                        resp->state = HTTP_RESP_INVALID;
+                        return i;
+                    }
+                    resp->remaining = resp->remaining * 16 + v;
+                    resp->line_length++;
+                }
+                break;
+            }
+            
+            case HTTP_RESP_CHUNK_CRLF:
+                if (data[i++] == '\n') {
+                    resp->state = HTTP_RESP_CHUNK_SIZE;
+                    resp->remaining = 0;
+                }
+                break;
+                
+            case HTTP_RESP_TRAILERS: {
+                char c = data[i++];
+                if (c == '\n') {
+                    if (resp->line_length == 0) {
+                        resp->state = HTTP_RESP_DONE;
+                    }
+                    resp->line_length = 0;
+                } else if (c != '\r') {
+                    resp->line_length++;
+                }
+                break;
+            }
+            
+            default:
+                /* HEADERS, DONE or INVALID: nothing here belongs to the body */
+                return i;
+        }
+    }
+    
+    return i;
+}
+
+int http_response_is_complete(const http_response_t *resp) {
+    return resp->state == HTTP_RESP_DONE;
+}
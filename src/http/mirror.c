@@ -0,0 +1,349 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mirror.h"
+#include "buffer.h"
+#include "connection.h"
+#include "epoll.h"
+#include "hugepage.h"
+#include "syscount.h"
+#include "timer.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* ============================================================================
+ * SETUP
+ * ============================================================================
+ */
+
+static size_t slots_size(uint32_t count) {
+    return count * sizeof(mirror_slot_t);
+}
+
+mirror_t *mirror_create(uint32_t slot_count) {
+    mirror_t *m = calloc(1, sizeof(mirror_t));
+    if (m == NULL) {
+        perror("mirror");
+        return NULL;
+    }
+
+    m->slots = hugepage_alloc(slots_size(slot_count), NULL);
+    if (m->slots == NULL) {
+        fprintf(stderr, "mirror: can't allocate %u slots\n", slot_count);
+        free(m);
+        return NULL;
+    }
+    m->slot_count = slot_count;
+
+    for (int i = (int)slot_count - 1; i >= 0; i--) {
+        m->slots[i].fd = -1;
+        m->slots[i].next_free = m->free_list;
+        m->free_list = &m->slots[i];
+    }
+    return m;
+}
+
+static void finish(proxy_config_t *config, mirror_slot_t *slot);
+
+void mirror_destroy(proxy_config_t *config, mirror_t *m) {
+    if (m == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < m->slot_count; i++) {
+        if (m->slots[i].fd != -1) {
+            finish(config, &m->slots[i]);
+        }
+    }
+    hugepage_free(m->slots, slots_size(m->slot_count));
+    free(m);
+}
+
+int mirror_add_route(mirror_t *m, char *spec) {
+    char *eq = strchr(spec, '=');
+    char *colon = eq != NULL ? strrchr(eq + 1, ':') : NULL;
+    if (eq == NULL || colon == NULL || spec[0] != '/') {
+        fprintf(stderr, "Invalid mirror route '%s' (expected /PREFIX=ADDR:PORT)\n", spec);
+        return -1;
+    }
+    if (m->route_count == MIRROR_MAX_ROUTES) {
+        fprintf(stderr, "Too many mirror routes (at most %d)\n", MIRROR_MAX_ROUTES);
+        return -1;
+    }
+
+    char *end;
+    long port = strtol(colon + 1, &end, 10);
+    struct in_addr addr;
+    *eq = '\0';
+    *colon = '\0';
+    if (*end != '\0' || port <= 0 || port > 65535 || inet_pton(AF_INET, eq + 1, &addr) != 1) {
+        fprintf(stderr, "Mirror route %s: bad shadow address %s:%s\n", spec, eq + 1, colon + 1);
+        return -1;
+    }
+
+    mirror_route_t *route = &m->routes[m->route_count++];
+    route->prefix = spec;
+    route->prefix_len = strlen(spec);
+    route->addr = eq + 1;
+    route->port = (uint16_t)port;
+    return 0;
+}
+
+mirror_route_t *mirror_route(mirror_t *m, const char *path) {
+    mirror_route_t *best = NULL;
+    for (int i = 0; i < m->route_count; i++) {
+        mirror_route_t *route = &m->routes[i];
+        if (strncmp(path, route->prefix, route->prefix_len) == 0 &&
+            (best == NULL || route->prefix_len > best->prefix_len)) {
+            best = route;
+        }
+    }
+    return best;
+}
+
+/* ============================================================================
+ * SHADOW REQUESTS
+ * ============================================================================
+ */
+
+/* Is ptr (a timer node) inside the slot array? */
+static mirror_slot_t *slot_of(const mirror_t *m, const void *ptr) {
+    uintptr_t p = (uintptr_t)ptr;
+    uintptr_t base = (uintptr_t)m->slots;
+    if (p < base || p >= base + slots_size(m->slot_count)) {
+        return NULL;
+    }
+    return &m->slots[(p - base) / sizeof(mirror_slot_t)];
+}
+
+/* Close the shadow connection, drop both buffers and free the slot */
+static void finish(proxy_config_t *config, mirror_slot_t *slot) {
+    mirror_t *m = config->mirror;
+
+    timer_cancel(&config->timers, &slot->timer);
+    syscount_n(config, SYSCALL_SIDE_MIRROR, SYSCALL_CLOSE, 1);
+    close(slot->fd);
+    slot->fd = -1;
+
+    buffer_pool_put(&config->buffers, slot->request);
+    buffer_pool_put(&config->buffers, slot->response);
+    slot->request = NULL;
+    slot->response = NULL;
+
+    slot->next_free = m->free_list;
+    m->free_list = slot;
+    m->in_flight--;
+}
+
+static void fail(proxy_config_t *config, mirror_slot_t *slot) {
+    slot->route->stats.failed++;
+    finish(config, slot);
+}
+
+void mirror_request(proxy_config_t *config, mirror_route_t *route,
+                    buffer_t *buf, size_t len, int head_request) {
+    mirror_t *m = config->mirror;
+    mirror_slot_t *slot = m->free_list;
+
+    /* Shed, don't queue: the primary never waits on the shadow */
+    if (slot == NULL) {
+        route->stats.dropped++;
+        return;
+    }
+
+    int fd = create_backend_connection(route->addr, route->port);
+    syscount_n(config, SYSCALL_SIDE_MIRROR, SYSCALL_SOCKET, 1);
+    syscount_n(config, SYSCALL_SIDE_MIRROR, SYSCALL_FCNTL, SYSCOUNT_SET_NONBLOCKING);
+    syscount_n(config, SYSCALL_SIDE_MIRROR, SYSCALL_SOCKOPT, SYSCOUNT_SOCKET_OPTIONS);
+    syscount_n(config, SYSCALL_SIDE_MIRROR, SYSCALL_CONNECT, 1);
+    if (fd == -1) {
+        route->stats.failed++;
+        return;
+    }
+
+    /* Both directions at once: edge-triggered, so no EPOLL_CTL_MOD later */
+    syscount_n(config, SYSCALL_SIDE_MIRROR, SYSCALL_EPOLL_CTL, 1);
+    if (epoll_add(config->epoll_fd, fd, EPOLLIN | EPOLLOUT,
+                  epoll_tag(slot, EPOLL_SOURCE_MIRROR)) == -1) {
+        syscount_n(config, SYSCALL_SIDE_MIRROR, SYSCALL_CLOSE, 1);
+        close(fd);
+        route->stats.failed++;
+        return;
+    }
+
+    m->free_list = slot->next_free;
+    m->in_flight++;
+    slot->fd = fd;
+    slot->connecting = 1;
+    slot->route = route;
+    slot->request = buffer_ref(buf);
+    slot->request_len = len;
+    slot->sent = 0;
+    slot->response = NULL;
+    http_response_init(&slot->framing, head_request);
+    timer_schedule(&config->timers, &slot->timer, get_timestamp_ms() + MIRROR_TIMEOUT_MS);
+    route->stats.mirrored++;
+}
+
+/* Returns 1 once the whole request is out (and its buffer released), 0 if
+ * the socket is full, -1 on error.
+ */
+static int send_request(proxy_config_t *config, mirror_slot_t *slot) {
+    while (slot->sent < slot->request_len) {
+        ssize_t n = write(slot->fd, slot->request->data + slot->sent,
+                          slot->request_len - slot->sent);
+        syscount(config, SYSCALL_SIDE_MIRROR, SYSCALL_WRITE, n);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        slot->sent += (size_t)n;
+    }
+
+    buffer_pool_put(&config->buffers, slot->request);
+    slot->request = NULL;
+    slot->response = buffer_pool_get(&config->buffers);
+    return slot->response != NULL ? 1 : -1;
+}
+
+/* Frame n freshly read bytes and throw them away. Only an incomplete header
+ * block is kept in the buffer. Returns 1 when the response is complete, 0
+ * if more is expected, -1 if it can't be framed.
+ */
+static int frame(mirror_slot_t *slot, size_t n) {
+    http_response_t *resp = &slot->framing;
+    buffer_t *buf = slot->response;
+    const char *body = buf->data + buf->len - n;
+
+    if (resp->state == HTTP_RESP_HEADERS) {
+        size_t off = 0;
+        int head_request = resp->head_request;
+
+        while (1) {
+            int r = http_response_parse_headers(resp, buf->data + off, buf->len - off);
+            if (r == -1) {
+                return -1;
+            }
+            if (r == 0) {
+                /* Keep the partial block (not the 1xx ones before it) */
+                memmove(buf->data, buf->data + off, buf->len - off);
+                buf->len -= off;
+                return buffer_is_full(buf) ? -1 : 0;
+            }
+            off += resp->header_length;
+            if (resp->status_code >= 200 || resp->status_code == 101) {
+                break;
+            }
+            http_response_init(resp, head_request);
+        }
+        body = buf->data + off;
+        n = buf->len - off;
+    }
+
+    http_response_consume(resp, body, n);
+    buffer_clear(buf);
+    if (resp->state == HTTP_RESP_INVALID) {
+        return -1;
+    }
+    return http_response_is_complete(resp);
+}
+
+static void complete(proxy_config_t *config, mirror_slot_t *slot) {
+    int class = slot->framing.status_code / 100;
+    slot->route->stats.completed++;
+    if (class >= 1 && class <= 5) {
+        slot->route->stats.status[class]++;
+    }
+    finish(config, slot);
+}
+
+static void read_response(proxy_config_t *config, mirror_slot_t *slot) {
+    while (1) {
+        ssize_t n = buffer_read_fd(slot->response, slot->fd);
+        syscount(config, SYSCALL_SIDE_MIRROR, SYSCALL_READ, n);
+
+        if (n > 0) {
+            int r = frame(slot, (size_t)n);
+            if (r == -1) {
+                fail(config, slot);
+                return;
+            }
+            if (r == 1) {
+                complete(config, slot);
+                return;
+            }
+        } else if (n == 0) {
+            if (slot->framing.state == HTTP_RESP_BODY_EOF) {
+                complete(config, slot);
+            } else {
+                fail(config, slot);
+            }
+            return;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fail(config, slot);
+            }
+            return;
+        }
+    }
+}
+
+void mirror_event(proxy_config_t *config, mirror_slot_t *slot, uint32_t events) {
+    if (slot->fd == -1) {
+        return;  /* Finished earlier in this batch of events */
+    }
+
+    if (slot->connecting) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        int ret = getsockopt(slot->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        syscount(config, SYSCALL_SIDE_MIRROR, SYSCALL_SOCKOPT, ret);
+        if (ret == -1 || error != 0) {
+            fail(config, slot);
+            return;
+        }
+        slot->connecting = 0;
+    }
+
+    if (slot->request != NULL) {
+        int sent = send_request(config, slot);
+        if (sent == -1) {
+            fail(config, slot);
+        }
+        if (sent != 1) {
+            return;
+        }
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        read_response(config, slot);
+    }
+}
+
+int mirror_timer(proxy_config_t *config, timer_node_t *node) {
+    mirror_slot_t *slot = config->mirror != NULL ? slot_of(config->mirror, node) : NULL;
+    if (slot == NULL) {
+        return 0;
+    }
+    slot->route->stats.timeouts++;
+    finish(config, slot);
+    return 1;
+}
+
+void mirror_print(const mirror_t *m) {
+    printf("Mirror slots:       %u, %u in flight\n", m->slot_count, m->in_flight);
+    for (int i = 0; i < m->route_count; i++) {
+        const mirror_route_t *r = &m->routes[i];
+        printf("%s -> %s:%u\n", r->prefix, r->addr, r->port);
+        printf("  copies:   %lu sent, %lu dropped (all slots busy), %lu failed, %lu timed out\n",
+               (unsigned long)r->stats.mirrored, (unsigned long)r->stats.dropped,
+               (unsigned long)r->stats.failed, (unsigned long)r->stats.timeouts);
+        printf("  answered: %lu (1xx %lu, 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu), discarded\n",
+               (unsigned long)r->stats.completed,
+               (unsigned long)r->stats.status[1], (unsigned long)r->stats.status[2],
+               (unsigned long)r->stats.status[3], (unsigned long)r->stats.status[4],
+               (unsigned long)r->stats.status[5]);
+    }
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include "spool.h"
+#include "buffer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ============================================================================
+ * SETUP
+ * ============================================================================
+ */
+
+spooler_t *spooler_create(buffer_pool_t *pool, size_t memory_kb, const char *dir) {
+    spooler_t *s = calloc(1, sizeof(spooler_t));
+    if (s == NULL) {
+        perror("spool");
+        return NULL;
+    }
+
+    size_t chunks = (memory_kb * 1024 + BUFFER_SIZE - 1) / BUFFER_SIZE;
+    s->pool = pool;
+    s->chunk_limit = chunks < SPOOL_MAX_CHUNKS ? (int)chunks : SPOOL_MAX_CHUNKS;
+    s->dir = dir;
+    return s;
+}
+
+void spooler_destroy(spooler_t *s) {
+    free(s);
+}
+
+void spooler_print(const spooler_t *s, const char *what) {
+    printf("Buffered %s: %lu, %.1f MB (up to %d KB each in memory)\n", what,
+           (unsigned long)s->stats.buffered, (double)s->stats.bytes / (1024 * 1024),
+           s->chunk_limit * BUFFER_SIZE / 1024);
+    printf("Spilled to %s: %lu, %.1f MB, %lu errors\n", s->dir,
+           (unsigned long)s->stats.spills, (double)s->stats.spill_bytes / (1024 * 1024),
+           (unsigned long)s->stats.failures);
+}
+
+/* ============================================================================
+ * SPOOLS
+ * ============================================================================
+ */
+
+void spool_begin(spool_t *sp, spooler_t *owner) {
+    sp->owner = owner;
+    sp->failed = 0;
+    sp->counted = 0;
+    sp->head = 0;
+    sp->count = 0;
+    sp->memory = 0;
+    sp->fd = -1;
+    sp->written = 0;
+    sp->read_off = 0;
+}
+
+void spool_reset(spool_t *sp) {
+    if (sp->owner == NULL) {
+        return;
+    }
+    while (sp->count > 0) {
+        buffer_pool_put(sp->owner->pool, sp->chunks[sp->head]);
+        sp->head = (sp->head + 1) % SPOOL_MAX_CHUNKS;
+        sp->count--;
+    }
+    if (sp->fd != -1) {
+        close(sp->fd);
+    }
+    spool_begin(sp, NULL);
+}
+
+static void fail(spool_t *sp, const char *what) {
+    perror(what);
+    sp->failed = 1;
+    sp->owner->stats.failures++;
+}
+
+/* An anonymous file: O_TMPFILE where the filesystem has it, otherwise a
+ * named one unlinked straight away. Either way it vanishes on close.
+ */
+static int open_spill(spool_t *sp) {
+    const char *dir = sp->owner->dir;
+
+    sp->fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (sp->fd == -1 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/epoll-proxy-spool-XXXXXX", dir);
+        sp->fd = mkostemp(path, O_CLOEXEC);
+        if (sp->fd != -1) {
+            unlink(path);
+        }
+    }
+    if (sp->fd == -1) {
+        fail(sp, "spool file");
+        return -1;
+    }
+    sp->owner->stats.spills++;
+    return 0;
+}
+
+static size_t spill(spool_t *sp, const char *data, size_t len) {
+    if (sp->fd == -1 && open_spill(sp) == -1) {
+        return 0;
+    }
+    if (sp->written + len > SPOOL_MAX_FILE) {
+        len = (size_t)(SPOOL_MAX_FILE - sp->written);
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    ssize_t n = pwrite(sp->fd, data, len, (off_t)sp->written);
+    if (n == -1) {
+        fail(sp, "spool write");
+        return 0;
+    }
+    sp->written += (uint64_t)n;
+    sp->owner->stats.spill_bytes += (uint64_t)n;
+    return (size_t)n;
+}
+
+size_t spool_append(spool_t *sp, const char *data, size_t len) {
+    if (sp->owner == NULL || sp->failed) {
+        return 0;
+    }
+    size_t taken = 0;
+
+    /* Memory first, unless the file has older bytes still to go */
+    while (taken < len && sp->written == sp->read_off) {
+        buffer_t *tail = sp->count > 0
+            ? sp->chunks[(sp->head + sp->count - 1) % SPOOL_MAX_CHUNKS] : NULL;
+        if (tail == NULL || buffer_is_full(tail)) {
+            if (sp->count == sp->owner->chunk_limit ||
+                (tail = buffer_pool_get(sp->owner->pool)) == NULL) {
+                break;
+            }
+            buffer_clear(tail);
+            sp->chunks[(sp->head + sp->count) % SPOOL_MAX_CHUNKS] = tail;
+            sp->count++;
+        }
+        size_t n = buffer_append(tail, data + taken, len - taken);
+        sp->memory += n;
+        taken += n;
+    }
+
+    if (taken < len) {
+        taken += spill(sp, data + taken, len - taken);
+    }
+
+    if (taken > 0 && !sp->counted) {
+        sp->counted = 1;
+        sp->owner->stats.buffered++;
+    }
+    sp->owner->stats.bytes += taken;
+    return taken;
+}
+
+size_t spool_pull(spool_t *sp, buffer_t *dst) {
+    if (sp->owner == NULL || sp->failed) {
+        return 0;
+    }
+    if (dst->pos > 0 && buffer_writable_bytes(dst) < 1024) {
+        buffer_compact(dst);
+    }
+    size_t pulled = 0;
+
+    while (sp->count > 0 && buffer_writable_bytes(dst) > 0) {
+        buffer_t *chunk = sp->chunks[sp->head];
+        size_t n = buffer_readable_bytes(chunk);
+        if (n > buffer_writable_bytes(dst)) {
+            n = buffer_writable_bytes(dst);
+        }
+        memcpy(dst->data + dst->len, chunk->data + chunk->pos, n);
+        dst->len += n;
+        chunk->pos += n;
+        sp->memory -= n;
+        pulled += n;
+
+        if (buffer_is_empty(chunk)) {
+            buffer_pool_put(sp->owner->pool, chunk);
+            sp->head = (sp->head + 1) % SPOOL_MAX_CHUNKS;
+            sp->count--;
+        }
+    }
+
+    if (sp->count == 0 && sp->written > sp->read_off && buffer_writable_bytes(dst) > 0) {
+        size_t want = buffer_writable_bytes(dst);
+        if (want > sp->written - sp->read_off) {
+            want = (size_t)(sp->written - sp->read_off);
+        }
+        ssize_t n = pread(sp->fd, dst->data + dst->len, want, (off_t)sp->read_off);
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;  /* The file lost bytes we wrote */
+            }
+            fail(sp, "spool read");
+            return pulled;
+        }
+        dst->len += (size_t)n;
+        sp->read_off += (uint64_t)n;
+        pulled += (size_t)n;
+
+        /* Drained: start over at the front of the file */
+        if (sp->read_off == sp->written) {
+            sp->read_off = 0;
+            sp->written = 0;
+        }
+    }
+    return pulled;
+}
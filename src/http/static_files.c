@@ -0,0 +1,587 @@
+#define _POSIX_C_SOURCE 200809L
+#include "static_files.h"
+#include "http_request.h"
+#include "connection.h"
+#include "hugepage.h"
+#include "arena.h"
+#include "syscount.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ============================================================================
+ * SETUP
+ * ============================================================================
+ */
+
+static size_t entries_size(void) {
+    return STATIC_CACHE_ENTRIES * sizeof(static_entry_t);
+}
+
+static_files_t *static_files_create(void) {
+    static_files_t *sf = calloc(1, sizeof(static_files_t));
+    if (sf == NULL) {
+        perror("static files");
+        return NULL;
+    }
+
+    sf->entries = hugepage_alloc(entries_size(), NULL);
+    if (sf->entries == NULL) {
+        fprintf(stderr, "static files: can't allocate the open-file cache\n");
+        free(sf);
+        return NULL;
+    }
+
+    for (int i = STATIC_CACHE_ENTRIES - 1; i >= 0; i--) {
+        sf->entries[i].fd = -1;
+        sf->entries[i].lru_next = sf->free_list;
+        sf->free_list = &sf->entries[i];
+    }
+    return sf;
+}
+
+void static_files_destroy(static_files_t *sf) {
+    if (sf == NULL) {
+        return;
+    }
+    for (int i = 0; i < STATIC_CACHE_ENTRIES; i++) {
+        if (sf->entries[i].fd != -1) {
+            close(sf->entries[i].fd);
+        }
+    }
+    hugepage_free(sf->entries, entries_size());
+    free(sf);
+}
+
+int static_files_add_route(static_files_t *sf, char *spec) {
+    char *eq = strchr(spec, '=');
+    if (eq == NULL || spec[0] != '/' || eq[1] == '\0') {
+        fprintf(stderr, "Invalid static route '%s' (expected /PREFIX=DIR)\n", spec);
+        return -1;
+    }
+    if (sf->route_count == STATIC_MAX_ROUTES) {
+        fprintf(stderr, "Too many static routes (at most %d)\n", STATIC_MAX_ROUTES);
+        return -1;
+    }
+
+    *eq = '\0';
+    struct stat st;
+    if (stat(eq + 1, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Static route %s: %s is not a directory\n", spec, eq + 1);
+        return -1;
+    }
+
+    static_route_t *route = &sf->routes[sf->route_count++];
+    route->prefix = spec;
+    route->prefix_len = strlen(spec);
+    route->root = eq + 1;
+    return 0;
+}
+
+const static_route_t *static_files_route(const static_files_t *sf, const char *path) {
+    const static_route_t *best = NULL;
+    for (int i = 0; i < sf->route_count; i++) {
+        const static_route_t *route = &sf->routes[i];
+        if (strncmp(path, route->prefix, route->prefix_len) == 0 &&
+            (best == NULL || route->prefix_len > best->prefix_len)) {
+            best = route;
+        }
+    }
+    return best;
+}
+
+/* ============================================================================
+ * PATHS
+ * ============================================================================
+ */
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* root + the part of the URL path after the prefix, percent-decoded, with
+ * "index.html" appended to directories. Returns -1 for anything that could
+ * climb out of root (a ".." segment, an encoded NUL) or doesn't fit.
+ */
+static int build_path(const static_route_t *route, const char *url, char *out, size_t size) {
+    size_t len = strlen(route->root);
+    if (len + 2 > size) {
+        return -1;
+    }
+    memcpy(out, route->root, len);
+    if (out[len - 1] != '/') {
+        out[len++] = '/';
+    }
+    size_t rest = len;
+
+    const char *p = url + route->prefix_len;
+    while (*p == '/') {
+        p++;
+    }
+    for (; *p != '\0' && *p != '?' && *p != '#'; p++) {
+        char c = *p;
+        if (c == '%') {
+            int hi = hex_value(p[1]);
+            int lo = hi < 0 ? -1 : hex_value(p[2]);
+            if (lo < 0) {
+                return -1;
+            }
+            c = (char)(hi * 16 + lo);
+            if (c == '\0') {
+                return -1;
+            }
+            p += 2;
+        }
+        if (len + 1 >= size) {
+            return -1;
+        }
+        out[len++] = c;
+    }
+    out[len] = '\0';
+
+    /* Any ".." segment, whether it came in literally or encoded */
+    for (size_t i = rest; i < len; i++) {
+        if ((i == rest || out[i - 1] == '/') && out[i] == '.' && out[i + 1] == '.' &&
+            (out[i + 2] == '/' || out[i + 2] == '\0')) {
+            return -1;
+        }
+    }
+
+    if (out[len - 1] == '/') {
+        static const char index_file[] = "index.html";
+        if (len + sizeof(index_file) > size) {
+            return -1;
+        }
+        memcpy(out + len, index_file, sizeof(index_file));
+    }
+    return 0;
+}
+
+static uint32_t hash_path(const char *path) {
+    uint32_t h = 2166136261u;  /* FNV-1a */
+    for (; *path; path++) {
+        h = (h ^ (uint8_t)*path) * 16777619u;
+    }
+    return h;
+}
+
+static const char *content_type(const char *path) {
+    static const struct { const char *ext; const char *type; } types[] = {
+        { "html",  "text/html; charset=utf-8" },
+        { "htm",   "text/html; charset=utf-8" },
+        { "css",   "text/css; charset=utf-8" },
+        { "js",    "text/javascript; charset=utf-8" },
+        { "mjs",   "text/javascript; charset=utf-8" },
+        { "json",  "application/json" },
+        { "txt",   "text/plain; charset=utf-8" },
+        { "xml",   "application/xml" },
+        { "svg",   "image/svg+xml" },
+        { "png",   "image/png" },
+        { "jpg",   "image/jpeg" },
+        { "jpeg",  "image/jpeg" },
+        { "gif",   "image/gif" },
+        { "webp",  "image/webp" },
+        { "avif",  "image/avif" },
+        { "ico",   "image/x-icon" },
+        { "woff",  "font/woff" },
+        { "woff2", "font/woff2" },
+        { "wasm",  "application/wasm" },
+        { "pdf",   "application/pdf" },
+        { "mp4",   "video/mp4" },
+        { "webm",  "video/webm" },
+    };
+
+    const char *dot = strrchr(path, '.');
+    if (dot != NULL && strchr(dot, '/') == NULL) {
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (http_strcasecmp(dot + 1, types[i].ext) == 0) {
+                return types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+/* ============================================================================
+ * OPEN-FILE CACHE
+ * ============================================================================
+ */
+
+static void lru_unlink(static_files_t *sf, static_entry_t *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next; else sf->lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev; else sf->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_head(static_files_t *sf, static_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = sf->lru_head;
+    if (sf->lru_head) sf->lru_head->lru_prev = e; else sf->lru_tail = e;
+    sf->lru_head = e;
+}
+
+static void lru_push_tail(static_files_t *sf, static_entry_t *e) {
+    e->lru_next = NULL;
+    e->lru_prev = sf->lru_tail;
+    if (sf->lru_tail) sf->lru_tail->lru_next = e; else sf->lru_head = e;
+    sf->lru_tail = e;
+}
+
+static static_entry_t **bucket(static_files_t *sf, uint32_t hash) {
+    return &sf->buckets[hash & (STATIC_CACHE_BUCKETS - 1)];
+}
+
+/* Make an entry unreachable. A reply still sending from it keeps its fd;
+ * at the LRU tail it's the first slot to be reused afterwards.
+ */
+static void unhash(static_files_t *sf, static_entry_t *e) {
+    static_entry_t **pp = bucket(sf, e->hash);
+    while (*pp != e) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = e->hash_next;
+    e->hash_next = NULL;
+    e->hashed = 0;
+    lru_unlink(sf, e);
+    lru_push_tail(sf, e);
+}
+
+static static_entry_t *find(static_files_t *sf, const char *path, uint32_t hash) {
+    for (static_entry_t *e = *bucket(sf, hash); e != NULL; e = e->hash_next) {
+        if (e->hash == hash && strcmp(e->path, path) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* A never used slot, or the least recently used one no reply is sending from */
+static static_entry_t *take_slot(proxy_config_t *config, static_files_t *sf) {
+    static_entry_t *e = sf->free_list;
+    if (e != NULL) {
+        sf->free_list = e->lru_next;
+        e->lru_next = NULL;
+        return e;
+    }
+
+    for (e = sf->lru_tail; e != NULL && e->refs > 0; e = e->lru_prev) {
+    }
+    if (e == NULL) {
+        return NULL;
+    }
+    if (e->hashed) {
+        unhash(sf, e);
+        sf->stats.evictions++;
+    }
+    lru_unlink(sf, e);
+    close(e->fd);
+    syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_FILE, 1);
+    e->fd = -1;
+    return e;
+}
+
+static int same_file(const static_entry_t *e, const struct stat *st) {
+    return e->ino == st->st_ino && e->dev == st->st_dev && e->size == st->st_size &&
+           e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Fill a fresh entry for an open file, including its 200 header */
+static int fill_entry(static_entry_t *e, const char *path, uint32_t hash, int fd,
+                      const struct stat *st, uint64_t now) {
+    size_t len = strlen(path);
+    memcpy(e->path, path, len + 1);
+    e->hash = hash;
+    e->fd = fd;
+    e->refs = 0;
+    e->size = st->st_size;
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->mtime = st->st_mtim;
+    e->validated_ms = now;
+    e->content_type = content_type(path);
+
+    struct tm tm;
+    gmtime_r(&st->st_mtim.tv_sec, &tm);
+    strftime(e->last_modified, sizeof(e->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    snprintf(e->etag, sizeof(e->etag), "\"%llx-%llx\"",
+             (unsigned long long)st->st_mtim.tv_sec, (unsigned long long)st->st_size);
+
+    int n = snprintf(e->header, sizeof(e->header),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %lld\r\n"
+                     "Last-Modified: %s\r\n"
+                     "ETag: %s\r\n"
+                     "Accept-Ranges: bytes\r\n",
+                     e->content_type, (long long)e->size, e->last_modified, e->etag);
+    if (n < 0 || (size_t)n >= sizeof(e->header)) {
+        return -1;
+    }
+    e->header_len = (size_t)n;
+    return 0;
+}
+
+/* The cache entry for path, opening (or reopening) the file if needed.
+ * NULL with *status set if it can't be served.
+ */
+static static_entry_t *lookup(proxy_config_t *config, static_files_t *sf,
+                              const char *path, uint64_t now, int *status) {
+    uint32_t hash = hash_path(path);
+    struct stat st;
+
+    static_entry_t *e = find(sf, path, hash);
+    if (e != NULL && now - e->validated_ms >= STATIC_REVALIDATE_MS) {
+        sf->stats.revalidations++;
+        int ret = stat(path, &st);
+        syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_FILE, 1);
+        if (ret == 0 && same_file(e, &st)) {
+            e->validated_ms = now;
+        } else {
+            sf->stats.changed++;
+            unhash(sf, e);
+            e = NULL;
+        }
+    }
+    if (e != NULL) {
+        sf->stats.hits++;
+        lru_unlink(sf, e);
+        lru_push_head(sf, e);
+        return e;
+    }
+
+    /* O_NONBLOCK: opening a FIFO for reading would otherwise wait for a
+     * writer, stalling the loop. It changes nothing for a regular file,
+     * and anything else is refused below.
+     */
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_FILE, 1);
+    if (fd == -1) {
+        sf->stats.not_found++;
+        *status = (errno == EMFILE || errno == ENFILE) ? 503 : 404;
+        return NULL;
+    }
+    int ret = fstat(fd, &st);
+    syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_FILE, 1);
+    if (ret == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_FILE, 1);
+        sf->stats.not_found++;
+        *status = 404;
+        return NULL;
+    }
+
+    e = take_slot(config, sf);
+    if (e == NULL || fill_entry(e, path, hash, fd, &st, now) == -1) {
+        if (e != NULL) {
+            e->fd = -1;
+            e->lru_next = sf->free_list;
+            sf->free_list = e;
+        }
+        close(fd);
+        syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_FILE, 1);
+        *status = 503;
+        return NULL;
+    }
+
+    sf->stats.opens++;
+    e->hashed = 1;
+    e->hash_next = *bucket(sf, hash);
+    *bucket(sf, hash) = e;
+    lru_push_head(sf, e);
+    return e;
+}
+
+/* ============================================================================
+ * RESPONSES
+ * ============================================================================
+ */
+
+/* If-None-Match: "*" or a list that includes our tag (weak or not) */
+static int etag_matches(const char *value, const char *etag) {
+    return strcmp(value, "*") == 0 || strstr(value, etag) != NULL;
+}
+
+/* Parse a Range header against a file of size bytes.
+ * Returns 1 with [*start, *end] set, 0 to send the whole file (no range,
+ * several ranges, or one we don't understand), -1 if unsatisfiable.
+ */
+static int parse_range(const char *value, off_t size, off_t *start, off_t *end) {
+    if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL) {
+        return 0;
+    }
+
+    const char *p = value + 6;
+    char *endp;
+
+    /* bytes=-N: the last N bytes */
+    if (*p == '-') {
+        if (!isdigit((unsigned char)p[1])) {
+            return 0;
+        }
+        long long n = strtoll(p + 1, &endp, 10);
+        if (*endp != '\0') {
+            return 0;
+        }
+        if (n == 0 || size == 0) {
+            return -1;
+        }
+        *start = n >= size ? 0 : size - n;
+        *end = size - 1;
+        return 1;
+    }
+
+    /* bytes=A- or bytes=A-B */
+    if (!isdigit((unsigned char)*p)) {
+        return 0;
+    }
+    long long first = strtoll(p, &endp, 10);
+    if (*endp != '-') {
+        return 0;
+    }
+    p = endp + 1;
+    long long last = size - 1;
+    if (*p != '\0') {
+        if (!isdigit((unsigned char)*p)) {
+            return 0;
+        }
+        last = strtoll(p, &endp, 10);
+        if (*endp != '\0' || last < first) {
+            return 0;
+        }
+    }
+    if (first >= size) {
+        return -1;
+    }
+    *start = first;
+    *end = last < size ? last : size - 1;
+    return 1;
+}
+
+/* Connection line and the blank line that ends the header */
+static const char *header_tail(const http_request_t *req, int keep_alive) {
+    if (!keep_alive) {
+        return "Connection: close\r\n\r\n";
+    }
+    return req->version == HTTP_VERSION_10 ? "Connection: keep-alive\r\n\r\n" : "\r\n";
+}
+
+int static_files_respond(proxy_config_t *config, const static_route_t *route,
+                         http_request_t *req, file_reply_t *reply,
+                         int keep_alive) {
+    static_files_t *sf = config->static_files;
+
+    if (req->method != HTTP_METHOD_GET && req->method != HTTP_METHOD_HEAD) {
+        return 405;
+    }
+
+    char path[STATIC_PATH_MAX];
+    if (build_path(route, req->path, path, sizeof(path)) == -1) {
+        sf->stats.not_found++;
+        return 404;
+    }
+
+    int status = 404;
+    static_entry_t *e = lookup(config, sf, path, get_timestamp_ms(), &status);
+    if (e == NULL) {
+        return status;
+    }
+
+    const char *tail = header_tail(req, keep_alive);
+    char *head = NULL;
+    int len = 0;
+    off_t start = 0, end = e->size - 1;
+
+    const char *inm = http_request_get_header(req, "If-None-Match");
+    const char *range = http_request_get_header(req, "Range");
+    const char *if_range = http_request_get_header(req, "If-Range");
+    int ranged = 0;
+
+    /* If-Range with a validator that no longer matches: send everything */
+    if (range != NULL && (if_range == NULL || strcmp(if_range, e->etag) == 0 ||
+                          strcmp(if_range, e->last_modified) == 0)) {
+        ranged = parse_range(range, e->size, &start, &end);
+    }
+
+    if (inm != NULL && etag_matches(inm, e->etag)) {
+        sf->stats.not_modified++;
+        head = arena_alloc(&req->arena, STATIC_HEADER_MAX);
+        if (head != NULL) {
+            len = snprintf(head, STATIC_HEADER_MAX,
+                           "HTTP/1.1 304 Not Modified\r\n"
+                           "Last-Modified: %s\r\n"
+                           "ETag: %s\r\n",
+                           e->last_modified, e->etag);
+        }
+        start = 0;
+        end = -1;
+    } else if (ranged == -1) {
+        head = arena_alloc(&req->arena, STATIC_HEADER_MAX);
+        if (head != NULL) {
+            len = snprintf(head, STATIC_HEADER_MAX,
+                           "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                           "Content-Range: bytes */%lld\r\n"
+                           "Content-Length: 0\r\n",
+                           (long long)e->size);
+        }
+        start = 0;
+        end = -1;
+    } else if (ranged == 1) {
+        sf->stats.ranges++;
+        head = arena_alloc(&req->arena, STATIC_HEADER_MAX);
+        if (head != NULL) {
+            len = snprintf(head, STATIC_HEADER_MAX,
+                           "HTTP/1.1 206 Partial Content\r\n"
+                           "Content-Type: %s\r\n"
+                           "Content-Length: %lld\r\n"
+                           "Content-Range: bytes %lld-%lld/%lld\r\n"
+                           "Last-Modified: %s\r\n"
+                           "ETag: %s\r\n"
+                           "Accept-Ranges: bytes\r\n",
+                           e->content_type, (long long)(end - start + 1),
+                           (long long)start, (long long)end, (long long)e->size,
+                           e->last_modified, e->etag);
+        }
+    } else {
+        head = e->header;
+        len = (int)e->header_len;
+    }
+
+    if (head == NULL || len < 0 || len >= STATIC_HEADER_MAX) {
+        return 503;
+    }
+
+    reply->active = 1;
+    reply->fd = e->fd;
+    reply->refs = &e->refs;
+    reply->body_bytes = &sf->stats.bytes;
+    e->refs++;
+    reply->head[0].iov_base = head;
+    reply->head[0].iov_len = (size_t)len;
+    reply->head[1].iov_base = (void *)(uintptr_t)tail;
+    reply->head[1].iov_len = strlen(tail);
+    reply->head_first = 0;
+    reply->head_count = 2;
+    reply->offset = start;
+    reply->remaining = req->method == HTTP_METHOD_GET ? end - start + 1 : 0;
+    return 0;
+}
+
+void static_files_print(const static_files_t *sf) {
+    printf("Static hits:        %lu (%lu opens, %lu not found)\n",
+           (unsigned long)sf->stats.hits, (unsigned long)sf->stats.opens,
+           (unsigned long)sf->stats.not_found);
+    printf("Static revalidated: %lu (%lu changed), %lu evictions\n",
+           (unsigned long)sf->stats.revalidations, (unsigned long)sf->stats.changed,
+           (unsigned long)sf->stats.evictions);
+    printf("Static responses:   %lu ranges, %lu not modified, %lu body bytes\n",
+           (unsigned long)sf->stats.ranges, (unsigned long)sf->stats.not_modified,
+           (unsigned long)sf->stats.bytes);
+}
@@ -1,4 +1,5 @@
 #include "buffer.h"
+#include "hugepage.h"
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -77,6 +78,10 @@ ssize_t buffer_read_fd(buffer_t *buf, int fd) {
 }
 
 ssize_t buffer_write_fd(buffer_t *buf, int fd) {
+    return buffer_write_fd_max(buf, fd, SIZE_MAX);
+}
+
+ssize_t buffer_write_fd_max(buffer_t *buf, int fd, size_t max) {
     /* Nothing to write? Don't even make the syscall.
      * This saves CPU when called in a loop.
      */
@@ -92,7 +97,8 @@ ssize_t buffer_write_fd(buffer_t *buf, int fd) {
      *   if the socket buffer is nearly full. We track position so we
      *   don't re-send the same data.
      */
-    ssize_t n = write(fd, buf->data + buf->pos, buf->len - buf->pos);
+    size_t len = buf->len - buf->pos;
+    ssize_t n = write(fd, buf->data + buf->pos, len < max ? len : max);
     
     if (n > 0) {
         /* Successfully wrote n bytes. Advance position. */
@@ -129,6 +135,16 @@ ssize_t buffer_write_fd(buffer_t *buf, int fd) {
     return n;
 }
 
+size_t buffer_append(buffer_t *buf, const void *data, size_t len) {
+    size_t space = BUFFER_SIZE - buf->len;
+    if (len > space) {
+        len = space;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return len;
+}
+
 int buffer_is_full(const buffer_t *buf) {
     /* Buffer is full when len reaches BUFFER_SIZE.
      * We can't append more data without overflowing.
@@ -191,4 +207,85 @@ void buffer_compact(buffer_t *buf) {
     memmove(buf->data, buf->data + buf->pos, remaining);
     buf->pos = 0;
     buf->len = remaining;
-}
\ No newline at end of file
+}
+
+/* ============================================================================
+ * BUFFER POOL IMPLEMENTATION
+ * ============================================================================
+ */
+
+/* Each chunk starts with this header; buffers follow it back to back */
+typedef struct buffer_chunk {
+    struct buffer_chunk *next;
+} buffer_chunk_t;
+
+/* Start buffers on a cache line boundary after the header */
+#define BUFFER_CHUNK_HEADER 64
+
+void buffer_pool_init(buffer_pool_t *pool) {
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    pool->total = 0;
+    pool->chunks = NULL;
+}
+
+static int buffer_pool_grow(buffer_pool_t *pool) {
+    buffer_chunk_t *chunk = hugepage_alloc(BUFFER_POOL_CHUNK_SIZE, NULL);
+    if (chunk == NULL) {
+        perror("buffer pool mmap");
+        return -1;
+    }
+    
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    
+    /* Carve the chunk into buffers and push them all on the free list.
+     * The memory is fresh from mmap, so it's already zeroed - no need
+     * for buffer_init().
+     */
+    size_t count = (BUFFER_POOL_CHUNK_SIZE - BUFFER_CHUNK_HEADER) / sizeof(buffer_t);
+    buffer_t *bufs = (buffer_t *)((char *)chunk + BUFFER_CHUNK_HEADER);
+    for (size_t i = 0; i < count; i++) {
+        bufs[i].next_free = pool->free_list;
+        pool->free_list = &bufs[i];
+    }
+    
+    pool->free_count += count;
+    pool->total += count;
+    return 0;
+}
+
+buffer_t *buffer_pool_get(buffer_pool_t *pool) {
+    if (pool->free_list == NULL && buffer_pool_grow(pool) == -1) {
+        return NULL;
+    }
+    
+    buffer_t *buf = pool->free_list;
+    pool->free_list = buf->next_free;
+    pool->free_count--;
+    
+    buf->next_free = NULL;
+    buf->refs = 1;
+    buffer_clear(buf);
+    return buf;
+}
+
+void buffer_pool_put(buffer_pool_t *pool, buffer_t *buf) {
+    if (buf == NULL || --buf->refs > 0) {
+        return;
+    }
+    
+    buf->next_free = pool->free_list;
+    pool->free_list = buf;
+    pool->free_count++;
+}
+
+void buffer_pool_destroy(buffer_pool_t *pool) {
+    buffer_chunk_t *chunk = pool->chunks;
+    while (chunk != NULL) {
+        buffer_chunk_t *next = chunk->next;
+        hugepage_free(chunk, BUFFER_POOL_CHUNK_SIZE);
+        chunk = next;
+    }
+    buffer_pool_init(pool);
+}
@@ -2,6 +2,13 @@
 #include "connection.h"
 #include "buffer.h"
 #include "epoll.h"
+#include "timer.h"
+#include "http_request.h"
+#include "arena.h"
+#include "tcpinfo.h"
+#include "syscount.h"
+#include "shaper.h"
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
@@ -21,12 +28,14 @@ void connection_pool_init(proxy_config_t *config) {
         conn->fd = -1;
         conn->peer = NULL;
         conn->state = CONN_CLOSED;
-        conn->is_client = 0;
         conn->last_active = 0;
+        conn->timer.next = NULL;
+        conn->timer.prev = NULL;
+        conn->http_req = NULL;
         
-        /* Initialize buffers */
-        buffer_init(&conn->read_buf);
-        buffer_init(&conn->write_buf);
+        /* Buffers are borrowed from the pool on allocation */
+        conn->read_buf = NULL;
+        conn->write_buf = NULL;
         
         /* Add to free list.
          * We build the free list in reverse order (MAX_CONNECTIONS-1 down to 0)
@@ -40,6 +49,12 @@ void connection_pool_init(proxy_config_t *config) {
     /* All connections are free initially */
     config->free_count = MAX_CONNECTIONS;
     
+    buffer_pool_init(&config->buffers);
+    arena_pool_init(&config->arenas);
+    http_request_pool_init(&config->requests, &config->arenas);
+    timer_wheel_init(&config->timers, get_timestamp_ms());
+    tcpinfo_init(&config->tcpinfo);
+    
     /* Initialize statistics */
     memset(&config->stats, 0, sizeof(config->stats));
 }
@@ -86,6 +101,18 @@ connection_t* connection_alloc(proxy_config_t *config) {
         conn->state = CONN_CLOSED;
     }
     
+    /* Borrow buffers. If the pool can't grow, give the slot back. */
+    conn->read_buf = buffer_pool_get(&config->buffers);
+    conn->write_buf = buffer_pool_get(&config->buffers);
+    if (conn->read_buf == NULL || conn->write_buf == NULL) {
+        buffer_pool_put(&config->buffers, conn->read_buf);
+        buffer_pool_put(&config->buffers, conn->write_buf);
+        conn->read_buf = NULL;
+        conn->write_buf = NULL;
+        config->free_count++;
+        return NULL;
+    }
+    
     /* Update statistics */
     config->stats.total_connections++;
     config->stats.active_connections++;
@@ -111,14 +138,27 @@ void connection_free(proxy_config_t *config, connection_t *conn) {
         return;
     }
     
+    if (!connection_is_client(conn)) {
+        config->stats.upstream_closes++;
+    }
+    
     /* Mark as closed */
     conn->state = CONN_CLOSED;
     conn->fd = -1;
     conn->peer = NULL;
     
-    /* Clear buffers (fast - just resets pointers) */
-    buffer_clear(&conn->read_buf);
-    buffer_clear(&conn->write_buf);
+    /* A timer left armed would fire on whoever reuses this slot */
+    timer_cancel(&config->timers, &conn->timer);
+    shaper_forget(config, conn);
+    
+    /* Give buffers and parser state back */
+    buffer_pool_put(&config->buffers, conn->read_buf);
+    buffer_pool_put(&config->buffers, conn->write_buf);
+    conn->read_buf = NULL;
+    conn->write_buf = NULL;
+    
+    http_request_pool_put(&config->requests, conn->http_req);
+    conn->http_req = NULL;
     
     /* Push back onto free list.
      * free_count is the next available slot.
@@ -140,17 +180,77 @@ void connection_free(proxy_config_t *config, connection_t *conn) {
  * ============================================================================
  */
 
-void connection_init(connection_t *conn, int fd, int is_client,
+void connection_init(connection_t *conn, int fd, conn_role_t role,
                     conn_state_t state) {
     conn->fd = fd;
-    conn->is_client = is_client;
+    conn->role = role;
     conn->state = state;
     conn->peer = NULL;
     conn->last_active = get_timestamp_ms();
+    conn->requests_handled = 0;
+    conn->keep_alive = 0;
+    conn->capture_id = 0;
+    conn->window_bytes = 0;
+    conn->traffic_class = 0;
+    conn->shape_route = 0;
+    conn->shape_paused = 0;
     
     /* Clear buffers */
-    buffer_clear(&conn->read_buf);
-    buffer_clear(&conn->write_buf);
+    buffer_clear(conn->read_buf);
+    buffer_clear(conn->write_buf);
+}
+
+/* ============================================================================
+ * IDLE SHRINKING
+ * ============================================================================
+ */
+
+int connection_is_shrunk(const connection_t *conn) {
+    return conn->read_buf == NULL;
+}
+
+int connection_shrink(proxy_config_t *config, connection_t *conn) {
+    /* Only a connection with nothing in flight can give its state back:
+     * no peer, nothing buffered in either direction.
+     */
+    if (connection_is_shrunk(conn) || conn->peer != NULL ||
+        !buffer_is_empty(conn->read_buf) || !buffer_is_empty(conn->write_buf)) {
+        return -1;
+    }
+    
+    buffer_pool_put(&config->buffers, conn->read_buf);
+    buffer_pool_put(&config->buffers, conn->write_buf);
+    conn->read_buf = NULL;
+    conn->write_buf = NULL;
+    
+    http_request_pool_put(&config->requests, conn->http_req);
+    conn->http_req = NULL;
+    
+    config->stats.idle_shrinks++;
+    return 0;
+}
+
+int connection_wake(proxy_config_t *config, connection_t *conn) {
+    if (!connection_is_shrunk(conn)) {
+        return 0;
+    }
+    
+    conn->read_buf = buffer_pool_get(&config->buffers);
+    conn->write_buf = buffer_pool_get(&config->buffers);
+    if (conn->read_buf == NULL || conn->write_buf == NULL) {
+        return -1;
+    }
+    
+    /* Only HTTP clients are ever shrunk, and they need parser state */
+    if (conn->role == ROLE_HTTP_CLIENT) {
+        conn->http_req = http_request_pool_get(&config->requests);
+        if (conn->http_req == NULL) {
+            return -1;
+        }
+    }
+    
+    config->stats.idle_wakeups++;
+    return 0;
 }
 
 void connection_pair(connection_t *client, connection_t *backend) {
@@ -189,8 +289,11 @@ void connection_close(proxy_config_t *config, connection_t *conn) {
      * but explicit removal is clearer and portable.
      */
     if (conn->fd >= 0) {
+        tcpinfo_sample_close(config, conn);
         epoll_del(config->epoll_fd, conn->fd);
         close(conn->fd);
+        syscount_n(config, syscount_side(conn), SYSCALL_EPOLL_CTL, 1);
+        syscount_n(config, syscount_side(conn), SYSCALL_CLOSE, 1);
     }
     
     /* Unpair from peer.
@@ -277,27 +380,61 @@ uint64_t get_timestamp_ms(void) {
  * They answer: "In this state, should I do X?"
  */
 
+/* Does conn buffer its response (spool.h)? Then a full write buffer
+ * doesn't hold its upstream back; a full spool does, through the
+ * upstream's own read buffer (below).
+ */
+static int connection_spools_response(const connection_t *conn) {
+    return conn->http_req != NULL && conn->http_req->spool.owner != NULL;
+}
+
+/* Is conn a client still sending the body of a request that went
+ * upstream with its headers (Expect: 100-continue)?
+ */
+static int connection_relays_body(const connection_t *conn) {
+    return connection_is_client(conn) && conn->http_req != NULL && conn->http_req->body_left > 0;
+}
+
+/* What each state allows, before buffers and the peer have their say.
+ *
+ * Readable states:
+ * - CONN_CONNECTED: Normal TCP mode, actively reading/writing
+ * - CONN_READING_REQUEST: HTTP mode, reading HTTP request from client
+ * - CONN_REQUEST_COMPLETE: HTTP mode, request fully read (transitional)
+ * - CONN_WRITING_RESPONSE: only while the client is still sending an
+ *   Expect: 100-continue body (the backend is done reading otherwise)
+ *
+ * Writable states:
+ * - CONN_CONNECTED: Normal TCP mode, actively reading/writing
+ * - CONN_WRITING_RESPONSE: HTTP mode, writing response to client
+ * - CONN_CONNECTING: not really, but we need EPOLLOUT to detect when the
+ *   async connect completes. Nothing is written until CONN_CONNECTED.
+ *
+ * Neither: CONN_CLOSING (peer sent EOF, only draining what we already
+ * read) and CONN_CLOSED.
+ */
+enum {
+    STATE_READS       = 1 << 0,
+    STATE_READS_ALONE = 1 << 1,     /* Even without a peer */
+    STATE_READS_BODY  = 1 << 2,     /* Only while relaying a request body */
+    STATE_WRITES      = 1 << 3,
+    STATE_CONNECTING  = 1 << 4,     /* EPOLLOUT: the connect completed */
+};
+
+static const uint8_t state_io[CONN_STATES] = {
+    [CONN_CONNECTING]       = STATE_CONNECTING,
+    [CONN_CONNECTED]        = STATE_READS | STATE_WRITES,
+    [CONN_READING_REQUEST]  = STATE_READS | STATE_READS_ALONE,
+    [CONN_REQUEST_COMPLETE] = STATE_READS | STATE_READS_ALONE,
+    [CONN_WRITING_RESPONSE] = STATE_READS_BODY | STATE_WRITES,
+    [CONN_CLOSING]          = 0,
+    [CONN_CLOSED]           = 0,
+};
+
 int connection_can_read(const connection_t *conn) {
-    if (!connection_is_valid(conn)) {
-        return 0;
-    }
+    uint8_t io = state_io[conn->state];
     
-    /* Can't read if we're not in a readable state.
-     * CONN_CONNECTING: waiting for connect() to complete
-     * CONN_CLOSING: shutting down (if defined)
-     * CONN_CLOSED: already closed
-     * 
-     * Readable states:
-     * - CONN_CONNECTED: Normal TCP mode, actively reading/writing
-     * - CONN_READING_REQUEST: HTTP mode, reading HTTP request from client
-     * - CONN_REQUEST_COMPLETE: HTTP mode, request fully read (transitional)
-     * 
-     * Non-readable states:
-     * - CONN_CONNECTING: Still establishing connection
-     * - CONN_WRITING_RESPONSE: HTTP mode, writing response to client (backend done reading)
-     */
-    if (conn->state == CONN_CONNECTING ||
-        conn->state == CONN_WRITING_RESPONSE) {
+    if (!(io & STATE_READS) && !((io & STATE_READS_BODY) && connection_relays_body(conn))) {
         return 0;
     }
     
@@ -308,12 +445,7 @@ int connection_can_read(const connection_t *conn) {
      * (we're reading their request before connecting to backend)
      */
     if (conn->peer == NULL) {
-        /* Allow reading if we're in HTTP request reading state */
-        if (conn->state == CONN_READING_REQUEST || 
-            conn->state == CONN_REQUEST_COMPLETE) {
-            return 1;
-        }
-        return 0;
+        return (io & STATE_READS_ALONE) != 0;
     }
     
     /* Can't read if peer's write buffer is full.
@@ -327,7 +459,17 @@ int connection_can_read(const connection_t *conn) {
      * 
      * This is how TCP naturally handles speed mismatches.
      */
-    if (buffer_is_full(&conn->peer->write_buf)) {
+    if (buffer_is_full(conn->peer->write_buf) && !connection_spools_response(conn->peer)) {
+        return 0;
+    }
+    
+    /* Nor if the peer only had room for part of what we read last time:
+     * the rest is still in our read buffer. A peer that writes slowly
+     * (bandwidth shaping hands out a few KB at a time) frees space in
+     * dribs, so this is common there. Its handle_write() pulls the rest
+     * and re-arms us.
+     */
+    if (buffer_is_full(conn->read_buf)) {
         return 0;
     }
     
@@ -335,44 +477,17 @@ int connection_can_read(const connection_t *conn) {
 }
 
 int connection_can_write(const connection_t *conn) {
-    if (!connection_is_valid(conn)) {
-        return 0;
-    }
+    uint8_t io = state_io[conn->state];
     
-    /* Can't write if we're not in a writable state.
-     * 
-     * Writable states:
-     * - CONN_CONNECTED: Normal TCP mode, actively reading/writing
-     * - CONN_WRITING_RESPONSE: HTTP mode, writing response to client
-     * 
-     * Non-writable states:
-     * - CONN_CONNECTING: Still establishing (but see below)
-     * - CONN_READING_REQUEST: HTTP mode, still reading request
-     * - CONN_REQUEST_COMPLETE: HTTP mode, transitional state
-     */
-    if (conn->state != CONN_CONNECTED && 
-        conn->state != CONN_CONNECTING &&
-        conn->state != CONN_WRITING_RESPONSE) {
-        return 0;
-    }
-    
-    /* Special case: CONN_CONNECTING state
-     * We allow "writing" while connecting because we need EPOLLOUT
-     * to detect when the async connect completes. But we don't
-     * actually write data until state becomes CONN_CONNECTED.
-     */
-    if (conn->state == CONN_CONNECTING) {
-        return 1;  /* Need EPOLLOUT to detect connect completion */
+    /* Need EPOLLOUT to detect connect completion */
+    if (io & STATE_CONNECTING) {
+        return 1;
     }
     
     /* Only write if we have data.
      * Otherwise we'd get EAGAIN immediately - waste of a syscall.
      */
-    if (buffer_is_empty(&conn->write_buf)) {
-        return 0;
-    }
-    
-    return 1;
+    return (io & STATE_WRITES) && !buffer_is_empty(conn->write_buf);
 }
 
 int connection_wants_read(const connection_t *conn) {
@@ -402,8 +517,18 @@ int connection_wants_write(const connection_t *conn) {
         return 1;
     }
     
-    /* Want to write if we have buffered data */
-    if (!buffer_is_empty(&conn->write_buf)) {
+    /* Out of bandwidth tokens: the shaper's timer resumes writing */
+    if (conn->shape_paused) {
+        return 0;
+    }
+    
+    /* Want to write if we have buffered data (shrunk connections have none) */
+    if (conn->write_buf != NULL && !buffer_is_empty(conn->write_buf)) {
+        return 1;
+    }
+    
+    /* ... or a static file response still going out */
+    if (conn->http_req != NULL && conn->http_req->file.active) {
         return 1;
     }
     
@@ -0,0 +1,246 @@
+#define _POSIX_C_SOURCE 200809L
+#include "shaper.h"
+#include "connection.h"
+#include "hugepage.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define US_PER_S   1000000
+#define MAX_RATE   (1ULL << 40)     /* 1 TB/s: keeps credit math in 64 bits */
+
+/* ============================================================================
+ * SETUP
+ * ============================================================================
+ */
+
+int shaper_parse_rate(const char *s, uint64_t *rate) {
+    char *end;
+    double value = strtod(s, &end);
+    double unit = 1;
+    switch (*end) {
+        case 'k': case 'K': unit = 1024.0; end++; break;
+        case 'm': case 'M': unit = 1024.0 * 1024; end++; break;
+        case 'g': case 'G': unit = 1024.0 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    value *= unit;
+    if (end == s || *end != '\0' || !(value >= 1) || value > (double)MAX_RATE) {
+        return -1;
+    }
+    *rate = (uint64_t)value;
+    return 0;
+}
+
+static int64_t burst_for(uint64_t rate) {
+    uint64_t burst = rate * SHAPER_BURST_MS / 1000;
+    return burst > SHAPER_MIN_BURST ? (int64_t)burst : SHAPER_MIN_BURST;
+}
+
+shaper_t *shaper_create(uint64_t conn_rate) {
+    shaper_t *s = calloc(1, sizeof(shaper_t));
+    if (s == NULL) {
+        perror("shaper");
+        return NULL;
+    }
+
+    /* Zeroed: every bucket unused (full), every timer disarmed */
+    s->conns = hugepage_alloc(MAX_CONNECTIONS * sizeof(shaper_conn_t), NULL);
+    if (s->conns == NULL) {
+        fprintf(stderr, "shaper: can't allocate per-connection buckets\n");
+        free(s);
+        return NULL;
+    }
+    s->conn_rate = conn_rate;
+    s->conn_burst = burst_for(conn_rate);
+    s->started_ms = get_timestamp_ms();
+    return s;
+}
+
+void shaper_destroy(shaper_t *s) {
+    if (s == NULL) {
+        return;
+    }
+    hugepage_free(s->conns, MAX_CONNECTIONS * sizeof(shaper_conn_t));
+    free(s);
+}
+
+int shaper_add_route(shaper_t *s, char *spec) {
+    char *eq = strchr(spec, '=');
+    if (eq == NULL || spec[0] != '/') {
+        fprintf(stderr, "Invalid shaped route '%s' (expected /PREFIX=RATE)\n", spec);
+        return -1;
+    }
+    if (s->route_count == SHAPER_MAX_ROUTES) {
+        fprintf(stderr, "Too many shaped routes (at most %d)\n", SHAPER_MAX_ROUTES);
+        return -1;
+    }
+
+    *eq = '\0';
+    uint64_t rate;
+    if (shaper_parse_rate(eq + 1, &rate) == -1) {
+        fprintf(stderr, "Shaped route %s: bad rate %s\n", spec, eq + 1);
+        return -1;
+    }
+
+    shaper_route_t *route = &s->routes[s->route_count++];
+    route->prefix = spec;
+    route->prefix_len = strlen(spec);
+    route->rate = rate;
+    route->burst = burst_for(rate);
+    return 0;
+}
+
+uint8_t shaper_route(shaper_t *s, const char *path) {
+    int best = -1;
+    for (int i = 0; i < s->route_count; i++) {
+        const shaper_route_t *route = &s->routes[i];
+        if (strncmp(path, route->prefix, route->prefix_len) == 0 &&
+            (best == -1 || route->prefix_len > s->routes[best].prefix_len)) {
+            best = i;
+        }
+    }
+    if (best == -1) {
+        return 0;
+    }
+    s->routes[best].stats.requests++;
+    return (uint8_t)(best + 1);
+}
+
+/* ============================================================================
+ * TOKEN BUCKETS
+ * ============================================================================
+ */
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * US_PER_S + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Add the credit earned since the last refill and return the balance */
+static int64_t refill(token_bucket_t *b, uint64_t rate, int64_t burst, uint64_t now) {
+    int64_t depth = burst * US_PER_S;
+    uint64_t elapsed = now - b->last_us;
+
+    /* Long enough to fill from empty: also covers never used */
+    if (b->last_us == 0 || elapsed >= (uint64_t)depth / rate) {
+        b->credit = depth;
+    } else {
+        b->credit += (int64_t)(elapsed * rate);
+        if (b->credit > depth) {
+            b->credit = depth;
+        }
+    }
+    b->last_us = now;
+    return b->credit;
+}
+
+size_t shaper_allow(proxy_config_t *config, connection_t *conn, size_t want) {
+    shaper_t *s = config->shaper;
+    shaper_conn_t *sc = &s->conns[conn - config->connections];
+    shaper_route_t *route = conn->shape_route != 0 ? &s->routes[conn->shape_route - 1] : NULL;
+    uint64_t now = now_us();
+
+    /* The tighter of the two buckets decides */
+    int64_t credit = INT64_MAX;
+    uint64_t rate = 0;
+    int64_t burst = 0;
+    if (s->conn_rate != 0) {
+        credit = refill(&sc->bucket, s->conn_rate, s->conn_burst, now);
+        rate = s->conn_rate;
+        burst = s->conn_burst;
+    }
+    int route_limits = 0;
+    if (route != NULL) {
+        int64_t c = refill(&route->bucket, route->rate, route->burst, now);
+        if (c < credit) {
+            credit = c;
+            rate = route->rate;
+            burst = route->burst;
+            route_limits = 1;
+        }
+    }
+
+    if (credit >= US_PER_S) {
+        uint64_t bytes = (uint64_t)(credit / US_PER_S);
+        return bytes < want ? (size_t)bytes : want;
+    }
+
+    /* Out of tokens: sleep until half the bucket is back */
+    uint64_t wait_us = (uint64_t)(burst / 2 * US_PER_S - credit) / rate;
+    timer_schedule(&config->timers, &sc->timer, get_timestamp_ms() + wait_us / 1000 + 1);
+    conn->shape_paused = 1;
+    s->stats.pauses++;
+    if (route_limits) {
+        route->stats.pauses++;
+    }
+    return 0;
+}
+
+void shaper_charge(proxy_config_t *config, connection_t *conn, size_t n) {
+    shaper_t *s = config->shaper;
+    int64_t credit = (int64_t)n * US_PER_S;
+
+    if (s->conn_rate != 0) {
+        s->conns[conn - config->connections].bucket.credit -= credit;
+        s->stats.bytes += n;
+    }
+    if (conn->shape_route != 0) {
+        shaper_route_t *route = &s->routes[conn->shape_route - 1];
+        route->bucket.credit -= credit;
+        route->stats.bytes += n;
+    }
+}
+
+connection_t *shaper_timer(proxy_config_t *config, timer_node_t *node) {
+    shaper_t *s = config->shaper;
+    if (s == NULL) {
+        return NULL;
+    }
+
+    uintptr_t p = (uintptr_t)node;
+    uintptr_t base = (uintptr_t)s->conns;
+    if (p < base || p >= base + MAX_CONNECTIONS * sizeof(shaper_conn_t)) {
+        return NULL;
+    }
+
+    connection_t *conn = &config->connections[(p - base) / sizeof(shaper_conn_t)];
+    conn->shape_paused = 0;
+    s->stats.wakeups++;
+    return conn;
+}
+
+void shaper_forget(proxy_config_t *config, connection_t *conn) {
+    shaper_t *s = config->shaper;
+    if (s == NULL) {
+        return;
+    }
+    shaper_conn_t *sc = &s->conns[conn - config->connections];
+    timer_cancel(&config->timers, &sc->timer);
+    sc->bucket.last_us = 0;
+    conn->shape_paused = 0;
+}
+
+void shaper_print(const shaper_t *s) {
+    double secs = (double)(get_timestamp_ms() - s->started_ms) / 1000.0;
+    const double mb = 1024.0 * 1024.0;
+
+    if (s->conn_rate != 0) {
+        printf("Per connection:     %.2f MB/s cap, %.1f MB sent\n",
+               (double)s->conn_rate / mb, (double)s->stats.bytes / mb);
+    }
+    printf("Pauses:             %lu (%lu woken by timer)\n",
+           (unsigned long)s->stats.pauses, (unsigned long)s->stats.wakeups);
+    for (int i = 0; i < s->route_count; i++) {
+        const shaper_route_t *r = &s->routes[i];
+        printf("%s: %.2f MB/s cap, %lu requests, %.1f MB sent (%.2f MB/s average), "
+               "%lu pauses\n",
+               r->prefix, (double)r->rate / mb, (unsigned long)r->stats.requests,
+               (double)r->stats.bytes / mb,
+               secs > 0 ? (double)r->stats.bytes / mb / secs : 0.0,
+               (unsigned long)r->stats.pauses);
+    }
+}
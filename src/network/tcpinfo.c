@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tcpinfo.h"
+#include "timer.h"
+#include "syscount.h"
+#include <netinet/in.h>
+#include <linux/tcp.h>  /* glibc's struct tcp_info lacks tcpi_delivery_rate */
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/* Starting guess for one getsockopt(TCP_INFO), refined as we go */
+#define TCPINFO_INITIAL_COST_NS 1000
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* ============================================================================
+ * SAMPLING
+ * ============================================================================
+ */
+
+void tcpinfo_init(tcpinfo_sampler_t *sampler) {
+    tcpinfo_stats_t *sides[2] = { &sampler->listener, &sampler->upstream };
+    for (int i = 0; i < 2; i++) {
+        sides[i]->samples = 0;
+        histogram_init(&sides[i]->rtt_us);
+        histogram_init(&sides[i]->rttvar_us);
+        histogram_init(&sides[i]->delivery_rate);
+        histogram_init(&sides[i]->unacked);
+        histogram_init(&sides[i]->cwnd);
+        histogram_init(&sides[i]->retrans);
+    }
+    sampler->enabled = 1;
+    sampler->timer.next = NULL;
+    sampler->timer.prev = NULL;
+    sampler->cursor = 0;
+    sampler->budget_ns = 0;
+    sampler->cost_ns = TCPINFO_INITIAL_COST_NS;
+    sampler->skipped = 0;
+}
+
+static int sample(tcpinfo_stats_t *stats, int fd, int closing) {
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) {
+        return -1;
+    }
+    
+    stats->samples++;
+    histogram_record(&stats->rtt_us, ti.tcpi_rtt);
+    histogram_record(&stats->rttvar_us, ti.tcpi_rttvar);
+    histogram_record(&stats->unacked, ti.tcpi_unacked);
+    histogram_record(&stats->cwnd, ti.tcpi_snd_cwnd);
+    
+    /* Older kernels return a shorter struct without the rate fields */
+    if (len >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(ti.tcpi_delivery_rate) &&
+        ti.tcpi_delivery_rate > 0) {
+        histogram_record(&stats->delivery_rate, ti.tcpi_delivery_rate);
+    }
+    
+    /* tcpi_total_retrans is cumulative, so it's only meaningful once */
+    if (closing) {
+        histogram_record(&stats->retrans, ti.tcpi_total_retrans);
+    }
+    return 0;
+}
+
+static tcpinfo_stats_t *side(tcpinfo_sampler_t *sampler, const connection_t *conn) {
+    return connection_is_client(conn) ? &sampler->listener : &sampler->upstream;
+}
+
+void tcpinfo_start(proxy_config_t *config, uint64_t now_ms) {
+    if (config->tcpinfo.enabled) {
+        timer_schedule(&config->timers, &config->tcpinfo.timer,
+                       now_ms + TCPINFO_INTERVAL_MS);
+    }
+}
+
+void tcpinfo_sample_round(proxy_config_t *config, uint64_t now_ms) {
+    tcpinfo_sampler_t *s = &config->tcpinfo;
+    
+    /* Budget for this interval; nothing carries over, so an idle period
+     * can't be saved up for a burst of syscalls later. Half of it is kept
+     * back for sampling connections as they close.
+     */
+    int64_t budget = (int64_t)TCPINFO_INTERVAL_MS * 1000000 * TCPINFO_BUDGET_PERMILLE / 1000;
+    s->budget_ns = budget / 2;
+    
+    int scan = TCPINFO_SCAN_MAX < MAX_CONNECTIONS ? TCPINFO_SCAN_MAX : MAX_CONNECTIONS;
+    uint64_t start = now_ns();
+    uint64_t mark = start;
+    int sampled = 0;
+    int calls = 0;
+    
+    for (int i = 0; i < scan && s->budget_ns > 0; i++) {
+        const connection_t *conn = &config->connections[s->cursor];
+        if (++s->cursor == MAX_CONNECTIONS) {
+            s->cursor = 0;
+        }
+        
+        /* Nothing to learn before the handshake completes */
+        if (conn->state == CONN_CLOSED || conn->state == CONN_CONNECTING || conn->fd < 0) {
+            continue;
+        }
+        
+        syscount_n(config, syscount_side(conn), SYSCALL_SOCKOPT, 1);
+        if (sample(side(s, conn), conn->fd, 0) == 0) {
+            sampled++;
+        }
+        
+        /* Reading the clock is cheap (vDSO) but not free: every 8 calls,
+         * whether or not they returned a sample
+         */
+        if ((++calls & 7) == 0) {
+            uint64_t t = now_ns();
+            s->budget_ns -= (int64_t)(t - mark);
+            mark = t;
+        }
+    }
+    
+    uint64_t end = now_ns();
+    s->budget_ns -= (int64_t)(end - mark);
+    if (sampled > 0) {
+        /* Smooth the per-sample cost estimate used for close sampling */
+        uint64_t cost = (end - start) / (uint64_t)sampled;
+        s->cost_ns = (s->cost_ns * 7 + cost) / 8;
+    }
+    s->budget_ns += budget / 2;
+    
+    timer_schedule(&config->timers, &s->timer, now_ms + TCPINFO_INTERVAL_MS);
+}
+
+void tcpinfo_sample_close(proxy_config_t *config, const connection_t *conn) {
+    tcpinfo_sampler_t *s = &config->tcpinfo;
+    
+    if (!s->enabled || conn->fd < 0 || conn->state == CONN_CONNECTING) {
+        return;
+    }
+    if (s->budget_ns < (int64_t)s->cost_ns) {
+        s->skipped++;
+        return;
+    }
+    
+    s->budget_ns -= (int64_t)s->cost_ns;
+    syscount_n(config, syscount_side(conn), SYSCALL_SOCKOPT, 1);
+    sample(side(s, conn), conn->fd, 1);
+}
+
+/* ============================================================================
+ * REPORTING
+ * ============================================================================
+ */
+
+void tcpinfo_print(const char *label, const tcpinfo_stats_t *stats) {
+    printf("%-10s %lu samples\n", label, (unsigned long)stats->samples);
+    if (stats->samples == 0) {
+        return;
+    }
+    printf("  RTT:      p50 %lu us, p99 %lu us, max %lu us (var p50 %lu us)\n",
+           (unsigned long)histogram_percentile(&stats->rtt_us, 50),
+           (unsigned long)histogram_percentile(&stats->rtt_us, 99),
+           (unsigned long)stats->rtt_us.max,
+           (unsigned long)histogram_percentile(&stats->rttvar_us, 50));
+    printf("  cwnd:     p50 %lu, unacked p99 %lu segments\n",
+           (unsigned long)histogram_percentile(&stats->cwnd, 50),
+           (unsigned long)histogram_percentile(&stats->unacked, 99));
+    if (stats->delivery_rate.count > 0) {
+        printf("  Delivery: p50 %.1f MB/s\n",
+               (double)histogram_percentile(&stats->delivery_rate, 50) / (1024 * 1024));
+    }
+    if (stats->retrans.count > 0) {
+        printf("  Retrans:  %.2f per connection, p99 %lu\n",
+               histogram_mean(&stats->retrans),
+               (unsigned long)histogram_percentile(&stats->retrans, 99));
+    }
+}
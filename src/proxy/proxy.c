@@ -3,6 +3,21 @@
 #include "buffer.h"
 #include "epoll.h"
 #include "http_request.h"
+#include "arena.h"
+#include "scoreboard.h"
+#include "tcpinfo.h"
+#include "syscount.h"
+#include "profiler.h"
+#include "capture.h"
+#include "static_files.h"
+#include "disk_cache.h"
+#include "mirror.h"
+#include "traffic_sched.h"
+#include "shaper.h"
+#include "spool.h"
+#include "direct.h"
+#include "timer.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +27,13 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <signal.h>
+#include <sys/sendfile.h>
+
+/* A handler body written once and compiled once per mode or connection
+ * role: that argument is a constant at every call site, so each copy
+ * loses the checks on it.
+ */
+#define SPECIALIZED static inline __attribute__((always_inline))
 
 /* Global flag for graceful shutdown */
 static volatile int running = 1;
@@ -19,6 +41,28 @@ static volatile int running = 1;
 /* Forward declarations */
 static void handle_read_tcp(proxy_config_t *config, connection_t *conn);
 static void handle_read_http_client(proxy_config_t *config, connection_t *client);
+static void handle_read_http_upstream(proxy_config_t *config, connection_t *upstream);
+static void handle_write_http_client(proxy_config_t *config, connection_t *client);
+static void handle_write_http_upstream(proxy_config_t *config, connection_t *upstream);
+static void handle_write_tcp(proxy_config_t *config, connection_t *conn);
+static void handle_error_client(proxy_config_t *config, connection_t *client);
+static void handle_error_http(proxy_config_t *config, connection_t *upstream);
+static void handle_error_tcp(proxy_config_t *config, connection_t *conn);
+static void handle_connect_http(proxy_config_t *config, connection_t *upstream);
+static void handle_connect_tcp(proxy_config_t *config, connection_t *backend);
+static void handle_accept_http(proxy_config_t *config);
+static void handle_accept_tcp(proxy_config_t *config);
+static void fail_upstream(proxy_config_t *config, connection_t *upstream);
+static void handle_timer(void *ctx, timer_node_t *node);
+static int open_tcp_backend(proxy_config_t *config, connection_t *client);
+static void serve_static(proxy_config_t *config, connection_t *client,
+                         const static_route_t *route);
+static void serve_file_reply(proxy_config_t *config, connection_t *client);
+static int write_file_reply(proxy_config_t *config, connection_t *client);
+static void publish_scoreboard(proxy_config_t *config, uint64_t now);
+static void start_rate_window(proxy_config_t *config, connection_t *client);
+static int forward_response(connection_t *upstream, connection_t *client);
+static void relay_request_body(proxy_config_t *config, connection_t *client);
 
 /* Signal handler */
 static void signal_handler(int signum) {
@@ -27,20 +71,21 @@ static void signal_handler(int signum) {
 }
 
 /* ============================================================================
- * INITIALIZATION - HTTP MODE
+ * INITIALIZATION
  * ============================================================================
  */
 
-int proxy_init_http(proxy_config_t *config,
-                    const char *listen_addr, uint16_t listen_port,
-                    const char *backend_addr, uint16_t backend_port) {
+/* Common setup; the mode is set once, here, and never changes after */
+static int proxy_listen(proxy_config_t *config, proxy_mode_t mode,
+                        const char *listen_addr, uint16_t listen_port,
+                        const char *backend_addr, uint16_t backend_port) {
     
     /* Store configuration */
     config->listen_addr = listen_addr;
     config->listen_port = listen_port;
     config->backend_addr = backend_addr;
     config->backend_port = backend_port;
-    config->mode = PROXY_MODE_HTTP;  /* HTTP mode */
+    config->mode = mode;
     
     /* Initialize connection pool */
     connection_pool_init(config);
@@ -84,28 +129,33 @@ int proxy_init_http(proxy_config_t *config,
 #endif
     
     /* Add listening socket to epoll */
-    if (epoll_add(config->epoll_fd, config->listen_fd, EPOLLIN, NULL) == -1) {
+    if (epoll_add(config->epoll_fd, config->listen_fd, EPOLLIN,
+                  epoll_tag(NULL, EPOLL_SOURCE_LISTENER)) == -1) {
         close(config->listen_fd);
         close(config->epoll_fd);
         return -1;
     }
     
-    printf("HTTP Proxy listening on %s:%d, forwarding to %s:%d\n",
+    printf("%s Proxy listening on %s:%d, forwarding to %s:%d\n",
+           mode == PROXY_MODE_HTTP ? "HTTP" : "TCP",
            listen_addr, listen_port, backend_addr, backend_port);
     
     return 0;
 }
 
+int proxy_init_http(proxy_config_t *config,
+                    const char *listen_addr, uint16_t listen_port,
+                    const char *backend_addr, uint16_t backend_port) {
+    return proxy_listen(config, PROXY_MODE_HTTP, listen_addr, listen_port,
+                        backend_addr, backend_port);
+}
+
 /* TCP mode initialization (original) */
 int proxy_init(proxy_config_t *config,
                const char *listen_addr, uint16_t listen_port,
                const char *backend_addr, uint16_t backend_port) {
-    
-    config->mode = PROXY_MODE_TCP;  /* TCP mode */
-    
-    /* Same as HTTP init but without HTTP-specific opts */
-    return proxy_init_http(config, listen_addr, listen_port, 
-                          backend_addr, backend_port);
+    return proxy_listen(config, PROXY_MODE_TCP, listen_addr, listen_port,
+                        backend_addr, backend_port);
 }
 
 void proxy_cleanup(proxy_config_t *config) {
@@ -113,11 +163,6 @@ void proxy_cleanup(proxy_config_t *config) {
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         connection_t *conn = &config->connections[i];
         if (conn->state != CONN_CLOSED) {
-            /* Free HTTP request if allocated */
-            if (conn->http_req) {
-                free(conn->http_req);
-                conn->http_req = NULL;
-            }
             connection_close(config, conn);
         }
     }
@@ -134,6 +179,41 @@ void proxy_cleanup(proxy_config_t *config) {
     }
     
     print_stats(config);
+    
+    scoreboard_destroy(config->scoreboard, config->scoreboard_path);
+    config->scoreboard = NULL;
+    
+    capture_close(config->capture);
+    config->capture = NULL;
+    
+    static_files_destroy(config->static_files);
+    config->static_files = NULL;
+    
+    direct_destroy(config->direct);
+    config->direct = NULL;
+    
+    disk_cache_destroy(config->disk_cache);
+    config->disk_cache = NULL;
+    
+    /* Shadow requests hold buffers: before the pool goes */
+    mirror_destroy(config, config->mirror);
+    config->mirror = NULL;
+    
+    sched_destroy(config->sched);
+    config->sched = NULL;
+    
+    shaper_destroy(config->shaper);
+    config->shaper = NULL;
+    
+    /* Spools went back to the pool with their connections */
+    spooler_destroy(config->spooler);
+    config->spooler = NULL;
+    spooler_destroy(config->body_spooler);
+    config->body_spooler = NULL;
+    
+    buffer_pool_destroy(&config->buffers);
+    http_request_pool_destroy(&config->requests);
+    arena_pool_destroy(&config->arenas);
 }
 
 /* ============================================================================
@@ -141,20 +221,129 @@ void proxy_cleanup(proxy_config_t *config) {
  * ============================================================================
  */
 
-int proxy_run(proxy_config_t *config) {
-    struct epoll_event events[MAX_EVENTS];
+/* What happened on a connection, from the epoll event bits */
+enum {
+    EV_READ,                /* EPOLLIN, EPOLLRDHUP */
+    EV_WRITE,               /* EPOLLOUT */
+    EV_ERROR,               /* EPOLLERR, EPOLLHUP */
+    CONN_EVENTS
+};
+
+typedef void (*event_handler_t)(proxy_config_t *config, connection_t *conn);
+
+#define ON(read, write, error) { [EV_READ] = (read), [EV_WRITE] = (write), [EV_ERROR] = (error) }
+
+/* The state machine: what an event runs, by the connection's role and
+ * state. NULL ignores the event, as does every state a role never gets
+ * to, CONN_CLOSED included.
+ *
+ * An HTTP client only reads while taking a request, or the rest of an
+ * Expect: 100-continue body that went upstream behind its headers;
+ * pipelined bytes stay in the socket until the keep-alive reset re-arms
+ * EPOLLIN. An HTTP upstream reads in every state: with its client gone,
+ * that is how it finds out. Errors on an HTTP client don't close its
+ * upstream; anywhere else they fail the pair, and an HTTP client that
+ * hasn't seen any of the response gets a 502.
+ *
+ * A new kind of connection is a new role and its rows here.
+ */
+static const event_handler_t state_handlers[CONN_ROLES][CONN_STATES][CONN_EVENTS] = {
+    [ROLE_TCP_CLIENT] = {
+        [CONN_CONNECTED]        = ON(handle_read_tcp, handle_write_tcp, handle_error_tcp),
+    },
+    [ROLE_TCP_BACKEND] = {
+        [CONN_CONNECTING]       = ON(NULL, handle_connect_tcp, handle_error_tcp),
+        [CONN_CONNECTED]        = ON(handle_read_tcp, handle_write_tcp, handle_error_tcp),
+    },
+    [ROLE_HTTP_CLIENT] = {
+        [CONN_READING_REQUEST]  = ON(handle_read_http_client, handle_write_http_client,
+                                     handle_error_client),
+        [CONN_REQUEST_COMPLETE] = ON(NULL, handle_write_http_client, handle_error_client),
+        [CONN_WRITING_RESPONSE] = ON(relay_request_body, handle_write_http_client,
+                                     handle_error_client),
+    },
+    [ROLE_HTTP_UPSTREAM] = {
+        [CONN_CONNECTING]       = ON(handle_read_http_upstream, handle_connect_http, handle_error_http),
+        [CONN_CONNECTED]        = ON(handle_read_http_upstream, handle_write_http_upstream,
+                                     handle_error_http),
+        [CONN_CLOSING]          = ON(handle_read_http_upstream, handle_write_http_upstream,
+                                     handle_error_http),
+    },
+};
+
+/* One epoll event for a client or upstream connection */
+static inline void dispatch_event(proxy_config_t *config, connection_t *conn, uint32_t events) {
+    const event_handler_t *on = state_handlers[conn->role][conn->state];
     
-    /* Setup signal handlers */
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGPIPE, SIG_IGN);  /* Ignore SIGPIPE - we handle EPIPE in write */
+    /* Handle error conditions.
+     * EPOLLRDHUP alone is not an error: the peer sent FIN, and
+     * there may still be data to read before the EOF. The read
+     * handler sees the EOF and decides what to do with it.
+     */
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        if (on[EV_ERROR] != NULL) {
+            on[EV_ERROR](config, conn);
+        }
+        return;
+    }
     
-    const char *mode = (config->mode == PROXY_MODE_HTTP) ? "HTTP" : "TCP";
-    printf("%s Proxy running (Ctrl-C to stop)...\n", mode);
+    /* Handle write events (process before reads for flow control).
+     * A write can complete a connect, or close the connection: the read
+     * goes by the state it left.
+     */
+    if ((events & EPOLLOUT) && on[EV_WRITE] != NULL) {
+        on[EV_WRITE](config, conn);
+        on = state_handlers[conn->role][conn->state];
+    }
+    
+    /* Handle read events */
+    if ((events & (EPOLLIN | EPOLLRDHUP)) && on[EV_READ] != NULL) {
+        on[EV_READ](config, conn);
+    }
+}
+
+void proxy_dispatch(proxy_config_t *config, connection_t *conn, uint32_t events) {
+    dispatch_event(config, conn, events);
+}
+
+/* Descriptors that aren't connections, by their registration tag (epoll.h).
+ * The listener isn't here: each copy of the loop calls its mode's accept.
+ */
+typedef void (*source_handler_t)(proxy_config_t *config, void *ptr, uint32_t events);
+
+/* The disk cache writer finished some entries */
+static void on_disk_cache(proxy_config_t *config, void *ptr, uint32_t events) {
+    (void)ptr;
+    (void)events;
+    disk_cache_poll(config);
+}
+
+/* A shadow upstream (traffic mirroring) */
+static void on_mirror(proxy_config_t *config, void *ptr, uint32_t events) {
+    mirror_event(config, ptr, events);
+}
+
+static const source_handler_t source_handlers[EPOLL_SOURCES] = {
+    [EPOLL_SOURCE_DISK_CACHE] = on_disk_cache,
+    [EPOLL_SOURCE_MIRROR]     = on_mirror,
+};
+
+/* The loop, compiled once per client role (the mode) with and without
+ * traffic classes: both are constants in each copy, and proxy_run()
+ * picks the copy once. An event for a connection costs the tag test and
+ * dispatch, nothing else.
+ */
+SPECIALIZED int event_loop(proxy_config_t *config, const conn_role_t clients,
+                           const int classes) {
+    struct epoll_event events[MAX_EVENTS];
     
     while (running) {
-        /* Wait for events with timeout for periodic tasks */
-        int nfds = epoll_wait_events(config->epoll_fd, events, MAX_EVENTS, 1000);
+        config->stats.loop_iterations++;
+        
+        /* Wait for events, waking up in time for the next timer tick */
+        int timeout = timer_wheel_timeout(&config->timers, get_timestamp_ms(), 1000);
+        int nfds = epoll_wait_events(config->epoll_fd, events, MAX_EVENTS, timeout);
+        syscount(config, SYSCALL_SIDE_LOOP, SYSCALL_EPOLL_WAIT, nfds);
         
         if (nfds == -1) {
             if (errno == EINTR) {
@@ -165,66 +354,164 @@ int proxy_run(proxy_config_t *config) {
         }
         
         /* Process each ready file descriptor */
+        uint64_t batch_us = classes ? sched_now_us() : 0;
         for (int i = 0; i < nfds; i++) {
             struct epoll_event *ev = &events[i];
-            connection_t *conn = (connection_t*)ev->data.ptr;
-            
-            /* Handle listening socket */
-            if (conn == NULL) {
-                handle_accept(config);
-                continue;
-            }
-            
-            /* Handle error conditions */
-            if (ev->events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
-                handle_error(config, conn);
-                continue;
-            }
             
-            /* Handle backend connection completion */
-            if (conn->state == CONN_CONNECTING && (ev->events & EPOLLOUT)) {
-                handle_connect(config, conn);
-                if (conn->state == CONN_CONNECTED && (ev->events & EPOLLOUT)) {
-                    handle_write(config, conn);
+            /* Listener, disk cache eventfd, shadow requests */
+            epoll_source_t source = epoll_source(ev->data.ptr);
+            if (source != EPOLL_SOURCE_CONN) {
+                if (source != EPOLL_SOURCE_LISTENER) {
+                    source_handlers[source](config, epoll_untag(ev->data.ptr), ev->events);
+                } else if (clients == ROLE_HTTP_CLIENT) {
+                    handle_accept_http(config);
+                } else {
+                    handle_accept_tcp(config);
                 }
                 continue;
             }
+            connection_t *conn = ev->data.ptr;
             
-            /* Handle write events (process before reads for flow control) */
-            if (ev->events & EPOLLOUT) {
-                handle_write(config, conn);
+            /* Traffic classes: connections wait for their class's turn */
+            if (classes) {
+                sched_enqueue(config->sched, conn, i);
+                continue;
             }
             
-            /* Handle read events */
-            if (ev->events & EPOLLIN) {
-                handle_read(config, conn);
-            }
+            dispatch_event(config, conn, ev->events);
+        }
+        if (classes) {
+            sched_run(config, events, batch_us, proxy_dispatch);
+        }
+        
+        /* Fire expired connection timers */
+        uint64_t now = get_timestamp_ms();
+        timer_wheel_expire(&config->timers, now, handle_timer, config);
+        
+        /* Write a requested profile dump (no-op unless -R) */
+        profiler_poll();
+        
+        /* Copy stats out for epoll-proxy-top */
+        if (config->scoreboard != NULL && now >= config->scoreboard_next_ms) {
+            config->scoreboard_next_ms = now + SCOREBOARD_PUBLISH_MS;
+            publish_scoreboard(config, now);
         }
         
         /* Periodic tasks every second */
         static uint64_t last_maintenance = 0;
-        uint64_t now = get_timestamp_ms();
         if (now - last_maintenance > 1000) {
             last_maintenance = now;
             
-            /* TODO: Close idle connections
-             * for each connection:
-             *   if (now - conn->last_active > IDLE_TIMEOUT * 1000)
-             *       connection_close(conn);
-             */
+            /* Snapshot the disk cache index for warm restarts */
+            if (config->disk_cache != NULL) {
+                disk_cache_tick(config->disk_cache, now);
+            }
         }
     }
-    
-    printf("\nShutting down...\n");
     return 0;
 }
 
+int proxy_run(proxy_config_t *config) {
+    /* Setup signal handlers */
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);  /* Ignore SIGPIPE - we handle EPIPE in write */
+    
+    const char *mode = (config->mode == PROXY_MODE_HTTP) ? "HTTP" : "TCP";
+    printf("%s Proxy running (Ctrl-C to stop)...\n", mode);
+    
+    tcpinfo_start(config, get_timestamp_ms());
+    
+    /* Neither the mode nor traffic classes change once running */
+    int ret;
+    if (config->mode == PROXY_MODE_HTTP) {
+        ret = config->sched != NULL ? event_loop(config, ROLE_HTTP_CLIENT, 1)
+                                    : event_loop(config, ROLE_HTTP_CLIENT, 0);
+    } else {
+        ret = config->sched != NULL ? event_loop(config, ROLE_TCP_CLIENT, 1)
+                                    : event_loop(config, ROLE_TCP_CLIENT, 0);
+    }
+    if (ret == 0) {
+        printf("\nShutting down...\n");
+    }
+    return ret;
+}
+
+/* ============================================================================
+ * COUNTED SYSCALLS
+ * ============================================================================
+ * Thin wrappers that charge each syscall to the right side (syscount.h),
+ * and the bytes moved to the running traffic class turn (traffic_sched.h).
+ */
+
+/* Bytes towards this min-rate window; saturates rather than wrapping */
+static inline void count_window(connection_t *conn, ssize_t n) {
+    uint32_t sum = conn->window_bytes + (uint32_t)n;
+    conn->window_bytes = sum < conn->window_bytes ? UINT32_MAX : sum;
+}
+
+/* buffer_read_fd() on a full buffer returns ENOBUFS without reading */
+static ssize_t read_counted(proxy_config_t *config, connection_t *conn) {
+    ssize_t n = buffer_read_fd(conn->read_buf, conn->fd);
+    if (n != -1 || errno != ENOBUFS) {
+        syscount(config, syscount_side(conn), SYSCALL_READ, n);
+    }
+    if (n > 0) {
+        count_window(conn, n);
+    }
+    sched_charge(config, n);
+    return n;
+}
+
+/* buffer_write_fd() on an empty buffer returns 0 without writing, and so
+ * do we when the connection is out of bandwidth tokens (now paused).
+ */
+static ssize_t write_counted(proxy_config_t *config, connection_t *conn) {
+    size_t max = SIZE_MAX;
+    if (shaper_applies(config, conn) && !buffer_is_empty(conn->write_buf)) {
+        max = shaper_allow(config, conn, buffer_readable_bytes(conn->write_buf));
+        if (max == 0) {
+            return 0;
+        }
+    }
+    
+    ssize_t n = buffer_write_fd_max(conn->write_buf, conn->fd, max);
+    if (n != 0) {
+        syscount(config, syscount_side(conn), SYSCALL_WRITE, n);
+    }
+    if (n > 0) {
+        count_window(conn, n);
+        if (max != SIZE_MAX) {
+            shaper_charge(config, conn, (size_t)n);
+        }
+    }
+    sched_charge(config, n);
+    return n;
+}
+
+static void close_counted(proxy_config_t *config, syscall_side_t side, int fd) {
+    syscount_n(config, side, SYSCALL_CLOSE, 1);
+    close(fd);
+}
+
+/* create_backend_connection(): socket, set_nonblocking(),
+ * set_socket_options(), connect. Charged in full even when it fails
+ * part-way: failures are rare and this is accounting, not tracing.
+ */
+static void count_backend_setup(proxy_config_t *config) {
+    syscount_n(config, SYSCALL_SIDE_UPSTREAM, SYSCALL_SOCKET, 1);
+    syscount_n(config, SYSCALL_SIDE_UPSTREAM, SYSCALL_FCNTL, SYSCOUNT_SET_NONBLOCKING);
+    syscount_n(config, SYSCALL_SIDE_UPSTREAM, SYSCALL_SOCKOPT, SYSCOUNT_SOCKET_OPTIONS);
+    syscount_n(config, SYSCALL_SIDE_UPSTREAM, SYSCALL_CONNECT, 1);
+}
+
 /* ============================================================================
  * ACCEPT HANDLER
  * ============================================================================
  */
 
-void handle_accept(proxy_config_t *config) {
+/* Accept everything pending, as clients of the mode's role */
+SPECIALIZED void accept_role(proxy_config_t *config, const conn_role_t role) {
     while (1) {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
@@ -232,6 +519,7 @@ void handle_accept(proxy_config_t *config) {
         int client_fd = accept(config->listen_fd, 
                               (struct sockaddr*)&client_addr, 
                               &client_len);
+        syscount(config, SYSCALL_SIDE_CLIENT, SYSCALL_ACCEPT, client_fd);
         
         if (client_fd == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -242,14 +530,16 @@ void handle_accept(proxy_config_t *config) {
         }
         
         /* Set non-blocking */
+        syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_FCNTL, SYSCOUNT_SET_NONBLOCKING);
         if (set_nonblocking(client_fd) == -1) {
-            close(client_fd);
+            close_counted(config, SYSCALL_SIDE_CLIENT, client_fd);
             continue;
         }
         
         /* Set socket options */
+        syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_SOCKOPT, SYSCOUNT_SOCKET_OPTIONS);
         if (set_socket_options(client_fd) == -1) {
-            close(client_fd);
+            close_counted(config, SYSCALL_SIDE_CLIENT, client_fd);
             continue;
         }
         
@@ -257,33 +547,96 @@ void handle_accept(proxy_config_t *config) {
         connection_t *client = connection_alloc(config);
         if (client == NULL) {
             fprintf(stderr, "Connection pool exhausted\n");
-            close(client_fd);
+            close_counted(config, SYSCALL_SIDE_CLIENT, client_fd);
             continue;
         }
         
         /* Initialize client connection */
-        connection_init(client, client_fd, 1, CONN_CONNECTED);
+        connection_init(client, client_fd, role, CONN_CONNECTED);
         
-        /* In HTTP mode, allocate HTTP request structure */
-        if (config->mode == PROXY_MODE_HTTP) {
-            client->http_req = calloc(1, sizeof(http_request_t));
+        /* An HTTP client takes parser state from the pool */
+        if (role == ROLE_HTTP_CLIENT) {
+            client->http_req = http_request_pool_get(&config->requests);
             if (client->http_req == NULL) {
                 fprintf(stderr, "Failed to allocate HTTP request\n");
                 connection_close(config, client);
-                close(client_fd);
                 continue;
             }
-            http_request_init((http_request_t*)client->http_req);
             client->state = CONN_READING_REQUEST;
+            
+            if (config->capture != NULL) {
+                client->capture_id = capture_connection(config->capture);
+            }
+            
+            /* If no request shows up soon, shrink to a bare descriptor */
+            timer_schedule(&config->timers, &client->timer,
+                           client->last_active + IDLE_SHRINK_MS);
         }
         
         /* Add to epoll */
+        syscount_n(config, SYSCALL_SIDE_CLIENT, SYSCALL_EPOLL_CTL, 1);
         if (epoll_add(config->epoll_fd, client_fd, EPOLLIN, client) == -1) {
-            if (client->http_req) free(client->http_req);
             connection_close(config, client);
             continue;
         }
+        
+        /* A TCP client gets its own backend right away */
+        if (role == ROLE_TCP_CLIENT && open_tcp_backend(config, client) == -1) {
+            config->stats.errors++;
+            connection_close(config, client);
+            continue;
+        }
+    }
+}
+
+static void handle_accept_http(proxy_config_t *config) {
+    accept_role(config, ROLE_HTTP_CLIENT);
+}
+
+static void handle_accept_tcp(proxy_config_t *config) {
+    accept_role(config, ROLE_TCP_CLIENT);
+}
+
+/* The event loop calls its mode's copy; this is for other callers */
+void handle_accept(proxy_config_t *config) {
+    if (config->mode == PROXY_MODE_HTTP) {
+        handle_accept_http(config);
+    } else {
+        handle_accept_tcp(config);
+    }
+}
+
+/* Start a non-blocking connect to the backend and pair it with client.
+ * Bytes the client sends meanwhile queue in the backend's write buffer
+ * and go out once the connect completes.
+ */
+static int open_tcp_backend(proxy_config_t *config, connection_t *client) {
+    int backend_fd = create_backend_connection(config->backend_addr,
+                                               config->backend_port);
+    count_backend_setup(config);
+    if (backend_fd == -1) {
+        fprintf(stderr, "Failed to connect to backend\n");
+        config->stats.upstream_failures++;
+        return -1;
     }
+    
+    connection_t *backend = connection_alloc(config);
+    if (backend == NULL) {
+        fprintf(stderr, "Connection pool exhausted for backend\n");
+        close_counted(config, SYSCALL_SIDE_UPSTREAM, backend_fd);
+        return -1;
+    }
+    
+    connection_init(backend, backend_fd, ROLE_TCP_BACKEND, CONN_CONNECTING);
+    config->stats.upstream_connects++;
+    syscount_n(config, SYSCALL_SIDE_UPSTREAM, SYSCALL_EPOLL_CTL, 1);
+    if (epoll_add(config->epoll_fd, backend_fd, EPOLLOUT, backend) == -1) {
+        connection_close(config, backend);
+        return -1;
+    }
+    
+    connection_pair(client, backend);
+    return 0;
 }
 
 /* ============================================================================
@@ -291,19 +644,14 @@ void handle_accept(proxy_config_t *config) {
  * ============================================================================
  */
 
+/* The event loop goes straight to the handler for the connection's role
+ * and state (state_handlers); this does the same for other callers.
+ */
 void handle_read(proxy_config_t *config, connection_t *conn) {
-    if (!connection_is_valid(conn)) {
-        return;
-    }
-    
-    /* HTTP mode: Handle client reads specially */
-    if (config->mode == PROXY_MODE_HTTP && conn->is_client) {
-        handle_read_http_client(config, conn);
-        return;
+    event_handler_t read = state_handlers[conn->role][conn->state][EV_READ];
+    if (read != NULL) {
+        read(config, conn);
     }
-    
-    /* TCP mode or backend reads: Original behavior */
-    handle_read_tcp(config, conn);
 }
 
 /* TCP read handler (original logic) */
@@ -313,16 +661,23 @@ static void handle_read_tcp(proxy_config_t *config, connection_t *conn) {
     }
     
     while (1) {
-        ssize_t n = buffer_read_fd(&conn->read_buf, conn->fd);
+        ssize_t n = read_counted(config, conn);
         
         if (n > 0) {
             connection_update_activity(conn);
             config->stats.bytes_received += n;
             
             if (forward_data(conn, conn->peer) == -1) {
-                handle_error(config, conn);
+                handle_error_tcp(config, conn);
                 return;
             }
+            
+            /* Peer's write buffer is full and so is ours: stop reading
+             * until the peer drains (handle_write pulls the rest).
+             */
+            if (buffer_is_full(conn->read_buf) || sched_over_budget(config)) {
+                break;
+            }
             continue;
         } else if (n == 0) {
             /* EOF */
@@ -347,55 +702,228 @@ static void handle_read_tcp(proxy_config_t *config, connection_t *conn) {
     }
 }
 
+/* A Content-Length body that won't fit in the read buffer goes to a
+ * spool (-O) once the headers are in, instead of ending in a 413.
+ */
+static int wants_body_spool(const proxy_config_t *config, const http_request_t *req) {
+    return config->body_spooler != NULL && req->headers_end_offset > 0 &&
+           req->content_length >= 0 && !req->chunked &&
+           req->total_length > BUFFER_SIZE && http_request_is_valid(req);
+}
+
+/* Move the body bytes read so far into the body spool, leaving only the
+ * header block in client->read_buf. Returns 1 once the whole body is in,
+ * 0 while more is expected, -1 if the spool failed.
+ */
+static int take_request_body(connection_t *client) {
+    http_request_t *req = (http_request_t*)client->http_req;
+    buffer_t *buf = client->read_buf;
+    size_t head = req->headers_end_offset;
+    
+    uint64_t missing = (uint64_t)req->content_length - spool_pending(&req->body);
+    size_t n = buf->len - head;
+    if (n > missing) {
+        n = (size_t)missing;  /* Pipelined bytes are dropped, as without -O */
+    }
+    if (n > 0 && spool_append(&req->body, buf->data + head, n) < n) {
+        return -1;
+    }
+    buf->len = head;
+    
+    if (spool_pending(&req->body) < (uint64_t)req->content_length) {
+        return 0;
+    }
+    req->is_complete = 1;
+    return 1;
+}
+
+/* Expect: 100-continue with the headers in and the body not: the client
+ * waits for a go-ahead before sending the rest.
+ */
+static int awaits_continue(const http_request_t *req) {
+    return req->expect_continue && req->headers_end_offset > 0 &&
+           req->content_length > 0 && !req->chunked;
+}
+
+/* The go-ahead from the proxy itself: when it takes the body, when the
+ * upstream speaks HTTP/1.0 (which has no 100 Continue), or when the
+ * upstream is slow to answer (CONTINUE_WAIT_MS, on the upstream's timer).
+ * Whatever doesn't go out now leads the response.
+ */
+static void send_continue(proxy_config_t *config, connection_t *client) {
+    buffer_append(client->write_buf, CONTINUE_RESPONSE, sizeof(CONTINUE_RESPONSE) - 1);
+    write_counted(config, client);
+    config->stats.continues_sent++;
+}
+
+/* The rest of an Expect: 100-continue body, read after its headers went
+ * upstream. The client sends it once the upstream's 100 Continue reaches
+ * it (or when it tires of waiting); a final response instead means it
+ * won't, and the connection closes after that response.
+ */
+static void relay_request_body(proxy_config_t *config, connection_t *client) {
+    http_request_t *req = (http_request_t*)client->http_req;
+    connection_t *upstream = client->peer;
+    
+    /* Body all sent: anything readable is the next request, for later */
+    if (req->body_left == 0) {
+        return;
+    }
+    
+    while (connection_can_read(client)) {
+        ssize_t n = read_counted(config, client);
+        
+        if (n > 0) {
+            connection_update_activity(client);
+            config->stats.bytes_received += n;
+            
+            /* Nothing may follow the body before the response is out */
+            if ((uint64_t)n > req->body_left) {
+                client->read_buf->len -= (size_t)n - (size_t)req->body_left;
+                n = (ssize_t)req->body_left;
+            }
+            req->body_left -= (uint64_t)n;
+            forward_data(client, upstream);
+            
+            if (sched_over_budget(config)) {
+                break;
+            }
+            continue;
+        } else if (n == 0) {
+            /* Client gave up halfway through its body */
+            connection_close_pair(config, client);
+            return;
+        } else {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            config->stats.errors++;
+            connection_close_pair(config, client);
+            return;
+        }
+    }
+    
+    update_epoll_events(config, client);
+    if (client->peer) {
+        update_epoll_events(config, client->peer);
+    }
+}
+
 /* HTTP client read handler */
 static void handle_read_http_client(proxy_config_t *config, connection_t *client) {
+    /* Only in CONN_READING_REQUEST: one request at a time (state_handlers) */
+    
+    /* Idle connection: take buffers and parser state back from the pools */
+    if (connection_is_shrunk(client) && connection_wake(config, client) == -1) {
+        fprintf(stderr, "Out of buffers waking idle connection\n");
+        config->stats.errors++;
+        connection_close(config, client);
+        return;
+    }
+    
     /* Read data into buffer */
     while (1) {
-        ssize_t n = buffer_read_fd(&client->read_buf, client->fd);
+        ssize_t n = read_counted(config, client);
         
         if (n > 0) {
+            http_request_t *req = (http_request_t*)client->http_req;
             connection_update_activity(client);
             config->stats.bytes_received += n;
             
-            /* Try to parse HTTP request */
-            int parse_result = http_request_parse(
-                (http_request_t*)client->http_req,
-                client->read_buf.data,
-                client->read_buf.len
-            );
+            /* First bytes of a request: from now on it has to keep coming */
+            if (client->read_buf->len == (size_t)n) {
+                start_rate_window(config, client);
+                count_window(client, n);
+            }
+            
+            /* Try to parse HTTP request; past the headers of a spooled
+             * body, just collect it.
+             */
+            int parse_result;
+            if (req->body.owner != NULL) {
+                parse_result = take_request_body(client);
+            } else {
+                parse_result = http_request_parse(req, client->read_buf->data,
+                                                  client->read_buf->len);
+                if (parse_result == 0 && wants_body_spool(config, req)) {
+                    spool_begin(&req->body, config->body_spooler);
+                    
+                    /* We take the body, not the upstream: say so ourselves */
+                    if (req->expect_continue) {
+                        send_continue(config, client);
+                    }
+                    parse_result = take_request_body(client);
+                } else if (parse_result == 0 && awaits_continue(req)) {
+                    /* The client holds its body back until told to go on:
+                     * the headers go upstream now and its answer decides.
+                     */
+                    parse_result = 1;
+                }
+            }
+            
+            if (req->body.failed) {
+                start_rate_window(config, client);
+                config->stats.errors++;
+                send_http_error(client, 500, "Internal Server Error");
+                handle_write_http_client(config, client);
+                return;
+            }
             
             if (parse_result == 1) {
-                /* Request complete! */
+                /* Request complete! Now the response must keep draining */
                 client->state = CONN_REQUEST_COMPLETE;
+                start_rate_window(config, client);
+                if (config->sched != NULL) {
+                    client->http_req->started_us = sched_now_us();
+                }
+                
+                /* Refused before the client sends (more of) it */
+                if (req->content_length > MAX_BODY_LEN) {
+                    config->stats.requests_error++;
+                    send_http_error(client, 413, "Request Too Large");
+                    handle_write_http_client(config, client);
+                    return;
+                }
                 
                 /* Validate request */
-                if (!http_request_is_valid((const http_request_t*)client->http_req)) {
+                if (!http_request_is_valid(req)) {
                     config->stats.requests_error++;
                     send_http_error(client, 400, "Bad Request");
+                    handle_write_http_client(config, client);
                     return;
                 }
                 
                 /* Update stats */
                 config->stats.requests_total++;
-                http_request_t *req = (http_request_t*)client->http_req;
                 if (req->method == HTTP_METHOD_GET) {
                     config->stats.requests_get++;
                 } else if (req->method == HTTP_METHOD_POST) {
                     config->stats.requests_post++;
                 }
                 
+                if (client->capture_id != 0) {
+                    capture_request(config->capture, client->capture_id,
+                                    client->read_buf->data,
+                                    http_request_buffered_length(req, client->read_buf->len));
+                }
+                
                 /* Handle the request */
                 handle_http_request(config, client);
                 return;
                 
             } else if (parse_result == -1) {
                 /* Parse error */
+                start_rate_window(config, client);
                 config->stats.requests_error++;
                 send_http_error(client, 400, "Malformed Request");
+                handle_write_http_client(config, client);
                 return;
             }
             
             /* Need more data - continue reading */
+            if (buffer_is_full(client->read_buf)) {
+                break;
+            }
             continue;
             
         } else if (n == 0) {
@@ -415,34 +943,343 @@ static void handle_read_http_client(proxy_config_t *config, connection_t *client
     }
     
     /* Check if request is getting too large */
-    if (client->read_buf.len > MAX_REQUEST_SIZE) {
+    if (buffer_is_full(client->read_buf)) {
+        start_rate_window(config, client);
         config->stats.requests_error++;
         send_http_error(client, 413, "Request Too Large");
+        handle_write_http_client(config, client);
         return;
     }
 }
 
 /* ============================================================================
- * WRITE HANDLER
+ * UPSTREAM READ HANDLER - HTTP MODE
  * ============================================================================
  */
 
-void handle_write(proxy_config_t *config, connection_t *conn) {
-    if (!connection_can_write(conn)) {
-        return;
-    }
-    
-    while (1) {
-        ssize_t n = buffer_write_fd(&conn->write_buf, conn->fd);
+/* Run response framing over n freshly read bytes at the end of buf.
+ * (Interim responses are also handed over early: forward_interim().)
+ * Returns 1 when the response is complete, 0 if more is expected, -1 if the
+ * upstream sent something we can't frame.
+ *
+ * Until the final header block is complete nothing is forwarded, so in the
+ * HTTP_RESP_HEADERS state the whole block (plus any 1xx interim responses
+ * before it) sits at buf->pos.
+ */
+static int frame_response(http_response_t *resp, buffer_t *buf, size_t n) {
+    if (resp->state == HTTP_RESP_HEADERS) {
+        const char *data = buf->data + buf->pos;
+        size_t avail = buf->len - buf->pos;
+        size_t off = 0;
+        int head_request = resp->head_request;
         
-        if (n > 0) {
-            connection_update_activity(conn);
-            config->stats.bytes_sent += n;
-            
-            if (buffer_is_empty(&conn->write_buf)) {
-                break;
+        while (1) {
+            int r = http_response_parse_headers(resp, data + off, avail - off);
+            if (r == -1) {
+                return -1;
             }
-            continue;
+            if (r == 0) {
+                /* What's complete so far can go to the client already */
+                resp->interim_length = off;
+                
+                /* Header block larger than a buffer */
+                return buffer_is_full(buf) ? -1 : 0;
+            }
+            off += resp->header_length;
+            if (resp->status_code >= 200 || resp->status_code == 101) {
+                break;
+            }
+            /* 1xx interim response: the final one follows */
+            http_response_init(resp, head_request);
+        }
+        
+        n = avail - off;  /* Whatever follows the headers is body */
+    }
+    
+    size_t used = http_response_consume(resp, buf->data + buf->len - n, n);
+    if (resp->state == HTTP_RESP_INVALID) {
+        return -1;
+    }
+    
+    /* Bytes past the end of the response don't belong to this client */
+    buf->len -= n - used;
+    
+    return http_response_is_complete(resp);
+}
+
+/* The response is complete. The upstream is done once every byte of it has
+ * been handed to the client: close it, and the client finishes the exchange
+ * in handle_write() once its write buffer drains.
+ *
+ * Returns 1 if the upstream was released. If the client's write buffer was
+ * too full to take the tail, the upstream goes to CONN_CLOSING instead and
+ * handle_write() on the client releases it after pulling the rest.
+ */
+static int finish_upstream(proxy_config_t *config, connection_t *upstream) {
+    connection_t *client = upstream->peer;
+    
+    if (!buffer_is_empty(upstream->read_buf)) {
+        upstream->state = CONN_CLOSING;
+        return 0;
+    }
+    
+    /* The point of buffering: the client is still downloading */
+    if (spool_pending(&client->http_req->spool) > 0) {
+        config->spooler->stats.released_early++;
+    }
+    
+    connection_close(config, upstream);
+    handle_write_http_client(config, client);
+    return 1;
+}
+
+/* Pass on the 1xx responses ahead of a final one that isn't complete yet.
+ * A 100 Continue is what an Expect: 100-continue client waits for before
+ * sending its body; holding it back until the final response would stall
+ * the upload. If the client's write buffer can't take them in one piece,
+ * they go with the final response instead.
+ */
+static void forward_interim(connection_t *upstream, connection_t *client) {
+    http_response_t *resp = &client->http_req->response;
+    buffer_t *buf = upstream->read_buf;
+    size_t n = resp->interim_length;
+    
+    if (buffer_writable_bytes(client->write_buf) < n) {
+        return;
+    }
+    buffer_append(client->write_buf, buf->data + buf->pos, n);
+    buf->pos += n;
+    resp->interim_length = 0;
+}
+
+static void handle_read_http_upstream(proxy_config_t *config, connection_t *upstream) {
+    connection_t *client = upstream->peer;
+    
+    /* Client went away: nobody wants this response */
+    if (client == NULL) {
+        connection_close(config, upstream);
+        return;
+    }
+    
+    if (!connection_can_read(upstream)) {
+        return;
+    }
+    
+    http_response_t *resp = &client->http_req->response;
+    
+    while (1) {
+        ssize_t n = read_counted(config, upstream);
+        
+        if (n > 0) {
+            connection_update_activity(upstream);
+            config->stats.bytes_received += n;
+            
+            /* It has answered: no stand-in 100 Continue */
+            timer_cancel(&config->timers, &upstream->timer);
+            
+            int had_headers = resp->state != HTTP_RESP_HEADERS;
+            int framed = frame_response(resp, upstream->read_buf, n);
+            if (framed == -1) {
+                config->stats.errors++;
+                fail_upstream(config, upstream);
+                return;
+            }
+            
+            /* Headers just completed: note the upstream's version, and
+             * decide whether to keep a copy
+             */
+            if (!had_headers && resp->state != HTTP_RESP_HEADERS) {
+                config->backend_http10 = resp->http10;
+                if (client->http_req->fill.wanted) {
+                    disk_cache_begin(config->disk_cache, client->http_req,
+                                     upstream->read_buf->data + upstream->read_buf->pos,
+                                     buffer_readable_bytes(upstream->read_buf));
+                }
+            }
+            
+            if (resp->state == HTTP_RESP_HEADERS && resp->interim_length > 0) {
+                forward_interim(upstream, client);
+            }
+            
+            if (resp->state != HTTP_RESP_HEADERS &&
+                forward_response(upstream, client) == -1) {
+                config->stats.errors++;
+                connection_close_pair(config, upstream);
+                return;
+            }
+            
+            if (framed == 1) {
+                if (finish_upstream(config, upstream)) {
+                    return;
+                }
+                break;
+            }
+            
+            /* Client's write buffer is full: stop until it drains.
+             * Out of turn budget: the re-arm below brings us back.
+             */
+            if (buffer_is_full(upstream->read_buf) || sched_over_budget(config)) {
+                break;
+            }
+            continue;
+        } else if (n == 0) {
+            /* EOF ends a close-delimited body; anywhere else it's a
+             * truncated response.
+             */
+            if (resp->state == HTTP_RESP_BODY_EOF) {
+                resp->state = HTTP_RESP_DONE;
+                client->keep_alive = 0;
+                if (finish_upstream(config, upstream)) {
+                    return;
+                }
+                break;
+            }
+            fail_upstream(config, upstream);
+            return;
+        } else {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno != ECONNRESET) {
+                perror("read");
+            }
+            config->stats.errors++;
+            fail_upstream(config, upstream);
+            return;
+        }
+    }
+    
+    update_epoll_events(config, upstream);
+    update_epoll_events(config, client);
+}
+
+/* The upstream failed. If the client hasn't seen any of the response yet we
+ * can still answer with a clean 502; otherwise all we can do is cut both.
+ */
+SPECIALIZED void fail_upstream_role(proxy_config_t *config, connection_t *upstream,
+                                    const conn_role_t role) {
+    connection_t *client = upstream->peer;
+    
+    if (role == ROLE_HTTP_UPSTREAM || !connection_is_client(upstream)) {
+        config->stats.upstream_failures++;
+        direct_upstream(config->direct, 0);
+    }
+    
+    if (role != ROLE_HTTP_UPSTREAM || client == NULL ||
+        client->http_req->response.state != HTTP_RESP_HEADERS) {
+        connection_close_pair(config, upstream);
+        return;
+    }
+    
+    connection_close(config, upstream);
+    send_http_error(client, 502, "Bad Gateway");
+    handle_write_http_client(config, client);
+}
+
+static void fail_upstream(proxy_config_t *config, connection_t *upstream) {
+    if (upstream->role == ROLE_HTTP_UPSTREAM) {
+        fail_upstream_role(config, upstream, ROLE_HTTP_UPSTREAM);
+    } else {
+        fail_upstream_role(config, upstream, ROLE_TCP_BACKEND);
+    }
+}
+
+/* ============================================================================
+ * WRITE HANDLER
+ * ============================================================================
+ */
+
+/* Move data the peer read while our write buffer was full: spooled
+ * bytes first, they are older than anything still in the peer.
+ * An HTTP upstream still collecting response headers has nothing to give.
+ */
+SPECIALIZED size_t pull_from_peer(proxy_config_t *config, connection_t *conn,
+                                  const conn_role_t role) {
+    connection_t *peer = conn->peer;
+    size_t pulled = 0;
+    
+    /* Request body collected before this upstream was leased (-O) */
+    if (role == ROLE_HTTP_UPSTREAM && peer != NULL && peer->http_req != NULL &&
+        spool_pending(&peer->http_req->body) > 0) {
+        return spool_pull(&peer->http_req->body, conn->write_buf);
+    }
+    
+    if (role == ROLE_HTTP_CLIENT && conn->http_req != NULL &&
+        spool_pending(&conn->http_req->spool) > 0) {
+        pulled = spool_pull(&conn->http_req->spool, conn->write_buf);
+        if (spool_pending(&conn->http_req->spool) > 0) {
+            return pulled;
+        }
+    }
+    
+    if (peer == NULL || buffer_is_empty(peer->read_buf)) {
+        return pulled;
+    }
+    if (role == ROLE_HTTP_CLIENT &&
+        conn->http_req->response.state == HTTP_RESP_HEADERS) {
+        return pulled;
+    }
+    
+    /* What doesn't fit goes to the spool, so the upstream can read on */
+    size_t before = buffer_readable_bytes(peer->read_buf);
+    if (role == ROLE_HTTP_CLIENT) {
+        forward_response(peer, conn);
+    } else {
+        forward_data(peer, conn);
+    }
+    return pulled + (before - buffer_readable_bytes(peer->read_buf));
+}
+
+/* Spool error on what conn is sending: its response as a client, the
+ * request body as an upstream.
+ */
+SPECIALIZED int spool_lost(const connection_t *conn, const conn_role_t role) {
+    if (role == ROLE_HTTP_CLIENT) {
+        return conn->http_req != NULL && conn->http_req->spool.failed;
+    }
+    if (role == ROLE_HTTP_UPSTREAM) {
+        return conn->peer != NULL && conn->peer->http_req != NULL &&
+               conn->peer->http_req->body.failed;
+    }
+    return 0;
+}
+
+SPECIALIZED void write_role(proxy_config_t *config, connection_t *conn, const conn_role_t role) {
+    if (!connection_is_valid(conn)) {
+        return;
+    }
+    
+    /* A static file response goes out on its own, not via write_buf */
+    if (role == ROLE_HTTP_CLIENT && conn->http_req != NULL && conn->http_req->file.active &&
+        write_file_reply(config, conn) == -1) {
+        config->stats.errors++;
+        connection_close(config, conn);
+        return;
+    }
+    
+    pull_from_peer(config, conn, role);
+    
+    /* Part of a spooled response or request body is lost */
+    if (spool_lost(conn, role)) {
+        config->stats.errors++;
+        connection_close_pair(config, conn);
+        return;
+    }
+    
+    while (connection_can_write(conn)) {
+        ssize_t n = write_counted(config, conn);
+        
+        if (n > 0) {
+            connection_update_activity(conn);
+            config->stats.bytes_sent += n;
+            
+            if (buffer_is_empty(conn->write_buf) && pull_from_peer(config, conn, role) == 0) {
+                break;
+            }
+            if (sched_over_budget(config)) {
+                break;
+            }
+            continue;
         } else if (n == 0) {
             break;
         } else {
@@ -454,32 +1291,48 @@ void handle_write(proxy_config_t *config, connection_t *conn) {
             }
             config->stats.errors++;
             
-            /* In HTTP mode, client writes are special */
-            if (config->mode == PROXY_MODE_HTTP && conn->is_client) {
-                /* Response write failed - close connection */
-                connection_close(config, conn);
-            } else {
-                /* TCP mode or backend write - close both */
-                connection_close_pair(config, conn);
-            }
+            /* Write failed - close both sides. In HTTP mode an upstream
+             * whose client is gone has nobody left to answer.
+             */
+            connection_close_pair(config, conn);
             return;
         }
     }
     
-    /* If we finished writing response and it's not keep-alive, close */
-    if (config->mode == PROXY_MODE_HTTP && conn->is_client && 
-        buffer_is_empty(&conn->write_buf) && !conn->keep_alive) {
-        connection_close(config, conn);
-        return;
+    /* Upstream finished its response and the client has now taken the
+     * tail: the upstream can go.
+     */
+    if (conn->peer && conn->peer->state == CONN_CLOSING &&
+        buffer_is_empty(conn->peer->read_buf)) {
+        connection_close(config, conn->peer);
     }
     
-    /* If we finished writing response and it IS keep-alive, prepare for next request */
-    if (config->mode == PROXY_MODE_HTTP && conn->is_client && 
-        buffer_is_empty(&conn->write_buf) && conn->keep_alive) {
+    /* An HTTP exchange is over when the upstream has been released and the
+     * response is fully written to the client.
+     */
+    if (role == ROLE_HTTP_CLIENT &&
+        conn->state == CONN_WRITING_RESPONSE && conn->peer == NULL &&
+        buffer_is_empty(conn->write_buf) && !conn->http_req->file.active &&
+        spool_pending(&conn->http_req->spool) == 0) {
+        
+        if (config->sched != NULL && conn->http_req->started_us != 0) {
+            sched_request_done(config->sched, conn->traffic_class,
+                               conn->http_req->started_us);
+        }
+        
+        /* Not keep-alive: close. Nor if the client never sent all of an
+         * Expect: 100-continue body: what's left of it isn't a request.
+         */
+        if (!conn->keep_alive || conn->http_req->body_left > 0) {
+            connection_close(config, conn);
+            return;
+        }
+        
+        /* Keep-alive: prepare for next request */
+        buffer_clear(conn->read_buf);
+        buffer_clear(conn->write_buf);
         
-        /* Reset for next request */
-        buffer_clear(&conn->read_buf);
-        buffer_clear(&conn->write_buf);
+        /* Also drops this request's arena allocations in one step */
         http_request_init((http_request_t*)conn->http_req);
         conn->state = CONN_READING_REQUEST;
         conn->requests_handled++;
@@ -491,6 +1344,10 @@ void handle_write(proxy_config_t *config, connection_t *conn) {
         }
         
         config->stats.keep_alive_reused++;
+        
+        /* Idle from now on until the next request arrives */
+        timer_schedule(&config->timers, &conn->timer,
+                       conn->last_active + IDLE_SHRINK_MS);
     }
     
     update_epoll_events(config, conn);
@@ -499,6 +1356,33 @@ void handle_write(proxy_config_t *config, connection_t *conn) {
     }
 }
 
+static void handle_write_http_client(proxy_config_t *config, connection_t *client) {
+    write_role(config, client, ROLE_HTTP_CLIENT);
+}
+
+static void handle_write_http_upstream(proxy_config_t *config, connection_t *upstream) {
+    write_role(config, upstream, ROLE_HTTP_UPSTREAM);
+}
+
+/* Either end of a pair: the TCP write path doesn't tell them apart */
+static void handle_write_tcp(proxy_config_t *config, connection_t *conn) {
+    write_role(config, conn, ROLE_TCP_CLIENT);
+}
+
+/* Not through state_handlers: there, a connection still connecting
+ * takes EPOLLOUT as the connect completing.
+ */
+static const event_handler_t role_writers[CONN_ROLES] = {
+    [ROLE_TCP_CLIENT]    = handle_write_tcp,
+    [ROLE_TCP_BACKEND]   = handle_write_tcp,
+    [ROLE_HTTP_CLIENT]   = handle_write_http_client,
+    [ROLE_HTTP_UPSTREAM] = handle_write_http_upstream,
+};
+
+void handle_write(proxy_config_t *config, connection_t *conn) {
+    role_writers[conn->role](config, conn);
+}
+
 /* ============================================================================
  * HTTP REQUEST HANDLER
  * ============================================================================
@@ -508,13 +1392,67 @@ void handle_http_request(proxy_config_t *config, connection_t *client) {
     /* We have a complete, valid HTTP request in client->read_buf
      * Now we need to forward it to backend
      */
+    http_request_t *req = (http_request_t*)client->http_req;
+    
+    /* Save keep-alive preference (errors below override it) */
+    client->keep_alive = req->keep_alive;
+    
+    /* Later turns of both connections are charged to the request's class */
+    if (config->sched != NULL) {
+        client->traffic_class = sched_classify(config->sched, req->path);
+    }
+    
+    /* The response to this request draws on its route's bandwidth cap */
+    if (config->shaper != NULL && config->shaper->route_count > 0) {
+        client->shape_route = shaper_route(config->shaper, req->path);
+    }
+    
+    /* Health checks, redirects and fixed bodies are answered here, ahead
+     * of static files: one write of pre-rendered bytes, no backend
+     */
+    if (config->direct != NULL) {
+        direct_route_t *route = direct_route(config->direct, req->path);
+        if (route != NULL) {
+            if (direct_respond(config->direct, route, req, &req->file, client->keep_alive) != 0) {
+                config->stats.requests_error++;
+                send_http_error(client, 400, "Bad Request");
+                handle_write_http_client(config, client);
+                return;
+            }
+            serve_file_reply(config, client);
+            return;
+        }
+    }
+    
+    /* Local files never reach the backend */
+    if (config->static_files != NULL) {
+        const static_route_t *route = static_files_route(config->static_files, req->path);
+        if (route != NULL) {
+            serve_static(config, client, route);
+            return;
+        }
+    }
+    
+    if (config->disk_cache != NULL &&
+        disk_cache_lookup(config->disk_cache, req, &req->file)) {
+        /* Stored bytes carry no Connection header for a 1.0 client */
+        if (req->version == HTTP_VERSION_10) {
+            client->keep_alive = 0;
+        }
+        serve_file_reply(config, client);
+        return;
+    }
     
     /* Create backend connection */
     int backend_fd = create_backend_connection(config->backend_addr,
                                                config->backend_port);
+    count_backend_setup(config);
     if (backend_fd == -1) {
         fprintf(stderr, "Failed to connect to backend\n");
+        config->stats.upstream_failures++;
+        direct_upstream(config->direct, 0);
         send_http_error(client, 502, "Bad Gateway");
+        handle_write_http_client(config, client);
         return;
     }
     
@@ -522,51 +1460,202 @@ void handle_http_request(proxy_config_t *config, connection_t *client) {
     connection_t *backend = connection_alloc(config);
     if (backend == NULL) {
         fprintf(stderr, "Connection pool exhausted for backend\n");
-        close(backend_fd);
+        close_counted(config, SYSCALL_SIDE_UPSTREAM, backend_fd);
         send_http_error(client, 503, "Service Unavailable");
+        handle_write_http_client(config, client);
         return;
     }
     
     /* Initialize backend connection */
-    connection_init(backend, backend_fd, 0, CONN_CONNECTING);
+    connection_init(backend, backend_fd, ROLE_HTTP_UPSTREAM, CONN_CONNECTING);
+    config->stats.upstream_connects++;
     
-    /* Pair client and backend */
-    connection_pair(client, backend);
+    /* Copy request data to backend write buffer. A spooled body follows
+     * the headers from pull_from_peer().
+     */
+    size_t request_len = http_request_buffered_length(req, client->read_buf->len);
     
-    /* Copy request data to backend write buffer */
-    http_request_t *req = (http_request_t*)client->http_req;
-    size_t request_len = req->total_length;
+    /* Expect: 100-continue: what the client sent so far; it relays the
+     * rest once the upstream lets it go on.
+     */
+    if (req->body.owner == NULL && request_len < req->total_length) {
+        req->body_left = req->total_length - request_len;
+    }
     if (request_len > BUFFER_SIZE) {
         /* Request too large for our buffer - shouldn't happen if we validated */
         fprintf(stderr, "Request too large: %zu bytes\n", request_len);
         connection_close(config, backend);
         send_http_error(client, 413, "Request Entity Too Large");
+        handle_write_http_client(config, client);
         return;
     }
     
-    memcpy(backend->write_buf.data, client->read_buf.data, request_len);
-    backend->write_buf.len = request_len;
-    backend->write_buf.pos = 0;
+    /* Pair client and backend */
+    connection_pair(client, backend);
+    backend->traffic_class = client->traffic_class;
+    
+    /* A spooled or relayed body is added to the backend's write buffer,
+     * which a shadow would be sharing: those requests aren't mirrored.
+     */
+    mirror_route_t *mirror =
+        config->mirror != NULL && req->body.owner == NULL && req->body_left == 0
+        ? mirror_route(config->mirror, req->path) : NULL;
+    if (mirror != NULL) {
+        /* The request goes out from the buffer it was read into: the
+         * backend takes it as its write buffer, the shadow shares it, and
+         * the client reads its next request into the backend's spare.
+         */
+        buffer_t *spare = backend->write_buf;
+        backend->write_buf = client->read_buf;
+        client->read_buf = spare;
+    } else {
+        memcpy(backend->write_buf->data, client->read_buf->data, request_len);
+    }
+    backend->write_buf->len = request_len;
+    backend->write_buf->pos = 0;
     
     /* Clear client read buffer */
-    buffer_clear(&client->read_buf);
+    buffer_clear(client->read_buf);
     
-    /* Save keep-alive preference */
-    client->keep_alive = req->keep_alive;
+    /* Get ready to frame the response */
+    http_response_init(&req->response, req->method == HTTP_METHOD_HEAD);
+    if (config->spooler != NULL) {
+        spool_begin(&req->spool, config->spooler);
+    }
     
     /* Add backend to epoll */
+    syscount_n(config, SYSCALL_SIDE_UPSTREAM, SYSCALL_EPOLL_CTL, 1);
     if (epoll_add(config->epoll_fd, backend_fd, EPOLLOUT, backend) == -1) {
         connection_close_pair(config, client);
         return;
     }
     
+    /* Best effort: dropped, never waited for, when the shadow can't keep up */
+    if (mirror != NULL) {
+        mirror_request(config, mirror, backend->write_buf, request_len,
+                       req->method == HTTP_METHOD_HEAD);
+    }
+    
     /* Update client state */
     client->state = CONN_WRITING_RESPONSE;
     
+    /* Expect: 100-continue. An HTTP/1.0 upstream never sends the go-ahead;
+     * any other gets CONTINUE_WAIT_MS to send it (or a final response)
+     * before the proxy does.
+     */
+    if (req->body_left > 0) {
+        if (config->backend_http10) {
+            send_continue(config, client);
+        } else {
+            timer_schedule(&config->timers, &backend->timer,
+                           get_timestamp_ms() + CONTINUE_WAIT_MS);
+        }
+    }
+    
     /* Update epoll for client (we want to write response to it later) */
     update_epoll_events(config, client);
 }
 
+/* ============================================================================
+ * FILE RESPONSES
+ * ============================================================================
+ */
+
+static void serve_static(proxy_config_t *config, connection_t *client,
+                         const static_route_t *route) {
+    http_request_t *req = client->http_req;
+    
+    int status = static_files_respond(config, route, req, &req->file, client->keep_alive);
+    if (status != 0) {
+        send_http_error(client, status,
+                        status == 404 ? "Not Found" :
+                        status == 405 ? "Method Not Allowed" : "Service Unavailable");
+        handle_write_http_client(config, client);
+        return;
+    }
+    
+    serve_file_reply(config, client);
+}
+
+/* req->file holds a response: send it, no upstream involved */
+static void serve_file_reply(proxy_config_t *config, connection_t *client) {
+    buffer_clear(client->read_buf);
+    client->state = CONN_WRITING_RESPONSE;
+    handle_write_http_client(config, client);
+}
+
+/* Header first (MSG_MORE while a body follows, so they can share a
+ * segment), then the body from the page cache. Gives way after
+ * FILE_REPLY_BURST bytes or at the end of a traffic class turn; the
+ * EPOLL_CTL_MOD that follows re-arms EPOLLOUT, so the rest goes out on the
+ * next loop iteration. Out of bandwidth tokens, the shaper's timer brings
+ * it back instead.
+ * Returns 0 (done or waiting for the socket or tokens) or -1 on error.
+ */
+static int write_file_reply(proxy_config_t *config, connection_t *client) {
+    file_reply_t *reply = &client->http_req->file;
+    
+    int shaped = shaper_applies(config, client);
+    
+    while (reply->head_count > 0) {
+        if (shaped && shaper_allow(config, client, 1) == 0) {
+            return 0;
+        }
+        struct msghdr msg = {
+            .msg_iov = &reply->head[reply->head_first],
+            .msg_iovlen = (size_t)reply->head_count
+        };
+        ssize_t n = sendmsg(client->fd, &msg, reply->remaining > 0 ? MSG_MORE : 0);
+        syscount(config, SYSCALL_SIDE_CLIENT, SYSCALL_WRITE, n);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        connection_update_activity(client);
+        config->stats.bytes_sent += n;
+        sched_charge(config, n);
+        count_window(client, n);
+        if (shaped) {
+            shaper_charge(config, client, (size_t)n);
+        }
+        file_reply_advance(reply, (size_t)n);
+    }
+    
+    size_t burst = 0;
+    while (reply->remaining > 0) {
+        size_t chunk = reply->remaining < FILE_REPLY_BURST
+            ? (size_t)reply->remaining : FILE_REPLY_BURST;
+        if (shaped && (chunk = shaper_allow(config, client, chunk)) == 0) {
+            return 0;
+        }
+        ssize_t n = sendfile(client->fd, reply->fd, &reply->offset, chunk);
+        syscount(config, SYSCALL_SIDE_CLIENT, SYSCALL_SENDFILE, n);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        if (n == 0) {
+            return -1;  /* File shrank under us: the length we sent is wrong */
+        }
+        connection_update_activity(client);
+        config->stats.bytes_sent += n;
+        if (reply->body_bytes != NULL) {
+            *reply->body_bytes += (uint64_t)n;
+        }
+        reply->remaining -= n;
+        burst += (size_t)n;
+        sched_charge(config, n);
+        count_window(client, n);
+        if (shaped) {
+            shaper_charge(config, client, (size_t)n);
+        }
+        if ((burst >= FILE_REPLY_BURST || sched_over_budget(config)) && reply->remaining > 0) {
+            return 0;
+        }
+    }
+    
+    file_reply_end(reply);
+    return 0;
+}
+
 /* ============================================================================
  * ERROR RESPONSE
  * ============================================================================
@@ -591,10 +1680,11 @@ void send_http_error(connection_t *client, int status_code, const char *message)
     /* Write error response to client buffer */
     if (len > 0 && (size_t)len < sizeof(response)) {
         size_t copy_len = (size_t)len < BUFFER_SIZE ? len : BUFFER_SIZE;
-        memcpy(client->write_buf.data, response, copy_len);
-        client->write_buf.len = copy_len;
-        client->write_buf.pos = 0;
+        memcpy(client->write_buf->data, response, copy_len);
+        client->write_buf->len = copy_len;
+        client->write_buf->pos = 0;
         client->keep_alive = 0;  /* Close after error */
+        client->state = CONN_WRITING_RESPONSE;
     }
 }
 
@@ -607,15 +1697,11 @@ void handle_connect(proxy_config_t *config, connection_t *conn) {
     int error = 0;
     socklen_t len = sizeof(error);
     
-    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+    int ret = getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    syscount(config, syscount_side(conn), SYSCALL_SOCKOPT, ret);
+    if (ret == -1) {
         perror("getsockopt SO_ERROR");
-        
-        /* In HTTP mode, send error to client */
-        if (config->mode == PROXY_MODE_HTTP && conn->peer && conn->peer->is_client) {
-            send_http_error(conn->peer, 502, "Bad Gateway");
-        } else {
-            connection_close_pair(config, conn);
-        }
+        fail_upstream(config, conn);
         return;
     }
     
@@ -624,30 +1710,157 @@ void handle_connect(proxy_config_t *config, connection_t *conn) {
         perror("backend connect");
         config->stats.errors++;
         
-        /* In HTTP mode, send error to client */
-        if (config->mode == PROXY_MODE_HTTP && conn->peer && conn->peer->is_client) {
-            send_http_error(conn->peer, 502, "Bad Gateway");
-        } else {
-            connection_close_pair(config, conn);
-        }
+        /* In HTTP mode, the client gets a 502 */
+        fail_upstream(config, conn);
         return;
     }
     
     /* Connection succeeded */
     connection_set_state(conn, CONN_CONNECTED);
+    direct_upstream(config->direct, 1);
     update_epoll_events(config, conn);
 }
 
+/* Connect completion, then whatever queued up meanwhile goes out */
+SPECIALIZED void connect_role(proxy_config_t *config, connection_t *conn,
+                              const conn_role_t role) {
+    handle_connect(config, conn);
+    if (conn->state == CONN_CONNECTED) {
+        write_role(config, conn, role);
+    }
+}
+
+static void handle_connect_http(proxy_config_t *config, connection_t *upstream) {
+    connect_role(config, upstream, ROLE_HTTP_UPSTREAM);
+}
+
+static void handle_connect_tcp(proxy_config_t *config, connection_t *backend) {
+    connect_role(config, backend, ROLE_TCP_BACKEND);
+}
+
+/* ============================================================================
+ * TIMER HANDLER
+ * ============================================================================
+ */
+
+/* ============================================================================
+ * MINIMUM DATA RATE
+ * ============================================================================
+ * A client that sends a request a byte at a time, or never reads its
+ * response, holds a connection slot, two buffers and parser state for as
+ * long as it likes. With -r, every HTTP client with a request arriving or
+ * a response waiting on it is checked once per MIN_RATE_WINDOW_MS on its
+ * own timer: fewer than min_rate bytes/s over the window and it is closed.
+ * The only cost on the data path is the window_bytes counter.
+ *
+ * Waiting on the upstream, or on our own bandwidth cap, doesn't count
+ * against the client: the drain check only applies while the response
+ * has bytes the client could be taking.
+ */
+
+static void start_rate_window(proxy_config_t *config, connection_t *client) {
+    if (config->min_rate == 0) {
+        return;
+    }
+    client->window_bytes = 0;
+    timer_schedule(&config->timers, &client->timer,
+                   get_timestamp_ms() + MIN_RATE_WINDOW_MS);
+}
+
+static void check_rate(proxy_config_t *config, connection_t *client) {
+    uint64_t need = config->min_rate * MIN_RATE_WINDOW_MS / 1000;
+    
+    if (client->window_bytes < need) {
+        if (client->state == CONN_READING_REQUEST) {
+            config->stats.slow_requests++;
+            connection_close(config, client);
+            return;
+        }
+        int waiting = !client->shape_paused &&
+            (!buffer_is_empty(client->write_buf) || client->http_req->file.active);
+        if (waiting) {
+            /* Reset, don't FIN: a FIN leaves the kernel trickling the
+             * queued response to the same slow reader for minutes.
+             */
+            struct linger abort = { .l_onoff = 1, .l_linger = 0 };
+            int ret = setsockopt(client->fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+            syscount(config, SYSCALL_SIDE_CLIENT, SYSCALL_SOCKOPT, ret);
+            config->stats.slow_drains++;
+            connection_close_pair(config, client);
+            return;
+        }
+    }
+    start_rate_window(config, client);
+}
+
+void handle_timeout(proxy_config_t *config, connection_t *conn) {
+    /* The only upstream timer: no answer yet to an Expect: 100-continue.
+     * A client that sent its body anyway needs no go-ahead.
+     */
+    if (conn->role == ROLE_HTTP_UPSTREAM) {
+        connection_t *client = conn->peer;
+        if (client != NULL && client->http_req->body_left > 0) {
+            send_continue(config, client);
+            update_epoll_events(config, client);
+        }
+        return;
+    }
+    
+    if (conn->role != ROLE_HTTP_CLIENT) {
+        return;
+    }
+    
+    /* Idle keep-alive client: give its buffers and parser state back.
+     * A request that has started arriving is on the min-rate clock instead.
+     */
+    if (conn->state == CONN_READING_REQUEST &&
+        (connection_is_shrunk(conn) || buffer_is_empty(conn->read_buf))) {
+        connection_shrink(config, conn);
+        return;
+    }
+    
+    if (config->min_rate != 0) {
+        check_rate(config, conn);
+    }
+}
+
+static void handle_timer(void *ctx, timer_node_t *node) {
+    proxy_config_t *config = (proxy_config_t *)ctx;
+    
+    /* The one timer that isn't embedded in a connection */
+    if (node == &config->tcpinfo.timer) {
+        tcpinfo_sample_round(config, get_timestamp_ms());
+        return;
+    }
+    
+    /* A shadow request ran out of time */
+    if (config->mirror != NULL && mirror_timer(config, node)) {
+        return;
+    }
+    
+    /* A connection's bandwidth tokens are back: carry on writing */
+    connection_t *conn = shaper_timer(config, node);
+    if (conn != NULL) {
+        handle_write(config, conn);
+        return;
+    }
+    
+    conn = (connection_t *)((char *)node - offsetof(connection_t, timer));
+    handle_timeout(config, conn);
+}
+
 /* ============================================================================
  * ERROR HANDLER
  * ============================================================================
  */
 
-void handle_error(proxy_config_t *config, connection_t *conn) {
+static void report_error(proxy_config_t *config, connection_t *conn) {
     int error = 0;
     socklen_t len = sizeof(error);
     
-    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error != 0) {
+    int ret = getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    syscount(config, syscount_side(conn), SYSCALL_SOCKOPT, ret);
+    if (ret == 0 && error != 0) {
         errno = error;
         if (errno != ECONNRESET && errno != EPIPE) {
             fprintf(stderr, "Connection error on fd=%d: %s\n", 
@@ -656,12 +1869,30 @@ void handle_error(proxy_config_t *config, connection_t *conn) {
     }
     
     config->stats.errors++;
-    
-    /* In HTTP mode, client errors don't close backend */
-    if (config->mode == PROXY_MODE_HTTP && conn->is_client) {
-        connection_close(config, conn);
-    } else {
-        connection_close_pair(config, conn);
+}
+
+/* In HTTP mode, client errors don't close backend */
+static void handle_error_client(proxy_config_t *config, connection_t *client) {
+    report_error(config, client);
+    connection_close(config, client);
+}
+
+/* Upstream failure: the client may still get a 502 */
+static void handle_error_http(proxy_config_t *config, connection_t *upstream) {
+    report_error(config, upstream);
+    fail_upstream_role(config, upstream, ROLE_HTTP_UPSTREAM);
+}
+
+/* Either end of a pair, as for writes */
+static void handle_error_tcp(proxy_config_t *config, connection_t *conn) {
+    report_error(config, conn);
+    fail_upstream_role(config, conn, ROLE_TCP_CLIENT);
+}
+
+void handle_error(proxy_config_t *config, connection_t *conn) {
+    event_handler_t error = state_handlers[conn->role][conn->state][EV_ERROR];
+    if (error != NULL) {
+        error(config, conn);
     }
 }
 
@@ -675,36 +1906,75 @@ ssize_t forward_data(connection_t *src, connection_t *dst) {
         return -1;
     }
     
-    size_t available = buffer_readable_bytes(&src->read_buf);
+    size_t available = buffer_readable_bytes(src->read_buf);
     if (available == 0) {
         return 0;
     }
     
-    size_t space = buffer_writable_bytes(&dst->write_buf);
+    size_t space = buffer_writable_bytes(dst->write_buf);
     if (space == 0) {
         return 0;
     }
     
     size_t to_copy = available < space ? available : space;
     
-    memcpy(dst->write_buf.data + dst->write_buf.len,
-           src->read_buf.data + src->read_buf.pos,
+    memcpy(dst->write_buf->data + dst->write_buf->len,
+           src->read_buf->data + src->read_buf->pos,
            to_copy);
     
-    dst->write_buf.len += to_copy;
-    src->read_buf.pos += to_copy;
+    /* Response on its way into the disk cache */
+    if (connection_is_client(dst) && dst->http_req != NULL && dst->http_req->fill.entry != NULL) {
+        disk_cache_tee(&dst->http_req->fill, src->read_buf->data + src->read_buf->pos, to_copy);
+    }
+    
+    dst->write_buf->len += to_copy;
+    src->read_buf->pos += to_copy;
     
-    if (src->read_buf.pos >= src->read_buf.len) {
-        buffer_clear(&src->read_buf);
+    if (src->read_buf->pos >= src->read_buf->len) {
+        buffer_clear(src->read_buf);
     }
     
-    if (dst->write_buf.pos > 0 && buffer_writable_bytes(&dst->write_buf) < 1024) {
-        buffer_compact(&dst->write_buf);
+    if (dst->write_buf->pos > 0 && buffer_writable_bytes(dst->write_buf) < 1024) {
+        buffer_compact(dst->write_buf);
     }
     
     return to_copy;
 }
 
+/* Hand response bytes from upstream to client. With buffering on, what
+ * the client's write buffer can't take goes into its spool instead of
+ * waiting in the upstream's read buffer. Nothing overtakes the spool:
+ * while it holds bytes, new ones queue behind them.
+ *
+ * Returns -1 if the spool failed and the response can't be delivered.
+ */
+static int forward_response(connection_t *upstream, connection_t *client) {
+    http_request_t *req = (http_request_t*)client->http_req;
+    spool_t *sp = &req->spool;
+    
+    if (sp->owner == NULL) {
+        forward_data(upstream, client);
+        return 0;
+    }
+    if (spool_pending(sp) == 0) {
+        forward_data(upstream, client);
+    }
+    
+    buffer_t *buf = upstream->read_buf;
+    size_t taken = spool_append(sp, buf->data + buf->pos, buffer_readable_bytes(buf));
+    if (sp->failed) {
+        return -1;
+    }
+    if (taken > 0 && req->fill.entry != NULL) {
+        disk_cache_tee(&req->fill, buf->data + buf->pos, taken);
+    }
+    buf->pos += taken;
+    if (buf->pos >= buf->len) {
+        buffer_clear(buf);
+    }
+    return 0;
+}
+
 int update_epoll_events(proxy_config_t *config, connection_t *conn) {
     if (!connection_is_valid(conn)) {
         return -1;
@@ -724,7 +1994,9 @@ int update_epoll_events(proxy_config_t *config, connection_t *conn) {
         events = EPOLLIN;  /* Keep minimal registration */
     }
     
-    return epoll_mod(config->epoll_fd, conn->fd, events, conn);
+    int ret = epoll_mod(config->epoll_fd, conn->fd, events, conn);
+    syscount(config, syscount_side(conn), SYSCALL_EPOLL_CTL, ret);
+    return ret;
 }
 
 void print_stats(const proxy_config_t *config) {
@@ -736,6 +2008,15 @@ void print_stats(const proxy_config_t *config) {
     printf("Bytes received:     %lu\n", config->stats.bytes_received);
     printf("Bytes sent:         %lu\n", config->stats.bytes_sent);
     printf("Errors:             %lu\n", config->stats.errors);
+    printf("Buffers:            %zu allocated, %zu in use\n",
+           config->buffers.total,
+           config->buffers.total - config->buffers.free_count);
+    printf("Parser states:      %zu allocated, %zu in use\n",
+           config->requests.total,
+           config->requests.total - config->requests.free_count);
+    printf("Arena blocks:       %zu allocated, %zu in use\n",
+           config->arenas.total,
+           config->arenas.total - config->arenas.free_count);
     
     if (config->mode == PROXY_MODE_HTTP) {
         printf("\n--- HTTP Stats ---\n");
@@ -744,7 +2025,144 @@ void print_stats(const proxy_config_t *config) {
         printf("Requests POST:      %lu\n", config->stats.requests_post);
         printf("Requests error:     %lu\n", config->stats.requests_error);
         printf("Keep-alive reused:  %lu\n", config->stats.keep_alive_reused);
+        printf("Idle shrinks:       %lu\n", config->stats.idle_shrinks);
+        printf("Idle wakeups:       %lu\n", config->stats.idle_wakeups);
+        printf("100 Continue sent:  %lu (by the proxy, not the upstream)\n",
+               config->stats.continues_sent);
+        if (config->min_rate != 0) {
+            printf("Slow clients:       %lu sending, %lu reading (closed below %lu B/s)\n",
+                   (unsigned long)config->stats.slow_requests,
+                   (unsigned long)config->stats.slow_drains,
+                   (unsigned long)config->min_rate);
+        }
+    }
+    
+    if (config->tcpinfo.enabled) {
+        printf("\n--- TCP_INFO ---\n");
+        tcpinfo_print("Clients:", &config->tcpinfo.listener);
+        tcpinfo_print("Upstream:", &config->tcpinfo.upstream);
+        printf("Close samples skipped (over budget): %lu\n",
+               (unsigned long)config->tcpinfo.skipped);
+    }
+    
+    if (config->direct != NULL) {
+        printf("\n--- Direct Responses ---\n");
+        direct_print(config->direct);
+    }
+    
+    if (config->static_files != NULL) {
+        printf("\n--- Static Files ---\n");
+        static_files_print(config->static_files);
+    }
+    
+    if (config->disk_cache != NULL) {
+        printf("\n--- Disk Cache ---\n");
+        disk_cache_print(config->disk_cache);
+    }
+    
+    if (config->mirror != NULL) {
+        printf("\n--- Mirror ---\n");
+        mirror_print(config->mirror);
+    }
+    
+    if (config->sched != NULL) {
+        printf("\n--- Traffic Classes ---\n");
+        sched_print(config->sched);
+    }
+    
+    if (config->shaper != NULL) {
+        printf("\n--- Bandwidth Shaping ---\n");
+        shaper_print(config->shaper);
+    }
+    
+    if (config->spooler != NULL) {
+        printf("\n--- Response Buffering ---\n");
+        spooler_print(config->spooler, "responses");
+        printf("Upstreams released before the client finished: %lu\n",
+               (unsigned long)config->spooler->stats.released_early);
+    }
+    
+    if (config->body_spooler != NULL) {
+        printf("\n--- Request Body Buffering ---\n");
+        spooler_print(config->body_spooler, "request bodies");
+    }
+    
+    printf("\n--- Syscalls ---\n");
+    syscount_print(config);
+    
+    if (config->capture != NULL) {
+        printf("\nCapture: %lu requests from %u connections, %lu dropped (file full)\n",
+               (unsigned long)config->capture->header->records,
+               config->capture->header->connections,
+               (unsigned long)config->capture->dropped);
     }
     
     printf("========================\n");
-}
\ No newline at end of file
+}
+
+static void publish_tcpinfo(scoreboard_tcpinfo_t *out, const tcpinfo_stats_t *in) {
+    out->samples = in->samples;
+    out->rtt_p50_us = histogram_percentile(&in->rtt_us, 50);
+    out->rtt_p99_us = histogram_percentile(&in->rtt_us, 99);
+    out->rttvar_p50_us = histogram_percentile(&in->rttvar_us, 50);
+    out->cwnd_p50 = histogram_percentile(&in->cwnd, 50);
+    out->unacked_p99 = histogram_percentile(&in->unacked, 99);
+    out->delivery_rate_p50 = histogram_percentile(&in->delivery_rate, 50);
+    out->retrans_milli = (uint64_t)(histogram_mean(&in->retrans) * 1000);
+}
+
+/* Copy the counters and gauges into the shared scoreboard.
+ * This proxy is one event loop, so it owns worker slot 0 and the single
+ * upstream slot.
+ */
+static void publish_scoreboard(proxy_config_t *config, uint64_t now) {
+    scoreboard_t *sb = config->scoreboard;
+    scoreboard_worker_t *w = &sb->workers[0];
+    scoreboard_upstream_t *up = &sb->upstreams[0];
+    
+    scoreboard_write_begin(sb);
+    
+    sb->worker_count = 1;
+    sb->upstream_count = 1;
+    
+    if (w->started_ms == 0) {
+        w->pid = (uint32_t)getpid();
+        w->started_ms = now;
+    }
+    w->mode = config->mode;
+    w->updated_ms = now;
+    
+    w->active_connections = config->stats.active_connections;
+    w->buffers_total = config->buffers.total;
+    w->buffers_in_use = config->buffers.total - config->buffers.free_count;
+    w->parsers_total = config->requests.total;
+    w->parsers_in_use = config->requests.total - config->requests.free_count;
+    w->arena_blocks_total = config->arenas.total;
+    w->arena_blocks_in_use = config->arenas.total - config->arenas.free_count;
+    w->timers_armed = config->timers.count;
+    
+    w->counters.total_connections = config->stats.total_connections;
+    w->counters.bytes_received = config->stats.bytes_received;
+    w->counters.bytes_sent = config->stats.bytes_sent;
+    w->counters.errors = config->stats.errors;
+    w->counters.requests_total = config->stats.requests_total;
+    w->counters.requests_get = config->stats.requests_get;
+    w->counters.requests_post = config->stats.requests_post;
+    w->counters.requests_error = config->stats.requests_error;
+    w->counters.keep_alive_reused = config->stats.keep_alive_reused;
+    w->counters.idle_shrinks = config->stats.idle_shrinks;
+    w->counters.idle_wakeups = config->stats.idle_wakeups;
+    w->counters.loop_iterations = config->stats.loop_iterations;
+    w->counters.syscalls = syscount_total(&config->syscalls);
+    w->counters.syscalls_eagain = syscount_wasted(&config->syscalls);
+    publish_tcpinfo(&w->clients, &config->tcpinfo.listener);
+    
+    snprintf(up->name, sizeof(up->name), "%s:%u",
+             config->backend_addr, config->backend_port);
+    up->connects = config->stats.upstream_connects;
+    up->failures = config->stats.upstream_failures;
+    up->active = config->stats.upstream_connects - config->stats.upstream_closes;
+    publish_tcpinfo(&up->tcp, &config->tcpinfo.upstream);
+    
+    scoreboard_write_end(sb);
+}
@@ -0,0 +1,143 @@
+/* Heap allocation counter, loaded with LD_PRELOAD.
+ *
+ * Wraps the glibc allocator entry points and counts calls. On SIGUSR2 the
+ * running totals are appended to $ALLOC_COUNTER_LOG as one line:
+ *
+ *     allocs=<n> frees=<n> bytes=<n>
+ *
+ * The harness (check_alloc.sh) takes a snapshot before and after a phase of
+ * traffic and diffs them. Everything here has to be async-signal-safe and
+ * must not allocate, so numbers are formatted by hand and written with
+ * write(2).
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* glibc's real allocator, exported under these names */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t alloc_count;
+static uint64_t free_count;
+static uint64_t alloc_bytes;
+static int log_fd = -1;
+
+static void count_alloc(size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+/* ============================================================================
+ * ALLOCATOR WRAPPERS
+ * ============================================================================
+ */
+
+void *malloc(size_t size) {
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    count_alloc(nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    count_alloc(size);
+    void *ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void free(void *ptr) {
+    if (ptr != NULL) {
+        __atomic_fetch_add(&free_count, 1, __ATOMIC_RELAXED);
+    }
+    __libc_free(ptr);
+}
+
+/* ============================================================================
+ * SNAPSHOTS
+ * ============================================================================
+ */
+
+static char *append_str(char *p, const char *s) {
+    while (*s) {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static char *append_u64(char *p, uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static void snapshot(int signum) {
+    (void)signum;
+    char line[128];
+    char *p = line;
+    p = append_str(p, "allocs=");
+    p = append_u64(p, __atomic_load_n(&alloc_count, __ATOMIC_RELAXED));
+    p = append_str(p, " frees=");
+    p = append_u64(p, __atomic_load_n(&free_count, __ATOMIC_RELAXED));
+    p = append_str(p, " bytes=");
+    p = append_u64(p, __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED));
+    *p++ = '\n';
+    
+    int saved_errno = errno;
+    if (write(log_fd, line, (size_t)(p - line)) < 0) {
+        /* Nothing sensible to do from a signal handler */
+    }
+    errno = saved_errno;
+}
+
+__attribute__((constructor))
+static void alloc_counter_init(void) {
+    const char *path = getenv("ALLOC_COUNTER_LOG");
+    if (path == NULL) {
+        return;
+    }
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd == -1) {
+        return;
+    }
+    
+    /* SA_RESTART so the snapshot doesn't disturb the proxy's syscalls */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = snapshot;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+}
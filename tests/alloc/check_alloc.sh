@@ -0,0 +1,131 @@
+#!/bin/bash
+
+# Zero-allocation steady-state check
+#
+# Runs the proxy under the allocation counter (LD_PRELOAD) and fails if,
+# once pools are warm, any of these touch the heap:
+#   - a keep-alive request/response cycle (HTTP mode)
+#   - a new connection: accept, one request, close (HTTP mode)
+#   - a request/response forwarded over a TCP mode connection
+#
+# Usage: check_alloc.sh PROXY_BINARY COUNTER_LIBRARY
+
+PROXY=$1
+COUNTER=$2
+PORT=${ALLOC_CHECK_PORT:-18380}
+BACKEND_PORT=$((PORT + 1))
+LOG=$(mktemp /tmp/alloc-counter.XXXXXX)
+FAILED=0
+
+if [ ! -x "$PROXY" ] || [ ! -f "$COUNTER" ]; then
+    echo "usage: $0 PROXY_BINARY COUNTER_LIBRARY"
+    exit 2
+fi
+
+# Keep-alive backend with a 32KB body, so responses take several reads
+python3 - $BACKEND_PORT > /dev/null 2>&1 <<'PY' &
+import asyncio, sys
+BODY = b"x" * 32768
+RESP = b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s" % (len(BODY), BODY)
+async def handle(reader, writer):
+    try:
+        while True:
+            await reader.readuntil(b"\r\n\r\n")
+            writer.write(RESP)
+            await writer.drain()
+    except Exception:
+        pass
+    writer.close()
+async def main():
+    server = await asyncio.start_server(handle, "127.0.0.1", int(sys.argv[1]))
+    async with server:
+        await server.serve_forever()
+asyncio.run(main())
+PY
+BACKEND_PID=$!
+PROXY_PID=
+
+cleanup() {
+    [ -n "$PROXY_PID" ] && kill $PROXY_PID 2>/dev/null
+    kill $BACKEND_PID 2>/dev/null
+    wait 2>/dev/null
+    rm -f "$LOG"
+}
+trap cleanup EXIT
+sleep 1
+
+# client CONNECTIONS REQUESTS_PER_CONNECTION
+client() {
+    python3 - $PORT "$@" <<'PY'
+import socket, sys
+port, conns, reqs = int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3])
+REQ = b"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+EXPECT = len(b"HTTP/1.1 200 OK\r\nContent-Length: 32768\r\n\r\n") + 32768
+for _ in range(conns):
+    s = socket.create_connection(("127.0.0.1", port))
+    for _ in range(reqs):
+        s.sendall(REQ)
+        got = 0
+        while got < EXPECT:
+            chunk = s.recv(65536)
+            if not chunk:
+                sys.exit("connection closed early")
+            got += len(chunk)
+    s.close()
+PY
+}
+
+start_proxy() {
+    LD_PRELOAD="$COUNTER" ALLOC_COUNTER_LOG="$LOG" \
+        "$PROXY" -p $PORT -P $BACKEND_PORT "$@" > /dev/null 2>&1 &
+    PROXY_PID=$!
+    sleep 1
+}
+
+stop_proxy() {
+    kill $PROXY_PID 2>/dev/null
+    wait $PROXY_PID 2>/dev/null
+    PROXY_PID=
+}
+
+# Allocation count from a fresh snapshot (lets in-flight closes settle first)
+allocs() {
+    sleep 0.2
+    : > "$LOG"
+    kill -USR2 $PROXY_PID
+    sleep 0.1
+    sed -n 's/^allocs=\([0-9]*\).*/\1/p' "$LOG"
+}
+
+# measure LABEL UNITS CONNECTIONS REQUESTS_PER_CONNECTION
+measure() {
+    local before after
+    before=$(allocs)
+    client $3 $4 || { echo "❌ $1: client failed"; FAILED=1; return; }
+    after=$(allocs)
+    local delta=$((after - before))
+    printf "  %-32s %6d allocations over %d (%s)\n" "$1" $delta $2 \
+        "$(awk -v d=$delta -v n=$2 'BEGIN { printf "%.3f each", d / n }')"
+    if [ $delta -ne 0 ]; then
+        echo "❌ $1 allocates in steady state"
+        FAILED=1
+    fi
+}
+
+echo "Zero-allocation check (steady state, pools warm)"
+
+start_proxy -m http
+client 50 20                      # warm up pools
+measure "HTTP keep-alive request" 900 1 900   # < MAX_REQUESTS_PER_CONN
+measure "HTTP accept + request" 200 200 1
+stop_proxy
+
+start_proxy -m tcp
+client 50 20
+measure "TCP forwarded request" 2000 1 2000
+stop_proxy
+
+if [ $FAILED -ne 0 ]; then
+    exit 1
+fi
+echo "✅ No heap allocations in steady state"
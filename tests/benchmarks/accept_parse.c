@@ -0,0 +1,123 @@
+/* Accept-to-first-parse microbenchmark.
+ *
+ * Measures the proxy-side work between accept() returning and the first
+ * request being parsed: taking a connection slot, borrowing buffers and
+ * parser state, parsing a small GET, then either resetting for the next
+ * keep-alive request or releasing everything. Syscalls are left out on
+ * purpose - they cost the same either way and would drown the signal.
+ *
+ * The "calloc" rows reproduce the old scheme (calloc per connection, full
+ * memset per keep-alive request) for comparison.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "buffer.h"
+#include "connection.h"
+#include "http_request.h"
+#include "hugepage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ITERATIONS 200000
+
+static const char request[] =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: bench/1.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char *label, uint64_t start, uint64_t end) {
+    printf("  %-34s %8.1f ns/op\n", label, (double)(end - start) / ITERATIONS);
+}
+
+/* Old per-request reset: zero the whole struct */
+static void memset_init(http_request_t *req) {
+    memset(req, 0, sizeof(http_request_t));
+    req->content_length = -1;
+    req->version = HTTP_VERSION_11;
+    req->keep_alive = 1;
+}
+
+int main(void) {
+    proxy_config_t *config = hugepage_alloc(sizeof(proxy_config_t), NULL);
+    if (config == NULL) {
+        perror("mmap");
+        return 1;
+    }
+    config->mode = PROXY_MODE_HTTP;
+    connection_pool_init(config);
+
+    int sink = 0;
+    uint64_t start, end;
+
+    printf("Accept-to-first-parse (%d iterations, %zu byte request)\n",
+           ITERATIONS, sizeof(request) - 1);
+
+    /* New connection: slot + buffers + pooled parser state + parse */
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        connection_t *conn = connection_alloc(config);
+        connection_init(conn, 3, ROLE_HTTP_CLIENT, CONN_READING_REQUEST);
+        conn->http_req = http_request_pool_get(&config->requests);
+        sink += http_request_parse(conn->http_req, request, sizeof(request) - 1);
+        connection_free(config, conn);
+    }
+    end = now_ns();
+    report("new connection (pooled)", start, end);
+
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        connection_t *conn = connection_alloc(config);
+        connection_init(conn, 3, ROLE_HTTP_CLIENT, CONN_READING_REQUEST);
+        conn->http_req = calloc(1, sizeof(http_request_t));
+        memset_init(conn->http_req);
+        sink += http_request_parse(conn->http_req, request, sizeof(request) - 1);
+        free(conn->http_req);
+        conn->http_req = NULL;
+        connection_free(config, conn);
+    }
+    end = now_ns();
+    report("new connection (calloc)", start, end);
+
+    /* Keep-alive: reset parser state and parse the next request */
+    http_request_t *req = http_request_pool_get(&config->requests);
+
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        http_request_init(req);
+        sink += http_request_parse(req, request, sizeof(request) - 1);
+    }
+    end = now_ns();
+    report("keep-alive request (field reset)", start, end);
+
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        memset_init(req);
+        sink += http_request_parse(req, request, sizeof(request) - 1);
+    }
+    end = now_ns();
+    report("keep-alive request (memset)", start, end);
+
+    /* Parse alone, so the rows above can be read as overhead */
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        req->is_complete = 0;
+        sink += http_request_parse(req, request, sizeof(request) - 1);
+    }
+    end = now_ns();
+    report("parse only", start, end);
+
+    http_request_pool_put(&config->requests, req);
+    buffer_pool_destroy(&config->buffers);
+    http_request_pool_destroy(&config->requests);
+    hugepage_free(config, sizeof(proxy_config_t));
+    return sink == 5 * ITERATIONS ? 0 : 1;
+}
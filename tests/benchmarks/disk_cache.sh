@@ -0,0 +1,152 @@
+#!/bin/bash
+
+# Disk cache: hit latency and disk I/O per hit
+#
+# For each response size, replays GETs for one URL at a constant rate
+# (epoll-proxy-replay -r) twice: through the proxy without a cache, where
+# every request goes to the backend, and through the proxy with -D after
+# one warming request, where every request is a hit sent from a slab file
+# with sendfile(). A third run restarts the cached proxy without warming
+# it: its hits come from the index snapshot written at shutdown.
+#
+# Disk I/O is what /proc/<proxy>/io reports as read_bytes / write_bytes
+# (block device traffic, not page cache hits) over the measured run,
+# divided by the requests completed. With COLD=1 the page cache is dropped
+# before the cached run (needs root), so hits really come from the disk.
+#
+# Environment:
+#   SIZES      response body sizes in bytes (default: 16384 262144 1048576)
+#   RATE       offered rate, req/s (default: 2000)
+#   DURATION   seconds per run (default: 5)
+#   CONNS      keep-alive client connections (default: 16)
+#   CACHE_DIR  slab file directory (default: /tmp/epoll-proxy-cache)
+#   CACHE_MB   cache size (default: 256)
+#   COLD       1: drop the page cache before each cached run
+#
+# Run via `make bench-cache`.
+
+SIZES=${SIZES:-"16384 262144 1048576"}
+RATE=${RATE:-2000}
+DURATION=${DURATION:-5}
+CONNS=${CONNS:-16}
+CACHE_DIR=${CACHE_DIR:-/tmp/epoll-proxy-cache}
+CACHE_MB=${CACHE_MB:-256}
+COLD=${COLD:-0}
+
+PROXY_PORT=9080
+BACKEND_PORT=9081
+BIN_DIR="$(cd "$(dirname "$0")/../../build/bin" && pwd)"
+
+for bin in epoll-proxy epoll-proxy-replay http-backend; do
+    if [ ! -x "$BIN_DIR/$bin" ]; then
+        echo "❌ $BIN_DIR/$bin not found (run: make bench-cache)"
+        exit 1
+    fi
+done
+
+echo "════════════════════════════════════════════════════════════"
+echo "  Disk cache: ${RATE} req/s for ${DURATION}s per run"
+echo "════════════════════════════════════════════════════════════"
+
+mkdir -p "$CACHE_DIR" || exit 1
+
+BACKEND_PID=""
+PROXY_PID=""
+
+stop_backend() {
+    if [ -n "$BACKEND_PID" ]; then
+        kill $BACKEND_PID 2>/dev/null
+        wait $BACKEND_PID 2>/dev/null
+        BACKEND_PID=""
+    fi
+}
+
+stop_proxy() {
+    if [ -n "$PROXY_PID" ]; then
+        kill $PROXY_PID 2>/dev/null
+        wait $PROXY_PID 2>/dev/null
+        PROXY_PID=""
+    fi
+}
+
+cleanup() {
+    stop_proxy
+    stop_backend
+}
+trap cleanup EXIT
+
+start_proxy() {
+    "$BIN_DIR/epoll-proxy" -p $PROXY_PORT -P $BACKEND_PORT -T "$@" \
+        > /tmp/disk_cache_proxy.log 2>&1 &
+    PROXY_PID=$!
+    sleep 0.5
+}
+
+# Value of key=... in a RESULT line
+field() {
+    echo "$1" | tr ' ' '\n' | sed -n "s/^$2=//p"
+}
+
+io_bytes() {
+    sed -n "s/^$2: //p" /proc/$1/io
+}
+
+# Replay one URL and print a table row: name, rate, latency, disk I/O
+run() {
+    local name=$1 size=$2
+    local rd0 wr0 rd1 wr1 line
+
+    rd0=$(io_bytes $PROXY_PID read_bytes)
+    wr0=$(io_bytes $PROXY_PID write_bytes)
+    line=$("$BIN_DIR/epoll-proxy-replay" -q -p $PROXY_PORT -r $RATE -d $DURATION \
+           -c $CONNS -u /object | grep '^RESULT')
+    rd1=$(io_bytes $PROXY_PID read_bytes)
+    wr1=$(io_bytes $PROXY_PID write_bytes)
+
+    if [ -z "$line" ]; then
+        echo "❌ load generator failed ($name, $size bytes)"
+        return
+    fi
+
+    local done_=$(field "$line" completed)
+    [ "$done_" -gt 0 ] || done_=1
+    printf "%8s %-9s %8s %6s %8s %8s %8s %10s %10s\n" \
+        $size $name $(field "$line" rate) $(field "$line" errors) \
+        $(field "$line" p50) $(field "$line" p99) $(field "$line" max) \
+        $(((rd1 - rd0) / done_)) $(((wr1 - wr0) / done_))
+}
+
+printf "%8s %-9s %8s %6s %8s %8s %8s %10s %10s\n" \
+    bytes run req/s errors p50_us p99_us max_us rd_B/req wr_B/req
+
+for size in $SIZES; do
+    stop_backend
+    "$BIN_DIR/http-backend" -p $BACKEND_PORT -s $size &
+    BACKEND_PID=$!
+    sleep 0.3
+
+    start_proxy
+    run upstream $size
+    stop_proxy
+
+    start_proxy -D "$CACHE_DIR" -Z $CACHE_MB
+    # One keep-alive request fills the slot (a Connection: close response
+    # isn't stored: its header would tell every later client to go away)
+    "$BIN_DIR/epoll-proxy-replay" -q -p $PROXY_PORT -r 1 -d 1 -c 1 -u /object > /dev/null
+    sleep 0.2  # Let the writer thread finish the slot
+    if [ "$COLD" = 1 ]; then
+        sync
+        echo 1 > /proc/sys/vm/drop_caches 2>/dev/null || echo "  (COLD=1 needs root)"
+    fi
+    run cached $size
+    stop_proxy
+    sed -n 's/^Cache hits: *//p' /tmp/disk_cache_proxy.log | sed 's/^/         hits: /'
+
+    start_proxy -D "$CACHE_DIR" -Z $CACHE_MB
+    run restarted $size
+    stop_proxy
+    sed -n 's/^Cache hits: *//p' /tmp/disk_cache_proxy.log | sed 's/^/         hits: /'
+done
+
+echo ""
+echo "Slab files: $CACHE_DIR (remove when done)"
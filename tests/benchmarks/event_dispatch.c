@@ -0,0 +1,212 @@
+/* Per-event dispatch microbenchmark.
+ *
+ * Feeds connections events the way the loop does, through
+ * proxy_dispatch(), over socketpairs instead of real clients and
+ * backends. Reports the cost per event in ns and, where the
+ * machine exposes a hardware counter, in user-space instructions: the
+ * syscalls an event makes cost the same whatever the dispatch code does,
+ * and the instruction count leaves them out.
+ *
+ *   tcp relay        64 bytes in from the client (EPOLLIN), out to its
+ *                    backend (EPOLLOUT): two events
+ *   http partial     a request's first line and a header, not yet complete
+ *   EPOLLOUT idle    a writable wakeup with nothing to write
+ *   EPOLLIN ignored  pipelined bytes while a response is in flight: no
+ *                    syscalls, so this row is the dispatch alone
+ */
+#define _GNU_SOURCE
+#include "buffer.h"
+#include "connection.h"
+#include "epoll.h"
+#include "http_request.h"
+#include "hugepage.h"
+#include "proxy.h"
+#include <linux/perf_event.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUNDS 200000
+
+static int rounds = ROUNDS;
+
+static const char payload[64] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde";
+static const char partial[] = "GET /index.html HTTP/1.1\r\nHost: example.com\r\n";
+
+static int counter_fd = -1;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Count user-space instructions retired, where the machine can */
+static void open_counter(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    counter_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counter_fd == -1) {
+        printf("  (no instruction counter: %s)\n", strerror(errno));
+    }
+}
+
+static uint64_t instructions(void) {
+    uint64_t count = 0;
+    if (counter_fd != -1 && read(counter_fd, &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+    }
+    return count;
+}
+
+typedef struct {
+    uint64_t ns;
+    uint64_t insns;
+} sample_t;
+
+static sample_t begin(void) {
+    sample_t s = { now_ns(), instructions() };
+    return s;
+}
+
+static void report(const char *label, sample_t start, int events) {
+    sample_t end = begin();
+    double n = (double)rounds * events;
+    if (counter_fd != -1) {
+        printf("  %-22s %8.1f ns/event %8.0f instructions/event\n", label,
+               (double)(end.ns - start.ns) / n, (double)(end.insns - start.insns) / n);
+    } else {
+        printf("  %-22s %8.1f ns/event\n", label, (double)(end.ns - start.ns) / n);
+    }
+}
+
+/* A registered connection on one end of a socketpair; *outside gets
+ * the other end.
+ */
+static connection_t *open_conn(proxy_config_t *config, conn_role_t role, conn_state_t state,
+                               int *outside) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
+    connection_t *conn = connection_alloc(config);
+    connection_init(conn, sv[0], role, state);
+    epoll_add(config->epoll_fd, sv[0], EPOLLIN, conn);
+    *outside = sv[1];
+    return conn;
+}
+
+static void drain(int fd) {
+    char sink[4096];
+    while (read(fd, sink, sizeof(sink)) > 0) {
+    }
+}
+
+static void bench_tcp(proxy_config_t *config) {
+    config->mode = PROXY_MODE_TCP;
+    int client_end, backend_end;
+    connection_t *client = open_conn(config, ROLE_TCP_CLIENT, CONN_CONNECTED, &client_end);
+    connection_t *backend = open_conn(config, ROLE_TCP_BACKEND, CONN_CONNECTED, &backend_end);
+    connection_pair(client, backend);
+
+    printf("TCP mode\n");
+    sample_t start = begin();
+    for (int i = 0; i < rounds; i++) {
+        if (write(client_end, payload, sizeof(payload)) != sizeof(payload)) {
+            perror("write");
+            exit(1);
+        }
+        proxy_dispatch(config, client, EPOLLIN);
+        proxy_dispatch(config, backend, EPOLLOUT);
+        drain(backend_end);
+    }
+    report("tcp relay", start, 2);
+
+    start = begin();
+    for (int i = 0; i < rounds; i++) {
+        proxy_dispatch(config, client, EPOLLOUT);
+    }
+    report("EPOLLOUT idle", start, 1);
+
+    connection_close_pair(config, client);
+    close(client_end);
+    close(backend_end);
+}
+
+static void bench_http(proxy_config_t *config) {
+    config->mode = PROXY_MODE_HTTP;
+    int client_end;
+    connection_t *client = open_conn(config, ROLE_HTTP_CLIENT, CONN_READING_REQUEST, &client_end);
+    client->http_req = http_request_pool_get(&config->requests);
+
+    printf("HTTP mode\n");
+    sample_t start = begin();
+    for (int i = 0; i < rounds; i++) {
+        if (write(client_end, partial, sizeof(partial) - 1) != sizeof(partial) - 1) {
+            perror("write");
+            exit(1);
+        }
+        proxy_dispatch(config, client, EPOLLIN);
+        buffer_clear(client->read_buf);
+        http_request_init(client->http_req);
+    }
+    report("http partial", start, 1);
+
+    start = begin();
+    for (int i = 0; i < rounds; i++) {
+        proxy_dispatch(config, client, EPOLLOUT);
+    }
+    report("EPOLLOUT idle", start, 1);
+
+    client->state = CONN_WRITING_RESPONSE;
+    start = begin();
+    for (int i = 0; i < rounds; i++) {
+        proxy_dispatch(config, client, EPOLLIN);
+    }
+    report("EPOLLIN ignored", start, 1);
+
+    connection_close(config, client);
+    close(client_end);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && (rounds = atoi(argv[1])) <= 0) {
+        fprintf(stderr, "usage: %s [ROUNDS]\n", argv[0]);
+        return 1;
+    }
+    proxy_config_t *config = hugepage_alloc(sizeof(proxy_config_t), NULL);
+    if (config == NULL) {
+        perror("mmap");
+        return 1;
+    }
+    connection_pool_init(config);
+    config->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (config->epoll_fd == -1) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    printf("Per-event dispatch (%d rounds per row)\n", rounds);
+    open_counter();
+    bench_tcp(config);
+    bench_http(config);
+
+    int ok = config->stats.errors == 0;
+    close(config->epoll_fd);
+    buffer_pool_destroy(&config->buffers);
+    http_request_pool_destroy(&config->requests);
+    hugepage_free(config, sizeof(proxy_config_t));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/* Minimal HTTP backend for the saturation sweep.
+ *
+ * One epoll loop answering every request with the same small 200 response,
+ * keep-alive unless the request says "Connection: close". Request bodies
+ * are not supported (the load generator only sends GETs). It exists so the
+ * sweep measures the proxy, not a Python backend that tops out first.
+ *
+ *   http-backend [-p PORT] [-s BODY_BYTES]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MAX_EVENTS   1024
+#define MAX_FDS      65536
+#define REQUEST_BUF  4096
+#define MAX_BODY     (4 * 1024 * 1024)
+
+typedef struct {
+    char in[REQUEST_BUF];
+    size_t in_len;
+    size_t out_pending;      /* Bytes of queued responses not yet written */
+    size_t out_off;          /* Offset into the response being written */
+    int close_after;         /* Last queued response said Connection: close */
+} client_t;
+
+static client_t *clients[MAX_FDS];
+static char response[MAX_BODY + 256];
+static char response_close[MAX_BODY + 256];
+static size_t response_len;
+static size_t response_close_len;
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int signum) {
+    (void)signum;
+    running = 0;
+}
+
+static void drop(int fd) {
+    free(clients[fd]);
+    clients[fd] = NULL;
+    close(fd);
+}
+
+/* Write queued responses; returns -1 once the connection should go */
+static int flush(int fd, client_t *c) {
+    while (c->out_pending > 0) {
+        const char *src = c->close_after && c->out_pending <= response_close_len
+                              ? response_close : response;
+        size_t len = src == response ? response_len : response_close_len;
+        ssize_t n = write(fd, src + c->out_off, len - c->out_off);
+        if (n == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->out_off += (size_t)n;
+        c->out_pending -= (size_t)n;
+        if (c->out_off == len) {
+            c->out_off = 0;
+        }
+    }
+    return c->close_after ? -1 : 0;
+}
+
+/* Queue a response for every complete request header block in the buffer */
+static void parse(client_t *c) {
+    char *start = c->in;
+    char *end;
+
+    while (!c->close_after &&
+           (end = memmem(start, c->in_len - (size_t)(start - c->in), "\r\n\r\n", 4)) != NULL) {
+        *end = '\0';
+        if (strcasestr(start, "\nConnection: close") != NULL) {
+            c->close_after = 1;
+            c->out_pending += response_close_len;
+        } else {
+            c->out_pending += response_len;
+        }
+        start = end + 4;
+    }
+
+    c->in_len -= (size_t)(start - c->in);
+    memmove(c->in, start, c->in_len);
+}
+
+static void on_client(int epfd, int fd) {
+    client_t *c = clients[fd];
+
+    for (;;) {
+        if (c->in_len == sizeof(c->in)) {
+            drop(fd);  /* Header block too large for this backend */
+            return;
+        }
+        ssize_t n = read(fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+        if (n == -1 && errno == EAGAIN) {
+            break;
+        }
+        if (n <= 0) {
+            drop(fd);
+            return;
+        }
+        c->in_len += (size_t)n;
+        parse(c);
+    }
+
+    if (flush(fd, c) == -1) {
+        drop(fd);
+        return;
+    }
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLET | (c->out_pending ? EPOLLOUT : 0),
+        .data.fd = fd
+    };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void on_accept(int epfd, int lfd) {
+    for (;;) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd == -1) {
+            return;
+        }
+        if (fd >= MAX_FDS || (clients[fd] = calloc(1, sizeof(client_t))) == NULL) {
+            close(fd);
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.fd = fd };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+int main(int argc, char **argv) {
+    int port = 8081;
+    long body = 13;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:h")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 's': body = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-p PORT] [-s BODY_BYTES]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (body < 0 || body > MAX_BODY) {
+        fprintf(stderr, "Body size must be 0..%d\n", MAX_BODY);
+        return 1;
+    }
+
+    const char *fmt = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                      "Content-Length: %ld\r\n%s\r\n";
+    response_len = (size_t)sprintf(response, fmt, body, "");
+    response_close_len = (size_t)sprintf(response_close, fmt, body, "Connection: close\r\n");
+    memset(response + response_len, 'x', (size_t)body);
+    memset(response_close + response_close_len, 'x', (size_t)body);
+    response_len += (size_t)body;
+    response_close_len += (size_t)body;
+
+    int lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int on = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lfd, 4096) == -1) {
+        perror("listen");
+        return 1;
+    }
+
+    int epfd = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = lfd };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (running) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 500);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == lfd) {
+                on_accept(epfd, lfd);
+            } else if (clients[fd] != NULL) {
+                on_client(epfd, fd);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/* Idle keep-alive client generator for the idle memory benchmark.
+ *
+ * Opens N connections to the proxy, sends one keep-alive request on each,
+ * waits for the response and then leaves the connection idle - exactly the
+ * state of a real keep-alive client between requests. Prints "ready N" once
+ * every connection is idle and then sleeps until killed.
+ *
+ * One source address only has ~28K ephemeral ports per destination, so
+ * connections are spread over 127.0.0.0/8 source addresses.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define CONNS_PER_SOURCE 20000
+#define MAX_EVENTS 1024
+
+static const char request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int signum) {
+    (void)signum;
+    running = 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-a ADDR] [-p PORT] [-n COUNT] [-c CONCURRENCY]\n", prog);
+}
+
+/* Open one non-blocking connection from the i-th source address */
+static int open_connection(const struct sockaddr_in *dst, long i) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct sockaddr_in src;
+    memset(&src, 0, sizeof(src));
+    src.sin_family = AF_INET;
+    src.sin_addr.s_addr = htonl(0x7f000001 + (uint32_t)(i / CONNS_PER_SOURCE));
+
+    /* Let connect() pick the port per destination instead of bind() */
+    int on = 1;
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+#endif
+    if (bind(fd, (struct sockaddr *)&src, sizeof(src)) == -1 ||
+        (connect(fd, (const struct sockaddr *)dst, sizeof(*dst)) == -1 &&
+         errno != EINPROGRESS)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    const char *addr = "127.0.0.1";
+    int port = 8080;
+    long count = 1000000;
+    long concurrency = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:p:n:c:")) != -1) {
+        switch (opt) {
+            case 'a': addr = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': count = atol(optarg); break;
+            case 'c': concurrency = atol(optarg); break;
+            default:  usage(argv[0]); return 1;
+        }
+    }
+
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &dst.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address: %s\n", addr);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int epfd = epoll_create1(0);
+    struct epoll_event events[MAX_EVENTS];
+    long opened = 0, idle = 0, failed = 0, in_flight = 0;
+
+    while (running && idle + failed < count) {
+        /* Keep up to `concurrency` connects/requests in flight */
+        while (opened < count && in_flight < concurrency) {
+            int fd = open_connection(&dst, opened++);
+            if (fd == -1) {
+                failed++;
+                continue;
+            }
+            struct epoll_event ev = { .events = EPOLLOUT, .data.fd = fd };
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+            in_flight++;
+        }
+
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                close(fd);
+                in_flight--;
+                failed++;
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT) {
+                /* Connected: send the request, then wait for the response */
+                if (write(fd, request, sizeof(request) - 1) != (ssize_t)sizeof(request) - 1) {
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                    close(fd);
+                    in_flight--;
+                    failed++;
+                    continue;
+                }
+                struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+                epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+                continue;
+            }
+
+            /* The benchmark backend answers with a tiny response that
+             * arrives in one segment; once it's here the connection is idle.
+             */
+            char buf[4096];
+            ssize_t r = read(fd, buf, sizeof(buf));
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+            in_flight--;
+            if (r <= 0) {
+                close(fd);
+                failed++;
+            } else {
+                idle++;
+            }
+        }
+
+        if (n == 0 && opened >= count) {
+            break;  /* Stragglers that never answered */
+        }
+    }
+
+    printf("ready %ld (failed %ld)\n", idle, failed);
+    fflush(stdout);
+
+    while (running) {
+        pause();
+    }
+    return 0;
+}
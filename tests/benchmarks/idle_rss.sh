@@ -0,0 +1,99 @@
+#!/bin/bash
+
+# Idle keep-alive memory benchmark
+#
+# Opens COUNT client connections (default 1M), sends one keep-alive request
+# on each and leaves them idle, then reports the proxy's RSS per connection.
+# Build first with a large enough table:  make bench-idle
+#
+# Needs `ulimit -n` above COUNT for both the proxy and the client generator
+# (raise fs.nr_open and the hard limit as root), and a wide ephemeral port
+# range is not required: clients spread over 127.0.0.0/8 source addresses.
+
+COUNT=${1:-1000000}
+BIN_DIR="$(cd "$(dirname "$0")/../../build/bin" && pwd)"
+
+echo "════════════════════════════════════════════════════════════"
+echo "  Idle keep-alive memory ($COUNT connections)"
+echo "════════════════════════════════════════════════════════════"
+
+ulimit -n $((COUNT + 1024)) 2>/dev/null || {
+    LIMIT=$(ulimit -Hn)
+    ulimit -n $LIMIT
+    COUNT=$((LIMIT - 1024))
+    echo "⚠️  fd hard limit is $LIMIT, measuring $COUNT connections instead"
+}
+
+# Minimal keep-alive backend: every request gets the same tiny response.
+# The proxy opens one upstream connection per request, so this has to
+# accept fast; asyncio keeps up where http.server does not.
+python3 - > /tmp/idle_backend.log 2>&1 <<'PY' &
+import asyncio
+RESP = b"HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok"
+async def handle(reader, writer):
+    try:
+        await reader.readuntil(b"\r\n\r\n")
+        writer.write(RESP)
+        await writer.drain()
+    except Exception:
+        pass
+    writer.close()
+async def main():
+    server = await asyncio.start_server(handle, "127.0.0.1", 8081, backlog=4096)
+    async with server:
+        await server.serve_forever()
+asyncio.run(main())
+PY
+BACKEND_PID=$!
+
+"$BIN_DIR/epoll-proxy" -m http > /tmp/proxy.log 2>&1 &
+PROXY_PID=$!
+CLIENTS_PID=
+
+cleanup() {
+    [ -n "$CLIENTS_PID" ] && kill $CLIENTS_PID 2>/dev/null
+    kill $PROXY_PID 2>/dev/null
+    kill $BACKEND_PID 2>/dev/null
+    wait 2>/dev/null
+}
+trap cleanup EXIT
+sleep 2
+
+rss_kb() {
+    awk '/^VmRSS/ { print $2 }' /proc/$PROXY_PID/status
+}
+
+RSS_BEFORE=$(rss_kb)
+echo "Proxy RSS before: ${RSS_BEFORE} KB"
+
+# Clients print "ready N" once every connection has had its response
+exec 3< <("$BIN_DIR/idle-clients" -n $COUNT -c 256)
+CLIENTS_PID=$!
+read -r _ IDLE REST <&3
+echo "Idle connections: $IDLE $REST"
+
+# Give the proxy time to shrink them (IDLE_SHRINK_MS plus slack)
+sleep 3
+
+RSS_AFTER=$(rss_kb)
+echo "Proxy RSS after:  ${RSS_AFTER} KB"
+if [ "$IDLE" -gt 0 ]; then
+    awk -v a=$RSS_AFTER -v b=$RSS_BEFORE -v n=$IDLE \
+        'BEGIN { printf "RSS per idle connection: %.1f bytes\n", (a - b) * 1024 / n }'
+fi
+
+# Proxy statistics (idle shrinks, buffers in use) are printed on shutdown
+kill $PROXY_PID
+wait $PROXY_PID 2>/dev/null
+grep -E "Buffers|Idle|Active" /tmp/proxy.log
+
+# The buffer pool keeps the peak number of in-flight buffers around; that is
+# a fixed cost set by request concurrency, not by idle connections.
+BUFFERS=$(awk '/^Buffers:/ { print $2 }' /tmp/proxy.log)
+if [ "$IDLE" -gt 0 ] && [ -n "$BUFFERS" ]; then
+    awk -v a=$RSS_AFTER -v b=$RSS_BEFORE -v n=$IDLE -v bufs=$BUFFERS \
+        'BEGIN { pool = bufs * 16384 / 1024;
+                 printf "Buffer pool (peak in flight): %.1f MB\n", pool / 1024;
+                 printf "RSS per idle connection excluding pool: %.1f bytes\n",
+                        (a - b - pool) * 1024 / n }'
+fi
@@ -21,11 +21,31 @@ python3 -m http.server 8081 > /tmp/backend.log 2>&1 &
 BACKEND_PID=$!
 sleep 2
 
-# Start proxy
-echo "Starting proxy..."
-../../build/bin/epoll-proxy -m http > /tmp/proxy.log 2>&1 &
-PROXY_PID=$!
-sleep 2
+# Start proxy (extra arguments are passed through to epoll-proxy)
+start_proxy() {
+    ../../build/bin/epoll-proxy -m http "$@" > /tmp/proxy.log 2>&1 &
+    PROXY_PID=$!
+    sleep 2
+}
+
+stop_proxy() {
+    kill $PROXY_PID 2>/dev/null
+    wait $PROXY_PID 2>/dev/null
+}
+
+# Syscall accounting the proxy prints on shutdown
+report_syscalls() {
+    echo ""
+    sed -n '/^--- Syscalls ---$/,/^Syscalls per/p' /tmp/proxy.log
+}
+
+# One load level against a fresh proxy, so its syscall counts are its own
+run_load() {
+    start_proxy
+    wrk "$@" http://localhost:8080
+    stop_proxy
+    report_syscalls
+}
 
 # Cleanup function
 cleanup() {
@@ -42,19 +62,54 @@ echo ""
 echo "════════════════════════════════════════════════════════════"
 echo "  Test 1: Light Load (10 connections)"
 echo "════════════════════════════════════════════════════════════"
-wrk -t2 -c10 -d10s http://localhost:8080
+run_load -t2 -c10 -d10s
 
 echo ""
 echo "════════════════════════════════════════════════════════════"
 echo "  Test 2: Medium Load (100 connections)"
 echo "════════════════════════════════════════════════════════════"
-wrk -t4 -c100 -d30s http://localhost:8080
+run_load -t4 -c100 -d30s
 
 echo ""
 echo "════════════════════════════════════════════════════════════"
 echo "  Test 3: High Load (1000 connections)"
 echo "════════════════════════════════════════════════════════════"
-wrk -t8 -c1000 -d30s http://localhost:8080
+run_load -t8 -c1000 -d30s
+
+echo ""
+echo "════════════════════════════════════════════════════════════"
+echo "  Test 4: dTLB misses (huge pages vs 4K pages, 1000 connections)"
+echo "════════════════════════════════════════════════════════════"
+if command -v perf &> /dev/null; then
+    for variant in "huge pages:" "4K pages:-H"; do
+        label=${variant%%:*}
+        flags=${variant#*:}
+        stop_proxy
+        start_proxy -F $flags
+        echo "--- $label ---"
+        perf stat -e dTLB-load-misses,dTLB-store-misses -p $PROXY_PID \
+            -- sleep 10 2>&1 | grep -E "dTLB|elapsed" &
+        PERF_PID=$!
+        wrk -t8 -c1000 -d10s http://localhost:8080 | grep -E "Requests/sec|Latency"
+        wait $PERF_PID
+        stop_proxy
+    done
+else
+    echo "perf not found - skipping dTLB measurement"
+fi
+
+echo ""
+echo "════════════════════════════════════════════════════════════"
+echo "  Test 5: Captured traffic replay (CAPTURE=file, SPEED=x)"
+echo "════════════════════════════════════════════════════════════"
+if [ -n "$CAPTURE" ]; then
+    start_proxy
+    ../../build/bin/epoll-proxy-replay -s "${SPEED:-1}" -x "${COPIES:-1}" "$CAPTURE"
+    stop_proxy
+    report_syscalls
+else
+    echo "No CAPTURE set - record one with epoll-proxy -C FILE"
+fi
 
 echo ""
 echo "════════════════════════════════════════════════════════════"
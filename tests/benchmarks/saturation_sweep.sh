@@ -0,0 +1,153 @@
+#!/bin/bash
+
+# Open-loop saturation sweep
+#
+# Offers constant arrival rates in steps (epoll-proxy-replay -r) and records
+# achieved throughput and latency percentiles at each step. Latency counts
+# from when each request was due, so queueing behind a saturated server
+# shows up instead of being hidden (coordinated omission).
+#
+# Scenarios:
+#   direct          load generator -> backend, the baseline
+#   tcp             through the proxy in TCP mode
+#   http-keepalive  through the proxy in HTTP mode, keep-alive clients
+#   http-close      through the proxy in HTTP mode, a connection per request
+#
+# The knee of each curve is the highest rate that met the SLO: p99 within
+# SLO_P99_US, no errors, and at least 95% of the offered rate achieved. A
+# scenario stops after two steps in a row miss it.
+#
+# Environment:
+#   RATES       offered rates, req/s (default: 1000 2000 5000 ... 200000)
+#   DURATION    seconds per step (default: 5)
+#   SLO_P99_US  p99 latency objective in microseconds (default: 10000)
+#   CONNS       keep-alive client connections (default: 64)
+#   SCENARIOS   subset to run (default: all four)
+#   CSV         results file (default: /tmp/saturation_sweep.csv)
+#
+# Run via `make bench-sweep`. The close scenario opens a connection per
+# request on both sides; at high rates it runs out of ephemeral ports
+# unless net.ipv4.tcp_tw_reuse is enabled.
+
+RATES=${RATES:-"1000 2000 5000 10000 20000 50000 100000 150000 200000"}
+DURATION=${DURATION:-5}
+SLO_P99_US=${SLO_P99_US:-10000}
+CONNS=${CONNS:-64}
+SCENARIOS=${SCENARIOS:-"direct tcp http-keepalive http-close"}
+CSV=${CSV:-/tmp/saturation_sweep.csv}
+
+PROXY_PORT=9080
+BACKEND_PORT=9081
+BIN_DIR="$(cd "$(dirname "$0")/../../build/bin" && pwd)"
+
+for bin in epoll-proxy epoll-proxy-replay http-backend; do
+    if [ ! -x "$BIN_DIR/$bin" ]; then
+        echo "❌ $BIN_DIR/$bin not found (run: make bench-sweep)"
+        exit 1
+    fi
+done
+
+echo "════════════════════════════════════════════════════════════"
+echo "  Open-loop saturation sweep (p99 SLO ${SLO_P99_US}us)"
+echo "════════════════════════════════════════════════════════════"
+
+ulimit -n 65536 2>/dev/null || ulimit -n "$(ulimit -Hn)"
+
+BACKEND_PID=""
+PROXY_PID=""
+
+cleanup() {
+    [ -n "$PROXY_PID" ] && kill $PROXY_PID 2>/dev/null && wait $PROXY_PID 2>/dev/null
+    [ -n "$BACKEND_PID" ] && kill $BACKEND_PID 2>/dev/null && wait $BACKEND_PID 2>/dev/null
+}
+trap cleanup EXIT
+
+"$BIN_DIR/http-backend" -p $BACKEND_PORT &
+BACKEND_PID=$!
+sleep 0.5
+
+start_proxy() {
+    "$BIN_DIR/epoll-proxy" -p $PROXY_PORT -P $BACKEND_PORT -m "$1" -T \
+        > /tmp/saturation_proxy.log 2>&1 &
+    PROXY_PID=$!
+    sleep 0.5
+}
+
+stop_proxy() {
+    if [ -n "$PROXY_PID" ]; then
+        kill $PROXY_PID 2>/dev/null
+        wait $PROXY_PID 2>/dev/null
+        PROXY_PID=""
+    fi
+}
+
+# Value of key=... in a RESULT line
+field() {
+    echo "$1" | tr ' ' '\n' | sed -n "s/^$2=//p"
+}
+
+echo "scenario,offered,achieved,errors,p50_us,p90_us,p99_us,p999_us,max_us,slo_met" > "$CSV"
+SUMMARY=""
+
+for scenario in $SCENARIOS; do
+    case $scenario in
+        direct)         port=$BACKEND_PORT; conns=$CONNS ;;
+        tcp)            port=$PROXY_PORT;   conns=$CONNS; start_proxy tcp ;;
+        http-keepalive) port=$PROXY_PORT;   conns=$CONNS; start_proxy http ;;
+        http-close)     port=$PROXY_PORT;   conns=0;      start_proxy http ;;
+        *) echo "Unknown scenario: $scenario"; continue ;;
+    esac
+
+    echo ""
+    echo "--- $scenario ---"
+    printf "%10s %10s %7s %9s %9s %9s %9s  %s\n" \
+        offered achieved errors p50_us p99_us p999_us max_us SLO
+
+    knee=0
+    misses=0
+    for rate in $RATES; do
+        line=$("$BIN_DIR/epoll-proxy-replay" -q -p $port -r $rate -d $DURATION -c $conns \
+               | grep '^RESULT')
+        if [ -z "$line" ]; then
+            echo "❌ load generator failed at $rate req/s"
+            break
+        fi
+
+        achieved=$(field "$line" rate)
+        errors=$(field "$line" errors)
+        p50=$(field "$line" p50)
+        p90=$(field "$line" p90)
+        p99=$(field "$line" p99)
+        p999=$(field "$line" p999)
+        max=$(field "$line" max)
+
+        met=no
+        if [ "$errors" -eq 0 ] && [ "$p99" -le "$SLO_P99_US" ] &&
+           [ $((achieved * 100)) -ge $((rate * 95)) ]; then
+            met=yes
+        fi
+
+        printf "%10s %10s %7s %9s %9s %9s %9s  %s\n" \
+            $rate $achieved $errors $p50 $p99 $p999 $max $met
+        echo "$scenario,$rate,$achieved,$errors,$p50,$p90,$p99,$p999,$max,$met" >> "$CSV"
+
+        if [ $met = yes ]; then
+            knee=$rate
+            misses=0
+        else
+            misses=$((misses + 1))
+            [ $misses -ge 2 ] && break
+        fi
+    done
+
+    stop_proxy
+    SUMMARY="$SUMMARY$(printf "  %-16s %10s req/s" $scenario $knee)\n"
+done
+
+echo ""
+echo "════════════════════════════════════════════════════════════"
+echo "  Max sustainable throughput at p99 <= ${SLO_P99_US}us"
+echo "════════════════════════════════════════════════════════════"
+printf "$SUMMARY"
+echo ""
+echo "Latency-vs-load data: $CSV"
@@ -45,12 +45,32 @@ void test_buffer_clear() {
     printf("✓ test_buffer_clear passed\n");
 }
 
+void test_buffer_pool_refs() {
+    buffer_pool_t pool;
+    buffer_pool_init(&pool);
+    
+    buffer_t *buf = buffer_pool_get(&pool);
+    assert(buf != NULL);
+    size_t free_count = pool.free_count;
+    
+    /* A shared buffer goes back to the pool with its last holder */
+    buffer_ref(buf);
+    buffer_pool_put(&pool, buf);
+    assert(pool.free_count == free_count);
+    buffer_pool_put(&pool, buf);
+    assert(pool.free_count == free_count + 1);
+    
+    buffer_pool_destroy(&pool);
+    printf("✓ test_buffer_pool_refs passed\n");
+}
+
 int main() {
     printf("Running buffer tests...\n");
     
     test_buffer_init();
     test_buffer_append();
     test_buffer_clear();
+    test_buffer_pool_refs();
     
     printf("\n✅ All buffer tests passed!\n");
     return 0;
@@ -0,0 +1,112 @@
+/* Unit tests for direct responses and the request line they rely on */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "arena.h"
+#include "direct.h"
+#include "http_request.h"
+
+static arena_pool_t arenas;
+static http_request_pool_t requests;
+
+/* Parse raw into a fresh request; returns http_request_parse's result */
+static int parse(http_request_t *req, const char *raw) {
+    http_request_init(req);
+    return http_request_parse(req, raw, strlen(raw));
+}
+
+static void test_request_line_rejects_bare_cr_lf(void) {
+    http_request_t *req = http_request_pool_get(&requests);
+    assert(req != NULL);
+
+    assert(parse(req, "GET /a HTTP/1.1\r\nHost: x\r\n\r\n") == 1);
+    assert(strcmp(req->path, "/a") == 0);
+
+    assert(parse(req, "GET /a\rLocation:evil HTTP/1.1\r\nHost: x\r\n\r\n") == -1);
+    assert(parse(req, "GET /a\nSet-Cookie:x HTTP/1.1\r\nHost: x\r\n\r\n") == -1);
+    assert(parse(req, "GET\r /a HTTP/1.1\r\nHost: x\r\n\r\n") == -1);
+
+    http_request_pool_put(&requests, req);
+    printf("✓ test_request_line_rejects_bare_cr_lf passed\n");
+}
+
+static void test_redirect_appends_path(void) {
+    direct_t *d = direct_create();
+    char spec[] = "/old/=301:https://example.com/new/*";
+    assert(direct_add_route(d, spec) == 0);
+
+    http_request_t *req = http_request_pool_get(&requests);
+    assert(parse(req, "GET /old/a/b?q=1 HTTP/1.1\r\nHost: x\r\n\r\n") == 1);
+
+    file_reply_t reply;
+    direct_route_t *route = direct_route(d, req->path);
+    assert(route != NULL);
+    assert(direct_respond(d, route, req, &reply, 1) == 0);
+    assert(reply.head_count == 3);
+    assert(reply.head[1].iov_len == strlen("a/b?q=1"));
+    assert(memcmp(reply.head[1].iov_base, "a/b?q=1", reply.head[1].iov_len) == 0);
+    assert(d->stats.responses == 1);
+
+    http_request_pool_put(&requests, req);
+    direct_destroy(d);
+    printf("✓ test_redirect_appends_path passed\n");
+}
+
+static void test_redirect_refuses_unsafe_path(void) {
+    direct_t *d = direct_create();
+    char spec[] = "/old/=301:https://example.com/new/*";
+    assert(direct_add_route(d, spec) == 0);
+
+    /* Bytes a parsed path may still carry: tab, other controls, DEL */
+    static const char *const unsafe[] = { "/old/a\tb", "/old/a\x01", "/old/\x7f" };
+    http_request_t *req = http_request_pool_get(&requests);
+    for (size_t i = 0; i < sizeof(unsafe) / sizeof(unsafe[0]); i++) {
+        http_request_init(req);
+        strcpy(req->path, unsafe[i]);
+        file_reply_t reply;
+        direct_route_t *route = direct_route(d, req->path);
+        assert(route != NULL);
+        assert(direct_respond(d, route, req, &reply, 1) == -1);
+    }
+    assert(d->stats.refused == 3);
+    assert(d->stats.responses == 0);
+
+    http_request_pool_put(&requests, req);
+    direct_destroy(d);
+    printf("✓ test_redirect_refuses_unsafe_path passed\n");
+}
+
+static void test_redirect_without_append_ignores_path(void) {
+    direct_t *d = direct_create();
+    char spec[] = "/old/=302:https://example.com/";
+    assert(direct_add_route(d, spec) == 0);
+
+    http_request_t *req = http_request_pool_get(&requests);
+    strcpy(req->path, "/old/a\tb");
+    file_reply_t reply;
+    direct_route_t *route = direct_route(d, req->path);
+    assert(direct_respond(d, route, req, &reply, 1) == 0);
+    assert(reply.head[1].iov_len == 0);
+
+    http_request_pool_put(&requests, req);
+    direct_destroy(d);
+    printf("✓ test_redirect_without_append_ignores_path passed\n");
+}
+
+int main(void) {
+    printf("Running direct response tests...\n");
+
+    arena_pool_init(&arenas);
+    http_request_pool_init(&requests, &arenas);
+
+    test_request_line_rejects_bare_cr_lf();
+    test_redirect_appends_path();
+    test_redirect_refuses_unsafe_path();
+    test_redirect_without_append_ignores_path();
+
+    http_request_pool_destroy(&requests);
+    arena_pool_destroy(&arenas);
+
+    printf("\n✅ All direct response tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,188 @@
+/* Unit tests for response framing: where each upstream response ends */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "http_response.h"
+
+/* Parse the header block of raw; returns the parse result */
+static int headers(http_response_t *resp, const char *raw, int head_request) {
+    http_response_init(resp, head_request);
+    return http_response_parse_headers(resp, raw, strlen(raw));
+}
+
+/* Feed body one byte at a time; returns the bytes that belonged to the
+ * response. Framing must not depend on how reads split the stream.
+ */
+static size_t trickle(http_response_t *resp, const char *body) {
+    size_t taken = 0;
+    size_t len = strlen(body);
+    while (taken < len && !http_response_is_complete(resp) &&
+           resp->state != HTTP_RESP_INVALID) {
+        size_t n = http_response_consume(resp, body + taken, 1);
+        if (n == 0) {
+            break;
+        }
+        taken += n;
+    }
+    return taken;
+}
+
+static void test_content_length(void) {
+    http_response_t resp;
+    const char *raw = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n";
+    assert(headers(&resp, raw, 0) == 1);
+    assert(resp.header_length == strlen(raw));
+    assert(resp.status_code == 200 && resp.keep_alive);
+    assert(resp.state == HTTP_RESP_BODY_LENGTH && resp.content_length == 5);
+
+    /* A pipelined next response is not ours */
+    const char *body = "helloHTTP/1.1 200 OK\r\n";
+    assert(http_response_consume(&resp, body, strlen(body)) == 5);
+    assert(http_response_is_complete(&resp));
+
+    assert(headers(&resp, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n", 0) == 1);
+    assert(trickle(&resp, "hello") == 5 && http_response_is_complete(&resp));
+
+    /* Zero length: done with the headers */
+    assert(headers(&resp, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", 0) == 1);
+    assert(http_response_is_complete(&resp));
+
+    printf("✓ test_content_length passed\n");
+}
+
+static void test_chunked(void) {
+    http_response_t resp;
+    const char *raw = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n"
+                      "Content-Length: 99\r\n\r\n";
+    const char *body = "5\r\nhello\r\n"
+                       "1A;name=value\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+                       "0\r\n"
+                       "Trailer: x\r\n"
+                       "\r\n";
+
+    /* Transfer-Encoding wins over Content-Length */
+    assert(headers(&resp, raw, 0) == 1);
+    assert(resp.state == HTTP_RESP_CHUNK_SIZE && resp.content_length == -1);
+    assert(http_response_consume(&resp, body, strlen(body)) == strlen(body));
+    assert(http_response_is_complete(&resp));
+
+    assert(headers(&resp, raw, 0) == 1);
+    assert(trickle(&resp, body) == strlen(body) && http_response_is_complete(&resp));
+
+    /* Without trailers, and with bytes after the end */
+    assert(headers(&resp, raw, 0) == 1);
+    const char *tail = "3\r\nabc\r\n0\r\n\r\nEXTRA";
+    assert(http_response_consume(&resp, tail, strlen(tail)) == strlen(tail) - 5);
+    assert(http_response_is_complete(&resp));
+
+    /* Not hex, or an empty size line: framing error */
+    assert(headers(&resp, raw, 0) == 1);
+    http_response_consume(&resp, "zz\r\n", 4);
+    assert(resp.state == HTTP_RESP_INVALID);
+    assert(headers(&resp, raw, 0) == 1);
+    http_response_consume(&resp, "\r\n", 2);
+    assert(resp.state == HTTP_RESP_INVALID);
+
+    /* A size that would overflow */
+    assert(headers(&resp, raw, 0) == 1);
+    http_response_consume(&resp, "fffffffffffffffff\r\n", 19);
+    assert(resp.state == HTTP_RESP_INVALID);
+
+    printf("✓ test_chunked passed\n");
+}
+
+static void test_read_until_close(void) {
+    http_response_t resp;
+
+    /* No length, not chunked: ends when the upstream closes */
+    assert(headers(&resp, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n", 0) == 1);
+    assert(resp.state == HTTP_RESP_BODY_EOF && !resp.keep_alive);
+    assert(http_response_consume(&resp, "anything at all", 15) == 15);
+    assert(!http_response_is_complete(&resp));
+
+    /* 101: a tunnel until close */
+    assert(headers(&resp, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: x\r\n\r\n", 0) == 1);
+    assert(resp.state == HTTP_RESP_BODY_EOF && !resp.keep_alive);
+
+    printf("✓ test_read_until_close passed\n");
+}
+
+static void test_no_body(void) {
+    http_response_t resp;
+
+    /* HEAD: the length describes the GET, nothing follows */
+    assert(headers(&resp, "HTTP/1.1 200 OK\r\nContent-Length: 1234\r\n\r\n", 1) == 1);
+    assert(http_response_is_complete(&resp));
+    assert(http_response_consume(&resp, "HTTP/1.1", 8) == 0);
+
+    assert(headers(&resp, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n", 1) == 1);
+    assert(http_response_is_complete(&resp));
+
+    assert(headers(&resp, "HTTP/1.1 204 No Content\r\nContent-Length: 10\r\n\r\n", 0) == 1);
+    assert(http_response_is_complete(&resp) && resp.keep_alive);
+
+    assert(headers(&resp, "HTTP/1.1 304 Not Modified\r\nContent-Length: 10\r\n\r\n", 0) == 1);
+    assert(http_response_is_complete(&resp) && resp.keep_alive);
+
+    printf("✓ test_no_body passed\n");
+}
+
+static void test_interim(void) {
+    http_response_t resp;
+    const char *raw = "HTTP/1.1 100 Continue\r\n\r\n"
+                      "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+    /* The 1xx is a complete response of its own... */
+    assert(headers(&resp, raw, 0) == 1);
+    assert(resp.status_code == 100 && http_response_is_complete(&resp));
+    size_t first = resp.header_length;
+    assert(first == strlen("HTTP/1.1 100 Continue\r\n\r\n"));
+
+    /* ...and the final one follows it */
+    http_response_init(&resp, 0);
+    assert(http_response_parse_headers(&resp, raw + first, strlen(raw) - first) == 1);
+    assert(resp.status_code == 200 && resp.state == HTTP_RESP_BODY_LENGTH);
+    assert(http_response_consume(&resp, "ok", 2) == 2 && http_response_is_complete(&resp));
+
+    printf("✓ test_interim passed\n");
+}
+
+static void test_headers(void) {
+    http_response_t resp;
+
+    /* Not all there yet */
+    http_response_init(&resp, 0);
+    assert(http_response_parse_headers(&resp, "HTTP/1.1 200 OK\r\nContent-Le", 27) == 0);
+
+    /* Persistence: 1.1 keeps, 1.0 closes, Connection overrides both */
+    assert(headers(&resp, "HTTP/1.0 200 OK\r\nContent-Length: 0\r\n\r\n", 0) == 1);
+    assert(!resp.keep_alive && resp.http10);
+    assert(headers(&resp, "HTTP/1.0 200 OK\r\nConnection: keep-alive\r\n"
+                          "Content-Length: 0\r\n\r\n", 0) == 1);
+    assert(resp.keep_alive);
+    assert(headers(&resp, "HTTP/1.1 200 OK\r\nconnection: Close\r\n"
+                          "Content-Length: 0\r\n\r\n", 0) == 1);
+    assert(!resp.keep_alive && !resp.http10);
+
+    /* Malformed status lines */
+    assert(headers(&resp, "HTTP/2 200 OK\r\n\r\n", 0) == -1);
+    assert(resp.state == HTTP_RESP_INVALID);
+    assert(headers(&resp, "HTTP/1.1 abc OK\r\n\r\n", 0) == -1);
+    assert(headers(&resp, "ICY 200 OK\r\n\r\n", 0) == -1);
+
+    printf("✓ test_headers passed\n");
+}
+
+int main(void) {
+    printf("Running response framing tests...\n");
+
+    test_content_length();
+    test_chunked();
+    test_read_until_close();
+    test_no_body();
+    test_interim();
+    test_headers();
+
+    printf("\n✅ All response framing tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,155 @@
+/* Unit tests for the bandwidth shaper's token buckets */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "connection.h"
+#include "hugepage.h"
+#include "shaper.h"
+#include "timer.h"
+
+#define CONN_RATE   1000000     /* 1 byte per microsecond */
+#define CONN_BURST  20000       /* SHAPER_BURST_MS of CONN_RATE */
+#define SLACK       5000        /* Bytes 5 ms of the test's own run time refill */
+
+static proxy_config_t *config;
+
+static shaper_conn_t *state(connection_t *conn) {
+    return &config->shaper->conns[conn - config->connections];
+}
+
+/* Pretend us microseconds went by since the bucket's last refill */
+static void age(token_bucket_t *b, uint64_t us) {
+    b->last_us -= us;
+}
+
+static void test_parse_rate(void) {
+    uint64_t rate;
+    assert(shaper_parse_rate("1000", &rate) == 0 && rate == 1000);
+    assert(shaper_parse_rate("500K", &rate) == 0 && rate == 500 * 1024);
+    assert(shaper_parse_rate("2m", &rate) == 0 && rate == 2 * 1024 * 1024);
+    assert(shaper_parse_rate("1.5G", &rate) == 0 && rate == 3ULL * 512 * 1024 * 1024);
+    assert(shaper_parse_rate("0", &rate) == -1);
+    assert(shaper_parse_rate("0.5", &rate) == -1);
+    assert(shaper_parse_rate("", &rate) == -1);
+    assert(shaper_parse_rate("10X", &rate) == -1);
+    assert(shaper_parse_rate("2048G", &rate) == -1);    /* Past MAX_RATE */
+
+    printf("✓ test_parse_rate passed\n");
+}
+
+static void test_full_bucket(void) {
+    connection_t *conn = &config->connections[10];
+
+    /* Never used: a full bucket, the burst and no more */
+    assert(config->shaper->conn_burst == CONN_BURST);
+    assert(shaper_allow(config, conn, 1000000) == CONN_BURST);
+    assert(shaper_allow(config, conn, 100) == 100);
+    assert(!conn->shape_paused);
+
+    shaper_forget(config, conn);
+    printf("✓ test_full_bucket passed\n");
+}
+
+static void test_pause_and_refill(void) {
+    connection_t *conn = &config->connections[11];
+    token_bucket_t *b = &state(conn)->bucket;
+
+    /* Overdrawn by 5000 bytes: no tokens, paused until half the burst is
+     * back, i.e. 5000 + 10000 bytes at 1 byte/us, about 15 ms.
+     */
+    assert(shaper_allow(config, conn, CONN_BURST) == CONN_BURST);
+    shaper_charge(config, conn, CONN_BURST + 5000);
+    uint64_t now = get_timestamp_ms();
+    assert(shaper_allow(config, conn, 1000) == 0);
+    assert(conn->shape_paused);
+    assert(timer_pending(&state(conn)->timer));
+    assert(state(conn)->timer.expires >= now + 14 && state(conn)->timer.expires <= now + 17);
+
+    /* The timer hands the connection back, unpaused */
+    assert(shaper_timer(config, &state(conn)->timer) == conn);
+    assert(!conn->shape_paused);
+
+    /* 8 ms later: 8000 bytes earned, 5000 of them pay off the debt */
+    age(b, 8000);
+    size_t n = shaper_allow(config, conn, 1000000);
+    assert(n >= 3000 && n <= 3000 + SLACK);
+
+    /* Exact integer refill: 250 us is 250 bytes, nothing lost to rounding */
+    shaper_charge(config, conn, n);
+    b->credit = 0;
+    age(b, 250);
+    n = shaper_allow(config, conn, 1000000);
+    assert(n >= 250 && n <= 250 + SLACK);
+
+    /* Idle for long: full again, never more than the burst */
+    age(b, 10 * 1000000);
+    assert(shaper_allow(config, conn, 1000000) == CONN_BURST);
+
+    shaper_forget(config, conn);
+    assert(!timer_pending(&state(conn)->timer));
+    assert(b->last_us == 0);
+    printf("✓ test_pause_and_refill passed\n");
+}
+
+static void test_route_bucket(void) {
+    shaper_t *s = config->shaper;
+    connection_t *a = &config->connections[12];
+    connection_t *b = &config->connections[13];
+
+    a->shape_route = shaper_route(s, "/slow/file");
+    b->shape_route = shaper_route(s, "/slow/other");
+    assert(a->shape_route == 1 && b->shape_route == 1);
+    assert(shaper_route(s, "/fast") == 0);
+    assert(s->routes[0].burst == SHAPER_MIN_BURST);
+
+    /* The route's bucket is tighter than the connection's and shared */
+    assert(shaper_allow(config, a, 1000000) == SHAPER_MIN_BURST);
+    shaper_charge(config, a, SHAPER_MIN_BURST - 1000);
+    size_t n = shaper_allow(config, b, 1000000);
+    assert(n >= 1000 && n <= 1000 + SLACK / 10);
+    assert(s->routes[0].stats.bytes == SHAPER_MIN_BURST - 1000);
+
+    /* Overdrawn by 1000 (10 ms at the route's rate): both clients wait */
+    shaper_charge(config, b, n + 1000);
+    assert(shaper_allow(config, a, 1) == 0);
+    assert(shaper_allow(config, b, 1) == 0);
+    assert(s->routes[0].stats.pauses == 2);
+
+    /* 100 ms at 100000 B/s is 10000 bytes, less the debt, for any client
+     * of the route (a new one here: a's own bucket is down to about 4600)
+     */
+    connection_t *c = &config->connections[14];
+    c->shape_route = shaper_route(s, "/slow/");
+    age(&s->routes[0].bucket, 100000);
+    n = shaper_allow(config, c, 1000000);
+    assert(n >= 8990 && n <= 9000 + SLACK / 10);
+
+    shaper_forget(config, a);
+    shaper_forget(config, b);
+    shaper_forget(config, c);
+    a->shape_route = b->shape_route = c->shape_route = 0;
+    printf("✓ test_route_bucket passed\n");
+}
+
+int main(void) {
+    printf("Running shaper tests...\n");
+
+    config = hugepage_alloc(sizeof(proxy_config_t), NULL);
+    assert(config != NULL);
+    timer_wheel_init(&config->timers, get_timestamp_ms());
+    config->shaper = shaper_create(CONN_RATE);
+    assert(config->shaper != NULL);
+    char route[] = "/slow/=100000";     /* Burst rounds up to SHAPER_MIN_BURST */
+    assert(shaper_add_route(config->shaper, route) == 0);
+
+    test_parse_rate();
+    test_full_bucket();
+    test_pause_and_refill();
+    test_route_bucket();
+
+    shaper_destroy(config->shaper);
+    hugepage_free(config, sizeof(proxy_config_t));
+
+    printf("\n✅ All shaper tests passed!\n");
+    return 0;
+}
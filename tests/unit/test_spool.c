@@ -0,0 +1,147 @@
+/* Unit tests for spools: bytes come out in the order they went in */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "buffer.h"
+#include "spool.h"
+
+#define MEMORY_KB 32    /* Two pool buffers, then the file */
+
+static buffer_pool_t pool;
+static spooler_t *spooler;
+
+/* Byte i of the stream: no short period, so a chunk out of place shows */
+static char byte_at(uint64_t i) {
+    return (char)(i * 7 + i / 251);
+}
+
+static uint64_t appended;
+static uint64_t pulled;
+
+static void append(spool_t *sp, size_t n) {
+    static char data[64 * 1024];
+    assert(n <= sizeof(data));
+    for (size_t i = 0; i < n; i++) {
+        data[i] = byte_at(appended + i);
+    }
+    assert(spool_append(sp, data, n) == n);
+    appended += n;
+}
+
+/* Pull at most room bytes and check each against the stream */
+static size_t pull(spool_t *sp, size_t room) {
+    static buffer_t dst;
+    buffer_init(&dst);
+    dst.len = BUFFER_SIZE - room;
+
+    size_t n = spool_pull(sp, &dst);
+    assert(n <= room);
+    for (size_t i = 0; i < n; i++) {
+        assert(dst.data[BUFFER_SIZE - room + i] == byte_at(pulled + i));
+    }
+    pulled += n;
+    return n;
+}
+
+static void drain(spool_t *sp) {
+    while (spool_pending(sp) > 0) {
+        assert(pull(sp, BUFFER_SIZE) > 0);
+    }
+    assert(pulled == appended);
+}
+
+static void test_memory_only(void) {
+    spool_t sp;
+    spool_begin(&sp, spooler);
+    appended = pulled = 0;
+
+    append(&sp, 20000);
+    assert(sp.memory == 20000 && sp.fd == -1);
+    assert(pull(&sp, 5000) == 5000);
+    append(&sp, 1000);
+    drain(&sp);
+    assert(sp.count == 0);
+
+    spool_reset(&sp);
+    printf("✓ test_memory_only passed\n");
+}
+
+static void test_spill_keeps_order(void) {
+    spool_t sp;
+    spool_begin(&sp, spooler);
+    appended = pulled = 0;
+    uint64_t spills = spooler->stats.spills;
+
+    /* Memory fills, the rest goes to the file */
+    append(&sp, 50000);
+    assert(sp.memory == MEMORY_KB * 1024);
+    assert(sp.written == 50000 - MEMORY_KB * 1024);
+    assert(spooler->stats.spills == spills + 1);
+
+    /* Room in memory again, but the file still has older bytes: the new
+     * ones must queue behind them in the file.
+     */
+    assert(pull(&sp, BUFFER_SIZE) == BUFFER_SIZE);
+    size_t memory = sp.memory;
+    append(&sp, 3000);
+    assert(sp.memory == memory);
+
+    /* Odd sizes across the memory/file boundary */
+    static const size_t rooms[] = { 1, 7000, 333, BUFFER_SIZE, 4096, 12345 };
+    for (int i = 0; spool_pending(&sp) > 0; i++) {
+        pull(&sp, rooms[i % 6]);
+        if (i == 3) {
+            append(&sp, 2000);
+        }
+    }
+    assert(pulled == appended);
+
+    /* Drained: the file starts over and memory is used first again */
+    assert(sp.written == 0 && sp.read_off == 0);
+    append(&sp, 100);
+    assert(sp.memory == 100 && sp.written == 0);
+    drain(&sp);
+
+    spool_reset(&sp);
+    assert(sp.owner == NULL && sp.fd == -1);
+    printf("✓ test_spill_keeps_order passed\n");
+}
+
+static void test_reset_returns_buffers(void) {
+    spool_t sp;
+    spool_begin(&sp, spooler);
+    appended = pulled = 0;
+
+    size_t free_count = pool.free_count;
+    append(&sp, 40000);
+    assert(pool.free_count == free_count - 2);
+    spool_reset(&sp);
+    assert(pool.free_count == free_count);
+
+    /* Off: takes nothing */
+    assert(spool_append(&sp, "x", 1) == 0);
+    spool_reset(&sp);
+    printf("✓ test_reset_returns_buffers passed\n");
+}
+
+int main(void) {
+    printf("Running spool tests...\n");
+
+    buffer_pool_init(&pool);
+    spooler = spooler_create(&pool, MEMORY_KB, "/tmp");
+    assert(spooler != NULL);
+    assert(spooler->chunk_limit == 2);
+
+    /* Warm the pool so free counts are comparable */
+    buffer_pool_put(&pool, buffer_pool_get(&pool));
+
+    test_memory_only();
+    test_spill_keeps_order();
+    test_reset_returns_buffers();
+
+    spooler_destroy(spooler);
+    buffer_pool_destroy(&pool);
+
+    printf("\n✅ All spool tests passed!\n");
+    return 0;
+}
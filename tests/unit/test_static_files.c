@@ -0,0 +1,177 @@
+/* Unit tests for static file routes: path mapping and byte ranges */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "http_request.h"
+#include "hugepage.h"
+#include "static_files.h"
+
+static proxy_config_t *config;
+static arena_pool_t arenas;
+static http_request_pool_t requests;
+static char base[] = "/tmp/test-static-XXXXXX";
+static char root[sizeof(base) + 8];
+static char spec[sizeof(root) + 8];
+
+static void write_file(const char *dir, const char *name, const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    assert(f != NULL);
+    fputs(text, f);
+    fclose(f);
+}
+
+/* Answer raw through the route; returns static_files_respond()'s result
+ * and leaves the status line in *line when there is a response.
+ */
+static int respond(const char *raw, file_reply_t *reply, char *line, size_t size) {
+    http_request_t *req = http_request_pool_get(&requests);
+    assert(http_request_parse(req, raw, strlen(raw)) == 1);
+    const static_route_t *route = static_files_route(config->static_files, req->path);
+    assert(route != NULL);
+
+    memset(reply, 0, sizeof(*reply));
+    int ret = static_files_respond(config, route, req, reply, 1);
+    if (ret == 0) {
+        const char *head = reply->head[0].iov_base;
+        size_t n = strcspn(head, "\r");
+        assert(n < size);
+        memcpy(line, head, n);
+        line[n] = '\0';
+        (*reply->refs)--;
+    }
+    http_request_pool_put(&requests, req);
+    return ret;
+}
+
+static int get_status(const char *target) {
+    char raw[512], line[128];
+    snprintf(raw, sizeof(raw), "GET %s HTTP/1.1\r\nHost: x\r\n\r\n", target);
+    file_reply_t reply;
+    int ret = respond(raw, &reply, line, sizeof(line));
+    return ret != 0 ? ret : atoi(line + 9);
+}
+
+static void test_paths(void) {
+    assert(get_status("/s/a.txt") == 200);
+    assert(get_status("/s/a%2etxt") == 200);
+    assert(get_status("/s/sub/") == 200);            /* index.html */
+    assert(get_status("/s/sub/index.html?x=1") == 200);
+    assert(get_status("/s/missing") == 404);
+    assert(get_status("/s/fifo") == 404);            /* Not a regular file */
+
+    printf("✓ test_paths passed\n");
+}
+
+static void test_path_traversal(void) {
+    /* secret.txt sits next to root, one level up */
+    assert(get_status("/s/../secret.txt") == 404);
+    assert(get_status("/s/sub/../../secret.txt") == 404);
+    assert(get_status("/s/%2e%2e/secret.txt") == 404);
+    assert(get_status("/s/%2E%2e/secret.txt") == 404);
+    assert(get_status("/s/.%2e/secret.txt") == 404);
+    assert(get_status("/s/sub/%2e%2e/%2e%2e/secret.txt") == 404);
+    assert(get_status("/s/..") == 404);
+    assert(get_status("/s/a.txt%00.html") == 404);
+    assert(get_status("/s/a.txt%0") == 404);         /* Truncated escape */
+    assert(get_status("/s/a.txt%zz") == 404);
+    assert(config->static_files->stats.opens <= 3);  /* None of these opened */
+
+    /* Dots that aren't a whole segment are ordinary names */
+    write_file(root, "..a", "dots\n");
+    assert(get_status("/s/..a") == 200);
+
+    printf("✓ test_path_traversal passed\n");
+}
+
+/* Range request for a.txt (10 bytes); *start and *len describe the body */
+static int range(const char *value, long long *start, long long *len) {
+    char raw[512], line[128];
+    snprintf(raw, sizeof(raw), "GET /s/a.txt HTTP/1.1\r\nHost: x\r\nRange: %s\r\n\r\n", value);
+    file_reply_t reply;
+    assert(respond(raw, &reply, line, sizeof(line)) == 0);
+    *start = (long long)reply.offset;
+    *len = (long long)reply.remaining;
+    return atoi(line + 9);
+}
+
+static void test_ranges(void) {
+    long long start, len;
+
+    /* bytes=-N: the last N, all of it when N is larger */
+    assert(range("bytes=-3", &start, &len) == 206 && start == 7 && len == 3);
+    assert(range("bytes=-10", &start, &len) == 206 && start == 0 && len == 10);
+    assert(range("bytes=-50", &start, &len) == 206 && start == 0 && len == 10);
+    assert(range("bytes=-0", &start, &len) == 416 && len == 0);
+
+    /* bytes=A-: from A to the end */
+    assert(range("bytes=4-", &start, &len) == 206 && start == 4 && len == 6);
+    assert(range("bytes=9-", &start, &len) == 206 && start == 9 && len == 1);
+
+    /* bytes=A-B, B clamped to the end */
+    assert(range("bytes=2-5", &start, &len) == 206 && start == 2 && len == 4);
+    assert(range("bytes=0-0", &start, &len) == 206 && start == 0 && len == 1);
+    assert(range("bytes=3-100", &start, &len) == 206 && start == 3 && len == 7);
+
+    /* B < A is not a valid range: the whole file */
+    assert(range("bytes=5-2", &start, &len) == 200 && start == 0 && len == 10);
+
+    /* Unsatisfiable: starts past the end */
+    assert(range("bytes=10-", &start, &len) == 416 && len == 0);
+    assert(range("bytes=10-20", &start, &len) == 416 && len == 0);
+
+    /* Not understood: the whole file */
+    assert(range("bytes=0-1,4-5", &start, &len) == 200 && len == 10);
+    assert(range("items=0-1", &start, &len) == 200 && len == 10);
+    assert(range("bytes=x-1", &start, &len) == 200 && len == 10);
+    assert(range("bytes=1-2x", &start, &len) == 200 && len == 10);
+
+    printf("✓ test_ranges passed\n");
+}
+
+int main(void) {
+    printf("Running static file tests...\n");
+
+    assert(mkdtemp(base) != NULL);
+    snprintf(root, sizeof(root), "%s/root", base);
+    assert(mkdir(root, 0755) == 0);
+    char sub[sizeof(root) + 8], fifo[sizeof(root) + 8];
+    snprintf(sub, sizeof(sub), "%s/sub", root);
+    assert(mkdir(sub, 0755) == 0);
+    snprintf(fifo, sizeof(fifo), "%s/fifo", root);
+    assert(mkfifo(fifo, 0644) == 0);
+    write_file(root, "a.txt", "0123456789");
+    write_file(sub, "index.html", "<p>index</p>\n");
+    write_file(base, "secret.txt", "secret\n");
+
+    config = hugepage_alloc(sizeof(proxy_config_t), NULL);
+    assert(config != NULL);
+    config->static_files = static_files_create();
+    assert(config->static_files != NULL);
+    snprintf(spec, sizeof(spec), "/s/=%s", root);
+    assert(static_files_add_route(config->static_files, spec) == 0);
+    arena_pool_init(&arenas);
+    http_request_pool_init(&requests, &arenas);
+
+    test_paths();
+    test_path_traversal();
+    test_ranges();
+
+    http_request_pool_destroy(&requests);
+    arena_pool_destroy(&arenas);
+    static_files_destroy(config->static_files);
+    hugepage_free(config, sizeof(proxy_config_t));
+
+    char cmd[sizeof(base) + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", base);
+    assert(system(cmd) == 0);
+
+    printf("\n✅ All static file tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,160 @@
+/* Unit tests for the timer wheel, on a made-up clock */
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "timer.h"
+
+#define START_MS 1000000    /* A tick boundary */
+
+static timer_wheel_t wheel;
+
+static timer_node_t *fired[16];
+static int fired_count;
+
+static void record(void *ctx, timer_node_t *node) {
+    (void)ctx;
+    assert(!timer_pending(node));   /* Disarmed before the callback */
+    assert(fired_count < 16);
+    fired[fired_count++] = node;
+}
+
+static size_t expire(uint64_t now_ms) {
+    fired_count = 0;
+    return timer_wheel_expire(&wheel, now_ms, record, NULL);
+}
+
+static void test_fires_at_deadline(void) {
+    timer_node_t node;
+    memset(&node, 0, sizeof(node));
+    timer_wheel_init(&wheel, START_MS);
+
+    timer_schedule(&wheel, &node, START_MS + 50);
+    assert(timer_pending(&node) && wheel.count == 1);
+    assert(expire(START_MS + 49) == 0);
+    assert(expire(START_MS + 50) == 1 && fired[0] == &node);
+    assert(wheel.count == 0);
+
+    /* Between ticks: never early, at the latest on the next tick */
+    timer_schedule(&wheel, &node, START_MS + 105);
+    assert(expire(START_MS + 104) == 0);
+    assert(expire(START_MS + 110) == 1);
+
+    /* Already due: the next tick we sweep, not a slot swept before */
+    timer_schedule(&wheel, &node, START_MS);
+    assert(expire(START_MS + 119) == 0);
+    assert(expire(START_MS + 120) == 1);
+
+    printf("✓ test_fires_at_deadline passed\n");
+}
+
+static void test_rearm_and_cancel(void) {
+    timer_node_t a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    timer_wheel_init(&wheel, START_MS);
+
+    /* Re-arming moves the node */
+    timer_schedule(&wheel, &a, START_MS + 30);
+    timer_schedule(&wheel, &a, START_MS + 500);
+    assert(wheel.count == 1);
+    assert(expire(START_MS + 100) == 0);
+
+    timer_schedule(&wheel, &b, START_MS + 200);
+    timer_cancel(&wheel, &b);
+    timer_cancel(&wheel, &b);                   /* Safe when not armed */
+    assert(!timer_pending(&b) && wheel.count == 1);
+    assert(expire(START_MS + 300) == 0);
+
+    assert(expire(START_MS + 500) == 1 && fired[0] == &a);
+    printf("✓ test_rearm_and_cancel passed\n");
+}
+
+static void test_later_revolution(void) {
+    timer_node_t near, far;
+    memset(&near, 0, sizeof(near));
+    memset(&far, 0, sizeof(far));
+    timer_wheel_init(&wheel, START_MS);
+
+    /* Same slot, one revolution apart */
+    uint64_t span = (uint64_t)TIMER_WHEEL_SLOTS * TIMER_TICK_MS;
+    timer_schedule(&wheel, &near, START_MS + 70);
+    timer_schedule(&wheel, &far, START_MS + 70 + span);
+
+    assert(expire(START_MS + 70) == 1 && fired[0] == &near);
+    assert(timer_pending(&far));
+    assert(expire(START_MS + 69 + span) == 0);
+    assert(expire(START_MS + 70 + span) == 1 && fired[0] == &far);
+
+    printf("✓ test_later_revolution passed\n");
+}
+
+static void test_long_stall(void) {
+    timer_node_t nodes[8];
+    memset(nodes, 0, sizeof(nodes));
+    timer_wheel_init(&wheel, START_MS);
+
+    for (int i = 0; i < 8; i++) {
+        timer_schedule(&wheel, &nodes[i], START_MS + 10 + (uint64_t)i * 3000);
+    }
+
+    /* An hour without a sweep: one pass over the wheel finds them all */
+    assert(expire(START_MS + 3600 * 1000) == 8);
+    assert(wheel.count == 0);
+
+    printf("✓ test_long_stall passed\n");
+}
+
+/* Re-arms into the slot being swept; must not fire again in this sweep */
+static void rearm(void *ctx, timer_node_t *node) {
+    uint64_t *now = ctx;
+    fired_count++;
+    timer_schedule(&wheel, node, *now);
+}
+
+static void test_callback_rearms(void) {
+    timer_node_t node;
+    memset(&node, 0, sizeof(node));
+    timer_wheel_init(&wheel, START_MS);
+
+    uint64_t now = START_MS + 20;
+    timer_schedule(&wheel, &node, now);
+    fired_count = 0;
+    assert(timer_wheel_expire(&wheel, now, rearm, &now) == 1);
+    assert(fired_count == 1);
+    assert(timer_pending(&node));
+
+    /* Due again, so it goes into the next tick */
+    now += TIMER_TICK_MS;
+    assert(timer_wheel_expire(&wheel, now, rearm, &now) == 1);
+    timer_cancel(&wheel, &node);
+
+    printf("✓ test_callback_rearms passed\n");
+}
+
+static void test_timeout(void) {
+    timer_node_t node;
+    memset(&node, 0, sizeof(node));
+    timer_wheel_init(&wheel, START_MS);
+
+    assert(timer_wheel_timeout(&wheel, START_MS + 3, 1000) == 1000);
+    timer_schedule(&wheel, &node, START_MS + 5000);
+    assert(timer_wheel_timeout(&wheel, START_MS + 3, 1000) == TIMER_TICK_MS - 3);
+    assert(timer_wheel_timeout(&wheel, START_MS + 3, 2) == 2);
+    timer_cancel(&wheel, &node);
+
+    printf("✓ test_timeout passed\n");
+}
+
+int main(void) {
+    printf("Running timer wheel tests...\n");
+
+    test_fires_at_deadline();
+    test_rearm_and_cancel();
+    test_later_revolution();
+    test_long_stall();
+    test_callback_rearms();
+    test_timeout();
+
+    printf("\n✅ All timer wheel tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,568 @@
+/* epoll-proxy-replay: open-loop load generator.
+ *
+ * Replays a capture written by epoll-proxy -C, sending every request again
+ * on as many concurrent connections as the original traffic had: each
+ * captured connection becomes one replay connection carrying the same
+ * keep-alive sequence. Requests go out at their original offsets divided
+ * by the speed factor.
+ *
+ *   epoll-proxy-replay [-a ADDR] [-p PORT] [-s SPEED] [-x COPIES] CAPTURE
+ *
+ * -s 0 sends as fast as responses allow. -x N replays N copies of the
+ * capture side by side, for N times the connections and load.
+ *
+ * Without a capture it generates a constant arrival rate instead: -r RATE
+ * GETs of -u PATH per second for -d SECONDS, spread round-robin over -c
+ * keep-alive connections (-c 0: a new connection and "Connection: close"
+ * for every request).
+ *
+ * Either way latency is measured from when a request was *due*, not from
+ * when it was sent. If the server falls behind, requests queue behind slow
+ * responses on their connection and that wait counts - otherwise an
+ * overloaded server would look fast (coordinated omission). -q prints one
+ * machine-readable RESULT line for scripts.
+ */
+#define _GNU_SOURCE
+#include "capture.h"
+#include "histogram.h"
+#include "http_response.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS    1024
+#define RESPONSE_BUF  16384
+
+typedef enum {
+    S_CLOSED = 0,     /* No connection (yet, or the server closed it) */
+    S_CONNECTING,
+    S_IDLE,           /* Connected, next request not due yet */
+    S_SENDING,
+    S_WAITING,        /* Request sent, reading the response */
+    S_DONE            /* No requests left */
+} session_state_t;
+
+/* One request to send: from a capture record, or synthesized */
+typedef struct {
+    uint64_t time_us;         /* Offset from the first request */
+    uint32_t conn;            /* Session it goes out on */
+    uint32_t len;
+    const char *data;
+} request_t;
+
+/* One replayed connection */
+typedef struct {
+    session_state_t state;
+    int fd;
+    long next;                /* Index of the next record to send, -1 = none */
+    size_t sent;              /* Bytes of the current request written */
+    uint64_t due_ns;          /* When the current request was due */
+    http_response_t resp;
+    char *buf;                /* Response header bytes */
+    size_t len;
+} session_t;
+
+static struct {
+    request_t *reqs;                /* In time order */
+    long *next_same;                /* Next record on the same connection */
+    long count;
+    uint32_t conns;                 /* Sessions per copy */
+    int copies;
+    double speed;
+    uint64_t start_ns;
+    session_t *sessions;
+    int epfd;
+    struct sockaddr_in dst;
+
+    histogram_t latency_us;
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t status[6];             /* By first digit */
+    long active;                    /* Sessions not yet S_DONE */
+} r;
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int signum) {
+    (void)signum;
+    running = 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* When record i is due, on this run's clock */
+static uint64_t due_at(long i) {
+    if (r.speed <= 0) {
+        return r.start_ns;
+    }
+    uint64_t offset_us = r.reqs[i].time_us - r.reqs[0].time_us;
+    return r.start_ns + (uint64_t)((double)offset_us * 1000.0 / r.speed);
+}
+
+static void watch(session_t *s, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.ptr = s };
+    epoll_ctl(r.epfd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+static void disconnect(session_t *s) {
+    if (s->fd != -1) {
+        close(s->fd);
+        s->fd = -1;
+    }
+    free(s->buf);
+    s->buf = NULL;
+    s->len = 0;
+    s->state = S_CLOSED;
+}
+
+/* The current request is over (answered or failed): move to the next */
+static void advance(session_t *s) {
+    s->next = r.next_same[s->next];
+    if (s->next == -1) {
+        disconnect(s);
+        s->state = S_DONE;
+        r.active--;
+    }
+}
+
+static void fail(session_t *s) {
+    r.errors++;
+    disconnect(s);
+    advance(s);
+}
+
+static int open_connection(session_t *s) {
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s->fd == -1) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (connect(s->fd, (const struct sockaddr *)&r.dst, sizeof(r.dst)) == -1 &&
+        errno != EINPROGRESS) {
+        return -1;
+    }
+    s->buf = malloc(RESPONSE_BUF);
+    if (s->buf == NULL) {
+        return -1;
+    }
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = s };
+    if (epoll_ctl(r.epfd, EPOLL_CTL_ADD, s->fd, &ev) == -1) {
+        return -1;
+    }
+    s->state = S_CONNECTING;
+    return 0;
+}
+
+/* Write (the rest of) the current request */
+static void send_request(session_t *s) {
+    const request_t *req = &r.reqs[s->next];
+
+    while (s->sent < req->len) {
+        ssize_t n = write(s->fd, req->data + s->sent, req->len - s->sent);
+        if (n == -1 && errno == EAGAIN) {
+            s->state = S_SENDING;
+            watch(s, EPOLLOUT);
+            return;
+        }
+        if (n <= 0) {
+            fail(s);
+            return;
+        }
+        s->sent += (size_t)n;
+    }
+
+    s->state = S_WAITING;
+    s->len = 0;
+    http_response_init(&s->resp, req->len >= 5 && memcmp(req->data, "HEAD ", 5) == 0);
+    watch(s, EPOLLIN);
+}
+
+/* Start the next request if it's due and the connection is free */
+static void kick(session_t *s, uint64_t now) {
+    while (s->state == S_CLOSED || s->state == S_IDLE) {
+        if (s->next == -1 || due_at(s->next) > now) {
+            return;
+        }
+        if (s->state == S_CLOSED) {
+            if (open_connection(s) == -1) {
+                fail(s);
+                continue;  /* Try the next request on a new connection */
+            }
+            return;  /* Sent once connected */
+        }
+        s->sent = 0;
+        s->due_ns = r.speed > 0 ? due_at(s->next) : now;
+        send_request(s);
+    }
+}
+
+static void complete(session_t *s) {
+    uint64_t now = now_ns();
+    histogram_record(&r.latency_us, (now - s->due_ns) / 1000);
+    r.completed++;
+    if (s->resp.status_code >= 100 && s->resp.status_code < 600) {
+        r.status[s->resp.status_code / 100]++;
+    }
+
+    int keep = s->resp.keep_alive;
+    advance(s);
+    if (s->state == S_DONE) {
+        return;
+    }
+    if (keep) {
+        s->state = S_IDLE;
+    } else {
+        disconnect(s);
+    }
+    kick(s, now);
+}
+
+static void on_readable(session_t *s) {
+    char scratch[RESPONSE_BUF];
+
+    while (s->state == S_WAITING) {
+        /* Headers are collected in s->buf; body bytes are only counted */
+        int headers = s->resp.state == HTTP_RESP_HEADERS;
+        char *dst = headers ? s->buf + s->len : scratch;
+        size_t room = headers ? RESPONSE_BUF - s->len : sizeof(scratch);
+        if (room == 0) {
+            fail(s);  /* Header block larger than we care to buffer */
+            return;
+        }
+
+        ssize_t n = read(s->fd, dst, room);
+        if (n == -1 && errno == EAGAIN) {
+            return;
+        }
+        if (n == 0 && s->resp.state == HTTP_RESP_BODY_EOF) {
+            s->resp.keep_alive = 0;
+            complete(s);
+            return;
+        }
+        if (n <= 0) {
+            fail(s);
+            return;
+        }
+
+        const char *body = dst;
+        size_t body_len = (size_t)n;
+        if (headers) {
+            s->len += (size_t)n;
+            size_t off = 0;
+            int ret;
+            for (;;) {
+                ret = http_response_parse_headers(&s->resp, s->buf + off, s->len - off);
+                if (ret != 1) {
+                    break;
+                }
+                off += s->resp.header_length;
+                if (s->resp.status_code >= 200 || s->resp.status_code == 101) {
+                    break;
+                }
+                http_response_init(&s->resp, s->resp.head_request);  /* 1xx */
+            }
+            if (ret == -1) {
+                fail(s);
+                return;
+            }
+            if (ret == 0) {
+                /* Drop interim responses already parsed */
+                memmove(s->buf, s->buf + off, s->len - off);
+                s->len -= off;
+                continue;
+            }
+            body = s->buf + off;
+            body_len = s->len - off;
+        }
+
+        http_response_consume(&s->resp, body, body_len);
+        if (s->resp.state == HTTP_RESP_INVALID) {
+            fail(s);
+            return;
+        }
+        if (http_response_is_complete(&s->resp)) {
+            complete(s);
+            return;
+        }
+    }
+}
+
+static void on_event(session_t *s, uint32_t events) {
+    if (s->state == S_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            fail(s);
+            kick(s, now_ns());
+            return;
+        }
+        s->state = S_IDLE;
+        kick(s, now_ns());
+        return;
+    }
+    if (s->state == S_SENDING) {
+        send_request(s);
+        return;
+    }
+    if (s->state == S_WAITING) {
+        on_readable(s);
+    }
+}
+
+/* One line for scripts: offered and achieved rate, latency in us */
+static void report_quiet(double seconds) {
+    printf("RESULT offered=%ld completed=%lu errors=%lu rate=%.0f "
+           "p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n",
+           r.count * r.copies, (unsigned long)r.completed, (unsigned long)r.errors,
+           seconds > 0 ? r.completed / seconds : 0.0,
+           (unsigned long)histogram_percentile(&r.latency_us, 50),
+           (unsigned long)histogram_percentile(&r.latency_us, 90),
+           (unsigned long)histogram_percentile(&r.latency_us, 99),
+           (unsigned long)histogram_percentile(&r.latency_us, 99.9),
+           (unsigned long)r.latency_us.max);
+}
+
+static void report(double seconds) {
+    printf("Replayed %lu requests in %.2fs (%.0f req/s), %lu errors\n",
+           (unsigned long)r.completed, seconds,
+           seconds > 0 ? r.completed / seconds : 0.0, (unsigned long)r.errors);
+    printf("Status: 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu\n",
+           (unsigned long)r.status[2], (unsigned long)r.status[3],
+           (unsigned long)r.status[4], (unsigned long)r.status[5]);
+    if (r.latency_us.count == 0) {
+        return;
+    }
+    printf("Latency (from due time, us):\n");
+    printf("  p50 %8lu   p90 %8lu   p99 %8lu   p99.9 %8lu   max %8lu   mean %.0f\n",
+           (unsigned long)histogram_percentile(&r.latency_us, 50),
+           (unsigned long)histogram_percentile(&r.latency_us, 90),
+           (unsigned long)histogram_percentile(&r.latency_us, 99),
+           (unsigned long)histogram_percentile(&r.latency_us, 99.9),
+           (unsigned long)r.latency_us.max, histogram_mean(&r.latency_us));
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-a ADDR] [-p PORT] [-q] [-s SPEED] [-x COPIES] CAPTURE\n", prog);
+    fprintf(stderr, "       %s [-a ADDR] [-p PORT] [-q] -r RATE [-d SECONDS] [-c CONNS] [-u PATH]\n", prog);
+}
+
+/* Requests from a capture file, on the connections they were captured on */
+static int load_capture(const char *path) {
+    size_t size;
+    const capture_header_t *cap = capture_map(path, &size);
+    if (cap == NULL) {
+        return -1;
+    }
+
+    r.count = 0;
+    for (const capture_record_t *rec = capture_next(cap, NULL); rec; rec = capture_next(cap, rec)) {
+        r.count++;
+    }
+    if (r.count == 0) {
+        fprintf(stderr, "%s: no requests captured\n", path);
+        return -1;
+    }
+
+    r.conns = cap->connections + 1;  /* conn_id 0 is unused */
+    r.reqs = malloc(r.count * sizeof(request_t));
+    if (r.reqs == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    /* The mapping stays for the lifetime of the run: data points into it */
+    long i = 0;
+    for (const capture_record_t *rec = capture_next(cap, NULL); rec; rec = capture_next(cap, rec), i++) {
+        r.reqs[i].time_us = rec->time_us;
+        r.reqs[i].conn = rec->conn_id < r.conns ? rec->conn_id : 0;
+        r.reqs[i].len = rec->length;
+        r.reqs[i].data = capture_data(rec);
+    }
+    return 0;
+}
+
+/* A constant arrival rate of identical GETs */
+static int synthesize(double rate, double seconds, uint32_t conns, const char *path,
+                      const char *host) {
+    static char request[1024];
+    int len = snprintf(request, sizeof(request),
+                       "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n", path, host,
+                       conns == 0 ? "Connection: close\r\n" : "");
+    if (len <= 0 || (size_t)len >= sizeof(request) || rate <= 0 || seconds <= 0) {
+        return -1;
+    }
+
+    r.count = (long)(rate * seconds);
+    if (r.count == 0) {
+        return -1;
+    }
+    r.reqs = malloc(r.count * sizeof(request_t));
+    if (r.reqs == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    /* conns == 0: every request on its own connection */
+    r.conns = conns == 0 ? (uint32_t)r.count : conns;
+    for (long i = 0; i < r.count; i++) {
+        r.reqs[i].time_us = (uint64_t)((double)i * 1e6 / rate);
+        r.reqs[i].conn = (uint32_t)(i % r.conns);
+        r.reqs[i].len = (uint32_t)len;
+        r.reqs[i].data = request;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *addr = "127.0.0.1";
+    int port = 8080;
+    const char *path = "/";
+    double rate = 0, seconds = 10;
+    int conns = 64;
+    int quiet = 0;
+    int opt;
+
+    r.speed = 1.0;
+    r.copies = 1;
+    while ((opt = getopt(argc, argv, "a:p:s:x:r:d:c:u:qh")) != -1) {
+        switch (opt) {
+            case 'a': addr = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 's': r.speed = atof(optarg); break;
+            case 'x': r.copies = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'd': seconds = atof(optarg); break;
+            case 'c': conns = atoi(optarg); break;
+            case 'u': path = optarg; break;
+            case 'q': quiet = 1; break;
+            default:  usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - (rate > 0 ? 0 : 1) || r.copies < 1 || conns < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&r.dst, 0, sizeof(r.dst));
+    r.dst.sin_family = AF_INET;
+    r.dst.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &r.dst.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address: %s\n", addr);
+        return 1;
+    }
+
+    int loaded = rate > 0 ? synthesize(rate, seconds, (uint32_t)conns, path, addr)
+                          : load_capture(argv[optind]);
+    if (loaded == -1) {
+        if (rate > 0) {
+            fprintf(stderr, "Invalid rate, duration or path\n");
+        }
+        return 1;
+    }
+
+    /* Chain each connection's requests */
+    r.next_same = malloc(r.count * sizeof(*r.next_same));
+    long *last = malloc(r.conns * sizeof(long));
+    long *first = malloc(r.conns * sizeof(long));
+    r.sessions = calloc((size_t)r.conns * r.copies, sizeof(session_t));
+    if (!r.next_same || !last || !first || !r.sessions) {
+        perror("malloc");
+        return 1;
+    }
+    for (uint32_t c = 0; c < r.conns; c++) {
+        last[c] = first[c] = -1;
+    }
+
+    for (long i = 0; i < r.count; i++) {
+        uint32_t c = r.reqs[i].conn;
+        r.next_same[i] = -1;
+        if (last[c] == -1) {
+            first[c] = i;
+        } else {
+            r.next_same[last[c]] = i;
+        }
+        last[c] = i;
+    }
+
+    r.epfd = epoll_create1(0);
+    histogram_init(&r.latency_us);
+    for (int copy = 0; copy < r.copies; copy++) {
+        for (uint32_t c = 0; c < r.conns; c++) {
+            session_t *s = &r.sessions[(size_t)copy * r.conns + c];
+            s->fd = -1;
+            s->next = first[c];
+            s->state = s->next == -1 ? S_DONE : S_CLOSED;
+            r.active += s->state != S_DONE;
+        }
+    }
+
+    if (!quiet) {
+        if (rate > 0) {
+            printf("Sending %ld requests at %.0f/s on %s\n", r.count, rate,
+                   conns > 0 ? "keep-alive connections" : "a connection each");
+        } else {
+            printf("Replaying %ld requests on %ld connections at %s\n",
+                   r.count * r.copies, r.active,
+                   r.speed > 0 ? "captured pace" : "full speed");
+            if (r.speed > 0 && r.speed != 1.0) {
+                printf("Speed x%.2f\n", r.speed);
+            }
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Walk the records in time order; each one wakes its session when due */
+    struct epoll_event events[MAX_EVENTS];
+    long cursor = 0;
+    r.start_ns = now_ns();
+
+    while (running && r.active > 0) {
+        uint64_t now = now_ns();
+        for (; cursor < r.count && due_at(cursor) <= now; cursor++) {
+            uint32_t c = r.reqs[cursor].conn;
+            for (int copy = 0; copy < r.copies; copy++) {
+                kick(&r.sessions[(size_t)copy * r.conns + c], now);
+            }
+        }
+
+        int timeout = 100;
+        if (cursor < r.count) {
+            uint64_t due = due_at(cursor);
+            timeout = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+        }
+
+        int n = epoll_wait(r.epfd, events, MAX_EVENTS, timeout);
+        for (int k = 0; k < n; k++) {
+            on_event(events[k].data.ptr, events[k].events);
+        }
+    }
+
+    double elapsed = (double)(now_ns() - r.start_ns) / 1e9;
+    if (quiet) {
+        report_quiet(elapsed);
+    } else {
+        report(elapsed);
+    }
+
+    free(first);
+    free(last);
+    return r.errors > 0 ? 2 : 0;
+}
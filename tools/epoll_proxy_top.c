@@ -0,0 +1,173 @@
+/* epoll-proxy-top: live view of a running proxy's scoreboard.
+ *
+ * Maps the scoreboard the proxy was started with (-S PATH) read-only and
+ * redraws once per interval. Rates are computed from the difference
+ * between two snapshots, so reading costs the proxy nothing.
+ *
+ *   epoll-proxy-top [-i SECONDS] [-n COUNT] [PATH]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "scoreboard.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_PATH "/dev/shm/epoll-proxy"
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int signum) {
+    (void)signum;
+    running = 0;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static double rate(uint64_t cur, uint64_t prev, double seconds) {
+    return cur >= prev ? (double)(cur - prev) / seconds : 0.0;
+}
+
+/* One line of TCP_INFO percentiles, or nothing before the first sample */
+static void draw_tcpinfo(const char *label, const scoreboard_tcpinfo_t *t) {
+    if (t->samples == 0) {
+        return;
+    }
+    printf("  %s RTT p50 %.2f ms  p99 %.2f ms  (var %.2f)   cwnd %lu   unacked p99 %lu"
+           "   rate %.1f MB/s   retrans/conn %.2f\n", label,
+           t->rtt_p50_us / 1000.0, t->rtt_p99_us / 1000.0, t->rttvar_p50_us / 1000.0,
+           (unsigned long)t->cwnd_p50, (unsigned long)t->unacked_p99,
+           t->delivery_rate_p50 / (1024.0 * 1024.0), t->retrans_milli / 1000.0);
+}
+
+static void draw(const scoreboard_t *cur, const scoreboard_t *prev,
+                 double seconds, int tty) {
+    uint64_t now = now_ms();
+    
+    if (tty) {
+        printf("\033[H\033[2J");  /* Home + clear */
+    }
+    
+    for (uint32_t i = 0; i < cur->worker_count && i < SCOREBOARD_MAX_WORKERS; i++) {
+        const scoreboard_worker_t *w = &cur->workers[i];
+        const scoreboard_counters_t *c = &w->counters;
+        const scoreboard_counters_t *p = &prev->workers[i].counters;
+        uint64_t age = now > w->updated_ms ? now - w->updated_ms : 0;
+        
+        printf("worker %u  pid %u  %s  up %lus%s\n", i, w->pid,
+               w->mode == 1 ? "HTTP" : "TCP",
+               (unsigned long)((w->updated_ms - w->started_ms) / 1000),
+               age > 2000 ? "  [STALE]" : "");
+        printf("  req/s %10.0f   conn/s %8.0f   err/s %6.0f   loops/s %8.0f\n",
+               rate(c->requests_total, p->requests_total, seconds),
+               rate(c->total_connections, p->total_connections, seconds),
+               rate(c->errors, p->errors, seconds),
+               rate(c->loop_iterations, p->loop_iterations, seconds));
+        printf("  in   %8.2f MB/s   out  %8.2f MB/s\n",
+               rate(c->bytes_received, p->bytes_received, seconds) / (1024 * 1024),
+               rate(c->bytes_sent, p->bytes_sent, seconds) / (1024 * 1024));
+        
+        /* Syscalls per request (per connection in TCP mode) over the interval */
+        uint64_t units = w->mode == 1 ? c->requests_total - p->requests_total
+                                      : c->total_connections - p->total_connections;
+        uint64_t calls = c->syscalls - p->syscalls;
+        printf("  syscalls/s %10.0f   per %s %6.2f   EAGAIN %4.1f%%\n",
+               rate(c->syscalls, p->syscalls, seconds),
+               w->mode == 1 ? "req " : "conn",
+               units ? (double)calls / units : 0.0,
+               calls ? 100.0 * (c->syscalls_eagain - p->syscalls_eagain) / calls : 0.0);
+        printf("  connections %8lu   timers %8lu   idle shrinks %lu / wakeups %lu\n",
+               (unsigned long)w->active_connections, (unsigned long)w->timers_armed,
+               (unsigned long)c->idle_shrinks, (unsigned long)c->idle_wakeups);
+        printf("  buffers %lu/%lu   parsers %lu/%lu   arena blocks %lu/%lu (in use/total)\n",
+               (unsigned long)w->buffers_in_use, (unsigned long)w->buffers_total,
+               (unsigned long)w->parsers_in_use, (unsigned long)w->parsers_total,
+               (unsigned long)w->arena_blocks_in_use, (unsigned long)w->arena_blocks_total);
+        printf("  requests %lu (GET %lu, POST %lu, bad %lu)   keep-alive reused %lu\n",
+               (unsigned long)c->requests_total, (unsigned long)c->requests_get,
+               (unsigned long)c->requests_post, (unsigned long)c->requests_error,
+               (unsigned long)c->keep_alive_reused);
+        draw_tcpinfo("clients", &w->clients);
+        printf("\n");
+    }
+    
+    printf("%-32s %8s %10s %10s %10s\n", "UPSTREAM", "ACTIVE", "CONN/s", "FAIL/s", "FAILURES");
+    for (uint32_t i = 0; i < cur->upstream_count && i < SCOREBOARD_MAX_UPSTREAMS; i++) {
+        const scoreboard_upstream_t *u = &cur->upstreams[i];
+        const scoreboard_upstream_t *p = &prev->upstreams[i];
+        printf("%-32.32s %8lu %10.0f %10.0f %10lu\n", u->name,
+               (unsigned long)u->active,
+               rate(u->connects, p->connects, seconds),
+               rate(u->failures, p->failures, seconds),
+               (unsigned long)u->failures);
+        draw_tcpinfo("   ", &u->tcp);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    double interval = 1.0;
+    long count = -1;  /* Forever */
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+        switch (opt) {
+            case 'i': interval = atof(optarg); break;
+            case 'n': count = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-i SECONDS] [-n COUNT] [PATH]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (interval < 0.1) {
+        interval = 0.1;
+    }
+    const char *path = optind < argc ? argv[optind] : DEFAULT_PATH;
+    
+    const scoreboard_t *sb = scoreboard_open(path);
+    if (sb == NULL) {
+        return 1;
+    }
+    
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    
+    static scoreboard_t prev, cur;
+    if (scoreboard_snapshot(sb, &prev) == -1) {
+        fprintf(stderr, "%s: scoreboard busy\n", path);
+        return 1;
+    }
+    uint64_t prev_ms = now_ms();
+    int tty = isatty(STDOUT_FILENO);
+    
+    while (running && count != 0) {
+        sleep_ms((long)(interval * 1000));
+        if (scoreboard_snapshot(sb, &cur) == -1) {
+            continue;
+        }
+        uint64_t cur_ms = now_ms();
+        draw(&cur, &prev, (double)(cur_ms - prev_ms) / 1000.0, tty);
+        if (!tty) {
+            printf("\n");
+        }
+        prev = cur;
+        prev_ms = cur_ms;
+        if (count > 0) {
+            count--;
+        }
+    }
+    
+    scoreboard_close(sb);
+    return 0;
+}